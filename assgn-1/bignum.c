@@ -0,0 +1,228 @@
+/**
+ * EECS 338 Operating Systems
+ * Case Western Reserve University
+ * (C) 2015 Christian Gunderman
+ */
+#include "bignum.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Preprocessor Defines.
+#define DECIMAL_GROUP 1000000000u  // 9 digits per division.
+
+/*
+ * Gets the length of a without leading zero limbs.
+ */
+int bignum_length(const limb_t *a, int n) {
+  while (n > 0 && a[n - 1] == 0) {
+    n--;
+  }
+  return n;
+}
+
+/*
+ * Writes a + b to out, which may be a or b, and returns the limbs
+ * written: one more than the longer of the two, the top one possibly 0.
+ */
+int bignum_add(limb_t *out, const limb_t *a, int an, const limb_t *b, int bn) {
+  int n = an > bn ? an : bn;
+  limb_t carry = 0;
+
+  for (int i = 0; i < n; i++) {
+    limb_t sum = (i < an ? a[i] : 0) + (i < bn ? b[i] : 0) + carry;
+    out[i] = sum & BIGNUM_MASK;
+    carry = sum >> BIGNUM_BITS;
+  }
+  out[n] = carry;
+  return n + 1;
+}
+
+/*
+ * Writes the an limbs of a - b to out, which may be a. b must be no
+ * bigger than a, and bn no more than an.
+ */
+void bignum_sub(limb_t *out, const limb_t *a, int an, const limb_t *b, int bn) {
+  int32_t borrow = 0;
+
+  for (int i = 0; i < an; i++) {
+    int32_t diff = (int32_t)a[i] - (i < bn ? (int32_t)b[i] : 0) - borrow;
+    borrow = diff < 0;
+    out[i] = diff + (borrow << BIGNUM_BITS);
+  }
+}
+
+/*
+ * Writes the sum of the low n / 2 limbs of a and the rest, the first step
+ * of Karatsuba, to the n - n / 2 + 1 limbs of sum.
+ */
+void bignum_split_sum(limb_t *sum, const limb_t *a, int n) {
+  int half = n / 2;
+
+  bignum_add(sum, a, half, a + half, n - half);
+}
+
+/*
+ * Finishes a Karatsuba product of two n limb numbers. out holds the
+ * product of the low halves in its first 2 * (n / 2) limbs and of the high
+ * halves after that, and mid the product of the bignum_split_sum()s. mid
+ * is overwritten.
+ */
+void bignum_combine(limb_t *out, limb_t *mid, int n) {
+  int half = n / 2;
+  int high = n - half;
+  int mid_n = 2 * (high + 1);
+
+  // Cross terms, a_lo * b_hi + a_hi * b_lo.
+  bignum_sub(mid, mid, mid_n, out, 2 * half);
+  bignum_sub(mid, mid, mid_n, out + 2 * half, 2 * high);
+  mid_n = bignum_length(mid, mid_n);
+
+  // Added in at the half, the carry running no further than the product.
+  limb_t *at = out + half;
+  limb_t carry = 0;
+  int i = 0;
+  for (i = 0; i < mid_n; i++) {
+    limb_t sum = at[i] + mid[i] + carry;
+    at[i] = sum & BIGNUM_MASK;
+    carry = sum >> BIGNUM_BITS;
+  }
+  for (; carry != 0; i++) {
+    limb_t sum = at[i] + carry;
+    at[i] = sum & BIGNUM_MASK;
+    carry = sum >> BIGNUM_BITS;
+  }
+}
+
+/*
+ * Multiplies two n limb numbers the long way, into the 2 * n limbs of out.
+ * Each row adds a[i] times all of b into the columns, the carries are
+ * only sorted out at the end.
+ */
+static void bignum_schoolbook(limb_t *restrict out, const limb_t *restrict a,
+                              const limb_t *restrict b, int n) {
+  uint64_t columns[2 * BIGNUM_KARATSUBA_CUTOFF];
+  uint64_t carry = 0;
+
+  memset(columns, 0, 2 * n * sizeof(uint64_t));
+  for (int i = 0; i < n; i++) {
+    uint64_t *restrict row = columns + i;
+    uint64_t ai = a[i];
+
+    for (int j = 0; j < n; j++) {
+      row[j] += ai * b[j];
+    }
+  }
+
+  for (int i = 0; i < 2 * n; i++) {
+    carry += columns[i];
+    out[i] = carry & BIGNUM_MASK;
+    carry >>= BIGNUM_BITS;
+  }
+}
+
+/*
+ * Gets the limbs of scratch bignum_mul() needs for n limb numbers.
+ */
+size_t bignum_mul_scratch(int n) {
+  if (n <= BIGNUM_KARATSUBA_CUTOFF) {
+    return 0;
+  }
+
+  int high = n - n / 2;
+  return 4 * (size_t)(high + 1) + bignum_mul_scratch(high + 1);
+}
+
+/*
+ * Multiplies two n limb numbers, which may be the same one, into the
+ * 2 * n limbs of out.
+ */
+void bignum_mul(limb_t *out, const limb_t *a, const limb_t *b, int n,
+                limb_t *scratch) {
+  if (n <= BIGNUM_KARATSUBA_CUTOFF) {
+    bignum_schoolbook(out, a, b, n);
+    return;
+  }
+
+  int half = n / 2;
+  int high = n - half;
+  limb_t *sum_a = scratch;
+  limb_t *sum_b = sum_a + high + 1;
+  limb_t *mid = sum_b + high + 1;
+
+  bignum_split_sum(sum_a, a, n);
+  bignum_split_sum(sum_b, b, n);
+  bignum_mul(out, a, b, half, mid + 2 * (high + 1));
+  bignum_mul(out + 2 * half, a + half, b + half, high,
+             mid + 2 * (high + 1));
+  bignum_mul(mid, sum_a, sum_b, high + 1, mid + 2 * (high + 1));
+  bignum_combine(out, mid, n);
+}
+
+/*
+ * Gets a mod m.
+ */
+uint32_t bignum_mod(const limb_t *a, int n, uint32_t m) {
+  uint64_t rem = 0;
+
+  for (int i = n - 1; i >= 0; i--) {
+    rem = ((rem << BIGNUM_BITS) | a[i]) % m;
+  }
+  return rem;
+}
+
+/*
+ * Gets log10(a), from its top three limbs. a must not be 0.
+ */
+double bignum_log10(const limb_t *a, int n) {
+  int low = n > 3 ? n - 3 : 0;
+  double top = 0;
+
+  for (int i = n - 1; i >= low; i--) {
+    top = top * (1 << BIGNUM_BITS) + a[i];
+  }
+  return log10(top) + low * BIGNUM_BITS * log10(2.0);
+}
+
+/*
+ * Writes a in decimal to out, dividing by 10^9 over and over. That's
+ * quadratic, so it's meant for numbers of a few limbs. Returns false if
+ * out is too small or there's no memory.
+ */
+bool bignum_to_decimal(const limb_t *a, int n, char *out, size_t size) {
+  limb_t *quotient = malloc((n + 1) * sizeof(limb_t));
+  uint32_t *groups = malloc((n + 1) * sizeof(uint32_t));
+  int count = 0;
+  bool fits = false;
+
+  if (quotient != NULL && groups != NULL) {
+    memcpy(quotient, a, n * sizeof(limb_t));
+    n = bignum_length(quotient, n);
+
+    // Groups of 9 digits, least significant first.
+    do {
+      uint64_t rem = 0;
+
+      for (int i = n - 1; i >= 0; i--) {
+        uint64_t cur = (rem << BIGNUM_BITS) | quotient[i];
+        quotient[i] = cur / DECIMAL_GROUP;
+        rem = cur % DECIMAL_GROUP;
+      }
+      groups[count++] = rem;
+      n = bignum_length(quotient, n);
+    } while (n > 0);
+
+    // The first without leading zeros.
+    size_t used = snprintf(out, size, "%u", groups[count - 1]);
+    for (int i = count - 2; i >= 0 && used < size; i--) {
+      used += snprintf(out + used, size - used, "%09u", groups[i]);
+    }
+    fits = used < size;
+  }
+
+  free(quotient);
+  free(groups);
+  return fits;
+}
@@ -0,0 +1,55 @@
+/**
+ * EECS 338 Operating Systems
+ * Case Western Reserve University
+ * (C) 2015 Christian Gunderman
+ */
+#ifndef BIGNUM__H__
+#define BIGNUM__H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Unsigned arbitrary precision integers, as little endian arrays of limbs
+ * with BIGNUM_BITS bits used in each. Leaving the top bits of each 32 bit
+ * limb empty means a limb product is under 2^56, so a schoolbook row can
+ * add up to 256 of them into a uint64_t column without carrying. The inner
+ * loop is then one multiply-add per limb with no dependency between
+ * columns, which the compiler turns into SIMD multiplies at -O3. Bigger
+ * products split in halves by Karatsuba down to that.
+ *
+ * Functions take lengths in limbs, and but for bignum_to_decimal() don't
+ * allocate; callers size the outputs and scratch.
+ */
+
+#define BIGNUM_BITS 28
+#define BIGNUM_MASK ((1u << BIGNUM_BITS) - 1)
+
+// Products of at most this many limbs are done schoolbook.
+#define BIGNUM_KARATSUBA_CUTOFF 48
+
+typedef uint32_t limb_t;
+
+int bignum_length(const limb_t *a, int n);
+
+int bignum_add(limb_t *out, const limb_t *a, int an, const limb_t *b, int bn);
+
+void bignum_sub(limb_t *out, const limb_t *a, int an, const limb_t *b, int bn);
+
+void bignum_split_sum(limb_t *sum, const limb_t *a, int n);
+
+void bignum_combine(limb_t *out, limb_t *mid, int n);
+
+size_t bignum_mul_scratch(int n);
+
+void bignum_mul(limb_t *out, const limb_t *a, const limb_t *b, int n,
+                limb_t *scratch);
+
+uint32_t bignum_mod(const limb_t *a, int n, uint32_t m);
+
+double bignum_log10(const limb_t *a, int n);
+
+bool bignum_to_decimal(const limb_t *a, int n, char *out, size_t size);
+
+#endif // BIGNUM__H__
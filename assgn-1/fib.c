@@ -0,0 +1,465 @@
+/**
+ * EECS 338 Operating Systems
+ * Case Western Reserve University
+ * (C) 2015 Christian Gunderman
+ */
+#include "fib.h"
+#include "bignum.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+// Preprocessor Defines.
+#define FIB_MAX_DEPTH 4        // Karatsuba levels split into tasks.
+#define FIB_MAX_TASKS 243      // 3 products * 3^FIB_MAX_DEPTH.
+#define FIB_PARALLEL_LIMBS 1024  // Smaller steps aren't worth posting.
+#define FIB_POLL_NS 100000000  // How often to check on the workers, 100ms.
+#define FIB_FULL_LIMBS 8       // Printed in full up to this, ~67 digits.
+
+// One product for a worker.
+typedef struct FibTask {
+  limb_t *out;
+  const limb_t *a;
+  const limb_t *b;
+  int n;
+} FibTask;
+
+// Shared with the workers, at the same address in all of them.
+typedef struct FibShared {
+  uint32_t gen;       // Futex word, bumped to post a batch or quit.
+  uint32_t done;      // Futex word, tasks of the batch finished.
+  int count;          // Tasks in the batch.
+  bool quit;
+  uint64_t claim;     // gen << 32 | count << 16 | next task to take, so a
+                      // worker still on the last batch can't take from
+                      // this one while it's being planned.
+  FibTask tasks[FIB_MAX_TASKS];
+} FibShared;
+
+// A Karatsuba split to finish once its sub-products are done.
+typedef struct FibCombine {
+  limb_t *out;
+  limb_t *mid;
+  int n;
+} FibCombine;
+
+typedef struct FibEngine {
+  FibShared *shared;   // NULL to do every product here.
+  limb_t *pool;        // Values, products and split sums.
+  limb_t *next;        // Where the next split sum goes.
+  size_t bytes;        // Of shared and pool, when mapped.
+  int cap;             // Limbs of the biggest value.
+  int workers;
+  int depth;           // Levels each product is split.
+  limb_t *scratch;     // For products done in this process.
+  FibCombine combines[FIB_MAX_TASKS];
+  int combine_count;
+  long batches;
+  long tasks;
+} FibEngine;
+
+// Global state:
+// The engine shared with the workers, inherited by them on fork.
+static FibEngine g_engine;
+
+/*
+ * Gets a monotonic timestamp in seconds.
+ */
+static double fib_now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Gets the limbs to hold F(term + 1) and the steps' spare top limbs.
+ * F(n) is about phi^n / sqrt(5), log2(phi) = 0.6942...
+ */
+static int fib_limbs(long term) {
+  return (term * 0.6942419136306174 + 2) / BIGNUM_BITS + 6;
+}
+
+/*
+ * Gets the limbs of split sums planning one product of n limbs to depth
+ * takes: two sums and their product per split.
+ */
+static size_t fib_plan_limbs(int n, int depth) {
+  if (depth == 0 || n <= BIGNUM_KARATSUBA_CUTOFF) {
+    return 0;
+  }
+
+  int half = n / 2;
+  int high = n - half;
+  return 4 * (size_t)(high + 1) + fib_plan_limbs(half, depth - 1) +
+    fib_plan_limbs(high, depth - 1) + fib_plan_limbs(high + 1, depth - 1);
+}
+
+/*
+ * Picks how deep to split products so there are at least two tasks per
+ * worker to even out their finishing times.
+ */
+static int fib_depth(int workers) {
+  int depth = 0;
+  int tasks = 3;
+
+  while (workers > 1 && tasks < 2 * workers && depth < FIB_MAX_DEPTH) {
+    depth++;
+    tasks *= 3;
+  }
+  return depth;
+}
+
+/*
+ * Sets up an engine for terms up to term. With workers, its memory is
+ * mapped shared, otherwise it's all this process's.
+ */
+static bool fib_init(FibEngine *engine, long term, int workers) {
+  memset(engine, 0, sizeof(FibEngine));
+  engine->cap = fib_limbs(term);
+  engine->workers = workers;
+  engine->depth = fib_depth(workers);
+
+  // a, b and 2b - a, and three products of twice that.
+  size_t limbs = 9 * (size_t)engine->cap +
+    3 * fib_plan_limbs(engine->cap, engine->depth);
+
+  if (workers > 0) {
+    engine->bytes = sizeof(FibShared) + limbs * sizeof(limb_t);
+    engine->shared = mmap(NULL, engine->bytes, PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (engine->shared == MAP_FAILED) {
+      engine->shared = NULL;
+      return false;
+    }
+    memset(engine->shared, 0, sizeof(FibShared));
+    engine->pool = (limb_t*)(engine->shared + 1);
+  } else {
+    engine->pool = calloc(limbs, sizeof(limb_t));
+  }
+
+  engine->scratch = malloc((bignum_mul_scratch(engine->cap) + 1) *
+                           sizeof(limb_t));
+  return engine->pool != NULL && engine->scratch != NULL;
+}
+
+/*
+ * Frees an engine's memory.
+ */
+static void fib_free(FibEngine *engine) {
+  if (engine->shared != NULL) {
+    munmap(engine->shared, engine->bytes);
+  } else {
+    free(engine->pool);
+  }
+  free(engine->scratch);
+  memset(engine, 0, sizeof(FibEngine));
+}
+
+/*
+ * Splits the product of two n limb numbers into out depth levels down,
+ * adding the bottom ones as tasks and the splits to finish afterwards,
+ * innermost first.
+ */
+static void fib_plan(FibEngine *engine, limb_t *out, const limb_t *a,
+                     const limb_t *b, int n, int depth) {
+  if (depth == 0 || n <= BIGNUM_KARATSUBA_CUTOFF) {
+    FibTask *task = &engine->shared->tasks[engine->shared->count++];
+    task->out = out;
+    task->a = a;
+    task->b = b;
+    task->n = n;
+    return;
+  }
+
+  int half = n / 2;
+  int high = n - half;
+  limb_t *sum_a = engine->next;
+  limb_t *sum_b = sum_a + high + 1;
+  limb_t *mid = sum_b + high + 1;
+  engine->next = mid + 2 * (high + 1);
+
+  bignum_split_sum(sum_a, a, n);
+  bignum_split_sum(sum_b, b, n);
+  fib_plan(engine, out, a, b, half, depth - 1);
+  fib_plan(engine, out + 2 * half, a + half, b + half, high, depth - 1);
+  fib_plan(engine, mid, sum_a, sum_b, high + 1, depth - 1);
+
+  FibCombine *combine = &engine->combines[engine->combine_count++];
+  combine->out = out;
+  combine->mid = mid;
+  combine->n = n;
+}
+
+/*
+ * Takes the next task of batch gen, or returns NULL if there are none
+ * left or the batch isn't current.
+ */
+static FibTask *fib_claim(FibShared *shared, uint32_t gen) {
+  uint64_t claim = __atomic_load_n(&shared->claim, __ATOMIC_ACQUIRE);
+
+  do {
+    if ((uint32_t)(claim >> 32) != gen ||
+        (claim & UINT16_MAX) >= ((claim >> 16) & UINT16_MAX)) {
+      return NULL;
+    }
+  } while (!__atomic_compare_exchange_n(&shared->claim, &claim, claim + 1,
+                                        false, __ATOMIC_ACQ_REL,
+                                        __ATOMIC_ACQUIRE));
+  return &shared->tasks[claim & UINT16_MAX];
+}
+
+/*
+ * Posts the planned tasks to the workers.
+ */
+static void fib_post(FibShared *shared) {
+  uint32_t gen = shared->gen + 1;
+
+  shared->done = 0;
+  __atomic_store_n(&shared->claim, (uint64_t)gen << 32 | shared->count << 16,
+                   __ATOMIC_RELEASE);
+  __atomic_store_n(&shared->gen, gen, __ATOMIC_RELEASE);
+  syscall(SYS_futex, &shared->gen, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+/*
+ * Waits for the workers to finish the posted tasks. Returns false if one
+ * of them died, since its task never will be.
+ */
+static bool fib_wait(FibShared *shared) {
+  struct timespec poll = { 0, FIB_POLL_NS };
+  uint32_t done;
+
+  while ((done = __atomic_load_n(&shared->done, __ATOMIC_ACQUIRE)) !=
+         (uint32_t)shared->count) {
+    if (syscall(SYS_futex, &shared->done, FUTEX_WAIT, done, &poll, NULL,
+                0) == -1 && errno == ETIMEDOUT &&
+        waitpid(-1, NULL, WNOHANG) != 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/*
+ * Multiplies x[i] by y[i] into out[i] for the three products of a step,
+ * all n limbs, on the workers if it's worth it.
+ */
+static bool fib_products(FibEngine *engine, limb_t **out, limb_t **x,
+                         limb_t **y, int n, limb_t *plan) {
+  if (engine->shared == NULL || n < FIB_PARALLEL_LIMBS) {
+    for (int i = 0; i < 3; i++) {
+      bignum_mul(out[i], x[i], y[i], n, engine->scratch);
+    }
+    return true;
+  }
+
+  engine->next = plan;
+  engine->combine_count = 0;
+  engine->shared->count = 0;
+  for (int i = 0; i < 3; i++) {
+    fib_plan(engine, out[i], x[i], y[i], n, engine->depth);
+  }
+
+  fib_post(engine->shared);
+  if (!fib_wait(engine->shared)) {
+    return false;
+  }
+
+  for (int i = 0; i < engine->combine_count; i++) {
+    FibCombine *combine = &engine->combines[i];
+    bignum_combine(combine->out, combine->mid, combine->n);
+  }
+  engine->batches++;
+  engine->tasks += engine->shared->count;
+  return true;
+}
+
+/*
+ * Computes F(term) into the start of the engine's pool, setting its
+ * length. Returns false if a worker died.
+ */
+static bool fib_run(FibEngine *engine, long term, int *length) {
+  int cap = engine->cap;
+  limb_t *a = engine->pool;   // F(k)
+  limb_t *b = a + cap;        // F(k + 1)
+  limb_t *t = b + cap;        // 2 * F(k + 1) - F(k)
+  limb_t *p[3] = { t + cap, t + 3 * cap, t + 5 * cap };
+  limb_t *x[3] = { a, a, b };
+  limb_t *y[3] = { t, a, b };
+  int an = 0;
+  int bn = 1;
+  int bit = 0;
+
+  b[0] = 1;
+  while (bit < 62 && (term >> (bit + 1)) > 0) {
+    bit++;
+  }
+
+  for (; term > 0 && bit >= 0; bit--) {
+    // Room for 2b, padded with zeros.
+    int n = (an > bn ? an : bn) + 1;
+    memset(a + an, 0, (n - an) * sizeof(limb_t));
+    memset(b + bn, 0, (n - bn) * sizeof(limb_t));
+
+    bignum_add(t, b, n, b, n);
+    bignum_sub(t, t, n, a, n);
+    if (!fib_products(engine, p, x, y, n, t + 7 * cap)) {
+      return false;
+    }
+
+    // p[0] = F(2k), p[1] = F(2k + 1).
+    int cn = bignum_length(p[0], 2 * n);
+    int dn = bignum_length(p[1], bignum_add(p[1], p[1], 2 * n, p[2], 2 * n));
+    if ((term >> bit) & 1) {
+      bn = bignum_length(b, bignum_add(b, p[0], cn, p[1], dn));
+      memcpy(a, p[1], dn * sizeof(limb_t));
+      an = dn;
+    } else {
+      memcpy(a, p[0], cn * sizeof(limb_t));
+      memcpy(b, p[1], dn * sizeof(limb_t));
+      an = cn;
+      bn = dn;
+    }
+  }
+
+  *length = an;
+  return true;
+}
+
+/*
+ * Prints F(term), whole if it's short, otherwise its first and last
+ * digits and how many there are.
+ */
+static void fib_print(long term, const limb_t *value, int length) {
+  char digits[FIB_FULL_LIMBS * 10];
+
+  if (length <= FIB_FULL_LIMBS &&
+      bignum_to_decimal(value, length, digits, sizeof(digits))) {
+    printf("PID %i, PARENT: F(%li) = %s\n", getpid(), term, digits);
+    return;
+  }
+
+  // The leading digits come from a double, so only the first 8 are sure.
+  double log = bignum_log10(value, length);
+  long count = (long)log + 1;
+  long leading = pow(10, log - floor(log) + 7);
+
+  printf("PID %i, PARENT: F(%li) = %li...%09u, %li digits\n", getpid(), term,
+         leading, bignum_mod(value, length, 1000000000u), count);
+}
+
+/*
+ * Maps the engine for terms up to term, to be shared with workers
+ * processes forked after this.
+ */
+bool fib_open(long term, int workers) {
+  if (!fib_init(&g_engine, term, workers)) {
+    perror("Unable to map shared memory for Fibonacci");
+    fib_free(&g_engine);
+    return false;
+  }
+  return true;
+}
+
+/*
+ * Main loop of a worker process: takes tasks and multiplies until
+ * fib_close().
+ */
+void fib_worker() {
+  FibShared *shared = g_engine.shared;
+  uint32_t gen = 0;
+
+  while (true) {
+    uint32_t posted;
+    FibTask *task;
+
+    while ((posted = __atomic_load_n(&shared->gen, __ATOMIC_ACQUIRE)) == gen) {
+      syscall(SYS_futex, &shared->gen, FUTEX_WAIT, gen, NULL, NULL, 0);
+    }
+    gen = posted;
+    if (shared->quit) {
+      return;
+    }
+
+    while ((task = fib_claim(shared, gen)) != NULL) {
+      bignum_mul(task->out, task->a, task->b, task->n, g_engine.scratch);
+      if (__atomic_add_fetch(&shared->done, 1, __ATOMIC_ACQ_REL) ==
+          (uint32_t)shared->count) {
+        syscall(SYS_futex, &shared->done, FUTEX_WAKE, 1, NULL, NULL, 0);
+      }
+    }
+  }
+}
+
+/*
+ * Computes and prints F(term) with the workers, and how long it took.
+ * Returns false if a worker died.
+ */
+bool fib_compute(long term) {
+  double start = fib_now();
+  int length = 0;
+
+  if (term < 0 || fib_limbs(term) > g_engine.cap) {
+    printf("PID %i, PARENT: F(%li) is bigger than the engine.\n", getpid(),
+           term);
+    return false;
+  }
+  if (!fib_run(&g_engine, term, &length)) {
+    printf("PID %i, PARENT: A Fibonacci worker died.\n", getpid());
+    return false;
+  }
+
+  double elapsed = fib_now() - start;
+  fib_print(term, g_engine.pool, length);
+  printf("PID %i, PARENT: Computed in %.3f s by %i workers, %li batches of "
+         "%li products.\n", getpid(), elapsed, g_engine.workers,
+         g_engine.batches, g_engine.tasks);
+  return true;
+}
+
+/*
+ * Stops the workers and unmaps the engine.
+ */
+void fib_close() {
+  if (g_engine.shared == NULL) {
+    return;
+  }
+
+  g_engine.shared->quit = true;
+  __atomic_store_n(&g_engine.shared->gen, g_engine.shared->gen + 1,
+                   __ATOMIC_RELEASE);
+  syscall(SYS_futex, &g_engine.shared->gen, FUTEX_WAKE, INT_MAX, NULL, NULL,
+          0);
+  fib_free(&g_engine);
+}
+
+/*
+ * Writes F(term) in decimal to out, computed in this process alone.
+ * Returns false if out is too small or there's no memory.
+ */
+bool fib_decimal(long term, char *out, size_t size) {
+  FibEngine engine;
+  int length = 0;
+  bool fits = false;
+
+  if (term < 0) {
+    return false;
+  }
+  if (fib_init(&engine, term, 0)) {
+    fib_run(&engine, term, &length);
+    fits = bignum_to_decimal(engine.pool, length, out, size);
+  }
+  fib_free(&engine);
+  return fits;
+}
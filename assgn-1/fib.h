@@ -0,0 +1,38 @@
+/**
+ * EECS 338 Operating Systems
+ * Case Western Reserve University
+ * (C) 2015 Christian Gunderman
+ */
+#ifndef FIB__H__
+#define FIB__H__
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Fibonacci numbers of any size by fast doubling:
+ *   F(2k)     = F(k) * (2 * F(k + 1) - F(k))
+ *   F(2k + 1) = F(k)^2 + F(k + 1)^2
+ * so F(n) takes one step per bit of n, each three multiplications of
+ * numbers about half the size of the next ones.
+ *
+ * fib_open() maps memory to share with worker processes, and must be
+ * called before they're forked. Each forked worker calls fib_worker(),
+ * which multiplies until fib_close(). The parent's fib_compute() splits
+ * each step's products into Karatsuba sub-products, enough to keep every
+ * worker busy, posts them in the shared memory for the workers to take,
+ * and adds the pieces back together once they're all done. Small steps it
+ * just does itself.
+ */
+
+bool fib_open(long term, int workers);
+
+void fib_worker();
+
+bool fib_compute(long term);
+
+void fib_close();
+
+bool fib_decimal(long term, char *out, size_t size);
+
+#endif // FIB__H__
@@ -0,0 +1,34 @@
+#!/bin/bash
+#
+# EECS 338 Operating Systems
+# Case Western Reserve University
+# (C) 2015 Christian Gunderman
+#
+# Measures how computing one big Fibonacci number scales with the number
+# of worker processes. Prints the time and speedup for each worker count.
+# Run after building with make.
+#
+# usage: ./fib_scaling.sh [worker counts...] (default 1 2 4 8)
+#   TERM_N overrides the term computed, default 10000000.
+
+COUNTS=${*:-1 2 4 8}
+TERM_N=${TERM_N:-10000000}
+
+cd "$(dirname "$0")" || exit 1
+
+echo "cores: $(nproc), F($TERM_N)"
+printf "%8s %10s %10s\n" workers seconds speedup
+BASELINE=""
+
+for N in $COUNTS; do
+    SECONDS_TAKEN=$(./app "$N" "$TERM_N" |
+                    sed -n 's/.*Computed in \([0-9.]*\) s.*/\1/p')
+
+    if [ "$SECONDS_TAKEN" == "" ]; then
+        echo "app failed with $N workers."
+        break
+    fi
+    BASELINE=${BASELINE:-$SECONDS_TAKEN}
+    awk -v n="$N" -v s="$SECONDS_TAKEN" -v base="$BASELINE" \
+        'BEGIN { printf "%8d %10.3f %9.2fx\n", n, s, base / s }'
+done
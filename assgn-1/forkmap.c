@@ -0,0 +1,104 @@
+/**
+ * EECS 338 Operating Systems
+ * Case Western Reserve University
+ * (C) 2015 Christian Gunderman
+ */
+#include "forkmap.h"
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Shared with the workers of one run.
+typedef struct ForkMapShared {
+  long next;  // Start of the next chunk to take.
+} ForkMapShared;
+
+/*
+ * Main function of a worker: runs fn on chunks until there are none left.
+ */
+static void forkmap_worker(ForkMapShared *shared, long count, long chunk,
+                           ForkMapFn fn, void *results, void *arg) {
+  long begin;
+
+  while ((begin = __atomic_fetch_add(&shared->next, chunk,
+                                     __ATOMIC_RELAXED)) < count) {
+    fn(begin, begin + chunk < count ? begin + chunk : count, results, arg);
+  }
+  exit(EXIT_SUCCESS);
+}
+
+/*
+ * Maps a results buffer shared with workers forked after this, all zeros.
+ * Returns NULL on failure.
+ */
+void *forkmap_alloc(size_t bytes) {
+  void *results = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+  return results == MAP_FAILED ? NULL : results;
+}
+
+/*
+ * Unmaps a results buffer.
+ */
+void forkmap_free(void *results, size_t bytes) {
+  if (results != NULL) {
+    munmap(results, bytes);
+  }
+}
+
+/*
+ * Runs fn over [0, count) in chunks of chunk indexes, on workers forked
+ * for the purpose, and waits for them all. Returns false if they couldn't
+ * be forked or one of them failed, in which case some results are missing.
+ */
+bool forkmap_run(int workers, long count, long chunk, ForkMapFn fn,
+                 void *results, void *arg) {
+  pid_t pids[FORKMAP_MAX_WORKERS];
+  bool succeeded = true;
+  int forked = 0;
+  int status;
+
+  if (workers < 1 || workers > FORKMAP_MAX_WORKERS || chunk < 1) {
+    return false;
+  }
+
+  ForkMapShared *shared = forkmap_alloc(sizeof(ForkMapShared));
+  if (shared == NULL) {
+    perror("Unable to map shared memory for workers");
+    return false;
+  }
+
+  // Otherwise each worker inherits, and prints again, whatever is buffered.
+  fflush(stdout);
+  for (forked = 0; forked < workers; forked++) {
+    if ((pids[forked] = fork()) == -1) {
+      perror("Error forking worker");
+      succeeded = false;
+      break;
+    } else if (pids[forked] == 0) {
+      forkmap_worker(shared, count, chunk, fn, results, arg);
+    }
+  }
+
+  // Wait for all workers to end, stopping the rest if one fails, since
+  // the run has failed anyway.
+  for (int i = 0; i < forked; i++) {
+    if (waitpid(pids[i], &status, 0) == -1 || !WIFEXITED(status) ||
+        WEXITSTATUS(status) != EXIT_SUCCESS) {
+      if (succeeded) {
+        for (int j = i + 1; j < forked; j++) {
+          kill(pids[j], SIGTERM);
+        }
+      }
+      succeeded = false;
+    }
+  }
+
+  forkmap_free(shared, sizeof(ForkMapShared));
+  return succeeded;
+}
@@ -0,0 +1,35 @@
+/**
+ * EECS 338 Operating Systems
+ * Case Western Reserve University
+ * (C) 2015 Christian Gunderman
+ */
+#ifndef FORKMAP__H__
+#define FORKMAP__H__
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Parallel map over worker processes: fork, split an index range, wait.
+ * forkmap_run() forks the workers, which take chunks of [0, count) one at
+ * a time from a shared counter until there are none left, so a worker
+ * that got cheap chunks just takes more. fn runs on each chunk in a
+ * worker. It sees everything the parent had when it forked, without
+ * copying, and writes its results straight into a buffer from
+ * forkmap_alloc(), which the parent reads in place once they're done.
+ */
+
+// Most workers forkmap_run() will fork.
+#define FORKMAP_MAX_WORKERS 64
+
+// Runs in a worker for indexes begin to end - 1.
+typedef void (*ForkMapFn)(long begin, long end, void *results, void *arg);
+
+void *forkmap_alloc(size_t bytes);
+
+void forkmap_free(void *results, size_t bytes);
+
+bool forkmap_run(int workers, long count, long chunk, ForkMapFn fn,
+                 void *results, void *arg);
+
+#endif // FORKMAP__H__
@@ -0,0 +1,148 @@
+/**
+ * EECS 338 Operating Systems
+ * Case Western Reserve University
+ * (C) 2015 Christian Gunderman
+ */
+#include "forkmap.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/**
+ * forkmap speedup benchmark. The kernel counts the primes in each block of
+ * BLOCK_NUMBERS numbers by trial division, one block per index, into a
+ * shared array. Later blocks cost more, so splitting the blocks evenly
+ * up front (static, one chunk per worker) leaves the first workers idle
+ * while the last one finishes; taking small chunks as they go (dynamic)
+ * doesn't. Every run is checked against the 1 worker run.
+ *
+ * Prints, per worker count, the time of each split in ms and its speedup
+ * over 1 worker.
+ *
+ * usage: ./forkmap_bench [blocks] [max_workers]
+ */
+
+// Preprocessor Defines.
+#define DEFAULT_BLOCKS 2000
+#define DEFAULT_MAX_WORKERS 8
+#define BLOCK_NUMBERS 1000
+#define DYNAMIC_CHUNK 4  // Blocks taken at a time by dynamic.
+
+/**
+ * Gets a monotonic timestamp in ns.
+ */
+static uint64_t now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/**
+ * Checks whether n is prime the slow way, which is the point.
+ */
+static bool is_prime(long n) {
+  if (n < 2) {
+    return false;
+  }
+  for (long d = 2; d * d <= n; d++) {
+    if (n % d == 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * Kernel: counts the primes in each of blocks begin to end - 1.
+ */
+static void count_primes(long begin, long end, void *results, void *arg) {
+  int *counts = results;
+
+  for (long block = begin; block < end; block++) {
+    int count = 0;
+    for (long n = block * BLOCK_NUMBERS; n < (block + 1) * BLOCK_NUMBERS;
+         n++) {
+      count += is_prime(n);
+    }
+    counts[block] = count;
+  }
+}
+
+/**
+ * Runs the kernel over blocks and returns its time in ns, or 0 if it
+ * failed or got a result other than expected's.
+ */
+static uint64_t run(int workers, long blocks, long chunk, int *counts,
+                    const int *expected) {
+  uint64_t start = now_ns();
+
+  if (!forkmap_run(workers, blocks, chunk, count_primes, counts, NULL)) {
+    return 0;
+  }
+
+  uint64_t elapsed = now_ns() - start;
+  for (long i = 0; expected != NULL && i < blocks; i++) {
+    if (counts[i] != expected[i]) {
+      printf("Block %li: %i primes, expected %i.\n", i, counts[i],
+             expected[i]);
+      return 0;
+    }
+  }
+  return elapsed;
+}
+
+/**
+ * Application Entry point.
+ */
+int main(int argc, char* argv[]) {
+  long blocks = argc > 1 ? atol(argv[1]) : DEFAULT_BLOCKS;
+  int max_workers = argc > 2 ? atoi(argv[2]) : DEFAULT_MAX_WORKERS;
+
+  if (blocks <= 0 || max_workers < 1 || max_workers > FORKMAP_MAX_WORKERS) {
+    printf("usage: ./forkmap_bench [blocks] [max_workers]\n");
+    return EXIT_FAILURE;
+  }
+
+  int *counts = forkmap_alloc(blocks * sizeof(int));
+  int *expected = malloc(blocks * sizeof(int));
+  if (counts == NULL || expected == NULL) {
+    printf("Out of memory.\n");
+    return EXIT_FAILURE;
+  }
+
+  uint64_t serial = run(1, blocks, blocks, counts, NULL);
+  if (serial == 0) {
+    printf("Serial run failed.\n");
+    return EXIT_FAILURE;
+  }
+
+  long primes = 0;
+  for (long i = 0; i < blocks; i++) {
+    expected[i] = counts[i];
+    primes += counts[i];
+  }
+  printf("%li primes below %li, 1 worker: %.1f ms\n", primes,
+         blocks * BLOCK_NUMBERS, serial / 1e6);
+  printf("%7s %10s %8s %10s %8s\n", "workers", "static_ms", "speedup",
+         "dynamic_ms", "speedup");
+
+  for (int workers = 1; workers <= max_workers; workers *= 2) {
+    uint64_t stat = run(workers, blocks, (blocks + workers - 1) / workers,
+                        counts, expected);
+    uint64_t dynamic = run(workers, blocks, DYNAMIC_CHUNK, counts, expected);
+
+    if (stat == 0 || dynamic == 0) {
+      printf("%7i failed\n", workers);
+      continue;
+    }
+    printf("%7i %10.1f %8.2f %10.1f %8.2f\n", workers, stat / 1e6,
+           (double)serial / stat, dynamic / 1e6, (double)serial / dynamic);
+  }
+
+  forkmap_free(counts, blocks * sizeof(int));
+  free(expected);
+  return EXIT_SUCCESS;
+}
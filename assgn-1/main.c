@@ -5,31 +5,55 @@
  */
 #include <errno.h>
 #include <pwd.h>
+#include <linux/futex.h>
 #include <linux/limits.h>
-#include <limits.h>
+#include <signal.h>
 #include <unistd.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
 #include <sys/wait.h>
 #include <time.h>
-#include <sys/times.h>
+
+#include "fib.h"
+#include "profile.h"
 
 // Preprocessor Defines.
-#define INIT_DELAY 0.5  // sec.
-#define PERIODIC_DELAY 1 // sec.
+#define DEFAULT_CHILDREN 2
+#define MAX_CHILDREN 64
 #define MAIN_ITERATIONS 10 // Fib. seq. iterations
 #define CWD_MAX PATH_MAX // chars.
+#define TERM_DIGITS 64 // Room for F(MAIN_ITERATIONS) and then some.
+
+// Shared memory data. The children pass a token around in order: the
+// child whose turn it is prints its term, then hands the next term to the
+// next child by setting that child's turn word and waking it.
+typedef struct baton_t {
+  int32_t turn[MAX_CHILDREN];  // Futex words, the term each child may print.
+  struct timespec passed[MAIN_ITERATIONS];  // When each term was handed off.
+  double latency_us[MAIN_ITERATIONS];  // How long the receiver took to run.
+} baton_t;
+
+// Global state:
+// Set up before forking and inherited by every child.
+static baton_t *g_baton = NULL;
+static int g_children = DEFAULT_CHILDREN;
+static pid_t g_pids[MAX_CHILDREN];
+static long g_term = 0; // If not 0, the children are workers computing it.
 
 // Forward Decls.
 static void fork_children();
-static bool fork_child(bool second_child);
+static bool fork_child(int child);
 static void fork_error();
-static void child_process(bool second_child);
+static void child_process(int child);
 static void parent_process();
-static void try_sleep(int sleep_time);
+static void baton_wait(int child, int term);
+static void baton_pass(int term);
 static void print_user_info(const char* process);
-static void print_time_stats(const char* process);
 
 /**
  * Application Entry point
@@ -37,6 +61,23 @@ static void print_time_stats(const char* process);
 int main(int argc, char* argv[]) {
   char working_dir[CWD_MAX];
 
+  if (argc > 1) {
+    g_children = atoi(argv[1]);
+  }
+  if (argc > 2) {
+    g_term = atol(argv[2]);
+  }
+  if (g_children < 1 || g_children > MAX_CHILDREN || g_term < 0) {
+    printf("usage: ./app [children, 1 to %i] [term]\n", MAX_CHILDREN);
+    return EXIT_FAILURE;
+  }
+
+  // Profile slot 0 is ours, the children's follow.
+  if (!profile_open(g_children)) {
+    return EXIT_FAILURE;
+  }
+  profile_start(0);
+
   // Print current working directory and user info.
   if (getcwd(working_dir, CWD_MAX) == NULL) {
     perror("Failure obtaining current working directory.");
@@ -52,25 +93,58 @@ int main(int argc, char* argv[]) {
 }
 
 /**
- * Forks parent into a parent and 2 child processes.
+ * Forks parent into a parent and g_children child processes, sharing
+ * one baton_t. The first child gets the token once they all exist. With a
+ * term to compute, they share the Fibonacci engine instead, as its workers.
  */
 static void fork_children() {
+  int i = 0;
+
+  if (g_term > 0 && !fib_open(g_term, g_children)) {
+    exit(EXIT_FAILURE);
+  }
+
+  g_baton = mmap(NULL, sizeof(baton_t), PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (g_baton == MAP_FAILED) {
+    perror("Unable to map shared memory");
+    exit(EXIT_FAILURE);
+  }
+
+  // Nobody's turn yet.
+  for (i = 0; i < MAX_CHILDREN; i++) {
+    g_baton->turn[i] = -1;
+  }
 
   // If true, this is the parent.
-  if (fork_child(false)) {
-    // Fork a second time.
-    if (fork_child(true)) {
-      parent_process();
+  for (i = 0; i < g_children; i++) {
+    if (!fork_child(i)) {
+      return;
     }
   }
+
+  if (g_term == 0) {
+    baton_pass(0);
+  } else if (!fib_compute(g_term)) {
+    for (i = 0; i < g_children; i++) {
+      kill(g_pids[i], SIGTERM);
+    }
+    exit(EXIT_FAILURE);
+  } else {
+    fib_close();
+  }
+  parent_process();
 }
 
 /**
  * Forks the process into a parent and child and starts the child
  * process main function.
  */
-static bool fork_child(bool second_child) {
+static bool fork_child(int child) {
   printf("PID %i, PARENT: Forking child.\n", getpid());
+
+  // Otherwise the child inherits, and prints again, whatever is buffered.
+  fflush(stdout);
   pid_t pid = fork();
 
   // Check that fork was successful.
@@ -78,10 +152,12 @@ static bool fork_child(bool second_child) {
     fork_error();
     return false;
   } else if (pid == 0) {
+    profile_start(child + 1);
     print_user_info("CHILD");
-    child_process(second_child);
+    child_process(child);
     return false;
   } else {
+    g_pids[child] = pid;
     return true;
   }
 }
@@ -95,58 +171,128 @@ static void fork_error() {
 }
 
 /**
- * Main function of child processes. If second_child is true,
- * process offsets fib. sequence by one so that every other
- * number is produced by each of the children.
+ * Main function of child processes. Each child prints every
+ * g_children'th number of the fib. sequence, starting at its own index,
+ * waiting for the token before each one. With a term to compute, it's a
+ * worker of the Fibonacci engine instead.
  */
-static void child_process(bool second_child) {
-  int first_number = 0;
-  int second_number = 1;
+static void child_process(int child) {
+  char number[TERM_DIGITS];
   int i = 0;
 
-  printf("PID %i, CHILD: This is a child process.\n", getpid());
+  printf("PID %i, CHILD: This is child process %i.\n", getpid(), child);
+  fflush(stdout);
 
-  // Offset the second child by a second so that order is maintained.
-  if (second_child) {
-    try_sleep(INIT_DELAY);
+  if (g_term > 0) {
+    fib_worker();
+    profile_finish(child + 1);
+    printf("PID %i, CHILD: Child %i Terminating.\n", getpid(), child);
+    exit(EXIT_SUCCESS);
   }
 
-  // Alternating Fib sequence.
-  for (i = 0; i < MAIN_ITERATIONS; i++) {
-
-    // Calculate next number and print.
-    int next_number = first_number + second_number;
-
-    // Print every other one, depending on first or second child.
-    if ((second_child && (i % 2 == 0)) ||
-    	(!second_child && (i % 2 != 0))) {
-      printf("PID %i, CHILD: Fib(%i) = %i\n", getpid(), i, first_number);
+  // Round robin Fib sequence, each number computed directly.
+  for (i = child; i < MAIN_ITERATIONS; i += g_children) {
+    if (!fib_decimal(i, number, sizeof(number))) {
+      printf("PID %i, CHILD: Unable to compute Fib(%i).\n", getpid(), i);
+      exit(EXIT_FAILURE);
     }
 
-    // Update prior two numbers.
-    first_number = second_number;
-    second_number = next_number;
+    baton_wait(child, i);
+    printf("PID %i, CHILD: Fib(%i) = %s\n", getpid(), i, number);
 
-    // Pause to let other child go.
-    sleep(PERIODIC_DELAY);
+    // Out before the next child prints, even to a pipe or file.
+    fflush(stdout);
+    baton_pass(i + 1);
   }
 
-  print_time_stats("CHILD");
+  profile_finish(child + 1);
 
   // Print exit message.
-  printf("PID %i, CHILD: %s Child Terminating.\n",
-	 getpid(), second_child ? "First" : "Second");
+  printf("PID %i, CHILD: Child %i Terminating.\n", getpid(), child);
   exit(EXIT_SUCCESS);
 }
 
 /**
- * Evaluates a wait() status integer.
+ * Gets the microseconds from start to now.
+ */
+static double elapsed_us(const struct timespec *start) {
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - start->tv_sec) * 1e6 +
+    (now.tv_nsec - start->tv_nsec) / 1e3;
+}
+
+/**
+ * Blocks until it is the child's turn to print term, and records how
+ * long the handoff took.
+ */
+static void baton_wait(int child, int term) {
+  int32_t *turn = &g_baton->turn[child];
+
+  while (__atomic_load_n(turn, __ATOMIC_ACQUIRE) != term) {
+    // Returns at once if the word already changed, or EINTR on a signal.
+    if (syscall(SYS_futex, turn, FUTEX_WAIT, *turn, NULL, NULL, 0) == -1 &&
+        errno != EAGAIN && errno != EINTR) {
+      perror("Unable to wait for turn");
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  g_baton->latency_us[term] = elapsed_us(&g_baton->passed[term]);
+}
+
+/**
+ * Hands term to the child that prints it and wakes that child.
  */
-static void evaluate_status(pid_t pid, int status) {
+static void baton_pass(int term) {
+  if (term >= MAIN_ITERATIONS) {
+    return;
+  }
+
+  int32_t *turn = &g_baton->turn[term % g_children];
+
+  clock_gettime(CLOCK_MONOTONIC, &g_baton->passed[term]);
+  __atomic_store_n(turn, term, __ATOMIC_RELEASE);
+  syscall(SYS_futex, turn, FUTEX_WAKE, 1, NULL, NULL, 0);
+}
+
+/**
+ * Prints the min, average and max latencies of the handoffs between
+ * children, leaving out the parent's to the first child.
+ */
+static void print_handoff_stats() {
+  double min = 0;
+  double max = 0;
+  double total = 0;
+  int i = 0;
+
+  for (i = 1; i < MAIN_ITERATIONS; i++) {
+    double us = g_baton->latency_us[i];
+
+    min = (i == 1 || us < min) ? us : min;
+    max = us > max ? us : max;
+    total += us;
+  }
+
+  if (MAIN_ITERATIONS > 1) {
+    printf("PID %i, PARENT: %i token handoffs, latency (us): min %.1f, "
+           "avg %.1f, max %.1f\n", getpid(), MAIN_ITERATIONS - 1, min,
+           total / (MAIN_ITERATIONS - 1), max);
+  }
+}
+
+/**
+ * Evaluates a wait() status integer. Returns true if the child
+ * exited successfully.
+ */
+static bool evaluate_status(pid_t pid, int status) {
   if (WIFEXITED(status)) {
     printf("Child process %i exited normally, code: %i.\n", pid, WEXITSTATUS(status));
+    return WEXITSTATUS(status) == EXIT_SUCCESS;
   } else {
     printf("Child process %i did not exit normally!\n", pid);
+    return false;
   }
 }
 
@@ -154,38 +300,42 @@ static void evaluate_status(pid_t pid, int status) {
  * Main function for parent process, post fork().
  */
 static void parent_process() {
-  int status_1;
-  int status_2;
-  pid_t pid_1;
-  pid_t pid_2;
+  bool succeeded = true;
+  struct rusage usage;
+  int status;
+  pid_t pid;
+  int i = 0;
 
-  // Wait for both children to end:
-  if ((pid_1 = wait(&status_1)) == -1) {
-    perror("Error waiting for child to terminate.");
-  }
-  evaluate_status(pid_1, status_1);
+  // Wait for all children to end, collecting what each used:
+  for (i = 0; i < g_children; i++) {
+    if ((pid = wait4(-1, &status, 0, &usage)) == -1) {
+      perror("Error waiting for child to terminate.");
+      continue;
+    }
+    for (int j = 0; j < g_children; j++) {
+      if (g_pids[j] == pid) {
+        profile_collect(j + 1, pid, &usage);
+      }
+    }
 
-  if ((pid_2 = wait(&status_2)) == -1) {
-    perror("Error waiting for child to terminate.");
+    // The rest would wait forever for a token that child won't pass.
+    if (!evaluate_status(pid, status) && succeeded) {
+      succeeded = false;
+      printf("PID %i, PARENT: Stopping remaining children.\n", getpid());
+      for (int j = 0; j < g_children; j++) {
+        kill(g_pids[j], SIGTERM);
+      }
+    }
   }
-  evaluate_status(pid_2, status_2);
 
-  print_time_stats("PARENT");
+  if (succeeded && g_term == 0) {
+    print_handoff_stats();
+  }
+  profile_report();
   printf("PID %i, PARENT: Parent terminating.\n", getpid());
   exit(EXIT_SUCCESS);
 }
 
-/**
- * Try to sleep the current process. If interrupted, give error message
- * and quit.
- */
-static void try_sleep(int sleep_time) {
-  if (sleep(sleep_time) != 0) {
-    printf("PID %i, CHILD: Sleep Interrupted! Exiting.", getpid());
-    exit(EXIT_FAILURE);
-  }
-}
-
 /**
  * Print process user information to the console.
  */
@@ -204,40 +354,3 @@ static void print_user_info(const char* process) {
   printf("PID %i, %s: With effective ID: %i\n", getpid(), process, geteuid());
   printf("PID %i, %s: With group ID: %i\n", getpid(), process, getgid());
 }
-
-/**
- * Loop for a bit to waste user CPU time.
- */
-static void waste_cpu_time(const char* process) {
-  int i = 0;
-
-  // Just loop a bunch to use up user CPU cycles so clock has something
-  // to show.
-  printf("PID %i, %s: Wasting CPU time, please be patient...\n", getpid(), process);
-  for (i = 0; i < INT_MAX; i++);
-}
-
-/**
- * Prints current system time, cpu time used, and system CPU time used
- * by/on behalf of this process.
- */
-static void print_time_stats(const char* process) {
-  const time_t current_time = time(NULL);
-  struct tms cpu_times;
-  long clock_ticks = sysconf(_SC_CLK_TCK);
-
-  // Waste a bunch of time.
-  waste_cpu_time(process);
-
-  // Get CPU times.
-  if (times(&cpu_times) == (clock_t)-1) {
-    perror("Unable to obtain CPU times.");
-  }
-
-  double user_time = cpu_times.tms_utime / (double)clock_ticks;
-  double sys_time = cpu_times.tms_stime / (double)clock_ticks;
-
-  printf("PID %i, %s: Current time: %s", getpid(), process, ctime(&current_time));
-  printf("PID %i, %s: Approx. User CPU Time (s): %f\n", getpid(), process, user_time);
-  printf("PID %i, %s: Approx. System CPU Time (s): %f\n", getpid(), process, sys_time);
-}
@@ -0,0 +1,243 @@
+/**
+ * EECS 338 Operating Systems
+ * Case Western Reserve University
+ * (C) 2015 Christian Gunderman
+ */
+#include "profile.h"
+
+#include <linux/perf_event.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+// Preprocessor Defines.
+#define PROFILE_COUNTERS 4
+#define PROFILE_UNAVAILABLE UINT64_MAX
+
+// Indexes into the counts.
+#define PROFILE_CPU_NS 0
+#define PROFILE_CYCLES 1
+#define PROFILE_INSTRUCTIONS 2
+#define PROFILE_CACHE_MISSES 3
+
+// One process's results, in memory shared with the parent.
+typedef struct ProfileSlot {
+  pid_t pid;
+  bool finished;      // Got to profile_finish().
+  bool collected;     // Has usage.
+  uint64_t start_ns;
+  uint64_t end_ns;
+  uint64_t counts[PROFILE_COUNTERS];  // Or PROFILE_UNAVAILABLE.
+  struct rusage usage;
+} ProfileSlot;
+
+// perf_event_open() type and config of each count.
+static const uint32_t kCounterTypes[PROFILE_COUNTERS] = {
+  PERF_TYPE_SOFTWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE,
+  PERF_TYPE_HARDWARE
+};
+static const uint64_t kCounterConfigs[PROFILE_COUNTERS] = {
+  PERF_COUNT_SW_TASK_CLOCK, PERF_COUNT_HW_CPU_CYCLES,
+  PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES
+};
+
+// Global state:
+// The slots are shared, the counters are this process's own.
+static ProfileSlot *g_slots = NULL;
+static int g_slot_count = 0;
+static int g_counters[PROFILE_COUNTERS] = { -1, -1, -1, -1 };
+
+/*
+ * Gets a monotonic timestamp in nanoseconds.
+ */
+static uint64_t profile_now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/*
+ * Closes this process's counters, including ones inherited over fork,
+ * which count the parent, not us.
+ */
+static void profile_close_counters() {
+  for (int i = 0; i < PROFILE_COUNTERS; i++) {
+    if (g_counters[i] != -1) {
+      close(g_counters[i]);
+      g_counters[i] = -1;
+    }
+  }
+}
+
+/*
+ * Opens a counter of this process in user space, or returns -1 if the
+ * hardware or the kernel's perf_event_paranoid won't have it.
+ */
+static int profile_open_counter(uint32_t type, uint64_t config) {
+  struct perf_event_attr attr;
+
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = type;
+  attr.config = config;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+    PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+  return syscall(SYS_perf_event_open, &attr, 0, -1, -1,
+                 PERF_FLAG_FD_CLOEXEC);
+}
+
+/*
+ * Reads a counter, scaled up for any time it spent multiplexed off the
+ * hardware.
+ */
+static uint64_t profile_read_counter(int fd) {
+  uint64_t values[3];  // Count, time enabled, time running.
+
+  if (fd == -1 || read(fd, values, sizeof(values)) != sizeof(values) ||
+      values[2] == 0) {
+    return PROFILE_UNAVAILABLE;
+  }
+  if (values[2] < values[1]) {
+    return (double)values[0] * values[1] / values[2];
+  }
+  return values[0];
+}
+
+/*
+ * Prints a count right aligned in width, or - if it's unavailable.
+ */
+static void profile_print_count(uint64_t count, int width) {
+  if (count == PROFILE_UNAVAILABLE) {
+    printf(" %*s", width, "-");
+  } else {
+    printf(" %*llu", width, (unsigned long long)count);
+  }
+}
+
+/*
+ * Prints one process's row.
+ */
+static void profile_print_row(const char *name, ProfileSlot *slot,
+                              uint64_t origin_ns) {
+  const struct rusage *usage = &slot->usage;
+
+  printf("%-8s %7i", name, slot->pid);
+  if (slot->finished) {
+    printf(" %10.1f %10.1f", (slot->start_ns - origin_ns) / 1e3,
+           (slot->end_ns - slot->start_ns) / 1e3);
+  } else {
+    printf(" %10s %10s", "-", "-");
+  }
+
+  printf(" %9.1f %9.1f %6li %6li %7li %6li %8li",
+         usage->ru_utime.tv_sec * 1e3 + usage->ru_utime.tv_usec / 1e3,
+         usage->ru_stime.tv_sec * 1e3 + usage->ru_stime.tv_usec / 1e3,
+         usage->ru_nvcsw, usage->ru_nivcsw, usage->ru_minflt,
+         usage->ru_majflt, usage->ru_maxrss);
+
+  profile_print_count(slot->counts[PROFILE_CPU_NS], 12);
+  profile_print_count(slot->counts[PROFILE_CYCLES], 13);
+  profile_print_count(slot->counts[PROFILE_INSTRUCTIONS], 13);
+  if (slot->counts[PROFILE_CYCLES] != PROFILE_UNAVAILABLE &&
+      slot->counts[PROFILE_INSTRUCTIONS] != PROFILE_UNAVAILABLE &&
+      slot->counts[PROFILE_CYCLES] > 0) {
+    printf(" %5.2f", (double)slot->counts[PROFILE_INSTRUCTIONS] /
+           slot->counts[PROFILE_CYCLES]);
+  } else {
+    printf(" %5s", "-");
+  }
+  profile_print_count(slot->counts[PROFILE_CACHE_MISSES], 11);
+  printf("\n");
+}
+
+/*
+ * Maps a slot for the parent and each of children, to be shared with
+ * processes forked after this.
+ */
+bool profile_open(int children) {
+  g_slot_count = children + 1;
+  g_slots = mmap(NULL, g_slot_count * sizeof(ProfileSlot),
+                 PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (g_slots == MAP_FAILED) {
+    perror("Unable to map shared memory for profile");
+    g_slots = NULL;
+    return false;
+  }
+  return true;
+}
+
+/*
+ * Starts counting this process into slot.
+ */
+void profile_start(int slot) {
+  profile_close_counters();
+  for (int i = 0; i < PROFILE_COUNTERS; i++) {
+    g_counters[i] = profile_open_counter(kCounterTypes[i],
+                                         kCounterConfigs[i]);
+  }
+
+  g_slots[slot].pid = getpid();
+  g_slots[slot].start_ns = profile_now_ns();
+}
+
+/*
+ * Stops counting and leaves the counts in slot, for the parent.
+ */
+void profile_finish(int slot) {
+  for (int i = 0; i < PROFILE_COUNTERS; i++) {
+    g_slots[slot].counts[i] = profile_read_counter(g_counters[i]);
+  }
+  profile_close_counters();
+
+  g_slots[slot].end_ns = profile_now_ns();
+  g_slots[slot].finished = true;
+}
+
+/*
+ * Adds a child's rusage, from wait4(), to its slot.
+ */
+void profile_collect(int slot, pid_t pid, const struct rusage *usage) {
+  g_slots[slot].pid = pid;
+  g_slots[slot].usage = *usage;
+  g_slots[slot].collected = true;
+}
+
+/*
+ * Finishes the parent's slot and prints every process's. Times are in us
+ * from when the parent started, CPU times in ms, max RSS in KB.
+ */
+void profile_report() {
+  ProfileSlot *parent = &g_slots[0];
+  char name[24];
+
+  profile_finish(0);
+  getrusage(RUSAGE_SELF, &parent->usage);
+  parent->collected = true;
+
+  printf("PID %i, PARENT: Resource profile:\n", getpid());
+  printf("%-8s %7s %10s %10s %9s %9s %6s %6s %7s %6s %8s %12s %13s %13s "
+         "%5s %11s\n", "process", "pid", "start_us", "wall_us", "user_ms",
+         "sys_ms", "vcsw", "ivcsw", "minflt", "majflt", "rss_kb",
+         "cpu_ns", "cycles", "instructions", "ipc", "cache_miss");
+
+  profile_print_row("parent", parent, parent->start_ns);
+  for (int i = 1; i < g_slot_count; i++) {
+    if (g_slots[i].collected) {
+      snprintf(name, sizeof(name), "child %i", i - 1);
+      profile_print_row(name, &g_slots[i], parent->start_ns);
+    }
+  }
+
+  if (parent->counts[PROFILE_CYCLES] == PROFILE_UNAVAILABLE) {
+    printf("Hardware counters unavailable (no PMU, or perf_event_paranoid "
+           "too high).\n");
+  }
+}
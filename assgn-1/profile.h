@@ -0,0 +1,36 @@
+/**
+ * EECS 338 Operating Systems
+ * Case Western Reserve University
+ * (C) 2015 Christian Gunderman
+ */
+#ifndef PROFILE__H__
+#define PROFILE__H__
+
+#include <stdbool.h>
+#include <sys/resource.h>
+#include <sys/types.h>
+
+/*
+ * Per-process resource profile, reported by the parent once its children
+ * are done. Each process counts its own cycles, instructions, cache misses
+ * and CPU time in ns with perf_event_open(), where the kernel and hardware
+ * allow, and leaves the counts and its start and end times in a slot of
+ * memory shared with the parent. The parent adds the rusage wait4() gives
+ * it for each child (context switches, page faults, max RSS) and prints a
+ * row per process.
+ *
+ * profile_open() maps the slots and must be called before forking.
+ * Slot 0 is the parent's, children use 1 to children.
+ */
+
+bool profile_open(int children);
+
+void profile_start(int slot);
+
+void profile_finish(int slot);
+
+void profile_collect(int slot, pid_t pid, const struct rusage *usage);
+
+void profile_report();
+
+#endif // PROFILE__H__
@@ -0,0 +1,300 @@
+/**
+ * EECS 338 Operating Systems
+ * Case Western Reserve University
+ * (C) 2015 Christian Gunderman
+ */
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <poll.h>
+#include <sched.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+/**
+ * Process creation benchmark. Times creating a child and reaping it, for
+ * each way of creating it and each way of waiting for it, with the parent
+ * holding a growing amount of touched memory, since fork copies the page
+ * tables for all of it. The memory is kept in 4K pages; transparent huge
+ * pages would need 512x fewer entries and hide most of the cost. The child
+ * either exits at once, or execs /bin/true, which is what posix_spawn
+ * always does.
+ *
+ * Prints, per combination, the percentiles of the whole round trip, the
+ * median time the creating call took to return to the parent, and the
+ * round trips per second.
+ *
+ * usage: ./spawn_bench [iterations] [parent_rss_mb...]
+ */
+
+// Preprocessor Defines.
+#define DEFAULT_ITERATIONS 1000
+#define WARMUP_DIVISOR 10  // Untimed round trips first, a tenth as many.
+#define CHILD_STACK_BYTES (64 * 1024)
+#define EXEC_PATH "/bin/true"
+
+#ifndef P_PIDFD
+#define P_PIDFD 3
+#endif
+
+static const int kDefaultRss[] = { 0, 64, 512 };
+
+typedef enum SpawnMethod {
+  SPAWN_FORK,
+  SPAWN_VFORK,
+  SPAWN_CLONE,        // clone(SIGCHLD), fork without the libc wrapper.
+  SPAWN_CLONE_VM,     // Shares memory, so no page tables to copy.
+  SPAWN_POSIX_SPAWN,  // Exec only.
+  SPAWN_METHODS
+} SpawnMethod;
+
+typedef enum WaitMethod {
+  WAIT_WAITPID,
+  WAIT_WAITID,
+  WAIT_PIDFD,         // poll() on a pidfd, then waitid(P_PIDFD).
+  WAIT_METHODS
+} WaitMethod;
+
+static const char *kSpawnNames[SPAWN_METHODS] = {
+  "fork", "vfork", "clone", "clone_vm", "posix_spawn"
+};
+static const char *kWaitNames[WAIT_METHODS] = { "waitpid", "waitid", "pidfd" };
+
+// Global state:
+static char *g_stack = NULL;       // For clone children.
+static bool g_exec = false;        // Children exec EXEC_PATH, else exit.
+static char *g_argv[] = { EXEC_PATH, NULL };
+extern char **environ;
+
+/**
+ * Gets a monotonic timestamp in ns.
+ */
+static uint64_t now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/**
+ * Body of a child: exec or exit, touching nothing a vfork parent needs.
+ */
+static int child_main(void *arg) {
+  if (g_exec) {
+    execve(EXEC_PATH, g_argv, environ);
+  }
+  _exit(0);
+}
+
+/**
+ * Creates a child by method, returning its pid, or -1 on failure.
+ */
+static pid_t spawn(SpawnMethod method) {
+  pid_t pid = -1;
+
+  switch (method) {
+  case SPAWN_FORK:
+    if ((pid = fork()) == 0) {
+      child_main(NULL);
+    }
+    break;
+  case SPAWN_VFORK:
+    // Inline, the child may not return from the function that vforked.
+    if ((pid = vfork()) == 0) {
+      if (g_exec) {
+        execve(EXEC_PATH, g_argv, environ);
+      }
+      _exit(0);
+    }
+    break;
+  case SPAWN_CLONE:
+    pid = clone(child_main, g_stack + CHILD_STACK_BYTES, SIGCHLD, NULL);
+    break;
+  case SPAWN_CLONE_VM:
+    pid = clone(child_main, g_stack + CHILD_STACK_BYTES, CLONE_VM | SIGCHLD,
+                NULL);
+    break;
+  case SPAWN_POSIX_SPAWN:
+    if ((errno = posix_spawn(&pid, EXEC_PATH, NULL, NULL, g_argv,
+                             environ)) != 0) {
+      pid = -1;
+    }
+    break;
+  default:
+    break;
+  }
+  return pid;
+}
+
+/**
+ * Reaps pid by method. Returns false if that fails or the child didn't
+ * exit cleanly.
+ */
+static bool reap(pid_t pid, WaitMethod method) {
+  siginfo_t info;
+  int status = 0;
+
+  memset(&info, 0, sizeof(info));
+  switch (method) {
+  case WAIT_WAITPID:
+    return waitpid(pid, &status, 0) == pid && WIFEXITED(status) &&
+      WEXITSTATUS(status) == 0;
+  case WAIT_WAITID:
+    return waitid(P_PID, pid, &info, WEXITED) == 0 &&
+      info.si_code == CLD_EXITED && info.si_status == 0;
+  case WAIT_PIDFD: {
+    int fd = syscall(SYS_pidfd_open, pid, 0);
+    if (fd == -1) {
+      waitpid(pid, &status, 0);
+      return false;
+    }
+
+    struct pollfd pfd = { fd, POLLIN, 0 };
+    bool exited = poll(&pfd, 1, -1) == 1 &&
+      waitid(P_PIDFD, fd, &info, WEXITED) == 0 &&
+      info.si_code == CLD_EXITED && info.si_status == 0;
+    close(fd);
+    return exited;
+  }
+  default:
+    return false;
+  }
+}
+
+/**
+ * qsort() comparator for timings.
+ */
+static int compare_u64(const void *a, const void *b) {
+  uint64_t ua = *(const uint64_t*)a;
+  uint64_t ub = *(const uint64_t*)b;
+
+  return (ua > ub) - (ua < ub);
+}
+
+/**
+ * Runs iterations round trips of one combination and prints its row.
+ * Returns false if the method isn't supported here.
+ */
+static bool run(int rss_mb, SpawnMethod spawn_method, WaitMethod wait_method,
+                int iterations, uint64_t *total, uint64_t *call) {
+  uint64_t elapsed = 0;
+
+  for (int i = 0; i < iterations / WARMUP_DIVISOR; i++) {
+    pid_t pid = spawn(spawn_method);
+    if (pid == -1 || !reap(pid, wait_method)) {
+      return false;
+    }
+  }
+
+  for (int i = 0; i < iterations; i++) {
+    uint64_t start = now_ns();
+    pid_t pid = spawn(spawn_method);
+    uint64_t spawned = now_ns();
+
+    if (pid == -1 || !reap(pid, wait_method)) {
+      return false;
+    }
+
+    total[i] = now_ns() - start;
+    call[i] = spawned - start;
+    elapsed += total[i];
+  }
+
+  qsort(total, iterations, sizeof(uint64_t), compare_u64);
+  qsort(call, iterations, sizeof(uint64_t), compare_u64);
+  printf("%6d %-5s %-11s %-8s %9.1f %9.1f %9.1f %9.1f %10.0f\n", rss_mb,
+         g_exec ? "exec" : "exit", kSpawnNames[spawn_method],
+         kWaitNames[wait_method], call[iterations / 2] / 1e3,
+         total[iterations / 2] / 1e3, total[iterations * 9 / 10] / 1e3,
+         total[iterations * 99 / 100] / 1e3, iterations / (elapsed / 1e9));
+  fflush(stdout);
+  return true;
+}
+
+/**
+ * Runs every combination with the parent holding rss_mb of touched memory.
+ */
+static void run_rss(int rss_mb, int iterations, uint64_t *total,
+                    uint64_t *call) {
+  size_t bytes = (size_t)rss_mb * 1024 * 1024;
+  char *ballast = NULL;
+
+  if (bytes > 0) {
+    ballast = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ballast == MAP_FAILED) {
+      printf("Unable to allocate %i MB.\n", rss_mb);
+      return;
+    }
+    madvise(ballast, bytes, MADV_NOHUGEPAGE);
+    memset(ballast, 1, bytes);
+  }
+
+  for (int exec = 0; exec < 2; exec++) {
+    g_exec = exec;
+    for (int s = 0; s < SPAWN_METHODS; s++) {
+      // posix_spawn can only exec.
+      if (s == SPAWN_POSIX_SPAWN && !g_exec) {
+        continue;
+      }
+      for (int w = 0; w < WAIT_METHODS; w++) {
+        if (!run(rss_mb, s, w, iterations, total, call)) {
+          printf("%6d %-5s %-11s %-8s failed: %s\n", rss_mb,
+                 g_exec ? "exec" : "exit", kSpawnNames[s], kWaitNames[w],
+                 strerror(errno));
+        }
+      }
+    }
+  }
+  if (ballast != NULL) {
+    munmap(ballast, bytes);
+  }
+}
+
+/**
+ * Application Entry point.
+ */
+int main(int argc, char* argv[]) {
+  int iterations = argc > 1 ? atoi(argv[1]) : DEFAULT_ITERATIONS;
+
+  if (iterations <= 0) {
+    printf("usage: ./spawn_bench [iterations] [parent_rss_mb...]\n");
+    return EXIT_FAILURE;
+  }
+
+  uint64_t *total = malloc(iterations * sizeof(uint64_t));
+  uint64_t *call = malloc(iterations * sizeof(uint64_t));
+  g_stack = malloc(CHILD_STACK_BYTES);
+  if (total == NULL || call == NULL || g_stack == NULL) {
+    printf("Out of memory.\n");
+    return EXIT_FAILURE;
+  }
+
+  printf("%i round trips each, times in us\n", iterations);
+  printf("%6s %-5s %-11s %-8s %9s %9s %9s %9s %10s\n", "rss_mb", "child",
+         "spawn", "wait", "call_p50", "p50", "p90", "p99", "per_sec");
+
+  if (argc > 2) {
+    for (int i = 2; i < argc; i++) {
+      run_rss(atoi(argv[i]), iterations, total, call);
+    }
+  } else {
+    for (size_t i = 0; i < sizeof(kDefaultRss) / sizeof(int); i++) {
+      run_rss(kDefaultRss[i], iterations, total, call);
+    }
+  }
+
+  free(total);
+  free(call);
+  free(g_stack);
+  return EXIT_SUCCESS;
+}
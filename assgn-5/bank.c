@@ -0,0 +1,418 @@
+/**
+ * EECS 338 Operating Systems
+ * Case Western Reserve University
+ * (C) 2015 Christian Gunderman
+ */
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ipc.h>
+#include <sys/sem.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bank.h"
+#include "batch.h"
+#include "monitor.h"
+
+// Preprocessor Defines.
+#define MIN_SEGMENT_ACCOUNTS (MONITOR_CACHE_LINE / sizeof(long))  // A line.
+#define MAX_SEGMENT_ACCOUNTS 512                                   // 4K.
+#define MAX_PASS_THREADS 64
+
+// A stripe's conditions.
+enum {
+  FUNDS_COND,    // Waited on by withdrawals its accounts can't cover.
+  STRIPE_CONDS
+};
+
+// What a stripe's monitor holds, besides its accounts.
+typedef struct stripe_data_t {
+  long transactions;
+} stripe_data_t;
+
+MONITOR_DECLARE(stripe_t, stripe_data_t, STRIPE_CONDS);
+
+struct bank_t {
+  long accounts;
+  int stripes;
+  long segment;        // Neighbouring accounts to a stripe, a power of 2.
+  int sem_id;          // One set for every stripe.
+  long *balances;
+  stripe_t *stripe;
+};
+
+// End of period passes.
+typedef enum pass_kind_t {
+  PASS_INTEREST,
+  PASS_FEES,
+  PASS_FIND_BELOW
+} pass_kind_t;
+
+// A pass, shared by the threads running it.
+typedef struct pass_t {
+  bank_t *bank;
+  pass_kind_t kind;
+  long rate;             // PASS_INTEREST.
+  long threshold;        // PASS_FEES' minimum, PASS_FIND_BELOW's.
+  long fee;              // PASS_FEES.
+  long *found;           // PASS_FIND_BELOW, up to max_found accounts.
+  long max_found;
+  long found_count;
+  long next_segment;     // The next one to take.
+  long result;
+} pass_t;
+
+/*
+ * Gets the stripe guarding an account.
+ */
+static int bank_stripe(bank_t *bank, long account) {
+  return (account / bank->segment) % bank->stripes;
+}
+
+/*
+ * Wakes every withdrawal waiting in a stripe, from inside it, to check
+ * whether its account can cover it now. Those that can't wait again, and
+ * aren't woken twice.
+ */
+static void bank_wake(stripe_t *stripe) {
+  int waiting = __atomic_load_n(&stripe->x_count[FUNDS_COND],
+                                __ATOMIC_RELAXED);
+
+  for (; waiting > 0; waiting--) {
+    MONITOR_SIGNAL(stripe, FUNDS_COND);
+  }
+}
+
+/*
+ * Creates a bank of accounts, each holding balance, guarded by stripes
+ * monitors. Returns NULL if it's out of memory or semaphores.
+ */
+bank_t *bank_create(long accounts, int stripes, long balance) {
+  bank_t *bank = calloc(1, sizeof(bank_t));
+
+  if (bank == NULL || accounts < 1 || stripes < 1) {
+    free(bank);
+    return NULL;
+  }
+
+  bank->accounts = accounts;
+  bank->stripes = stripes;
+  // Segments as big as they can be, for the passes, while still giving
+  // every stripe at least one, so small banks spread over all of them.
+  bank->segment = MIN_SEGMENT_ACCOUNTS;
+  while (bank->segment < MAX_SEGMENT_ACCOUNTS &&
+         bank->segment * 2 * stripes <= accounts) {
+    bank->segment *= 2;
+  }
+  // Line aligned, so the kernels' vectors never straddle two lines.
+  size_t bytes = (accounts * sizeof(long) + MONITOR_CACHE_LINE - 1) /
+    MONITOR_CACHE_LINE * MONITOR_CACHE_LINE;
+  bank->balances = aligned_alloc(MONITOR_CACHE_LINE, bytes);
+  bank->stripe = aligned_alloc(MONITOR_CACHE_LINE, stripes * sizeof(stripe_t));
+  if (bank->balances == NULL || bank->stripe == NULL) {
+    printf("PID: %i, PARENT: Out of memory for bank.\n", getpid());
+    free(bank->balances);
+    free(bank->stripe);
+    free(bank);
+    return NULL;
+  }
+
+  // One semaphore set for every stripe, all zero.
+  int num = stripes * MONITOR_SEMS(&bank->stripe[0]);
+  unsigned short *values = calloc(num, sizeof(unsigned short));
+  bank->sem_id = semget(IPC_PRIVATE, num, S_IRUSR | S_IWUSR);
+  if (values == NULL || bank->sem_id == -1 ||
+      semctl(bank->sem_id, /* Ignored. */ 0, SETALL, values) == -1) {
+    printf("PID: %i, PARENT: Error creating semaphores.\n", getpid());
+    perror("Semaphore error");
+    if (bank->sem_id != -1) {
+      semctl(bank->sem_id, /* Ignored. */ 0, IPC_RMID);
+    }
+    free(values);
+    free(bank->balances);
+    free(bank->stripe);
+    free(bank);
+    return NULL;
+  }
+  free(values);
+
+  for (int i = 0; i < stripes; i++) {
+    MONITOR_ATTACH(&bank->stripe[i], bank->sem_id,
+                   i * MONITOR_SEMS(&bank->stripe[i]));
+    bank->stripe[i].data.transactions = 0;
+  }
+  for (long i = 0; i < accounts; i++) {
+    bank->balances[i] = balance;
+  }
+  return bank;
+}
+
+/*
+ * Deletes a bank, its semaphores and memory. Nothing may be using it.
+ */
+void bank_delete(bank_t *bank) {
+  if (semctl(bank->sem_id, /* Ignored. */ 0, IPC_RMID) == -1) {
+    printf("PID: %i, PARENT: Error deleting semaphores.\n", getpid());
+  }
+  free(bank->balances);
+  free(bank->stripe);
+  free(bank);
+}
+
+/*
+ * Deposits amount into an account, waking withdrawals it might cover.
+ */
+void bank_deposit(bank_t *bank, long account, long amount) {
+  stripe_t *stripe = &bank->stripe[bank_stripe(bank, account)];
+
+  MONITOR_ENTER(stripe);
+  bank->balances[account] += amount;
+  stripe->data.transactions++;
+  bank_wake(stripe);
+  MONITOR_LEAVE(stripe);
+}
+
+/*
+ * Withdraws amount from an account, waiting until it can cover it.
+ */
+void bank_withdraw(bank_t *bank, long account, long amount) {
+  stripe_t *stripe = &bank->stripe[bank_stripe(bank, account)];
+
+  MONITOR_ENTER(stripe);
+  while (bank->balances[account] < amount) {
+    MONITOR_WAIT(stripe, FUNDS_COND);
+  }
+  bank->balances[account] -= amount;
+  stripe->data.transactions++;
+  MONITOR_LEAVE(stripe);
+}
+
+/*
+ * Withdraws amount from an account, waiting at most timeout_ms for it to
+ * cover it, or not at all if 0. Returns false, withdrawing nothing, if it
+ * still can't.
+ */
+bool bank_withdraw_timed(bank_t *bank, long account, long amount,
+                         long timeout_ms) {
+  stripe_t *stripe = &bank->stripe[bank_stripe(bank, account)];
+  struct timespec deadline;
+  bool withdrawn = false;
+
+  clock_gettime(CLOCK_MONOTONIC, &deadline);
+  deadline.tv_sec += timeout_ms / 1000;
+  deadline.tv_nsec += timeout_ms % 1000 * 1000000L;
+  if (deadline.tv_nsec >= 1000000000L) {
+    deadline.tv_sec++;
+    deadline.tv_nsec -= 1000000000L;
+  }
+
+  MONITOR_ENTER(stripe);
+  while (bank->balances[account] < amount && timeout_ms > 0 &&
+         MONITOR_WAIT_UNTIL(stripe, FUNDS_COND, &deadline)) {
+  }
+  if (bank->balances[account] >= amount) {
+    bank->balances[account] -= amount;
+    stripe->data.transactions++;
+    withdrawn = true;
+  }
+  MONITOR_LEAVE(stripe);
+  return withdrawn;
+}
+
+/*
+ * Moves amount from one account to another, all at once. Returns false,
+ * moving nothing, if from can't cover it.
+ */
+bool bank_transfer(bank_t *bank, long from, long to, long amount) {
+  int from_stripe = bank_stripe(bank, from);
+  int to_stripe = bank_stripe(bank, to);
+  stripe_t *first = &bank->stripe[from_stripe < to_stripe ?
+                                  from_stripe : to_stripe];
+  stripe_t *second = &bank->stripe[from_stripe < to_stripe ?
+                                   to_stripe : from_stripe];
+  stripe_t *source = &bank->stripe[from_stripe];
+  stripe_t *dest = &bank->stripe[to_stripe];
+  bool moved = false;
+
+  // Always in stripe order, so no two transfers can each hold the stripe
+  // the other is waiting for.
+  MONITOR_ENTER(first);
+  if (second != first) {
+    MONITOR_ENTER(second);
+  }
+
+  if (bank->balances[from] >= amount) {
+    bank->balances[from] -= amount;
+    bank->balances[to] += amount;
+    source->data.transactions++;
+    moved = true;
+  }
+
+  // Let go of the source first, so it isn't held while woken withdrawals
+  // run in the destination.
+  if (source != dest) {
+    MONITOR_LEAVE(source);
+  }
+  if (moved) {
+    bank_wake(dest);
+  }
+  MONITOR_LEAVE(dest);
+  return moved;
+}
+
+/*
+ * Gets an account's balance.
+ */
+long bank_balance(bank_t *bank, long account) {
+  stripe_t *stripe = &bank->stripe[bank_stripe(bank, account)];
+
+  MONITOR_ENTER(stripe);
+  long balance = bank->balances[account];
+  MONITOR_LEAVE(stripe);
+  return balance;
+}
+
+/*
+ * Sums every balance. Only consistent while nothing is using the bank.
+ */
+long bank_total(bank_t *bank) {
+  long total = 0;
+
+  for (long i = 0; i < bank->accounts; i++) {
+    total += bank->balances[i];
+  }
+  return total;
+}
+
+/*
+ * Counts the deposits, withdrawals and transfers that went through.
+ * Only consistent while nothing is using the bank.
+ */
+long bank_transactions(bank_t *bank) {
+  long total = 0;
+
+  for (int i = 0; i < bank->stripes; i++) {
+    total += bank->stripe[i].data.transactions;
+  }
+  return total;
+}
+
+/*
+ * Runs a pass's kernel over one segment, from inside its stripe. Returns
+ * what the kernel did.
+ */
+static long bank_pass_segment(pass_t *pass, stripe_t *stripe, long first,
+                              long count) {
+  long *balances = pass->bank->balances + first;
+  long result = 0;
+
+  switch (pass->kind) {
+  case PASS_INTEREST:
+    result = batch_interest(balances, count, pass->rate);
+    if (result > 0) {
+      bank_wake(stripe);
+    }
+    break;
+  case PASS_FEES:
+    result = batch_fees(balances, count, pass->threshold, pass->fee);
+    break;
+  case PASS_FIND_BELOW:
+    result = batch_count_below(balances, count, pass->threshold);
+    for (long i = 0; result > 0 && pass->found != NULL && i < count; i++) {
+      if (balances[i] < pass->threshold) {
+        long slot = __atomic_fetch_add(&pass->found_count, 1,
+                                       __ATOMIC_RELAXED);
+        if (slot < pass->max_found) {
+          pass->found[slot] = first + i;
+        }
+      }
+    }
+    break;
+  }
+  return result;
+}
+
+/*
+ * Main function of a pass's threads: takes segments until there are none
+ * left, holding each one's stripe only while its kernel runs, so
+ * transactions go on around the pass.
+ */
+static void *bank_pass_thread(void *input) {
+  pass_t *pass = input;
+  bank_t *bank = pass->bank;
+  long segments = (bank->accounts + bank->segment - 1) / bank->segment;
+  long segment;
+  long result = 0;
+
+  while ((segment = __atomic_fetch_add(&pass->next_segment, 1,
+                                       __ATOMIC_RELAXED)) < segments) {
+    stripe_t *stripe = &bank->stripe[segment % bank->stripes];
+    long first = segment * bank->segment;
+    long count = bank->accounts - first < bank->segment ?
+      bank->accounts - first : bank->segment;
+
+    MONITOR_ENTER(stripe);
+    result += bank_pass_segment(pass, stripe, first, count);
+    MONITOR_LEAVE(stripe);
+  }
+
+  __atomic_add_fetch(&pass->result, result, __ATOMIC_RELAXED);
+  return NULL;
+}
+
+/*
+ * Runs a pass on threads threads, this one included. Returns its result.
+ */
+static long bank_pass(pass_t *pass, int threads) {
+  pthread_t ids[MAX_PASS_THREADS];
+  int started = 0;
+
+  pass->next_segment = 0;
+  pass->result = 0;
+  pass->found_count = 0;
+  threads = threads < 1 ? 1 : threads > MAX_PASS_THREADS ?
+    MAX_PASS_THREADS : threads;
+
+  // If a thread can't be made, the rest take its share.
+  while (started < threads - 1 &&
+         pthread_create(&ids[started], NULL, bank_pass_thread, pass) == 0) {
+    started++;
+  }
+  bank_pass_thread(pass);
+  for (int i = 0; i < started; i++) {
+    pthread_join(ids[i], NULL);
+  }
+  return pass->result;
+}
+
+/*
+ * Pays interest at rate, from BATCH_RATE(), on every positive balance, on
+ * threads threads, while transactions go on. Returns the interest paid.
+ */
+long bank_accrue_interest(bank_t *bank, long rate, int threads) {
+  pass_t pass = { bank, PASS_INTEREST, rate, 0, 0, NULL, 0 };
+  return bank_pass(&pass, threads);
+}
+
+/*
+ * Charges fee on every balance under minimum, on threads threads, while
+ * transactions go on. Returns the number of accounts charged.
+ */
+long bank_charge_fees(bank_t *bank, long minimum, long fee, int threads) {
+  pass_t pass = { bank, PASS_FEES, 0, minimum, fee, NULL, 0 };
+  return bank_pass(&pass, threads);
+}
+
+/*
+ * Finds the accounts with balances under threshold, such as overdrawn
+ * ones, on threads threads, while transactions go on. Writes up to max of
+ * them to accounts, in no order, and returns how many there are.
+ */
+long bank_find_below(bank_t *bank, long threshold, long *accounts, long max,
+                     int threads) {
+  pass_t pass = { bank, PASS_FIND_BELOW, 0, threshold, 0, accounts, max };
+  return bank_pass(&pass, threads);
+}
@@ -0,0 +1,59 @@
+/**
+ * EECS 338 Operating Systems
+ * Case Western Reserve University
+ * (C) 2015 Christian Gunderman
+ */
+#ifndef BANK__H__
+#define BANK__H__
+
+#include <stdbool.h>
+
+/*
+ * A bank of many accounts, for threads of one process. The balances are
+ * one contiguous array of fixed point cents. Accounts are guarded by
+ * striped monitors, each covering a segment of neighbouring accounts out
+ * of every stripes segments, so transactions on accounts in different
+ * stripes run at once. Segments are a power of 2 from a cache line's 8
+ * accounts up to 512, as big as still gives every stripe one. Withdrawals
+ * block until the account can cover them, like the savings account's, or
+ * for at most a timeout with bank_withdraw_timed(). A transfer takes both
+ * accounts' stripes, lowest first, so two transfers never wait on each
+ * other in a cycle, and fails rather than waits if the source can't cover
+ * it.
+ *
+ * End of period passes (interest, fees, finding overdrawn accounts) run
+ * batch.c's vectorized kernels over the array a segment at a time, on
+ * several threads, each holding only that segment's stripe, so
+ * transactions go on during the pass. Each account sees a pass exactly
+ * once, but the pass as a whole isn't atomic.
+ */
+
+typedef struct bank_t bank_t;
+
+bank_t *bank_create(long accounts, int stripes, long balance);
+
+void bank_delete(bank_t *bank);
+
+void bank_deposit(bank_t *bank, long account, long amount);
+
+void bank_withdraw(bank_t *bank, long account, long amount);
+
+bool bank_withdraw_timed(bank_t *bank, long account, long amount,
+                         long timeout_ms);
+
+bool bank_transfer(bank_t *bank, long from, long to, long amount);
+
+long bank_balance(bank_t *bank, long account);
+
+long bank_total(bank_t *bank);
+
+long bank_transactions(bank_t *bank);
+
+long bank_accrue_interest(bank_t *bank, long rate, int threads);
+
+long bank_charge_fees(bank_t *bank, long minimum, long fee, int threads);
+
+long bank_find_below(bank_t *bank, long threshold, long *accounts, long max,
+                     int threads);
+
+#endif // BANK__H__
@@ -0,0 +1,252 @@
+/**
+ * EECS 338 Operating Systems
+ * Case Western Reserve University
+ * (C) 2015 Christian Gunderman
+ */
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bank.h"
+
+/*
+ * Bank benchmark. Threads run a mix of transfers, deposits and
+ * withdrawals between random accounts, picked uniformly or by Zipf rank,
+ * for 1, 2, 4... threads, and it prints transactions per second and the
+ * speedup over 1 thread. Accounts start rich enough that no withdrawal
+ * waits; that they do wait, and wake, is checked first. After each run
+ * the money and transactions are checked against what the threads did.
+ *
+ * usage: ./bank_bench [accounts] [operations] [stripes] [max_threads]
+ */
+
+// Preprocessor Defines.
+#define DEFAULT_ACCOUNTS 1000000
+#define DEFAULT_OPERATIONS 2000000
+#define DEFAULT_STRIPES 1024
+#define DEFAULT_MAX_THREADS 8
+#define MAX_THREADS 64
+#define START_BALANCE 1000000000L
+#define MAX_AMOUNT 100
+#define TRANSFER_PCT 80   // The rest are half deposits, half withdrawals.
+#define ZIPF_EXPONENT 0.99
+#define SCATTER 2654435761u  // Spreads Zipf ranks over the accounts.
+
+// A benchmark thread's params and what it did.
+typedef struct bench_params_t {
+  pthread_t thread;
+  unsigned int seed;
+  long operations;
+  bool zipf;
+  long deposited;
+  long withdrawn;
+  long failed;       // Transfers the source couldn't cover.
+} bench_params_t;
+
+// Global state:
+static bank_t *g_bank = NULL;
+static long g_accounts = DEFAULT_ACCOUNTS;
+static double *g_cumulative = NULL;  // Zipf weights, by rank.
+
+/**
+ * Gets a monotonic timestamp in ns.
+ */
+static uint64_t now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/**
+ * Picks an account, uniformly or by Zipf rank.
+ */
+static long pick_account(bench_params_t *params) {
+  if (!params->zipf) {
+    return ((long)rand_r(&params->seed) * RAND_MAX + rand_r(&params->seed)) %
+      g_accounts;
+  }
+
+  double r = (double)rand_r(&params->seed) / RAND_MAX *
+    g_cumulative[g_accounts - 1];
+  long low = 0;
+  long high = g_accounts - 1;
+
+  while (low < high) {
+    long mid = low + (high - low) / 2;
+    if (g_cumulative[mid] < r) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+  return (unsigned long)low * SCATTER % g_accounts;
+}
+
+/**
+ * Runs a thread's share of the mix.
+ */
+static void *bench_thread(void *input) {
+  bench_params_t *params = input;
+
+  for (long i = 0; i < params->operations; i++) {
+    int kind = rand_r(&params->seed) % 100;
+    long amount = 1 + rand_r(&params->seed) % MAX_AMOUNT;
+    long account = pick_account(params);
+
+    if (kind < TRANSFER_PCT) {
+      if (!bank_transfer(g_bank, account, pick_account(params), amount)) {
+        params->failed++;
+      }
+    } else if (kind < TRANSFER_PCT + (100 - TRANSFER_PCT) / 2) {
+      bank_deposit(g_bank, account, amount);
+      params->deposited += amount;
+    } else {
+      bank_withdraw(g_bank, account, amount);
+      params->withdrawn += amount;
+    }
+  }
+  return NULL;
+}
+
+/**
+ * Withdraws 50 from account 0, which must wait for the deposits.
+ */
+static void *withdraw_thread(void *input) {
+  bank_withdraw(input, 0, 50);
+  return NULL;
+}
+
+/**
+ * Checks that a withdrawal waits for enough money, and gets it.
+ */
+static bool check_withdrawal_waits(int stripes) {
+  bank_t *bank = bank_create(1, stripes, 0);
+  pthread_t thread;
+
+  if (bank == NULL ||
+      pthread_create(&thread, NULL, withdraw_thread, bank) != 0) {
+    return false;
+  }
+
+  usleep(10000);
+  bank_deposit(bank, 0, 30);
+  usleep(10000);
+  bool waited = bank_balance(bank, 0) == 30;
+  bank_deposit(bank, 0, 30);
+  pthread_join(thread, NULL);
+
+  bool ok = waited && bank_balance(bank, 0) == 10;
+  bank_delete(bank);
+  return ok;
+}
+
+/**
+ * Runs the mix on threads threads, operations split between them, and
+ * returns the time in ns, or 0 if the books don't balance.
+ */
+static uint64_t run(int threads, long operations, int stripes, bool zipf) {
+  bench_params_t params[MAX_THREADS];
+
+  g_bank = bank_create(g_accounts, stripes, START_BALANCE);
+  if (g_bank == NULL) {
+    return 0;
+  }
+
+  uint64_t start = now_ns();
+  for (int i = 0; i < threads; i++) {
+    params[i] = (bench_params_t){ 0 };
+    params[i].seed = i + 1;
+    params[i].operations = operations / threads;
+    params[i].zipf = zipf;
+    if (pthread_create(&params[i].thread, NULL, bench_thread,
+                       &params[i]) != 0) {
+      perror("Error creating thread");
+      exit(EXIT_FAILURE);
+    }
+  }
+  for (int i = 0; i < threads; i++) {
+    pthread_join(params[i].thread, NULL);
+  }
+  uint64_t elapsed = now_ns() - start;
+
+  long expected = START_BALANCE * g_accounts;
+  long transactions = 0;
+  for (int i = 0; i < threads; i++) {
+    expected += params[i].deposited - params[i].withdrawn;
+    transactions += params[i].operations - params[i].failed;
+  }
+  if (bank_total(g_bank) != expected ||
+      bank_transactions(g_bank) != transactions) {
+    printf("Books don't balance: %li in %li transactions, expected %li in "
+           "%li.\n", bank_total(g_bank), bank_transactions(g_bank),
+           expected, transactions);
+    elapsed = 0;
+  }
+
+  bank_delete(g_bank);
+  return elapsed;
+}
+
+/**
+ * Application Entry point.
+ */
+int main(int argc, char* argv[]) {
+  g_accounts = argc > 1 ? atol(argv[1]) : DEFAULT_ACCOUNTS;
+  long operations = argc > 2 ? atol(argv[2]) : DEFAULT_OPERATIONS;
+  int stripes = argc > 3 ? atoi(argv[3]) : DEFAULT_STRIPES;
+  int max_threads = argc > 4 ? atoi(argv[4]) : DEFAULT_MAX_THREADS;
+
+  if (g_accounts < 1 || operations < 1 || stripes < 1 || max_threads < 1 ||
+      max_threads > MAX_THREADS) {
+    printf("usage: ./bank_bench [accounts] [operations] [stripes] "
+           "[max_threads]\n");
+    return EXIT_FAILURE;
+  }
+
+  g_cumulative = malloc(g_accounts * sizeof(double));
+  if (g_cumulative == NULL) {
+    printf("Out of memory.\n");
+    return EXIT_FAILURE;
+  }
+  for (long i = 0; i < g_accounts; i++) {
+    g_cumulative[i] = (i > 0 ? g_cumulative[i - 1] : 0) +
+      1 / pow(i + 1, ZIPF_EXPONENT);
+  }
+
+  if (!check_withdrawal_waits(stripes)) {
+    printf("Withdrawals don't wait for their money.\n");
+    return EXIT_FAILURE;
+  }
+
+  printf("%li accounts, %i stripes, %li operations, %i%% transfers\n",
+         g_accounts, stripes, operations, TRANSFER_PCT);
+  printf("%7s %12s %8s %12s %8s\n", "threads", "uniform_tps", "speedup",
+         "zipf_tps", "speedup");
+
+  double base[2] = { 0, 0 };
+  for (int threads = 1; threads <= max_threads; threads *= 2) {
+    printf("%7i", threads);
+    for (int zipf = 0; zipf < 2; zipf++) {
+      uint64_t elapsed = run(threads, operations, stripes, zipf);
+      if (elapsed == 0) {
+        printf(" %12s %8s", "failed", "-");
+        continue;
+      }
+
+      double tps = operations / threads * threads / (elapsed / 1e9);
+      if (threads == 1) {
+        base[zipf] = tps;
+      }
+      printf(" %12.0f %8.2f", tps, base[zipf] > 0 ? tps / base[zipf] : 0);
+    }
+    printf("\n");
+    fflush(stdout);
+  }
+
+  free(g_cumulative);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,501 @@
+/**
+ * EECS 338 Operating Systems
+ * Case Western Reserve University
+ * (C) 2015 Christian Gunderman
+ */
+#define _XOPEN_SOURCE 700
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bank_rpc.h"
+
+/*
+ * Load client for the bank server. Runs a number of clients, each a thread
+ * with its own RPC client, issuing deposits, withdrawals and balance
+ * checks on random accounts back to back for a while, and prints the
+ * throughput and latency of each, end to end.
+ *
+ * Withdrawals wait for their money up to a timeout, so the mix sets how
+ * much they wait: withdrawing faster than depositing drains the accounts
+ * and leaves withdrawals waiting on deposits. Before and after the run
+ * it adds up the balances and checks the money against what it deposited
+ * and withdrew, which only holds while it's the server's only client.
+ *
+ * usage: ./bank_client [options], see print_help().
+ */
+
+// Preprocessor Defines.
+#define DEFAULT_HOST "localhost"
+#define DEFAULT_CLIENTS 8
+#define DEFAULT_SECONDS 10
+#define DEFAULT_ACCOUNTS 1000
+#define DEFAULT_TIMEOUT_MS 100
+#define DEFAULT_MAX_AMOUNT 10000       // $100.
+#define DEFAULT_MIX "deposit=45,withdraw=45,balance=10"
+#define RPC_SLACK_SECONDS 5            // Past a withdrawal's own timeout.
+#define BLOCKING_RPC_SECONDS 60        // For withdrawals with no timeout.
+#define INITIAL_SAMPLES 4096
+
+// Operations the client issues.
+typedef enum op_t {
+  OP_DEPOSIT,
+  OP_WITHDRAW,
+  OP_BALANCE,
+  OP_COUNT
+} op_t;
+
+const char *kOpNames[] = {
+  "deposit",
+  "withdraw",
+  "balance",
+};
+
+// Latencies, in microseconds, of one operation on one client.
+typedef struct samples_t {
+  float *us;
+  size_t count;
+  size_t capacity;
+  unsigned long timeouts;  // Withdrawals the account didn't cover in time.
+  unsigned long busy;      // Withdrawals the server had no thread to wait.
+  unsigned long errors;    // Calls the server answered with a failure.
+  unsigned long failures;  // Calls that got no answer at all.
+} samples_t;
+
+// A client: one thread and one RPC client.
+typedef struct client_t {
+  pthread_t thread;
+  unsigned int seed;
+  long deposited;          // Cents, of the calls that went through.
+  long withdrawn;
+  samples_t samples[OP_COUNT];
+} client_t;
+
+// Run configuration, shared read only by all clients.
+static const char *g_host = DEFAULT_HOST;
+static int g_port = 0;
+static int g_clients = DEFAULT_CLIENTS;
+static int g_seconds = DEFAULT_SECONDS;
+static int g_accounts = DEFAULT_ACCOUNTS;
+static int g_timeout_ms = DEFAULT_TIMEOUT_MS;
+static long g_max_amount = DEFAULT_MAX_AMOUNT;
+static int g_mix[OP_COUNT];
+static int g_mix_total = 0;
+static double g_end = 0;
+
+/**
+ * Gets a monotonic timestamp in seconds.
+ */
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * Print application usage info.
+ */
+static void print_help() {
+  printf("RPC Bank Load Client\n");
+  printf("(C) 2015 Christian Gunderman\n\n");
+  printf("usage: ./bank_client [-h host] [-p port] [-c clients] "
+         "[-d seconds]\n"
+         "                     [-a accounts] [-t timeout_ms] "
+         "[-x max_amount] [-m mix]\n");
+  printf("  -h  server host (default %s)\n", DEFAULT_HOST);
+  printf("  -p  server port, skips the portmapper (bank_server -p)\n");
+  printf("  -c  concurrent clients, one thread each (default %i)\n",
+         DEFAULT_CLIENTS);
+  printf("  -d  seconds to run for (default %i)\n", DEFAULT_SECONDS);
+  printf("  -a  accounts to use, at most the server's (default %i)\n",
+         DEFAULT_ACCOUNTS);
+  printf("  -t  how long withdrawals wait for their money, 0 for not at\n"
+         "      all, -1 for as long as it takes, which may be forever once\n"
+         "      every client is waiting (default %i)\n",
+         DEFAULT_TIMEOUT_MS);
+  printf("  -x  largest amount, in cents (default %i)\n", DEFAULT_MAX_AMOUNT);
+  printf("  -m  operation weights (default %s)\n", DEFAULT_MIX);
+  exit(1);
+}
+
+/**
+ * Parses the operation mix, e.g. "deposit=50,withdraw=50".
+ */
+static bool parse_mix(const char *spec) {
+  char *copy = strdup(spec);
+  char *save = NULL;
+
+  memset(g_mix, 0, sizeof(g_mix));
+  g_mix_total = 0;
+
+  for (char *tok = strtok_r(copy, ",", &save); tok != NULL;
+       tok = strtok_r(NULL, ",", &save)) {
+    char *eq = strchr(tok, '=');
+    int op;
+
+    if (eq == NULL) {
+      free(copy);
+      return false;
+    }
+    *eq = '\0';
+
+    for (op = 0; op < OP_COUNT && strcasecmp(tok, kOpNames[op]) != 0; op++) {
+    }
+    if (op == OP_COUNT || atoi(eq + 1) < 0) {
+      free(copy);
+      return false;
+    }
+
+    g_mix[op] = atoi(eq + 1);
+    g_mix_total += g_mix[op];
+  }
+
+  free(copy);
+  return g_mix_total > 0;
+}
+
+/**
+ * Creates an RPC client to the server, directly to the port if one was
+ * given, otherwise through the portmapper. A UDP client resends a call
+ * it hasn't heard back about; it's only told to once the call would
+ * have timed out anyway, so waiting withdrawals aren't sent again.
+ */
+static CLIENT *connect_server() {
+  struct timeval timeout;
+  CLIENT *clnt;
+
+  timeout.tv_sec = g_timeout_ms < 0 ? BLOCKING_RPC_SECONDS :
+    g_timeout_ms / 1000 + RPC_SLACK_SECONDS;
+  timeout.tv_usec = 0;
+
+  if (g_port == 0) {
+    clnt = clnt_create(g_host, BANK_PROG, BANK_VERSION, "udp");
+  } else {
+    struct sockaddr_in addr;
+    struct hostent *host = gethostbyname(g_host);
+    int sock = RPC_ANYSOCK;
+
+    if (host == NULL) {
+      return NULL;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    memcpy(&addr.sin_addr, host->h_addr_list[0], sizeof(addr.sin_addr));
+    addr.sin_port = htons(g_port);
+    clnt = clntudp_create(&addr, BANK_PROG, BANK_VERSION, timeout, &sock);
+  }
+
+  if (clnt != NULL) {
+    clnt_control(clnt, CLSET_RETRY_TIMEOUT, (char*)&timeout);
+    clnt_control(clnt, CLSET_TIMEOUT, (char*)&timeout);
+  }
+  return clnt;
+}
+
+/**
+ * Makes one call. Returns false if it got no answer.
+ */
+static bool call(CLIENT *clnt, op_t op, BankParams *params,
+                 BankResponse *result) {
+  static const unsigned long kProcs[] = {
+    BANK_DEPOSIT,
+    BANK_WITHDRAW,
+    BANK_BALANCE,
+  };
+  struct timeval timeout;
+
+  // Ignored, CLSET_TIMEOUT was set.
+  timeout.tv_sec = 0;
+  timeout.tv_usec = 0;
+
+  memset(result, 0, sizeof(BankResponse));
+  return clnt_call(clnt, kProcs[op], (xdrproc_t)xdr_BankParams,
+                   (caddr_t)params, (xdrproc_t)xdr_BankResponse,
+                   (caddr_t)result, timeout) == RPC_SUCCESS;
+}
+
+/**
+ * Records a latency sample.
+ */
+static void record(samples_t *samples, double seconds) {
+  if (samples->count == samples->capacity) {
+    size_t capacity = samples->capacity == 0 ? INITIAL_SAMPLES :
+      samples->capacity * 2;
+    float *us = realloc(samples->us, capacity * sizeof(float));
+    if (us == NULL) {
+      return;
+    }
+    samples->us = us;
+    samples->capacity = capacity;
+  }
+  samples->us[samples->count++] = seconds * 1e6;
+}
+
+/**
+ * Picks an operation from the mix.
+ */
+static op_t pick_op(unsigned int *seed) {
+  int roll = rand_r(seed) % g_mix_total;
+  op_t op = 0;
+
+  while (roll >= g_mix[op]) {
+    roll -= g_mix[op];
+    op++;
+  }
+  return op;
+}
+
+/**
+ * Main function of the client threads: issues operations until the end
+ * of the run.
+ */
+static void *client_thread(void *input) {
+  client_t *client = input;
+  CLIENT *clnt = connect_server();
+
+  if (clnt == NULL) {
+    clnt_pcreateerror(g_host);
+    return NULL;
+  }
+
+  while (now() < g_end) {
+    op_t op = pick_op(&client->seed);
+    samples_t *samples = &client->samples[op];
+    BankParams params;
+    BankResponse result;
+
+    params.account = rand_r(&client->seed) % g_accounts;
+    params.amount = 1 + rand_r(&client->seed) % g_max_amount;
+    params.timeout_ms = g_timeout_ms;
+
+    double start = now();
+    if (!call(clnt, op, &params, &result)) {
+      samples->failures++;
+      continue;
+    }
+    record(samples, now() - start);
+
+    if (result.result == BankResultSuccess) {
+      if (op == OP_DEPOSIT) {
+        client->deposited += params.amount;
+      } else if (op == OP_WITHDRAW) {
+        client->withdrawn += params.amount;
+      }
+    } else if (result.result == BankResultTimedOut) {
+      samples->timeouts++;
+    } else if (result.result == BankResultBusy) {
+      samples->busy++;
+    } else {
+      samples->errors++;
+    }
+  }
+
+  clnt_destroy(clnt);
+  return NULL;
+}
+
+/**
+ * Adds up the balances of the accounts used. Returns false if the server
+ * didn't answer for all of them.
+ */
+static bool sum_balances(long *total) {
+  CLIENT *clnt = connect_server();
+  BankParams params;
+  BankResponse result;
+
+  if (clnt == NULL) {
+    clnt_pcreateerror(g_host);
+    return false;
+  }
+
+  *total = 0;
+  memset(&params, 0, sizeof(params));
+  for (params.account = 0; params.account < g_accounts; params.account++) {
+    if (!call(clnt, OP_BALANCE, &params, &result) ||
+        result.result != BankResultSuccess) {
+      clnt_destroy(clnt);
+      return false;
+    }
+    *total += result.balance;
+  }
+
+  clnt_destroy(clnt);
+  return true;
+}
+
+/**
+ * qsort comparator for latencies.
+ */
+static int compare_float(const void *a, const void *b) {
+  float fa = *(const float*)a;
+  float fb = *(const float*)b;
+  return (fa > fb) - (fa < fb);
+}
+
+/**
+ * Gets the p'th percentile of sorted latencies.
+ */
+static double percentile(float *sorted, size_t count, double p) {
+  if (count == 0) {
+    return 0;
+  }
+
+  size_t i = (size_t)(p / 100 * count);
+  return sorted[i < count ? i : count - 1];
+}
+
+/**
+ * Merges every client's samples for op and prints a row for it, adding
+ * its answered calls to total and unanswered ones to lost.
+ */
+static void print_op(client_t *clients, op_t op, double elapsed,
+                     unsigned long *total, unsigned long *lost) {
+  samples_t all;
+  memset(&all, 0, sizeof(all));
+
+  for (int i = 0; i < g_clients; i++) {
+    all.count += clients[i].samples[op].count;
+    all.timeouts += clients[i].samples[op].timeouts;
+    all.busy += clients[i].samples[op].busy;
+    all.errors += clients[i].samples[op].errors;
+    all.failures += clients[i].samples[op].failures;
+  }
+
+  all.us = malloc((all.count + 1) * sizeof(float));
+  size_t pos = 0;
+  double sum = 0;
+  for (int i = 0; i < g_clients; i++) {
+    samples_t *samples = &clients[i].samples[op];
+    memcpy(all.us + pos, samples->us, samples->count * sizeof(float));
+    pos += samples->count;
+  }
+  for (size_t i = 0; i < all.count; i++) {
+    sum += all.us[i];
+  }
+  qsort(all.us, all.count, sizeof(float), compare_float);
+
+  printf("%-9s %9zu %9.0f %8lu %6lu %6lu %8.0f %8.0f %8.0f %8.0f %9.0f\n",
+         kOpNames[op], all.count, all.count / elapsed, all.timeouts,
+         all.busy, all.errors + all.failures,
+         all.count > 0 ? sum / all.count : 0,
+         percentile(all.us, all.count, 50), percentile(all.us, all.count, 90),
+         percentile(all.us, all.count, 99),
+         all.count > 0 ? all.us[all.count - 1] : 0);
+
+  free(all.us);
+  *total += all.count;
+  *lost += all.failures;
+}
+
+/**
+ * Application Entry point.
+ */
+int main(int argc, char* argv[]) {
+  const char *mix = DEFAULT_MIX;
+  long before = 0;
+  long after = 0;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "h:p:c:d:a:t:x:m:")) != -1) {
+    switch (opt) {
+    case 'h':
+      g_host = optarg;
+      break;
+    case 'p':
+      g_port = atoi(optarg);
+      break;
+    case 'c':
+      g_clients = atoi(optarg);
+      break;
+    case 'd':
+      g_seconds = atoi(optarg);
+      break;
+    case 'a':
+      g_accounts = atoi(optarg);
+      break;
+    case 't':
+      g_timeout_ms = atoi(optarg);
+      break;
+    case 'x':
+      g_max_amount = atol(optarg);
+      break;
+    case 'm':
+      mix = optarg;
+      break;
+    default:
+      print_help();
+    }
+  }
+
+  if (g_clients < 1 || g_seconds < 1 || g_accounts < 1 ||
+      g_timeout_ms < -1 || g_max_amount < 1 || !parse_mix(mix)) {
+    print_help();
+  }
+
+  if (!sum_balances(&before)) {
+    printf("Unable to read the balances.\n");
+    return EXIT_FAILURE;
+  }
+
+  client_t *clients = calloc(g_clients, sizeof(client_t));
+  double start = now();
+  g_end = start + g_seconds;
+  for (int i = 0; i < g_clients; i++) {
+    clients[i].seed = i + 1;
+    pthread_create(&clients[i].thread, NULL, client_thread, &clients[i]);
+  }
+
+  long deposited = 0;
+  long withdrawn = 0;
+  for (int i = 0; i < g_clients; i++) {
+    pthread_join(clients[i].thread, NULL);
+    deposited += clients[i].deposited;
+    withdrawn += clients[i].withdrawn;
+  }
+  double elapsed = now() - start;
+
+  printf("%i clients, %i accounts, %.1f s, withdrawals wait %i ms\n",
+         g_clients, g_accounts, elapsed, g_timeout_ms);
+  printf("%-9s %9s %9s %8s %6s %6s %8s %8s %8s %8s %9s\n", "op", "calls",
+         "calls/s", "timeouts", "busy", "errors", "mean_us", "p50_us",
+         "p90_us", "p99_us", "max_us");
+
+  unsigned long total = 0;
+  unsigned long lost = 0;
+  for (op_t op = 0; op < OP_COUNT; op++) {
+    print_op(clients, op, elapsed, &total, &lost);
+  }
+  printf("%-9s %9lu %9.0f\n", "total", total, total / elapsed);
+
+  // A call that got no answer may or may not have gone through.
+  if (lost > 0) {
+    printf("%lu calls got no answer, not checking the money.\n", lost);
+  } else if (!sum_balances(&after)) {
+    printf("Unable to read the balances.\n");
+    return EXIT_FAILURE;
+  } else if (after != before + deposited - withdrawn) {
+    printf("The money doesn't add up: $%.2f, expected $%.2f.\n",
+           after / 100.0, (before + deposited - withdrawn) / 100.0);
+    return EXIT_FAILURE;
+  } else {
+    printf("The money adds up: $%.2f before, $%.2f after.\n",
+           before / 100.0, after / 100.0);
+  }
+
+  for (int i = 0; i < g_clients; i++) {
+    for (op_t op = 0; op < OP_COUNT; op++) {
+      free(clients[i].samples[op].us);
+    }
+  }
+  free(clients);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,39 @@
+/**
+ * EECS 338 Operating Systems
+ * Case Western Reserve University
+ * (C) 2015 Christian Gunderman
+ */
+
+/* The bank's accounts over RPC, served by bank_server.c. Amounts are in
+   cents. */
+
+enum BankResult {
+  BankResultSuccess = 0,
+  BankResultServerFailure = 1,
+  BankResultNoAccount = 2,
+  BankResultBadAmount = 3,
+  BankResultTimedOut = 4,      /* The account didn't cover it in time. */
+  BankResultBusy = 5,          /* No thread left to wait with. */
+  BankResultShuttingDown = 6
+};
+
+struct BankParams {
+  int account;
+  hyper amount;
+  int timeout_ms;   /* BANK_WITHDRAW's wait, 0 for none, -1 for no limit. */
+};
+typedef struct BankParams BankParams;
+
+struct BankResponse {
+  BankResult result;
+  hyper balance;    /* BANK_BALANCE's. */
+};
+typedef struct BankResponse BankResponse;
+
+program BANK_PROG {
+  version BANK_VERSION {
+    BankResponse BANK_DEPOSIT(BankParams) = 1;
+    BankResponse BANK_WITHDRAW(BankParams) = 2;
+    BankResponse BANK_BALANCE(BankParams) = 3;
+  } = 1;
+} = 2473651;
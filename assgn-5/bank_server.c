@@ -0,0 +1,558 @@
+/**
+ * EECS 338 Operating Systems
+ * Case Western Reserve University
+ * (C) 2015 Christian Gunderman
+ */
+#define _XOPEN_SOURCE 700
+
+#include <errno.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <rpc/pmap_clnt.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bank.h"
+#include "bank_rpc.h"
+
+/*
+ * Bank server. Serves the bank's accounts over RPC (bank_rpc.x), on UDP.
+ *
+ * The main thread only receives: rpcgen's dispatcher decodes each request
+ * and its handler queues it for a pool of worker threads and returns
+ * without replying. A worker runs the request on the bank, where a
+ * withdrawal may wait on its stripe's monitor for as long as its timeout,
+ * and sends the reply itself, built with the request's own id, the way
+ * assgn-6's waiting mailbox calls are answered late. So a waiting
+ * withdrawal holds a worker, never the receiving thread, and at most all
+ * but one worker may be waiting, so there is always one to run the
+ * deposits that would let them go; past that they are answered
+ * BankResultBusy.
+ *
+ * A client resends a request it hasn't heard back about, which mustn't
+ * withdraw twice, so requests are known by their id and sender. Resends
+ * of one still queued or running are dropped, and of one answered, the
+ * reply is sent again. Answers are kept for REPLY_CACHE_SECONDS, and only
+ * the last REPLY_CACHE_MAX of them, so a resend later than that runs
+ * again.
+ *
+ * usage: ./bank_server [options], see print_help().
+ */
+
+// Preprocessor Defines.
+#define DEFAULT_ACCOUNTS 1000
+#define DEFAULT_STRIPES 64
+#define DEFAULT_BALANCE 0
+#define DEFAULT_THREADS 8
+#define MAX_THREADS 256
+#define WAIT_SLICE_MS 100       // Waiting withdrawals check for shutdown.
+#define REPLY_SIZE 128          // Fits a BankResponse with room over.
+#define INFLIGHT_BUCKETS 1024
+#define REPLY_CACHE_SECONDS 30
+#define REPLY_CACHE_MAX 65536   // ~11MB of answered requests.
+
+// rpcgen -m generated dispatcher, in bank_rpc_svc.c.
+void bank_prog_1(struct svc_req *rqstp, SVCXPRT *transp);
+
+// A request, from when it's received until its answer expires.
+typedef struct job_t {
+  struct job_t *next;           // In the queue, then in the answered.
+  struct job_t *bucket_next;    // Known, by request id.
+  unsigned long proc;
+  BankParams params;
+  uint32_t xid;                 // Who to reply to.
+  struct sockaddr_storage addr;
+  socklen_t addr_len;
+  bool answered;
+  BankResponse reply;           // Once answered.
+  double answered_at;
+} job_t;
+
+// Global state:
+static bank_t *g_bank = NULL;
+static long g_accounts = DEFAULT_ACCOUNTS;
+static int g_threads = DEFAULT_THREADS;
+static SVCXPRT *g_transp = NULL;
+
+// The queue and the requests in flight, under g_lock.
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_queued = PTHREAD_COND_INITIALIZER;
+static job_t *g_head = NULL;
+static job_t *g_tail = NULL;
+static job_t *g_inflight[INFLIGHT_BUCKETS];
+static job_t *g_answered_head = NULL;   // Oldest first.
+static job_t *g_answered_tail = NULL;
+static long g_answered = 0;
+static int g_waiting = 0;       // Workers in withdrawals that had to wait.
+static long g_resends = 0;
+static long g_replays = 0;
+
+// The transport's operations, with receive wrapped to keep the id of the
+// last request.
+static struct xp_ops g_ops;
+static const struct xp_ops *g_orig_ops = NULL;
+static uint32_t g_xid = 0;
+
+// Set by the signal handler to stop the request loop.
+static volatile sig_atomic_t g_stop = 0;
+
+/**
+ * SIGINT/SIGTERM handler. Just flags the loop to stop, the actual shutdown
+ * happens outside of signal context.
+ */
+static void stop_handler(int signum) {
+  g_stop = 1;
+}
+
+/**
+ * Gets a monotonic timestamp in seconds.
+ */
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * Receives a request, keeping its id for the late reply.
+ */
+static bool_t server_recv(SVCXPRT *transp, struct rpc_msg *msg) {
+  bool_t ok = g_orig_ops->xp_recv(transp, msg);
+
+  if (ok) {
+    g_xid = msg->rm_xid;
+  }
+  return ok;
+}
+
+/**
+ * Sends a request's reply. The transport has moved on to other requests,
+ * so it's built here with the request's own id.
+ */
+static void server_reply(job_t *job, BankResponse *result) {
+  struct rpc_msg reply;
+  char buf[REPLY_SIZE];
+  XDR xdrs;
+
+  memset(&reply, 0, sizeof(reply));
+  reply.rm_xid = job->xid;
+  reply.rm_direction = REPLY;
+  reply.rm_reply.rp_stat = MSG_ACCEPTED;
+  reply.acpted_rply.ar_verf = _null_auth;
+  reply.acpted_rply.ar_stat = SUCCESS;
+  reply.acpted_rply.ar_results.where = (caddr_t)result;
+  reply.acpted_rply.ar_results.proc = (xdrproc_t)xdr_BankResponse;
+
+  xdrmem_create(&xdrs, buf, sizeof(buf), XDR_ENCODE);
+  if (!xdr_replymsg(&xdrs, &reply) ||
+      sendto(g_transp->xp_fd, buf, xdr_getpos(&xdrs), 0,
+             (struct sockaddr*)&job->addr, job->addr_len) == -1) {
+    perror("Reply error");
+  }
+  xdr_destroy(&xdrs);
+}
+
+/**
+ * Queues a request for the workers. Returns NULL, as the reply is sent
+ * later, or a failure to reply with now.
+ */
+static BankResponse *server_queue(unsigned long proc, BankParams *params,
+                                  struct svc_req *rqstp) {
+  static BankResponse failure;
+  job_t *job = calloc(1, sizeof(job_t));
+
+  if (job == NULL) {
+    failure.result = BankResultServerFailure;
+    return &failure;
+  }
+
+  job->proc = proc;
+  job->params = *params;
+  job->xid = g_xid;
+#ifdef svc_getrpccaller
+  struct netbuf *caller = svc_getrpccaller(rqstp->rq_xprt);
+  job->addr_len = caller->len < sizeof(job->addr) ?
+    caller->len : sizeof(job->addr);
+  memcpy(&job->addr, caller->buf, job->addr_len);
+#else
+  job->addr_len = sizeof(struct sockaddr_in);
+  memcpy(&job->addr, svc_getcaller(rqstp->rq_xprt), job->addr_len);
+#endif
+
+  pthread_mutex_lock(&g_lock);
+  job_t **bucket = &g_inflight[job->xid % INFLIGHT_BUCKETS];
+  for (job_t *other = *bucket; other != NULL; other = other->bucket_next) {
+    if (other->xid == job->xid && other->addr_len == job->addr_len &&
+        memcmp(&other->addr, &job->addr, job->addr_len) == 0) {
+      // A resend. If it's been answered the answer was lost, so it goes
+      // again, otherwise the first one will be answered.
+      bool answered = other->answered;
+      BankResponse reply = other->reply;
+      if (answered) {
+        g_replays++;
+      } else {
+        g_resends++;
+      }
+      pthread_mutex_unlock(&g_lock);
+
+      if (answered) {
+        server_reply(job, &reply);
+      }
+      free(job);
+      return NULL;
+    }
+  }
+  job->bucket_next = *bucket;
+  *bucket = job;
+
+  if (g_tail != NULL) {
+    g_tail->next = job;
+  } else {
+    g_head = job;
+  }
+  g_tail = job;
+  pthread_cond_signal(&g_queued);
+  pthread_mutex_unlock(&g_lock);
+  return NULL;
+}
+
+/**
+ * BANK_DEPOSIT handler, called by the dispatcher.
+ */
+BankResponse *bank_deposit_1_svc(BankParams *params, struct svc_req *rqstp) {
+  return server_queue(BANK_DEPOSIT, params, rqstp);
+}
+
+/**
+ * BANK_WITHDRAW handler, called by the dispatcher.
+ */
+BankResponse *bank_withdraw_1_svc(BankParams *params, struct svc_req *rqstp) {
+  return server_queue(BANK_WITHDRAW, params, rqstp);
+}
+
+/**
+ * BANK_BALANCE handler, called by the dispatcher.
+ */
+BankResponse *bank_balance_1_svc(BankParams *params, struct svc_req *rqstp) {
+  return server_queue(BANK_BALANCE, params, rqstp);
+}
+
+/**
+ * Withdraws, waiting up to timeout_ms, or without limit if it's negative,
+ * a slice at a time so a shutdown isn't held up.
+ */
+static BankResult server_withdraw(long account, long amount, long timeout_ms) {
+  // Most withdrawals needn't wait, and don't take a waiting worker.
+  if (bank_withdraw_timed(g_bank, account, amount, 0)) {
+    return BankResultSuccess;
+  } else if (timeout_ms == 0) {
+    return BankResultTimedOut;
+  }
+
+  pthread_mutex_lock(&g_lock);
+  bool busy = g_waiting >= g_threads - 1;
+  if (!busy) {
+    g_waiting++;
+  }
+  pthread_mutex_unlock(&g_lock);
+  if (busy) {
+    return BankResultBusy;
+  }
+
+  BankResult result = BankResultTimedOut;
+  while (timeout_ms != 0) {
+    long slice = timeout_ms > 0 && timeout_ms < WAIT_SLICE_MS ?
+      timeout_ms : WAIT_SLICE_MS;
+
+    if (bank_withdraw_timed(g_bank, account, amount, slice)) {
+      result = BankResultSuccess;
+      break;
+    } else if (g_stop) {
+      result = BankResultShuttingDown;
+      break;
+    }
+    if (timeout_ms > 0) {
+      timeout_ms -= slice;
+    }
+  }
+
+  pthread_mutex_lock(&g_lock);
+  g_waiting--;
+  pthread_mutex_unlock(&g_lock);
+  return result;
+}
+
+/**
+ * Runs a request on the bank.
+ */
+static void server_run(job_t *job, BankResponse *result) {
+  BankParams *params = &job->params;
+
+  memset(result, 0, sizeof(BankResponse));
+  if (params->account < 0 || params->account >= g_accounts) {
+    result->result = BankResultNoAccount;
+    return;
+  } else if (job->proc != BANK_BALANCE && params->amount <= 0) {
+    result->result = BankResultBadAmount;
+    return;
+  }
+
+  switch (job->proc) {
+  case BANK_DEPOSIT:
+    bank_deposit(g_bank, params->account, params->amount);
+    result->result = BankResultSuccess;
+    break;
+  case BANK_WITHDRAW:
+    result->result = server_withdraw(params->account, params->amount,
+                                     params->timeout_ms);
+    break;
+  case BANK_BALANCE:
+    result->balance = bank_balance(g_bank, params->account);
+    result->result = BankResultSuccess;
+    break;
+  }
+}
+
+/**
+ * Keeps a request's answer for resends, and lets go of the oldest ones,
+ * past REPLY_CACHE_SECONDS or REPLY_CACHE_MAX. A resend of one let go of
+ * is a new request.
+ */
+static void server_answered(job_t *job, BankResponse *result) {
+  double answered_at = now();
+
+  pthread_mutex_lock(&g_lock);
+  job->answered = true;
+  job->reply = *result;
+  job->answered_at = answered_at;
+  job->next = NULL;
+  if (g_answered_tail != NULL) {
+    g_answered_tail->next = job;
+  } else {
+    g_answered_head = job;
+  }
+  g_answered_tail = job;
+  g_answered++;
+
+  while (g_answered > REPLY_CACHE_MAX ||
+         g_answered_head->answered_at < answered_at - REPLY_CACHE_SECONDS) {
+    job_t *old = g_answered_head;
+    job_t **link = &g_inflight[old->xid % INFLIGHT_BUCKETS];
+
+    while (*link != old) {
+      link = &(*link)->bucket_next;
+    }
+    *link = old->bucket_next;
+    g_answered_head = old->next;
+    if (g_answered_head == NULL) {
+      g_answered_tail = NULL;
+    }
+    g_answered--;
+    free(old);
+  }
+  pthread_mutex_unlock(&g_lock);
+}
+
+/**
+ * Main function of the workers: runs and answers requests until the
+ * queue is empty and the server is stopping.
+ */
+static void *server_worker(void *input) {
+  for (;;) {
+    pthread_mutex_lock(&g_lock);
+    while (g_head == NULL && !g_stop) {
+      pthread_cond_wait(&g_queued, &g_lock);
+    }
+    job_t *job = g_head;
+    if (job == NULL) {
+      pthread_mutex_unlock(&g_lock);
+      return NULL;
+    }
+    g_head = job->next;
+    if (g_head == NULL) {
+      g_tail = NULL;
+    }
+    pthread_mutex_unlock(&g_lock);
+
+    BankResponse result;
+    server_run(job, &result);
+    server_reply(job, &result);
+    server_answered(job, &result);
+  }
+}
+
+/**
+ * Print application usage info.
+ */
+static void print_help() {
+  printf("RPC Bank Server\n");
+  printf("(C) 2015 Christian Gunderman\n\n");
+  printf("usage: ./bank_server [-a accounts] [-s stripes] [-b balance] "
+         "[-t threads]\n"
+         "                     [-p port]\n");
+  printf("  -a  accounts (default %i)\n", DEFAULT_ACCOUNTS);
+  printf("  -s  stripes guarding them (default %i)\n", DEFAULT_STRIPES);
+  printf("  -b  each account's opening balance, in cents (default %i)\n",
+         DEFAULT_BALANCE);
+  printf("  -t  worker threads, 2 to %i (default %i)\n", MAX_THREADS,
+         DEFAULT_THREADS);
+  printf("  -p  serve on this fixed port without the portmapper\n");
+  exit(1);
+}
+
+/**
+ * Creates and registers the UDP transport. With a port the socket is bound
+ * to it and not registered with the portmapper, otherwise it gets any port
+ * and is registered like rpcgen's main does.
+ */
+static void register_transport(int port) {
+  int sock = RPC_ANYSOCK;
+  int protocol = IPPROTO_UDP;
+
+  if (port != 0) {
+    struct sockaddr_in addr;
+    int one = 1;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+
+    if ((sock = socket(AF_INET, SOCK_DGRAM, 0)) == -1 ||
+        setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) == -1 ||
+        bind(sock, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
+      perror("Unable to bind server port");
+      exit(1);
+    }
+    protocol = 0;
+  } else {
+    pmap_unset(BANK_PROG, BANK_VERSION);
+  }
+
+  if ((g_transp = svcudp_create(sock)) == NULL) {
+    fprintf(stderr, "cannot create udp service.\n");
+    exit(1);
+  }
+
+  // Before the first request, so each one's id is kept.
+  g_orig_ops = g_transp->xp_ops;
+  g_ops = *g_orig_ops;
+  g_ops.xp_recv = server_recv;
+  g_transp->xp_ops = &g_ops;
+
+  if (!svc_register(g_transp, BANK_PROG, BANK_VERSION, bank_prog_1,
+                    protocol)) {
+    fprintf(stderr, "unable to register (BANK_PROG, BANK_VERSION, udp).\n");
+    exit(1);
+  }
+}
+
+/**
+ * Application entry point.
+ */
+int main(int argc, char *argv[]) {
+  pthread_t workers[MAX_THREADS];
+  int stripes = DEFAULT_STRIPES;
+  long balance = DEFAULT_BALANCE;
+  int port = 0;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "a:s:b:t:p:")) != -1) {
+    switch (opt) {
+    case 'a':
+      g_accounts = atol(optarg);
+      break;
+    case 's':
+      stripes = atoi(optarg);
+      break;
+    case 'b':
+      balance = atol(optarg);
+      break;
+    case 't':
+      g_threads = atoi(optarg);
+      break;
+    case 'p':
+      port = atoi(optarg);
+      break;
+    default:
+      print_help();
+    }
+  }
+
+  if (g_accounts < 1 || g_accounts > INT32_MAX || stripes < 1 ||
+      g_threads < 2 || g_threads > MAX_THREADS) {
+    print_help();
+  }
+
+  if ((g_bank = bank_create(g_accounts, stripes, balance)) == NULL) {
+    exit(1);
+  }
+  register_transport(port);
+
+  // Stop on Ctrl-C without SA_RESTART, so select() returns and the loop
+  // notices. Only this thread takes the signals, the workers block them.
+  struct sigaction sa;
+  sigset_t signals;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = stop_handler;
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGINT);
+  sigaddset(&signals, SIGTERM);
+
+  pthread_sigmask(SIG_BLOCK, &signals, NULL);
+  for (int i = 0; i < g_threads; i++) {
+    if (pthread_create(&workers[i], NULL, server_worker, NULL) != 0) {
+      perror("Unable to start worker");
+      exit(1);
+    }
+  }
+  pthread_sigmask(SIG_UNBLOCK, &signals, NULL);
+
+  printf("Serving %li accounts on port %i with %i threads.\n", g_accounts,
+         g_transp->xp_port, g_threads);
+  fflush(stdout);
+
+  // Same as svc_run(), but stops on a signal.
+  while (!g_stop) {
+    fd_set readfds = svc_fdset;
+
+    if (select(FD_SETSIZE, &readfds, NULL, NULL, NULL) == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      perror("select failed");
+      break;
+    }
+    svc_getreqset(&readfds);
+  }
+
+  // Let the workers finish what's queued; waiting withdrawals give up
+  // within a slice.
+  printf("Shutting down.\n");
+  pthread_mutex_lock(&g_lock);
+  g_stop = 1;
+  pthread_cond_broadcast(&g_queued);
+  pthread_mutex_unlock(&g_lock);
+  for (int i = 0; i < g_threads; i++) {
+    pthread_join(workers[i], NULL);
+  }
+
+  printf("%li transactions, %li resends dropped, %li answered again, "
+         "$%.2f on deposit.\n", bank_transactions(g_bank), g_resends,
+         g_replays, bank_total(g_bank) / 100.0);
+  if (port == 0) {
+    svc_unregister(BANK_PROG, BANK_VERSION);
+  }
+  bank_delete(g_bank);
+  return 0;
+}
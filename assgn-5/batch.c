@@ -0,0 +1,54 @@
+/**
+ * EECS 338 Operating Systems
+ * Case Western Reserve University
+ * (C) 2015 Christian Gunderman
+ */
+#include "batch.h"
+
+/*
+ * Pays rate on every positive balance, rounding down to the cent. Returns
+ * the interest paid.
+ */
+__attribute__((target_clones("avx2", "default")))
+long batch_interest(long *restrict balances, long count, long rate) {
+  long paid = 0;
+
+  for (long i = 0; i < count; i++) {
+    long positive = balances[i] > 0 ? balances[i] : 0;
+    long interest = (positive * rate) >> BATCH_RATE_SHIFT;
+    balances[i] += interest;
+    paid += interest;
+  }
+  return paid;
+}
+
+/*
+ * Charges fee on every balance under minimum, which may overdraw it.
+ * Returns the number charged.
+ */
+__attribute__((target_clones("avx2", "default")))
+long batch_fees(long *restrict balances, long count, long minimum,
+                long fee) {
+  long charged = 0;
+
+  for (long i = 0; i < count; i++) {
+    long below = balances[i] < minimum;
+    balances[i] -= below * fee;
+    charged += below;
+  }
+  return charged;
+}
+
+/*
+ * Counts the balances under threshold.
+ */
+__attribute__((target_clones("avx2", "default")))
+long batch_count_below(const long *restrict balances, long count,
+                       long threshold) {
+  long below = 0;
+
+  for (long i = 0; i < count; i++) {
+    below += balances[i] < threshold;
+  }
+  return below;
+}
@@ -0,0 +1,33 @@
+/**
+ * EECS 338 Operating Systems
+ * Case Western Reserve University
+ * (C) 2015 Christian Gunderman
+ */
+#ifndef BATCH__H__
+#define BATCH__H__
+
+/*
+ * End of period kernels over an array of fixed point balances, in cents.
+ * They are plain loops with no branches, built -O3 so gcc vectorizes them,
+ * once for AVX2 and once for plain x86-64, the loader picking whichever the
+ * CPU runs (SSE2 has no 64 bit compare, so the plain ones stay scalar).
+ * They know nothing of locking; bank.c runs them a segment at a time.
+ *
+ * Interest rates are fixed point, in 2^-BATCH_RATE_SHIFT per period, so
+ * interest is one multiply and shift per account. balance * rate must fit
+ * in a long: at up to 6.25% a period, balances up to $343M.
+ */
+
+// Preprocessor Defines.
+#define BATCH_RATE_SHIFT 32
+
+// A rate of percent per period, for the kernels.
+#define BATCH_RATE(percent) (long)((percent) / 100.0 * (1L << BATCH_RATE_SHIFT))
+
+long batch_interest(long *balances, long count, long rate);
+
+long batch_fees(long *balances, long count, long minimum, long fee);
+
+long batch_count_below(const long *balances, long count, long threshold);
+
+#endif // BATCH__H__
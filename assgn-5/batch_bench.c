@@ -0,0 +1,306 @@
+/**
+ * EECS 338 Operating Systems
+ * Case Western Reserve University
+ * (C) 2015 Christian Gunderman
+ */
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "bank.h"
+#include "batch.h"
+
+/*
+ * End of period pass benchmark. Times, in millions of accounts a second:
+ *  - each kernel alone over a plain array, next to interest the way a
+ *    float balance per savings_account_t struct would get it,
+ *  - each bank pass on 1, 2, 4... threads, locking segment by segment,
+ *    with one account in EMPTIED_EVERY emptied so the fees overdraw it
+ *    and finding the overdrawn ones has some to find,
+ *  - interest passes while other threads run transfers, and what the
+ *    passes cost the transfers.
+ * Checks the money after the passes.
+ *
+ * usage: ./batch_bench [accounts] [max_threads]
+ */
+
+// Preprocessor Defines.
+#define DEFAULT_ACCOUNTS 4000000
+#define DEFAULT_MAX_THREADS 4
+#define STRIPES 1024
+#define START_BALANCE 100000L          // $1000.
+#define FEE_MINIMUM 100001L            // A hair over, so half get charged.
+#define FEE 500L
+#define EMPTIED_EVERY 1000             // Accounts emptied, then overdrawn.
+#define INTEREST_PERCENT 0.01
+#define REPEATS 10                     // Passes per timing.
+#define ONLINE_THREADS 2
+#define ONLINE_SECONDS 0.5
+
+// The old shape: one float balance per account struct.
+typedef struct savings_account_t {
+  float balance;
+  float needed;
+} savings_account_t;
+
+// An online transaction thread's params and what it did.
+typedef struct online_params_t {
+  pthread_t thread;
+  unsigned int seed;
+  long transactions;
+} online_params_t;
+
+// Global state:
+static bank_t *g_bank = NULL;
+static long g_accounts = DEFAULT_ACCOUNTS;
+static volatile bool g_stop = false;
+
+/**
+ * Gets a monotonic timestamp in seconds.
+ */
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * Pays interest on structs of float balances, one at a time.
+ */
+static void struct_interest(savings_account_t *accounts, long count,
+                            float rate) {
+  for (long i = 0; i < count; i++) {
+    if (accounts[i].balance > 0) {
+      accounts[i].balance += accounts[i].balance * rate;
+    }
+  }
+}
+
+/**
+ * Times the kernels alone, single threaded, over a plain array.
+ */
+static void run_kernels() {
+  long *balances = aligned_alloc(64, g_accounts * sizeof(long));
+  savings_account_t *accounts = malloc(g_accounts *
+                                       sizeof(savings_account_t));
+  double start;
+  long sink = 0;
+
+  for (long i = 0; i < g_accounts; i++) {
+    balances[i] = START_BALANCE + i % 3;
+    accounts[i].balance = balances[i] / 100.0f;
+    accounts[i].needed = 0;
+  }
+
+  printf("%-20s %10s\n", "kernel", "M_accts/s");
+  start = now();
+  for (int r = 0; r < REPEATS; r++) {
+    struct_interest(accounts, g_accounts, INTEREST_PERCENT / 100);
+  }
+  printf("%-20s %10.0f\n", "struct_float_interest",
+         REPEATS * g_accounts / (now() - start) / 1e6);
+
+  start = now();
+  for (int r = 0; r < REPEATS; r++) {
+    sink += batch_interest(balances, g_accounts,
+                           BATCH_RATE(INTEREST_PERCENT));
+  }
+  printf("%-20s %10.0f\n", "interest",
+         REPEATS * g_accounts / (now() - start) / 1e6);
+
+  start = now();
+  for (int r = 0; r < REPEATS; r++) {
+    sink += batch_fees(balances, g_accounts, FEE_MINIMUM, FEE);
+  }
+  printf("%-20s %10.0f\n", "fees",
+         REPEATS * g_accounts / (now() - start) / 1e6);
+
+  start = now();
+  for (int r = 0; r < REPEATS; r++) {
+    sink += batch_count_below(balances, g_accounts, 0);
+  }
+  printf("%-20s %10.0f\n", "count_below",
+         REPEATS * g_accounts / (now() - start) / 1e6);
+
+  // Keep the results alive.
+  if (sink == 42 || accounts[0].balance < 0) {
+    printf("\n");
+  }
+  free(balances);
+  free(accounts);
+}
+
+/**
+ * Times each bank pass on threads threads. Returns false if the money
+ * doesn't add up.
+ */
+static bool run_passes(int threads) {
+  long *found = malloc(g_accounts * sizeof(long));
+  long paid = 0;
+  long charged = 0;
+  long below = 0;
+  double times[3];
+
+  g_bank = bank_create(g_accounts, STRIPES, START_BALANCE);
+  if (g_bank == NULL || found == NULL) {
+    return false;
+  }
+  for (long i = 0; i < g_accounts; i += EMPTIED_EVERY) {
+    bank_withdraw(g_bank, i, START_BALANCE);
+  }
+  long total = bank_total(g_bank);
+
+  for (int pass = 0; pass < 3; pass++) {
+    double start = now();
+    for (int r = 0; r < REPEATS; r++) {
+      if (pass == 0) {
+        paid += bank_accrue_interest(g_bank, BATCH_RATE(INTEREST_PERCENT),
+                                     threads);
+      } else if (pass == 1) {
+        charged += bank_charge_fees(g_bank, FEE_MINIMUM + paid / g_accounts,
+                                    FEE, threads);
+      } else {
+        below = bank_find_below(g_bank, 0, found, g_accounts, threads);
+      }
+    }
+    times[pass] = now() - start;
+  }
+
+  printf("%7i %10.0f %10.0f %10.0f %10li\n", threads,
+         REPEATS * g_accounts / times[0] / 1e6,
+         REPEATS * g_accounts / times[1] / 1e6,
+         REPEATS * g_accounts / times[2] / 1e6, below);
+
+  bool ok = bank_total(g_bank) == total + paid - charged * FEE &&
+    below == (g_accounts + EMPTIED_EVERY - 1) / EMPTIED_EVERY;
+  for (long i = 0; ok && i < below; i++) {
+    ok = bank_balance(g_bank, found[i]) < 0;
+  }
+  bank_delete(g_bank);
+  free(found);
+  return ok;
+}
+
+/**
+ * Online transactions: transfers between random accounts until stopped.
+ */
+static void *online_thread(void *input) {
+  online_params_t *params = input;
+
+  while (!g_stop) {
+    long from = ((long)rand_r(&params->seed) << 16 ^
+                 rand_r(&params->seed)) % g_accounts;
+    long to = ((long)rand_r(&params->seed) << 16 ^
+               rand_r(&params->seed)) % g_accounts;
+    bank_transfer(g_bank, from, to, 1 + rand_r(&params->seed) % 100);
+    params->transactions++;
+  }
+  return NULL;
+}
+
+/**
+ * Runs transfers for ONLINE_SECONDS, alone and then during interest
+ * passes on threads threads. Returns false if the money doesn't add up.
+ */
+static bool run_online(int threads) {
+  online_params_t params[ONLINE_THREADS];
+  long transactions[2] = { 0, 0 };
+  long paid = 0;
+  long passes = 0;
+  double pass_time = 0;
+
+  g_bank = bank_create(g_accounts, STRIPES, START_BALANCE);
+  if (g_bank == NULL) {
+    return false;
+  }
+  long total = bank_total(g_bank);
+
+  g_stop = false;
+  for (int i = 0; i < ONLINE_THREADS; i++) {
+    params[i] = (online_params_t){ 0 };
+    params[i].seed = i + 1;
+    pthread_create(&params[i].thread, NULL, online_thread, &params[i]);
+  }
+
+  // Alone, then with passes.
+  for (int phase = 0; phase < 2; phase++) {
+    long before = 0;
+    for (int i = 0; i < ONLINE_THREADS; i++) {
+      before += params[i].transactions;
+    }
+
+    double start = now();
+    while (now() - start < ONLINE_SECONDS) {
+      if (phase == 1) {
+        double pass_start = now();
+        paid += bank_accrue_interest(g_bank, BATCH_RATE(INTEREST_PERCENT),
+                                     threads);
+        pass_time += now() - pass_start;
+        passes++;
+      } else {
+        struct timespec nap = { 0, 1000000 };
+        nanosleep(&nap, NULL);
+      }
+    }
+
+    for (int i = 0; i < ONLINE_THREADS; i++) {
+      transactions[phase] += params[i].transactions;
+    }
+    transactions[phase] = (transactions[phase] - before) /
+      (now() - start);
+  }
+
+  g_stop = true;
+  for (int i = 0; i < ONLINE_THREADS; i++) {
+    pthread_join(params[i].thread, NULL);
+  }
+
+  printf("%7i %10.0f %12li %12li\n", threads,
+         passes * g_accounts / pass_time / 1e6, transactions[0],
+         transactions[1]);
+
+  bool ok = bank_total(g_bank) == total + paid;
+  bank_delete(g_bank);
+  return ok;
+}
+
+/**
+ * Application Entry point.
+ */
+int main(int argc, char* argv[]) {
+  g_accounts = argc > 1 ? atol(argv[1]) : DEFAULT_ACCOUNTS;
+  int max_threads = argc > 2 ? atoi(argv[2]) : DEFAULT_MAX_THREADS;
+
+  if (g_accounts < 1 || max_threads < 1) {
+    printf("usage: ./batch_bench [accounts] [max_threads]\n");
+    return EXIT_FAILURE;
+  }
+
+  printf("%li accounts, %i passes each\n", g_accounts, REPEATS);
+  run_kernels();
+
+  printf("\nbank passes, M_accts/s\n");
+  printf("%7s %10s %10s %10s %10s\n", "threads", "interest", "fees",
+         "overdrawn", "found");
+  for (int threads = 1; threads <= max_threads; threads *= 2) {
+    if (!run_passes(threads)) {
+      printf("The money doesn't add up.\n");
+      return EXIT_FAILURE;
+    }
+  }
+
+  printf("\ninterest passes during %i threads of transfers\n",
+         ONLINE_THREADS);
+  printf("%7s %10s %12s %12s\n", "threads", "M_accts/s", "alone_tps",
+         "during_tps");
+  for (int threads = 1; threads <= max_threads; threads *= 2) {
+    if (!run_online(threads)) {
+      printf("The money doesn't add up.\n");
+      return EXIT_FAILURE;
+    }
+  }
+  return EXIT_SUCCESS;
+}
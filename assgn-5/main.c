@@ -21,8 +21,13 @@
 
 // Constants.
 static const int NUM_CHILDREN = 150; // Number of child threads.
-static const int A_COND = 0;
-static const int B_COND = 1;
+
+// The savings account monitor's conditions.
+enum {
+  A_COND,
+  B_COND,
+  ACCOUNT_CONDS
+};
 
 // The savings account monitor data fields.
 typedef struct savings_account_t {
@@ -30,37 +35,43 @@ typedef struct savings_account_t {
   float needed;
 } savings_account_t;
 
+// The savings account monitor, the account inside it.
+MONITOR_DECLARE(account_monitor_t, savings_account_t, ACCOUNT_CONDS);
+
 // Child thread startup params.
 typedef struct child_params_t {
   int child_num;
   int usleep_delay;
   int net_transaction;
-  monitor_t *monitor;
+  account_monitor_t *monitor;
 } child_params_t;
 
+// Global state:
+static account_monitor_t g_monitor;
+
 /**
  * Performs a withdrawal from the bank account. 
  * amount is the amount to withdraw as a positive integer and tid
  * is an arbitrary thread id number.
  */
-static void withdrawal(monitor_t *monitor, float amount, int tid) {
+static void withdrawal(account_monitor_t *monitor, float amount, int tid) {
   // Grab account data from the monitor.
-  savings_account_t *account = monitor_data(monitor);
+  savings_account_t *account = &monitor->data;
 
   // Try to enter monitor.
-  monitor_enter(monitor);
+  MONITOR_ENTER(monitor);
 
   // There is somebody waiting for a deposit. Get in line.
   if (account->needed > 0) {
     printf("Thread %i withdrawal of %f waiting on B. Balance %f\n", tid, amount, account->balance);
-    monitor_cond_wait(monitor, B_COND);
+    MONITOR_WAIT(monitor, B_COND);
   }
 
   // The balance is too small.
   if (account->balance < amount) {
     account->needed = amount - account->balance;
     printf("Thread %i withdrawal of %f waiting on A. Balance %f\n", tid, amount, account->balance);
-    monitor_cond_wait(monitor, A_COND);
+    MONITOR_WAIT(monitor, A_COND);
   }
 
   // Withdraw our cash.
@@ -68,22 +79,22 @@ static void withdrawal(monitor_t *monitor, float amount, int tid) {
   printf("Thread %i withdrew $%f. Balance %f.\n", tid, amount, account->balance);
 
   printf("Thread %i signaling B.\n", tid);
-  monitor_cond_signal(monitor, B_COND);
+  MONITOR_SIGNAL(monitor, B_COND);
 
   // Leave the monitor and let the next one in.
-  monitor_leave(monitor);
+  MONITOR_LEAVE(monitor);
 }
 
 /**
  * Performs a deposit operation. Amount is the amount to deposit and tid
  * is an arbitrary thread identifier int.
  */
-static void deposit(monitor_t *monitor, float amount, int tid) {
+static void deposit(account_monitor_t *monitor, float amount, int tid) {
   // Grab the account info from the monitor.
-  savings_account_t *account = monitor_data(monitor);
+  savings_account_t *account = &monitor->data;
 
   // Try to enter the monitor.
-  monitor_enter(monitor);
+  MONITOR_ENTER(monitor);
 
   // Deposit.
   account->balance += amount;
@@ -96,13 +107,13 @@ static void deposit(monitor_t *monitor, float amount, int tid) {
     if (amount >= account->needed) {
       account->needed = 0;
       printf("Thread %i signaling A.\n", tid);
-      monitor_cond_signal(monitor, A_COND);
+      MONITOR_SIGNAL(monitor, A_COND);
     } else {
       account->needed = account->needed - amount;
     }
   }
 
-  monitor_leave(monitor);
+  MONITOR_LEAVE(monitor);
 }
 
 /**
@@ -145,13 +156,10 @@ static void *thread_entry(void *input) {
  */
 int main(int argc, char* argv[]) {
 
-  // Create savings account.
-  savings_account_t account;
-  account.balance = START_BALANCE;
-  account.needed = 0;
-
-  // Create new monitor wrapping the savings account.
-  monitor_t *monitor = monitor_create(argv[0], 2, &account, sizeof(savings_account_t));
+  // Create the monitor and the savings account inside it.
+  MONITOR_INIT(&g_monitor, argv[0]);
+  g_monitor.data.balance = START_BALANCE;
+  g_monitor.data.needed = 0;
 
   // Set random seed to current time.
   srand(RAND_SEED);
@@ -181,7 +189,7 @@ int main(int argc, char* argv[]) {
     params->net_transaction = (rand() % (int)201) - 100;
 
     // Pass monitor to new thread.
-    params->monitor = monitor;
+    params->monitor = &g_monitor;
 
     // Create new child thread.
     if (pthread_create(&new_thread, NULL, thread_entry, params) != 0) {
@@ -3,6 +3,9 @@
  * Case Western Reserve University
  * (C) 2015 Christian Gunderman
  */
+#define _GNU_SOURCE
+
+#include <errno.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <fcntl.h>
@@ -23,6 +26,7 @@
 
 // Constants.
 static const int SEM_PROJ_ID = 1;
+static const int CORE_SEM_PROJ_ID = 2;  // Typed monitors'.
 static const int MUTEX_SEM = 0;
 static const int NEXT_SEM = 0;
 static const int MONITOR_SEM_COUNT = 2;
@@ -219,3 +223,147 @@ void monitor_cond_signal(monitor_t *monitor, int cond) {
     monitor->next_count--;
   }
 }
+
+/**
+ * Creates a typed monitor's semaphores for app_name, like monitor_create()
+ * but with a key of their own, all zero, since an idle monitor's entry
+ * doesn't touch them.
+ */
+void monitor_core_init(monitor_core_t *core, char *app_name, int *x_count,
+                       int cond_count) {
+  int num = MONITOR_CORE_CONDS + cond_count;
+  unsigned short values[num];
+  key_t sem_key = ftok(app_name, CORE_SEM_PROJ_ID);
+
+  memset(values, 0, sizeof(values));
+  core->sem_id = sem_key == -1 ? -1 :
+    semget(sem_key, num, IPC_CREAT | S_IRUSR | S_IWUSR);
+  if (core->sem_id == -1 ||
+      semctl(core->sem_id, /* Ignored. */ 0, SETALL, values) == -1) {
+    printf("PID: %i, PARENT: Error creating semaphores.\n",
+           getpid());
+    perror("Semaphore error");
+    exit(EXIT_FAILURE);
+  }
+
+  monitor_core_attach(core, core->sem_id, 0, x_count, cond_count);
+}
+
+/**
+ * Sets up a typed monitor on semaphores sem_base on of a set the caller
+ * made, all zero, and will delete.
+ */
+void monitor_core_attach(monitor_core_t *core, int sem_id, int sem_base,
+                         int *x_count, int cond_count) {
+  core->sem_id = sem_id;
+  core->sem_base = sem_base;
+  core->users = 0;
+  core->next_count = 0;
+  memset(x_count, 0, cond_count * sizeof(int));
+}
+
+/**
+ * Deletes a typed monitor's semaphores.
+ */
+void monitor_core_delete(monitor_core_t *core) {
+  semaphore_delete(core->sem_id);
+}
+
+/**
+ * Slow path of a typed monitor: waits on one of its semaphores.
+ */
+void monitor_core_block(monitor_core_t *core, int sem) {
+  struct sembuf sops[1];
+
+  sops[0].sem_num = core->sem_base + sem;
+  sops[0].sem_op = -1;
+  sops[0].sem_flg = 0;
+
+  while (semop(core->sem_id, sops, 1) != 0) {
+    if (errno != EINTR) {
+      printf("PID: %i, CHILD: Error waiting in semaphore.\n",
+             getpid());
+      perror("Semaphore wait error");
+      exit(EXIT_FAILURE);
+    }
+  }
+}
+
+/**
+ * Slow path of a typed monitor: waits on one of its semaphores until the
+ * CLOCK_MONOTONIC time deadline. Returns false if it passed first.
+ */
+bool monitor_core_block_until(monitor_core_t *core, int sem,
+                              const struct timespec *deadline) {
+  struct sembuf sops[1];
+
+  sops[0].sem_num = core->sem_base + sem;
+  sops[0].sem_op = -1;
+  sops[0].sem_flg = 0;
+
+  for (;;) {
+    struct timespec now;
+    struct timespec left;
+
+    // What's left of the wait, none once it's past.
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    left.tv_sec = deadline->tv_sec - now.tv_sec;
+    left.tv_nsec = deadline->tv_nsec - now.tv_nsec;
+    if (left.tv_nsec < 0) {
+      left.tv_sec--;
+      left.tv_nsec += 1000000000L;
+    }
+    if (left.tv_sec < 0) {
+      left.tv_sec = 0;
+      left.tv_nsec = 0;
+    }
+
+    if (semtimedop(core->sem_id, sops, 1, &left) == 0) {
+      return true;
+    } else if (errno == EAGAIN) {
+      return false;
+    } else if (errno != EINTR) {
+      printf("PID: %i, CHILD: Error waiting in semaphore.\n",
+             getpid());
+      perror("Semaphore wait error");
+      exit(EXIT_FAILURE);
+    }
+  }
+}
+
+/**
+ * Slow path of a typed monitor: signals one of its semaphores.
+ */
+void monitor_core_post(monitor_core_t *core, int sem) {
+  semaphore_signal(core->sem_id, core->sem_base + sem);
+}
+
+/**
+ * Waits on a condition, count being its waiters, until the CLOCK_MONOTONIC
+ * time deadline. Returns false if it passed without a signal. Either way,
+ * it's back in the monitor. Use MONITOR_WAIT_UNTIL.
+ */
+bool monitor_core_wait_until(monitor_core_t *core, int *count, int cond,
+                             const struct timespec *deadline) {
+  __atomic_add_fetch(count, 1, __ATOMIC_RELAXED);
+  monitor_core_leave(core);
+  if (monitor_core_block_until(core, MONITOR_CORE_CONDS + cond, deadline)) {
+    return true;
+  }
+
+  // Out of time, but a signaler may have taken a waiter out of the count
+  // and be handing the monitor over. While the count still has waiters,
+  // one of them can leave it, and those still blocked get the handoffs.
+  int waiting = __atomic_load_n(count, __ATOMIC_RELAXED);
+  while (waiting > 0) {
+    if (__atomic_compare_exchange_n(count, &waiting, waiting - 1, false,
+                                    __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+      monitor_core_enter(core);
+      return false;
+    }
+  }
+
+  // Otherwise the handoff is this one's to take.
+  monitor_core_block(core, MONITOR_CORE_CONDS + cond);
+  return true;
+}
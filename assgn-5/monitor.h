@@ -6,6 +6,9 @@
 #ifndef MONITOR__H__
 #define MONITOR__H__
 
+#include <stdbool.h>
+#include <time.h>
+
 typedef struct monitor_t {
   int sem_id;
   int next_count;
@@ -28,4 +31,169 @@ void monitor_cond_wait(monitor_t *monitor, int cond);
 
 void monitor_cond_signal(monitor_t *monitor, int cond);
 
+/*
+ * Typed monitors. MONITOR_DECLARE(name, type, conds) declares a monitor
+ * that holds its type and its conds condition counts inline, in one cache
+ * line aligned object the caller owns, instead of a monitor_t pointing at
+ * a heap copy of the data through monitor_data(). The data is just
+ * monitor->data. Condition ids must be constants under conds, which
+ * MONITOR_WAIT and MONITOR_SIGNAL check at compile time.
+ *
+ * Entry is a benaphore over the same SysV semaphores: a count of the
+ * threads in the monitor or waiting to get in, so entering and leaving an
+ * idle monitor is one atomic op, inline, and only a thread that finds it
+ * busy makes a semop() call. Conditions are Hoare's, as above.
+ *
+ * MONITOR_WAIT_UNTIL waits no later than a CLOCK_MONOTONIC deadline, and
+ * is false if it passed. Either way the waiter is back in the monitor. So
+ * that a waiter giving up can't strand a signaler that has just picked
+ * it, a signaler takes its waiter out of the condition's count itself,
+ * and a waiter whose time is up only leaves if it can still take itself
+ * out; if not, it waits for the handoff that is on its way.
+ *
+ * MONITOR_INIT gives a monitor a semaphore set of its own. Many monitors,
+ * such as an array of them, can instead share one set the caller made,
+ * MONITOR_SEMS(monitor) semaphores each, with MONITOR_ATTACH.
+ */
+
+// Preprocessor Defines.
+#define MONITOR_CACHE_LINE 64
+
+// Semaphores of a typed monitor's set.
+#define MONITOR_CORE_MUTEX 0
+#define MONITOR_CORE_NEXT 1
+#define MONITOR_CORE_CONDS 2  // The first condition's.
+
+// The part of a typed monitor that isn't typed.
+typedef struct monitor_core_t {
+  int sem_id;
+  int sem_base;    // Its first semaphore in the set.
+  int users;       // In the monitor or waiting to get in.
+  int next_count;
+} monitor_core_t;
+
+#define MONITOR_DECLARE(name, type, conds)                                  \
+  typedef struct name {                                                     \
+    monitor_core_t core;                                                    \
+    int x_count[conds];                                                     \
+    type data;                                                              \
+  } __attribute__((aligned(MONITOR_CACHE_LINE))) name
+
+#define MONITOR_CONDS(monitor)                                              \
+  (int)(sizeof((monitor)->x_count) / sizeof((monitor)->x_count[0]))
+
+#define MONITOR_INIT(monitor, app_name)                                     \
+  monitor_core_init(&(monitor)->core, app_name, (monitor)->x_count,         \
+                    MONITOR_CONDS(monitor))
+
+#define MONITOR_SEMS(monitor) (MONITOR_CORE_CONDS + MONITOR_CONDS(monitor))
+
+#define MONITOR_ATTACH(monitor, sem_id, sem_base)                             \
+  monitor_core_attach(&(monitor)->core, sem_id, sem_base, (monitor)->x_count, \
+                      MONITOR_CONDS(monitor))
+
+#define MONITOR_DELETE(monitor) monitor_core_delete(&(monitor)->core)
+
+#define MONITOR_ENTER(monitor) monitor_core_enter(&(monitor)->core)
+
+#define MONITOR_LEAVE(monitor) monitor_core_leave(&(monitor)->core)
+
+#define MONITOR_WAIT(monitor, cond) do {                                    \
+    _Static_assert((cond) >= 0 && (cond) < MONITOR_CONDS(monitor),          \
+                   "no such condition");                                    \
+    monitor_core_wait(&(monitor)->core, &(monitor)->x_count[cond], cond);   \
+  } while (0)
+
+#define MONITOR_WAIT_UNTIL(monitor, cond, deadline) ({                      \
+    _Static_assert((cond) >= 0 && (cond) < MONITOR_CONDS(monitor),          \
+                   "no such condition");                                    \
+    monitor_core_wait_until(&(monitor)->core, &(monitor)->x_count[cond],    \
+                            cond, deadline);                                \
+  })
+
+#define MONITOR_SIGNAL(monitor, cond) do {                                  \
+    _Static_assert((cond) >= 0 && (cond) < MONITOR_CONDS(monitor),          \
+                   "no such condition");                                    \
+    monitor_core_signal(&(monitor)->core, &(monitor)->x_count[cond], cond); \
+  } while (0)
+
+void monitor_core_init(monitor_core_t *core, char *app_name, int *x_count,
+                       int cond_count);
+
+void monitor_core_attach(monitor_core_t *core, int sem_id, int sem_base,
+                         int *x_count, int cond_count);
+
+void monitor_core_delete(monitor_core_t *core);
+
+void monitor_core_block(monitor_core_t *core, int sem);
+
+bool monitor_core_block_until(monitor_core_t *core, int sem,
+                              const struct timespec *deadline);
+
+void monitor_core_post(monitor_core_t *core, int sem);
+
+bool monitor_core_wait_until(monitor_core_t *core, int *count, int cond,
+                             const struct timespec *deadline);
+
+/*
+ * Enters the monitor, waiting only if someone else is in it.
+ */
+static inline void monitor_core_enter(monitor_core_t *core) {
+  if (__atomic_fetch_add(&core->users, 1, __ATOMIC_ACQUIRE) > 0) {
+    monitor_core_block(core, MONITOR_CORE_MUTEX);
+  }
+}
+
+/*
+ * Gives the monitor up, to a thread waiting to get in if there is one.
+ */
+static inline void monitor_core_release(monitor_core_t *core) {
+  if (__atomic_sub_fetch(&core->users, 1, __ATOMIC_RELEASE) > 0) {
+    monitor_core_post(core, MONITOR_CORE_MUTEX);
+  }
+}
+
+/*
+ * Leaves the monitor, to a signaler waiting to resume first.
+ */
+static inline void monitor_core_leave(monitor_core_t *core) {
+  if (core->next_count > 0) {
+    monitor_core_post(core, MONITOR_CORE_NEXT);
+  } else {
+    monitor_core_release(core);
+  }
+}
+
+/*
+ * Waits on a condition, count being its waiters. Use MONITOR_WAIT.
+ */
+static inline void monitor_core_wait(monitor_core_t *core, int *count,
+                                     int cond) {
+  __atomic_add_fetch(count, 1, __ATOMIC_RELAXED);
+  monitor_core_leave(core);
+  monitor_core_block(core, MONITOR_CORE_CONDS + cond);
+}
+
+/*
+ * Hands the monitor to a waiter on a condition, if there is one, until it
+ * leaves. Use MONITOR_SIGNAL.
+ */
+static inline void monitor_core_signal(monitor_core_t *core, int *count,
+                                       int cond) {
+  int waiting = __atomic_load_n(count, __ATOMIC_RELAXED);
+
+  // Takes the waiter out of the count, as one that timed out may be
+  // taking itself out at the same time.
+  while (waiting > 0) {
+    if (__atomic_compare_exchange_n(count, &waiting, waiting - 1, false,
+                                    __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+      core->next_count++;
+      monitor_core_post(core, MONITOR_CORE_CONDS + cond);
+      monitor_core_block(core, MONITOR_CORE_NEXT);
+      core->next_count--;
+      return;
+    }
+  }
+}
+
 #endif // MONITOR__H__
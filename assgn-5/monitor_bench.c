@@ -0,0 +1,219 @@
+/**
+ * EECS 338 Operating Systems
+ * Case Western Reserve University
+ * (C) 2015 Christian Gunderman
+ */
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "monitor.h"
+
+/*
+ * Monitor benchmark: the monitor_t C API against a typed monitor doing the
+ * same work. Each thread enters, adds to a counter and leaves, alone and
+ * then 2 and 4 at a time, and then two threads take turns through a
+ * condition each, a wait and a signal per turn. Prints ns per operation
+ * of each, and checks the counter.
+ *
+ * usage: ./monitor_bench [operations]
+ */
+
+// Preprocessor Defines.
+#define DEFAULT_OPERATIONS 200000
+#define MAX_THREADS 4
+
+// The benchmark monitors' conditions, one per turn taking thread.
+enum {
+  TURN_0,
+  TURN_1,
+  BENCH_CONDS
+};
+
+// What the monitors hold.
+typedef struct bench_data_t {
+  long count;
+  int turn;
+} bench_data_t;
+
+MONITOR_DECLARE(bench_monitor_t, bench_data_t, BENCH_CONDS);
+
+// A benchmark thread's params.
+typedef struct bench_params_t {
+  int id;
+  long operations;
+} bench_params_t;
+
+// Global state:
+static monitor_t *g_c_monitor = NULL;
+static bench_monitor_t g_typed_monitor;
+
+/**
+ * Gets a monotonic timestamp in ns.
+ */
+static uint64_t now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/**
+ * Counts through the C API.
+ */
+static void *c_count(void *input) {
+  bench_params_t *params = input;
+  bench_data_t *data = monitor_data(g_c_monitor);
+
+  for (long i = 0; i < params->operations; i++) {
+    monitor_enter(g_c_monitor);
+    data->count++;
+    monitor_leave(g_c_monitor);
+  }
+  return NULL;
+}
+
+/**
+ * Counts through the typed monitor.
+ */
+static void *typed_count(void *input) {
+  bench_params_t *params = input;
+  bench_monitor_t *monitor = &g_typed_monitor;
+
+  for (long i = 0; i < params->operations; i++) {
+    MONITOR_ENTER(monitor);
+    monitor->data.count++;
+    MONITOR_LEAVE(monitor);
+  }
+  return NULL;
+}
+
+/**
+ * Takes turns through the C API: waits for its turn, counts and hands the
+ * turn over.
+ */
+static void *c_turns(void *input) {
+  bench_params_t *params = input;
+  bench_data_t *data = monitor_data(g_c_monitor);
+
+  for (long i = 0; i < params->operations; i++) {
+    monitor_enter(g_c_monitor);
+    while (data->turn != params->id) {
+      monitor_cond_wait(g_c_monitor, params->id);
+    }
+    data->count++;
+    data->turn = 1 - params->id;
+    monitor_cond_signal(g_c_monitor, 1 - params->id);
+    monitor_leave(g_c_monitor);
+  }
+  return NULL;
+}
+
+/**
+ * Takes turns through the typed monitor. Condition ids must be constants,
+ * so each thread's are spelled out.
+ */
+static void *typed_turns(void *input) {
+  bench_params_t *params = input;
+  bench_monitor_t *monitor = &g_typed_monitor;
+
+  for (long i = 0; i < params->operations; i++) {
+    MONITOR_ENTER(monitor);
+    while (monitor->data.turn != params->id) {
+      if (params->id == 0) {
+        MONITOR_WAIT(monitor, TURN_0);
+      } else {
+        MONITOR_WAIT(monitor, TURN_1);
+      }
+    }
+    monitor->data.count++;
+    monitor->data.turn = 1 - params->id;
+    if (params->id == 0) {
+      MONITOR_SIGNAL(monitor, TURN_1);
+    } else {
+      MONITOR_SIGNAL(monitor, TURN_0);
+    }
+    MONITOR_LEAVE(monitor);
+  }
+  return NULL;
+}
+
+/**
+ * Runs entry on threads threads, operations split between them, with the
+ * counter at zero. Returns ns per operation, or -1 if the counter is off.
+ */
+static double run(void *(*entry)(void*), int threads, long operations,
+                  long *count) {
+  pthread_t ids[MAX_THREADS];
+  bench_params_t params[MAX_THREADS];
+
+  *count = 0;
+  uint64_t start = now_ns();
+  for (int i = 0; i < threads; i++) {
+    params[i].id = i;
+    params[i].operations = operations / threads;
+    if (pthread_create(&ids[i], NULL, entry, &params[i]) != 0) {
+      perror("Error creating thread");
+      exit(EXIT_FAILURE);
+    }
+  }
+  for (int i = 0; i < threads; i++) {
+    pthread_join(ids[i], NULL);
+  }
+
+  uint64_t elapsed = now_ns() - start;
+  if (*count != operations / threads * threads) {
+    return -1;
+  }
+  return (double)elapsed / *count;
+}
+
+/**
+ * Prints a row: the C API's time, the typed monitor's and the speedup.
+ */
+static void print_row(const char *name, double c_ns, double typed_ns) {
+  if (c_ns < 0 || typed_ns < 0) {
+    printf("%-16s counter off, monitor broken\n", name);
+    return;
+  }
+  printf("%-16s %10.1f %10.1f %8.1fx\n", name, c_ns, typed_ns,
+         c_ns / typed_ns);
+}
+
+/**
+ * Application Entry point.
+ */
+int main(int argc, char* argv[]) {
+  long operations = argc > 1 ? atol(argv[1]) : DEFAULT_OPERATIONS;
+  bench_data_t data = { 0, 0 };
+  char name[32];
+
+  if (operations < MAX_THREADS) {
+    printf("usage: ./monitor_bench [operations]\n");
+    return EXIT_FAILURE;
+  }
+
+  g_c_monitor = monitor_create(argv[0], BENCH_CONDS, &data, sizeof(data));
+  MONITOR_INIT(&g_typed_monitor, argv[0]);
+  bench_data_t *c_data = monitor_data(g_c_monitor);
+
+  printf("%li operations each, ns per operation\n", operations);
+  printf("%-16s %10s %10s %9s\n", "test", "c_api", "typed", "speedup");
+  for (int threads = 1; threads <= MAX_THREADS; threads *= 2) {
+    snprintf(name, sizeof(name), "count %i thread%s", threads,
+             threads > 1 ? "s" : "");
+    double c_ns = run(c_count, threads, operations, &c_data->count);
+    print_row(name, c_ns, run(typed_count, threads, operations,
+                              &g_typed_monitor.data.count));
+  }
+
+  c_data->turn = g_typed_monitor.data.turn = 0;
+  double c_ns = run(c_turns, 2, operations, &c_data->count);
+  print_row("turns 2 threads", c_ns, run(typed_turns, 2, operations,
+                                         &g_typed_monitor.data.count));
+
+  monitor_delete(g_c_monitor);
+  MONITOR_DELETE(&g_typed_monitor);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,784 @@
+/**
+ * EECS 338 Operating Systems
+ * Case Western Reserve University
+ * (C) 2015 Christian Gunderman
+ */
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <mqueue.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <rpc/rpc.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/ipc.h>
+#include <sys/mman.h>
+#include <sys/msg.h>
+#include <sys/select.h>
+#include <sys/sem.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * IPC benchmark: the ways the assignments hand control between processes
+ * and threads, head to head. For each mechanism, a pinger and a ponger,
+ * two processes or two threads of one, first play ping-pong: the pinger
+ * sends a message, the ponger answers it, and the pinger times the round
+ * trip. Then the pinger streams as many messages one way, as fast as the
+ * mechanism takes them, and the ponger answers only the last one.
+ *
+ * Pipes, unix sockets, SysV and POSIX message queues and RPC carry a
+ * payload of the message size. eventfd (in semaphore mode), a futex over
+ * shared memory and SysV and POSIX semaphores only count, so a message is
+ * one post. RPC is a UDP call on loopback to a server the ponger runs
+ * without the portmapper; its calls are synchronous, so it streams one
+ * call at a time.
+ *
+ * usage: ./ipc_bench [options] [mechanism...], see print_help().
+ */
+
+// Preprocessor Defines.
+#define DEFAULT_ITERATIONS 10000
+#define DEFAULT_MESSAGE_SIZE 64
+#define MAX_MESSAGE_SIZE 4096
+#define WARMUP_DIVISOR 10        // Untimed round trips first, a tenth as many.
+#define MQ_MAX_MESSAGES 8
+#define RPC_PROGRAM 0x20338338
+#define RPC_VERSION 1
+#define RPC_ECHO 1
+#define RPC_TIMEOUT_SECONDS 5
+
+// The two directions messages go.
+#define PING 0
+#define PONG 1
+
+// Both ends of every mechanism, made before the ponger starts.
+typedef struct channel_t {
+  int fds[2][2];          // Per direction, the end read and the end written.
+  uint32_t *futex;        // Shared, a sequence number per direction.
+  uint32_t seen[2];       // Sequence numbers each direction's reader has had.
+  sem_t *sems;            // Shared, a semaphore per direction.
+  int sem_id;             // SysV semaphore set, one per direction.
+  int msg_id;             // SysV message queue, mtype is direction + 1.
+  mqd_t mqs[2];
+  SVCXPRT *xprt;
+  CLIENT *clnt;
+} channel_t;
+
+// A mechanism. send and recv block and return false on failure.
+typedef struct mech_t {
+  const char *name;
+  bool (*open)(channel_t *ch);
+  bool (*send)(channel_t *ch, int dir, char *buf);
+  bool (*recv)(channel_t *ch, int dir, char *buf);
+  void (*close)(channel_t *ch);
+} mech_t;
+
+// One end's part in a run.
+typedef struct side_t {
+  const mech_t *mech;
+  channel_t *ch;
+  char *buf;
+  int cpu;                // Or -1 if not pinned.
+  bool ok;
+} side_t;
+
+// Global state:
+static int g_iterations = DEFAULT_ITERATIONS;
+static int g_size = DEFAULT_MESSAGE_SIZE;
+static int g_cpus[2] = { -1, -1 };  // Pinger's and ponger's, or -1.
+static char g_rpc_payload[MAX_MESSAGE_SIZE];  // The RPC server's.
+
+/**
+ * Gets a monotonic timestamp in ns.
+ */
+static uint64_t now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/**
+ * Reads exactly size bytes from a stream.
+ */
+static bool read_full(int fd, char *buf, size_t size) {
+  while (size > 0) {
+    ssize_t got = read(fd, buf, size);
+    if (got <= 0 && !(got == -1 && errno == EINTR)) {
+      return false;
+    } else if (got > 0) {
+      buf += got;
+      size -= got;
+    }
+  }
+  return true;
+}
+
+/**
+ * Writes exactly size bytes to a stream.
+ */
+static bool write_full(int fd, const char *buf, size_t size) {
+  while (size > 0) {
+    ssize_t put = write(fd, buf, size);
+    if (put <= 0 && !(put == -1 && errno == EINTR)) {
+      return false;
+    } else if (put > 0) {
+      buf += put;
+      size -= put;
+    }
+  }
+  return true;
+}
+
+/**
+ * Streams, for pipes and unix sockets.
+ */
+static bool stream_send(channel_t *ch, int dir, char *buf) {
+  return write_full(ch->fds[dir][1], buf, g_size);
+}
+
+static bool stream_recv(channel_t *ch, int dir, char *buf) {
+  return read_full(ch->fds[dir][0], buf, g_size);
+}
+
+/**
+ * Pipes, one per direction.
+ */
+static bool pipe_open(channel_t *ch) {
+  if (pipe(ch->fds[PING]) == -1) {
+    return false;
+  } else if (pipe(ch->fds[PONG]) == -1) {
+    close(ch->fds[PING][0]);
+    close(ch->fds[PING][1]);
+    return false;
+  }
+  return true;
+}
+
+static void pipe_close(channel_t *ch) {
+  for (int dir = 0; dir < 2; dir++) {
+    close(ch->fds[dir][0]);
+    close(ch->fds[dir][1]);
+  }
+}
+
+/**
+ * Unix stream socket pair: the pinger writes one end and the ponger the
+ * other.
+ */
+static bool unix_open(channel_t *ch) {
+  int pair[2];
+
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair) == -1) {
+    return false;
+  }
+  ch->fds[PING][0] = pair[1];
+  ch->fds[PING][1] = pair[0];
+  ch->fds[PONG][0] = pair[0];
+  ch->fds[PONG][1] = pair[1];
+  return true;
+}
+
+static void unix_close(channel_t *ch) {
+  close(ch->fds[PING][0]);
+  close(ch->fds[PING][1]);
+}
+
+/**
+ * eventfds in semaphore mode, one per direction: each read takes one
+ * write's count.
+ */
+static bool eventfd_open(channel_t *ch) {
+  for (int dir = 0; dir < 2; dir++) {
+    ch->fds[dir][0] = ch->fds[dir][1] = eventfd(0, EFD_SEMAPHORE);
+    if (ch->fds[dir][0] == -1) {
+      if (dir > 0) {
+        close(ch->fds[PING][0]);
+      }
+      return false;
+    }
+  }
+  return true;
+}
+
+static bool eventfd_send(channel_t *ch, int dir, char *buf) {
+  uint64_t one = 1;
+  return write_full(ch->fds[dir][1], (char*)&one, sizeof(one));
+}
+
+static bool eventfd_recv(channel_t *ch, int dir, char *buf) {
+  uint64_t count;
+  return read_full(ch->fds[dir][0], (char*)&count, sizeof(count));
+}
+
+static void eventfd_close(channel_t *ch) {
+  close(ch->fds[PING][0]);
+  close(ch->fds[PONG][0]);
+}
+
+/**
+ * Futex over shared memory: the sender bumps the direction's sequence
+ * number and wakes the reader, who sleeps while it's one it has seen.
+ */
+static bool futex_open(channel_t *ch) {
+  ch->futex = mmap(NULL, 2 * sizeof(uint32_t), PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (ch->futex == MAP_FAILED) {
+    return false;
+  }
+  ch->seen[PING] = ch->seen[PONG] = 0;
+  return true;
+}
+
+static bool futex_send(channel_t *ch, int dir, char *buf) {
+  __atomic_add_fetch(&ch->futex[dir], 1, __ATOMIC_RELEASE);
+  return syscall(SYS_futex, &ch->futex[dir], FUTEX_WAKE, 1, NULL, NULL,
+                 0) != -1;
+}
+
+static bool futex_recv(channel_t *ch, int dir, char *buf) {
+  while (__atomic_load_n(&ch->futex[dir], __ATOMIC_ACQUIRE) ==
+         ch->seen[dir]) {
+    if (syscall(SYS_futex, &ch->futex[dir], FUTEX_WAIT, ch->seen[dir],
+                NULL, NULL, 0) == -1 && errno != EAGAIN && errno != EINTR) {
+      return false;
+    }
+  }
+  ch->seen[dir]++;
+  return true;
+}
+
+static void futex_close(channel_t *ch) {
+  munmap(ch->futex, 2 * sizeof(uint32_t));
+}
+
+/**
+ * SysV semaphore set, one per direction.
+ */
+static bool sysv_sem_open(channel_t *ch) {
+  unsigned short values[2] = { 0, 0 };
+
+  if ((ch->sem_id = semget(IPC_PRIVATE, 2, S_IRUSR | S_IWUSR)) == -1) {
+    return false;
+  }
+  if (semctl(ch->sem_id, /* Ignored. */ 0, SETALL, values) == -1) {
+    semctl(ch->sem_id, /* Ignored. */ 0, IPC_RMID);
+    return false;
+  }
+  return true;
+}
+
+static bool sysv_sem_send(channel_t *ch, int dir, char *buf) {
+  struct sembuf op = { dir, 1, 0 };
+  return semop(ch->sem_id, &op, 1) == 0;
+}
+
+static bool sysv_sem_recv(channel_t *ch, int dir, char *buf) {
+  struct sembuf op = { dir, -1, 0 };
+  while (semop(ch->sem_id, &op, 1) == -1) {
+    if (errno != EINTR) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static void sysv_sem_close(channel_t *ch) {
+  semctl(ch->sem_id, /* Ignored. */ 0, IPC_RMID);
+}
+
+/**
+ * POSIX semaphores in shared memory, one per direction.
+ */
+static bool posix_sem_open(channel_t *ch) {
+  ch->sems = mmap(NULL, 2 * sizeof(sem_t), PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (ch->sems == MAP_FAILED) {
+    return false;
+  }
+  sem_init(&ch->sems[PING], 1, 0);
+  sem_init(&ch->sems[PONG], 1, 0);
+  return true;
+}
+
+static bool posix_sem_send(channel_t *ch, int dir, char *buf) {
+  return sem_post(&ch->sems[dir]) == 0;
+}
+
+static bool posix_sem_recv(channel_t *ch, int dir, char *buf) {
+  while (sem_wait(&ch->sems[dir]) == -1) {
+    if (errno != EINTR) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static void posix_sem_close(channel_t *ch) {
+  sem_destroy(&ch->sems[PING]);
+  sem_destroy(&ch->sems[PONG]);
+  munmap(ch->sems, 2 * sizeof(sem_t));
+}
+
+/**
+ * SysV message queue, both directions in one, told apart by mtype. The
+ * buffer starts with the mtype.
+ */
+static bool sysv_msg_open(channel_t *ch) {
+  return (ch->msg_id = msgget(IPC_PRIVATE, S_IRUSR | S_IWUSR)) != -1;
+}
+
+static bool sysv_msg_send(channel_t *ch, int dir, char *buf) {
+  *(long*)buf = dir + 1;
+  while (msgsnd(ch->msg_id, buf, g_size, 0) == -1) {
+    if (errno != EINTR) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static bool sysv_msg_recv(channel_t *ch, int dir, char *buf) {
+  while (msgrcv(ch->msg_id, buf, g_size, dir + 1, 0) == -1) {
+    if (errno != EINTR) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static void sysv_msg_close(channel_t *ch) {
+  msgctl(ch->msg_id, IPC_RMID, NULL);
+}
+
+/**
+ * POSIX message queues, one per direction, unlinked as soon as they're
+ * open.
+ */
+static bool posix_mq_open(channel_t *ch) {
+  struct mq_attr attr;
+  char name[64];
+
+  memset(&attr, 0, sizeof(attr));
+  attr.mq_maxmsg = MQ_MAX_MESSAGES;
+  attr.mq_msgsize = g_size;
+  for (int dir = 0; dir < 2; dir++) {
+    snprintf(name, sizeof(name), "/ipc_bench.%i.%i", getpid(), dir);
+    ch->mqs[dir] = mq_open(name, O_RDWR | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR,
+                           &attr);
+    if (ch->mqs[dir] == (mqd_t)-1) {
+      if (dir > 0) {
+        mq_close(ch->mqs[PING]);
+      }
+      return false;
+    }
+    mq_unlink(name);
+  }
+  return true;
+}
+
+static bool posix_mq_send(channel_t *ch, int dir, char *buf) {
+  while (mq_send(ch->mqs[dir], buf, g_size, 0) == -1) {
+    if (errno != EINTR) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static bool posix_mq_recv(channel_t *ch, int dir, char *buf) {
+  while (mq_receive(ch->mqs[dir], buf, g_size, NULL) == -1) {
+    if (errno != EINTR) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static void posix_mq_close(channel_t *ch) {
+  mq_close(ch->mqs[PING]);
+  mq_close(ch->mqs[PONG]);
+}
+
+/**
+ * XDR for a message: g_size opaque bytes.
+ */
+static bool_t xdr_payload(XDR *xdrs, char *buf) {
+  return xdr_opaque(xdrs, buf, g_size);
+}
+
+/**
+ * The RPC server: echoes the message back.
+ */
+static void rpc_dispatch(struct svc_req *req, SVCXPRT *xprt) {
+  if (req->rq_proc == NULLPROC) {
+    svc_sendreply(xprt, (xdrproc_t)xdr_void, NULL);
+  } else if (req->rq_proc != RPC_ECHO ||
+             !svc_getargs(xprt, (xdrproc_t)xdr_payload, g_rpc_payload)) {
+    svcerr_decode(xprt);
+  } else {
+    svc_sendreply(xprt, (xdrproc_t)xdr_payload, g_rpc_payload);
+  }
+}
+
+/**
+ * RPC over UDP on loopback: a server on a port of its own, registered
+ * without the portmapper, and a client of it.
+ */
+static bool rpc_open(channel_t *ch) {
+  struct timeval retry = { 1, 0 };
+  struct sockaddr_in addr;
+  int sock = RPC_ANYSOCK;
+
+  if ((ch->xprt = svcudp_create(RPC_ANYSOCK)) == NULL) {
+    return false;
+  }
+  if (!svc_register(ch->xprt, RPC_PROGRAM, RPC_VERSION, rpc_dispatch, 0)) {
+    svc_destroy(ch->xprt);
+    return false;
+  }
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(ch->xprt->xp_port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  ch->clnt = clntudp_create(&addr, RPC_PROGRAM, RPC_VERSION, retry, &sock);
+  if (ch->clnt == NULL) {
+    svc_destroy(ch->xprt);
+    return false;
+  }
+  return true;
+}
+
+/**
+ * A ping is the whole call, reply and all, so the pong has nothing to
+ * send and the pinger nothing to wait for.
+ */
+static bool rpc_send(channel_t *ch, int dir, char *buf) {
+  struct timeval timeout = { RPC_TIMEOUT_SECONDS, 0 };
+
+  if (dir == PONG) {
+    return true;
+  }
+  return clnt_call(ch->clnt, RPC_ECHO, (xdrproc_t)xdr_payload, buf,
+                   (xdrproc_t)xdr_payload, buf, timeout) == RPC_SUCCESS;
+}
+
+/**
+ * Serves one call.
+ */
+static bool rpc_recv(channel_t *ch, int dir, char *buf) {
+  fd_set fds;
+
+  if (dir == PONG) {
+    return true;
+  }
+
+  FD_ZERO(&fds);
+  FD_SET(ch->xprt->xp_fd, &fds);
+  while (select(ch->xprt->xp_fd + 1, &fds, NULL, NULL, NULL) == -1) {
+    if (errno != EINTR) {
+      return false;
+    }
+  }
+  svc_getreqset(&fds);
+  return true;
+}
+
+static void rpc_close(channel_t *ch) {
+  clnt_destroy(ch->clnt);
+  svc_destroy(ch->xprt);
+}
+
+static const mech_t kMechs[] = {
+  { "pipe", pipe_open, stream_send, stream_recv, pipe_close },
+  { "unix", unix_open, stream_send, stream_recv, unix_close },
+  { "eventfd", eventfd_open, eventfd_send, eventfd_recv, eventfd_close },
+  { "futex", futex_open, futex_send, futex_recv, futex_close },
+  { "sysv_sem", sysv_sem_open, sysv_sem_send, sysv_sem_recv,
+    sysv_sem_close },
+  { "posix_sem", posix_sem_open, posix_sem_send, posix_sem_recv,
+    posix_sem_close },
+  { "sysv_msg", sysv_msg_open, sysv_msg_send, sysv_msg_recv,
+    sysv_msg_close },
+  { "posix_mq", posix_mq_open, posix_mq_send, posix_mq_recv,
+    posix_mq_close },
+  { "rpc", rpc_open, rpc_send, rpc_recv, rpc_close },
+};
+#define MECH_COUNT (int)(sizeof(kMechs) / sizeof(mech_t))
+
+/**
+ * Print application usage info.
+ */
+static void print_help() {
+  printf("IPC Ping-Pong Benchmark\n");
+  printf("(C) 2015 Christian Gunderman\n\n");
+  printf("usage: ./ipc_bench [-n iterations] [-s message_size] [-m mode]\n");
+  printf("                   [-p pinning] [mechanism...]\n");
+  printf("  -n  round trips, and messages streamed (default %i)\n",
+         DEFAULT_ITERATIONS);
+  printf("  -s  message size in bytes, 1 to %i (default %i)\n",
+         MAX_MESSAGE_SIZE, DEFAULT_MESSAGE_SIZE);
+  printf("  -m  process, thread or both (default both)\n");
+  printf("  -p  none, same (both on CPU 0), cross (CPUs 0 and 1) or two\n"
+         "      CPUs like 2,5 for the pinger and ponger (default none)\n");
+  printf("mechanisms (default all):");
+  for (int i = 0; i < MECH_COUNT; i++) {
+    printf(" %s", kMechs[i].name);
+  }
+  printf("\n");
+  exit(1);
+}
+
+/**
+ * Pins the calling thread to cpu, unless it's -1.
+ */
+static bool pin(int cpu) {
+  cpu_set_t set;
+
+  if (cpu == -1) {
+    return true;
+  }
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  return sched_setaffinity(0, sizeof(set), &set) == 0;
+}
+
+/**
+ * The ponger: answers every round trip, then the last streamed message.
+ */
+static void *pong(void *arg) {
+  side_t *side = arg;
+  const mech_t *mech = side->mech;
+  int round_trips = g_iterations + g_iterations / WARMUP_DIVISOR;
+
+  side->ok = pin(side->cpu);
+  for (int i = 0; side->ok && i < round_trips; i++) {
+    side->ok = mech->recv(side->ch, PING, side->buf) &&
+      mech->send(side->ch, PONG, side->buf);
+  }
+  for (int i = 0; side->ok && i < g_iterations; i++) {
+    side->ok = mech->recv(side->ch, PING, side->buf);
+  }
+  side->ok = side->ok && mech->send(side->ch, PONG, side->buf);
+  return NULL;
+}
+
+/**
+ * The pinger: times every round trip into samples, then the stream.
+ * Returns the stream's time in ns, or 0 on failure.
+ */
+static uint64_t ping(side_t *side, uint64_t *samples) {
+  const mech_t *mech = side->mech;
+  bool ok = true;
+
+  for (int i = 0; ok && i < g_iterations / WARMUP_DIVISOR; i++) {
+    ok = mech->send(side->ch, PING, side->buf) &&
+      mech->recv(side->ch, PONG, side->buf);
+  }
+  for (int i = 0; ok && i < g_iterations; i++) {
+    uint64_t start = now_ns();
+    ok = mech->send(side->ch, PING, side->buf) &&
+      mech->recv(side->ch, PONG, side->buf);
+    samples[i] = now_ns() - start;
+  }
+  if (!ok) {
+    return 0;
+  }
+
+  uint64_t start = now_ns();
+  for (int i = 0; ok && i < g_iterations; i++) {
+    ok = mech->send(side->ch, PING, side->buf);
+  }
+  ok = ok && mech->recv(side->ch, PONG, side->buf);
+  return ok ? now_ns() - start : 0;
+}
+
+/**
+ * qsort() comparator for timings.
+ */
+static int compare_u64(const void *a, const void *b) {
+  uint64_t ua = *(const uint64_t*)a;
+  uint64_t ub = *(const uint64_t*)b;
+
+  return (ua > ub) - (ua < ub);
+}
+
+/**
+ * Runs one mechanism between two processes, or two threads, and prints its
+ * row. Returns false, with errno set, if it failed.
+ */
+static bool run(const mech_t *mech, bool threads, uint64_t *samples,
+                char *bufs[2]) {
+  side_t pinger = { mech, NULL, bufs[0], g_cpus[0], true };
+  side_t ponger = { mech, NULL, bufs[1], g_cpus[1], true };
+  channel_t ch;
+  pthread_t thread;
+  pid_t pid = -1;
+  int status;
+
+  memset(&ch, 0, sizeof(ch));
+  pinger.ch = ponger.ch = &ch;
+  if (!mech->open(&ch)) {
+    return false;
+  }
+
+  // Otherwise the ponger inherits, and prints again, whatever is buffered.
+  fflush(stdout);
+  if (threads) {
+    if ((errno = pthread_create(&thread, NULL, pong, &ponger)) != 0) {
+      mech->close(&ch);
+      return false;
+    }
+  } else if ((pid = fork()) == -1) {
+    mech->close(&ch);
+    return false;
+  } else if (pid == 0) {
+    pong(&ponger);
+    _exit(ponger.ok ? EXIT_SUCCESS : EXIT_FAILURE);
+  }
+
+  int saved_errno = 0;
+  uint64_t stream = pin(pinger.cpu) ? ping(&pinger, samples) : 0;
+  if (stream == 0) {
+    saved_errno = errno;
+  }
+
+  // A ponger still waiting on a failed pinger would never end.
+  if (threads) {
+    if (stream == 0) {
+      pthread_cancel(thread);
+    }
+    pthread_join(thread, NULL);
+  } else {
+    if (stream == 0) {
+      kill(pid, SIGTERM);
+    }
+    waitpid(pid, &status, 0);
+    ponger.ok = WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS;
+  }
+  mech->close(&ch);
+
+  if (stream == 0 || !ponger.ok) {
+    errno = saved_errno;
+    return false;
+  }
+
+  uint64_t sum = 0;
+  for (int i = 0; i < g_iterations; i++) {
+    sum += samples[i];
+  }
+  qsort(samples, g_iterations, sizeof(uint64_t), compare_u64);
+  printf("%-7s %-9s %8.2f %8.2f %8.2f %8.2f %10.0f %10.0f\n",
+         threads ? "thread" : "process", mech->name,
+         samples[g_iterations / 2] / 1e3, samples[g_iterations * 9 / 10] / 1e3,
+         samples[g_iterations * 99 / 100] / 1e3,
+         (double)sum / g_iterations / 1e3, g_iterations / (sum / 1e9),
+         g_iterations / (stream / 1e9));
+  fflush(stdout);
+  return true;
+}
+
+/**
+ * Application Entry point.
+ */
+int main(int argc, char* argv[]) {
+  bool modes[2] = { true, true };  // Processes, threads.
+  const char *pinning = "none";
+  int opt;
+
+  while ((opt = getopt(argc, argv, "n:s:m:p:")) != -1) {
+    switch (opt) {
+    case 'n':
+      g_iterations = atoi(optarg);
+      break;
+    case 's':
+      g_size = atoi(optarg);
+      break;
+    case 'm':
+      modes[0] = strcmp(optarg, "process") == 0 || strcmp(optarg, "both") == 0;
+      modes[1] = strcmp(optarg, "thread") == 0 || strcmp(optarg, "both") == 0;
+      if (!modes[0] && !modes[1]) {
+        print_help();
+      }
+      break;
+    case 'p':
+      pinning = optarg;
+      if (strcmp(optarg, "same") == 0) {
+        g_cpus[0] = g_cpus[1] = 0;
+      } else if (strcmp(optarg, "cross") == 0) {
+        g_cpus[0] = 0;
+        g_cpus[1] = 1;
+      } else if (strcmp(optarg, "none") != 0 &&
+                 sscanf(optarg, "%i,%i", &g_cpus[0], &g_cpus[1]) != 2) {
+        print_help();
+      }
+      break;
+    default:
+      print_help();
+    }
+  }
+
+  if (g_iterations < WARMUP_DIVISOR || g_size < 1 ||
+      g_size > MAX_MESSAGE_SIZE) {
+    print_help();
+  }
+
+  // Check the CPUs exist before anything depends on them, ponger's first
+  // so the process is left on the pinger's.
+  for (int i = 1; i >= 0; i--) {
+    if (!pin(g_cpus[i])) {
+      printf("Unable to pin to CPU %i: %s\n", g_cpus[i], strerror(errno));
+      return EXIT_FAILURE;
+    }
+  }
+
+  uint64_t *samples = malloc(g_iterations * sizeof(uint64_t));
+  char *bufs[2] = {
+    calloc(1, sizeof(long) + MAX_MESSAGE_SIZE),
+    calloc(1, sizeof(long) + MAX_MESSAGE_SIZE)
+  };
+  if (samples == NULL || bufs[0] == NULL || bufs[1] == NULL) {
+    printf("Out of memory.\n");
+    return EXIT_FAILURE;
+  }
+
+  printf("%i round trips, then %i messages streamed, of %i bytes, pinning "
+         "%s, times in us\n", g_iterations, g_iterations, g_size, pinning);
+  printf("%-7s %-9s %8s %8s %8s %8s %10s %10s\n", "mode", "mechanism", "p50",
+         "p90", "p99", "mean", "rt_per_s", "msg_per_s");
+
+  for (int mode = 0; mode < 2; mode++) {
+    if (!modes[mode]) {
+      continue;
+    }
+    for (int i = 0; i < MECH_COUNT; i++) {
+      bool selected = optind == argc;
+      for (int j = optind; j < argc; j++) {
+        selected = selected || strcmp(argv[j], kMechs[i].name) == 0;
+      }
+      if (selected && !run(&kMechs[i], mode == 1, samples, bufs)) {
+        printf("%-7s %-9s failed: %s\n", mode == 1 ? "thread" : "process",
+               kMechs[i].name, strerror(errno));
+      }
+    }
+  }
+
+  free(samples);
+  free(bufs[0]);
+  free(bufs[1]);
+  return EXIT_SUCCESS;
+}
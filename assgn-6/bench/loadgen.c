@@ -0,0 +1,742 @@
+/**
+ * EECS 338 Operating Systems
+ * Case Western Reserve University
+ * (C) 2015 Christian Gunderman
+ */
+#define _XOPEN_SOURCE 700
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "proto_mt.h"
+#include "shard.h"
+#include "shm.h"
+
+/*
+ * Load generator for the mailbox server. Runs a number of concurrent
+ * sessions, each a thread with its own RPC client and its own users,
+ * issuing a weighted mix of operations either back to back (closed loop)
+ * or at a constant overall rate. Prints throughput and latency percentiles
+ * per procedure as JSON on stdout.
+ *
+ * usage: ./loadgen [options], see print_help().
+ */
+
+// Preprocessor Defines.
+#define DEFAULT_HOST "localhost"
+#define DEFAULT_SESSIONS 8
+#define DEFAULT_SECONDS 10
+#define DEFAULT_USERS 1000
+#define DEFAULT_MESSAGE_SIZE 64
+#define DEFAULT_MESSAGES_PER_USER 20
+#define DEFAULT_MIX "insert=40,retrieve=40,list=10,delete=10"
+#define RPC_TIMEOUT_SECONDS 5
+
+// Operations the generator issues.
+typedef enum op_t {
+  OP_START,
+  OP_QUIT,
+  OP_INSERT,
+  OP_RETRIEVE,
+  OP_LIST,
+  OP_DELETE,
+  OP_COUNT
+} op_t;
+
+const char *kOpNames[] = {
+  "start",
+  "quit",
+  "insert",
+  "retrieve",
+  "list",
+  "delete",
+};
+
+// Latencies, in microseconds, of one operation in one session.
+typedef struct samples_t {
+  float *us;
+  size_t count;
+  size_t capacity;
+  unsigned long errors;    // Calls the server answered with a failure.
+  unsigned long failures;  // Calls that got no answer at all.
+} samples_t;
+
+// A session: one thread, one RPC client and a slice of the users.
+typedef struct session_t {
+  pthread_t thread;
+  int id;
+  unsigned int seed;
+  int first_user;          // Users first_user.. first_user + users - 1.
+  int users;
+  int extra_users;         // Users beyond those added by START ops.
+  u_quad_t *handles;       // Session handles of the users, with -H.
+  samples_t samples[OP_COUNT];
+} session_t;
+
+// Run configuration, shared read only by all sessions.
+static const char *g_host = DEFAULT_HOST;
+static int g_port = 0;
+static bool g_tcp = false;
+static const char *g_local = NULL;  // Unix socket path, with -L.
+static int g_sessions = DEFAULT_SESSIONS;
+static int g_seconds = DEFAULT_SECONDS;
+static int g_users = DEFAULT_USERS;
+static int g_message_size = DEFAULT_MESSAGE_SIZE;
+static int g_messages_per_user = DEFAULT_MESSAGES_PER_USER;
+static double g_rate = 0;  // Total ops/s, 0 for closed loop.
+static bool g_use_handles = false;
+static int g_hot_pct = 0;  // % of ops to the hottest tenth of users.
+static const char *g_shard_spec = NULL;
+static ShardAddr g_shards[SHARD_MAX];  // Routed by user, with -S.
+static int g_shard_count = 0;
+static const char *g_mix_spec = DEFAULT_MIX;
+static int g_mix[OP_COUNT];
+static int g_mix_total = 0;
+static double g_start = 0;
+static double g_end = 0;
+
+/**
+ * Gets a monotonic timestamp in seconds.
+ */
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * Sleeps until the monotonic time until.
+ */
+static void sleep_until(double until) {
+  struct timespec ts;
+
+  ts.tv_sec = (time_t)until;
+  ts.tv_nsec = (long)((until - ts.tv_sec) * 1e9);
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) != 0) {
+  }
+}
+
+/**
+ * Print application usage info.
+ */
+static void print_help() {
+  printf("RPC Mailbox Load Generator\n");
+  printf("(C) 2015 Christian Gunderman\n\n");
+  printf("usage: ./loadgen [-h host] [-p port] [-T] [-c sessions] [-d seconds]\n");
+  printf("                 [-u users] [-s message_size] [-n messages_per_user]\n");
+  printf("                 [-r ops_per_second] [-m mix] [-H] [-k hot_pct]\n");
+  printf("                 [-S shards] [-L socket_path]\n");
+  printf("  -h  server host (default %s)\n", DEFAULT_HOST);
+  printf("  -p  server port, skips the portmapper (server -p)\n");
+  printf("  -T  use TCP instead of UDP\n");
+  printf("  -L  use shared memory to a server on this machine, through its\n"
+         "      unix socket (server -L), in place of -h, -p and -T\n");
+  printf("  -c  concurrent sessions, one thread each (default %i)\n",
+         DEFAULT_SESSIONS);
+  printf("  -d  seconds to run for (default %i)\n", DEFAULT_SECONDS);
+  printf("  -u  users, split between the sessions (default %i)\n",
+         DEFAULT_USERS);
+  printf("  -s  message size in bytes (default %i)\n", DEFAULT_MESSAGE_SIZE);
+  printf("  -n  message numbers used per user (default %i)\n",
+         DEFAULT_MESSAGES_PER_USER);
+  printf("  -r  total operations per second, 0 for closed loop (default 0)\n");
+  printf("  -m  operation weights (default %s)\n", DEFAULT_MIX);
+  printf("      from start, quit, insert, retrieve, list and delete\n");
+  printf("  -H  open session handles and use the handle calls\n");
+  printf("  -k  send this %% of operations to a tenth of the users, the rest\n"
+         "      to the others (default 0, all users alike)\n");
+  printf("  -S  route each user to its shard, from a list of ports or\n"
+         "      host:ports like 7001,7002, in place of -p\n");
+  exit(1);
+}
+
+/**
+ * Parses the operation mix, e.g. "insert=50,retrieve=50".
+ */
+static bool parse_mix(const char *spec) {
+  char *copy = strdup(spec);
+  char *save = NULL;
+
+  memset(g_mix, 0, sizeof(g_mix));
+  g_mix_total = 0;
+
+  for (char *tok = strtok_r(copy, ",", &save); tok != NULL;
+       tok = strtok_r(NULL, ",", &save)) {
+    char *eq = strchr(tok, '=');
+    int op;
+
+    if (eq == NULL) {
+      free(copy);
+      return false;
+    }
+    *eq = '\0';
+
+    for (op = 0; op < OP_COUNT && strcasecmp(tok, kOpNames[op]) != 0; op++) {
+    }
+    if (op == OP_COUNT || atoi(eq + 1) < 0) {
+      free(copy);
+      return false;
+    }
+
+    g_mix[op] = atoi(eq + 1);
+    g_mix_total += g_mix[op];
+  }
+
+  free(copy);
+  return g_mix_total > 0;
+}
+
+/**
+ * Creates an RPC client to host, directly to the port if one was given,
+ * otherwise through the portmapper. With -L it's a shared memory client
+ * instead.
+ */
+static CLIENT *connect_server(const char *host, int port) {
+  if (g_local != NULL) {
+    return clntshm_create(g_local);
+  }
+  if (port == 0) {
+    return clnt_create(host, MAILBOX_PROG, MAILBOX_VERSION,
+                       g_tcp ? "tcp" : "udp");
+  }
+
+  struct addrinfo hints, *res;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_INET;
+  if (getaddrinfo(host, NULL, &hints, &res) != 0) {
+    return NULL;
+  }
+
+  struct sockaddr_in addr;
+  memcpy(&addr, res->ai_addr, sizeof(addr));
+  addr.sin_port = htons(port);
+  freeaddrinfo(res);
+
+  int sock = RPC_ANYSOCK;
+  if (g_tcp) {
+    return clnttcp_create(&addr, MAILBOX_PROG, MAILBOX_VERSION, &sock, 0, 0);
+  } else {
+    struct timeval retry = { 1, 0 };
+    return clntudp_create(&addr, MAILBOX_PROG, MAILBOX_VERSION, retry, &sock);
+  }
+}
+
+/**
+ * Creates a client to every shard, or just to the server without -S, in
+ * clnts. Returns false, with none left open, if any can't be reached.
+ */
+static bool connect_all(CLIENT **clnts) {
+  int count = g_shard_count > 0 ? g_shard_count : 1;
+  struct timeval timeout = { RPC_TIMEOUT_SECONDS, 0 };
+
+  for (int i = 0; i < count; i++) {
+    const char *host = g_shard_count > 0 ? g_shards[i].host : g_host;
+    int port = g_shard_count > 0 ? g_shards[i].port : g_port;
+
+    if (!(clnts[i] = connect_server(host, port))) {
+      clnt_pcreateerror(host);
+      while (--i >= 0) {
+        clnt_destroy(clnts[i]);
+      }
+      return false;
+    }
+    clnt_control(clnts[i], CLSET_TIMEOUT, (char*)&timeout);
+  }
+  return true;
+}
+
+/**
+ * Closes the clients opened by connect_all().
+ */
+static void disconnect_all(CLIENT **clnts) {
+  int count = g_shard_count > 0 ? g_shard_count : 1;
+
+  for (int i = 0; i < count; i++) {
+    clnt_destroy(clnts[i]);
+  }
+}
+
+/**
+ * Gets the client for the server that owns user.
+ */
+static CLIENT *route(CLIENT **clnts, const char *user) {
+  return g_shard_count > 0 ? clnts[shard_of(user, g_shard_count)] : clnts[0];
+}
+
+/**
+ * Records one operation's latency and outcome.
+ */
+static void record(samples_t *samples, double us, bool answered, bool ok) {
+  if (!answered) {
+    samples->failures++;
+    return;
+  }
+  if (!ok) {
+    samples->errors++;
+  }
+
+  if (samples->count == samples->capacity) {
+    size_t capacity = samples->capacity == 0 ? 1024 : samples->capacity * 2;
+    float *grown = realloc(samples->us, capacity * sizeof(float));
+    if (grown == NULL) {
+      return;
+    }
+    samples->us = grown;
+    samples->capacity = capacity;
+  }
+  samples->us[samples->count++] = us;
+}
+
+/**
+ * Picks the next operation from the mix.
+ */
+static op_t pick_op(session_t *session) {
+  int pick = rand_r(&session->seed) % g_mix_total;
+  int op;
+
+  for (op = 0; pick >= g_mix[op]; op++) {
+    pick -= g_mix[op];
+  }
+  return op;
+}
+
+/**
+ * Issues one operation. Returns false if the server didn't answer, and
+ * sets ok to whether it succeeded.
+ */
+static bool issue(CLIENT **clnts, session_t *session, op_t op, char *message,
+                  bool *ok) {
+  char user[32];
+  MailboxParams params;
+  int user_num;
+
+  // START and QUIT add and remove users past the session's own, the rest
+  // work on the session's own users.
+  if (op == OP_START) {
+    user_num = session->extra_users++;
+  } else if (op == OP_QUIT) {
+    user_num = --session->extra_users;
+  } else if (g_hot_pct > 0) {
+    // A tenth of the users get hot_pct of the traffic.
+    int hot = session->users / 10 > 0 ? session->users / 10 : 1;
+    if ((int)(rand_r(&session->seed) % 100) < g_hot_pct ||
+        hot == session->users) {
+      user_num = rand_r(&session->seed) % hot;
+    } else {
+      user_num = hot + rand_r(&session->seed) % (session->users - hot);
+    }
+    user_num += session->first_user;
+  } else {
+    user_num = session->first_user + rand_r(&session->seed) % session->users;
+  }
+
+  if (op == OP_START || op == OP_QUIT) {
+    snprintf(user, sizeof(user), "load_%d_extra_%d", session->id, user_num);
+  } else {
+    snprintf(user, sizeof(user), "load_%d", user_num);
+  }
+
+  params.user = user;
+  params.mnum = rand_r(&session->seed) % g_messages_per_user;
+  params.message = op == OP_INSERT ? message : "\0";
+  CLIENT *clnt = route(clnts, user);
+
+  // The same again, but by session handle.
+  MailboxHandleParams handle_params;
+  bool by_handle = g_use_handles && op != OP_START && op != OP_QUIT;
+  if (by_handle) {
+    handle_params.handle = session->handles[user_num - session->first_user];
+    handle_params.mnum = params.mnum;
+    handle_params.message = params.message;
+  }
+
+  // Every response starts with its result.
+  union {
+    MailboxResult result;
+    MailboxMessageResponse message;
+    MailboxMessageListResponse list;
+  } reply;
+  enum clnt_stat stat = RPC_FAILED;
+
+  memset(&reply, 0, sizeof(reply));
+  if (by_handle) {
+    switch (op) {
+    case OP_INSERT:
+      stat = mailbox_insert_message_by_handle_1(&handle_params, &reply.result,
+                                                clnt);
+      break;
+    case OP_RETRIEVE:
+      stat = mailbox_retrieve_message_by_handle_1(&handle_params,
+                                                  &reply.message, clnt);
+      break;
+    case OP_LIST:
+      stat = mailbox_list_all_messages_by_handle_1(&handle_params,
+                                                   &reply.list, clnt);
+      break;
+    case OP_DELETE:
+      stat = mailbox_delete_message_by_handle_1(&handle_params, &reply.result,
+                                                clnt);
+      break;
+    default:
+      break;
+    }
+  } else {
+    switch (op) {
+    case OP_START:
+      stat = mailbox_start_1(&params, &reply.result, clnt);
+      break;
+    case OP_QUIT:
+      stat = mailbox_quit_1(&params, &reply.result, clnt);
+      break;
+    case OP_INSERT:
+      stat = mailbox_insert_message_1(&params, &reply.result, clnt);
+      break;
+    case OP_RETRIEVE:
+      stat = mailbox_retrieve_message_1(&params, &reply.message, clnt);
+      break;
+    case OP_LIST:
+      stat = mailbox_list_all_messages_1(&params, &reply.list, clnt);
+      break;
+    case OP_DELETE:
+      stat = mailbox_delete_message_1(&params, &reply.result, clnt);
+      break;
+    default:
+      break;
+    }
+  }
+
+  if (stat != RPC_SUCCESS) {
+    return false;
+  }
+
+  // Free the decoded strings. Through the client, since shared memory
+  // results point into its region.
+  MailboxResult result = reply.result;
+  if (op == OP_RETRIEVE) {
+    clnt_freeres(clnt, (xdrproc_t)xdr_MailboxMessageResponse,
+                 (char*)&reply.message);
+  } else if (op == OP_LIST) {
+    clnt_freeres(clnt, (xdrproc_t)xdr_MailboxMessageListResponse,
+                 (char*)&reply.list);
+  }
+
+  // Retrieving or deleting a message that isn't there is part of the
+  // workload, not a server error.
+  *ok = result == MailboxResultSuccess ||
+        (result == MailboxResultMessageNotExists &&
+         (op == OP_RETRIEVE || op == OP_DELETE));
+  return true;
+}
+
+/**
+ * Session thread. Runs operations until the end time.
+ */
+static void *session_run(void *arg) {
+  session_t *session = arg;
+  CLIENT *clnts[SHARD_MAX];
+
+  if (!connect_all(clnts)) {
+    return NULL;
+  }
+
+  // Open a handle for each of the session's users, outside of the timing.
+  if (g_use_handles) {
+    char user[32];
+    MailboxParams params;
+
+    params.user = user;
+    params.mnum = 0;
+    params.message = "\0";
+    session->handles = calloc(session->users, sizeof(u_quad_t));
+
+    for (int i = 0; i < session->users; i++) {
+      snprintf(user, sizeof(user), "load_%d", session->first_user + i);
+      MailboxOpenResponse open;
+      if (mailbox_open_1(&params, &open, route(clnts, user)) != RPC_SUCCESS ||
+          open.result != MailboxResultSuccess) {
+        printf("Open of %s failed.\n", user);
+        disconnect_all(clnts);
+        return NULL;
+      }
+      session->handles[i] = open.handle;
+    }
+  }
+
+  char *message = malloc(g_message_size + 1);
+  memset(message, 'a' + session->id % 26, g_message_size);
+  message[g_message_size] = '\0';
+
+  // Constant rate: each session sends on its own fixed schedule, offset so
+  // they don't all fire at once. Latency is measured from when a request
+  // was due, so a slow server can't hide its queueing.
+  double interval = g_rate > 0 ? g_sessions / g_rate : 0;
+  double due = g_start + interval * session->id / g_sessions;
+
+  while (true) {
+    if (interval > 0) {
+      if (due >= g_end) {
+        break;
+      }
+      sleep_until(due);
+    } else {
+      due = now();
+      if (due >= g_end) {
+        break;
+      }
+    }
+
+    // Nothing to QUIT yet, so START one instead.
+    op_t op = pick_op(session);
+    if (op == OP_QUIT && session->extra_users == 0) {
+      op = OP_START;
+    }
+
+    bool ok = false;
+    bool answered = issue(clnts, session, op, message, &ok);
+    record(&session->samples[op], (now() - due) * 1e6, answered, ok);
+
+    due += interval;
+  }
+
+  free(message);
+  free(session->handles);
+  disconnect_all(clnts);
+  return NULL;
+}
+
+/**
+ * Starts every session's users, outside of the measured run.
+ */
+static bool populate(session_t *sessions) {
+  CLIENT *clnts[SHARD_MAX];
+  char user[32];
+  MailboxParams params;
+
+  if (!connect_all(clnts)) {
+    return false;
+  }
+
+  params.user = user;
+  params.mnum = 0;
+  params.message = "\0";
+
+  for (int i = 0; i < g_users; i++) {
+    snprintf(user, sizeof(user), "load_%d", i);
+    MailboxResult result;
+    CLIENT *clnt = route(clnts, user);
+    if (mailbox_start_1(&params, &result, clnt) != RPC_SUCCESS) {
+      clnt_perror(clnt, "Start call failed.");
+      disconnect_all(clnts);
+      return false;
+    }
+  }
+
+  disconnect_all(clnts);
+  return true;
+}
+
+/**
+ * qsort comparator for latencies.
+ */
+static int compare_float(const void *a, const void *b) {
+  float fa = *(const float*)a;
+  float fb = *(const float*)b;
+  return (fa > fb) - (fa < fb);
+}
+
+/**
+ * Gets the p'th percentile of sorted latencies.
+ */
+static double percentile(float *sorted, size_t count, double p) {
+  if (count == 0) {
+    return 0;
+  }
+
+  size_t i = (size_t)(p / 100 * count);
+  return sorted[i < count ? i : count - 1];
+}
+
+/**
+ * Merges every session's samples for op into one and prints it as a JSON
+ * object, adding its operations to total. Returns false if op never ran.
+ */
+static bool print_op(session_t *sessions, op_t op, double elapsed,
+                     bool first, unsigned long *total) {
+  samples_t all;
+  memset(&all, 0, sizeof(all));
+
+  for (int i = 0; i < g_sessions; i++) {
+    all.count += sessions[i].samples[op].count;
+    all.errors += sessions[i].samples[op].errors;
+    all.failures += sessions[i].samples[op].failures;
+  }
+  if (all.count == 0 && all.failures == 0) {
+    return false;
+  }
+
+  all.us = malloc((all.count + 1) * sizeof(float));
+  size_t pos = 0;
+  double sum = 0;
+  for (int i = 0; i < g_sessions; i++) {
+    samples_t *samples = &sessions[i].samples[op];
+    memcpy(all.us + pos, samples->us, samples->count * sizeof(float));
+    pos += samples->count;
+  }
+  for (size_t i = 0; i < all.count; i++) {
+    sum += all.us[i];
+  }
+  qsort(all.us, all.count, sizeof(float), compare_float);
+
+  printf("%s\n    \"%s\": {\"ops\": %zu, \"errors\": %lu, \"timeouts\": %lu, "
+         "\"ops_per_s\": %.1f,\n", first ? "" : ",", kOpNames[op], all.count,
+         all.errors, all.failures, all.count / elapsed);
+  printf("      \"latency_us\": {\"mean\": %.1f, \"p50\": %.1f, \"p90\": %.1f, "
+         "\"p99\": %.1f, \"p99.9\": %.1f, \"max\": %.1f}}",
+         all.count > 0 ? sum / all.count : 0,
+         percentile(all.us, all.count, 50), percentile(all.us, all.count, 90),
+         percentile(all.us, all.count, 99), percentile(all.us, all.count, 99.9),
+         all.count > 0 ? all.us[all.count - 1] : 0);
+
+  free(all.us);
+  *total += all.count;
+  return true;
+}
+
+/**
+ * Application Entry point.
+ */
+int main(int argc, char* argv[]) {
+  int opt;
+
+  while ((opt = getopt(argc, argv, "h:p:TL:c:d:u:s:n:r:m:Hk:S:")) != -1) {
+    switch (opt) {
+    case 'h':
+      g_host = optarg;
+      break;
+    case 'p':
+      g_port = atoi(optarg);
+      break;
+    case 'T':
+      g_tcp = true;
+      break;
+    case 'L':
+      g_local = optarg;
+      break;
+    case 'c':
+      g_sessions = atoi(optarg);
+      break;
+    case 'd':
+      g_seconds = atoi(optarg);
+      break;
+    case 'u':
+      g_users = atoi(optarg);
+      break;
+    case 's':
+      g_message_size = atoi(optarg);
+      break;
+    case 'n':
+      g_messages_per_user = atoi(optarg);
+      break;
+    case 'r':
+      g_rate = atof(optarg);
+      break;
+    case 'm':
+      g_mix_spec = optarg;
+      break;
+    case 'H':
+      g_use_handles = true;
+      break;
+    case 'k':
+      g_hot_pct = atoi(optarg);
+      break;
+    case 'S':
+      g_shard_spec = optarg;
+      break;
+    default:
+      print_help();
+    }
+  }
+
+  if (g_sessions <= 0 || g_seconds <= 0 || g_users < g_sessions ||
+      g_message_size < 0 || g_messages_per_user <= 0 || g_rate < 0 ||
+      g_hot_pct < 0 || g_hot_pct > 100 ||
+      (g_local != NULL && g_shard_spec != NULL) ||
+      (g_shard_spec != NULL &&
+       (g_shard_count = shard_parse(g_shard_spec, g_host, g_shards,
+                                    SHARD_MAX)) <= 0) ||
+      !parse_mix(g_mix_spec)) {
+    print_help();
+  }
+
+  session_t *sessions = calloc(g_sessions, sizeof(session_t));
+  for (int i = 0; i < g_sessions; i++) {
+    sessions[i].id = i;
+    sessions[i].seed = i + 1;
+    sessions[i].first_user = g_users * i / g_sessions;
+    sessions[i].users = g_users * (i + 1) / g_sessions - sessions[i].first_user;
+  }
+
+  if (!populate(sessions)) {
+    return 1;
+  }
+
+  g_start = now();
+  g_end = g_start + g_seconds;
+  for (int i = 0; i < g_sessions; i++) {
+    if (pthread_create(&sessions[i].thread, NULL, session_run,
+                       &sessions[i]) != 0) {
+      perror("Thread create error");
+      return 1;
+    }
+  }
+  for (int i = 0; i < g_sessions; i++) {
+    pthread_join(sessions[i].thread, NULL);
+  }
+  double elapsed = now() - g_start;
+
+  // Results.
+  printf("{\n");
+  printf("  \"config\": {\"host\": \"%s\", \"port\": %d, \"transport\": \"%s\", "
+         "\"sessions\": %d, \"seconds\": %d,\n", g_host, g_port,
+         g_local != NULL ? "shm" : g_tcp ? "tcp" : "udp", g_sessions,
+         g_seconds);
+  printf("    \"users\": %d, \"message_size\": %d, \"messages_per_user\": %d, "
+         "\"pacing\": \"%s\", \"rate\": %.1f, \"mix\": \"%s\", "
+         "\"handles\": %s, \"hot_pct\": %d, \"shards\": %d},\n",
+         g_users, g_message_size, g_messages_per_user,
+         g_rate > 0 ? "constant" : "closed", g_rate, g_mix_spec,
+         g_use_handles ? "true" : "false", g_hot_pct,
+         g_shard_count > 0 ? g_shard_count : 1);
+  printf("  \"procs\": {");
+
+  unsigned long total = 0;
+  bool first = true;
+  for (int op = 0; op < OP_COUNT; op++) {
+    if (print_op(sessions, op, elapsed, first, &total)) {
+      first = false;
+    }
+  }
+
+  printf("\n  },\n");
+  printf("  \"elapsed_s\": %.3f,\n", elapsed);
+  printf("  \"total\": {\"ops\": %lu, \"ops_per_s\": %.1f}\n", total,
+         total / elapsed);
+  printf("}\n");
+
+  for (int i = 0; i < g_sessions; i++) {
+    for (int op = 0; op < OP_COUNT; op++) {
+      free(sessions[i].samples[op].us);
+    }
+  }
+  free(sessions);
+  return 0;
+}
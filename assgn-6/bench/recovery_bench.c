@@ -0,0 +1,170 @@
+/**
+ * EECS 338 Operating Systems
+ * Case Western Reserve University
+ * (C) 2015 Christian Gunderman
+ */
+#define _XOPEN_SOURCE 700
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "proto.h"
+#include "persist.h"
+#include "server.h"
+
+/*
+ * Restart recovery benchmark. Builds a dataset of the requested size by
+ * calling the server's RPC handlers directly, snapshots it, writes a log
+ * tail on top, and then times a fresh process recovering it all with
+ * server_init(), exactly as the server does at startup.
+ *
+ * usage: ./recovery_bench [data_dir] [dataset_mb] [message_size] [tail_pct]
+ */
+
+// Preprocessor Defines.
+#define DEFAULT_DATA_DIR "recovery-bench-data"
+#define DEFAULT_DATASET_MB 1024
+#define DEFAULT_MESSAGE_SIZE 1000
+#define DEFAULT_TAIL_PCT 10
+#define MESSAGES_PER_USER 100
+
+/**
+ * Gets a monotonic timestamp in seconds.
+ */
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * Inserts count messages round robin over users user_0.., starting at
+ * message number first.
+ */
+static void insert_messages(long count, long users, long first,
+                            char *message) {
+  char user[32];
+  MailboxParams params;
+
+  params.user = user;
+  params.message = message;
+
+  for (long i = 0; i < count; i++) {
+    snprintf(user, sizeof(user), "user_%ld", i % users);
+    params.mnum = first + i / users;
+
+    // Vary the body a little so it's not all the same bytes.
+    message[0] = 'a' + i % 26;
+
+    if (*mailbox_insert_message_1_svc(&params, NULL) != MailboxResultSuccess) {
+      printf("Insert failed.\n");
+      exit(EXIT_FAILURE);
+    }
+
+    // Let group commit run as the server's loop would.
+    persist_tick();
+  }
+}
+
+/**
+ * Builds the dataset in data_dir.
+ */
+static void build_dataset(const char *data_dir, long messages,
+                          int message_size, int tail_pct) {
+  char *message = malloc(message_size + 1);
+  long users = messages / MESSAGES_PER_USER + 1;
+  long tail = messages * tail_pct / 100;
+  char user[32];
+  MailboxParams params;
+
+  memset(message, 'm', message_size);
+  message[message_size] = '\0';
+
+  // Never snapshot on our own, we take exactly one below.
+  if (!server_init(data_dir, 0, 0)) {
+    exit(EXIT_FAILURE);
+  }
+
+  double start = now();
+  params.user = user;
+  params.message = "";
+  params.mnum = 0;
+  for (long u = 0; u < users; u++) {
+    snprintf(user, sizeof(user), "user_%ld", u);
+    mailbox_start_1_svc(&params, NULL);
+  }
+
+  insert_messages(messages - tail, users, 0, message);
+  persist_snapshot();
+
+  // Everything past the snapshot has to be replayed from the log.
+  insert_messages(tail, users, MESSAGES_PER_USER * 2, message);
+  server_shutdown();
+
+  printf("Built %ld users, %ld messages (%ld in log tail) in %.1f s.\n",
+         users, messages, tail, now() - start);
+  free(message);
+}
+
+/**
+ * Application Entry point.
+ */
+int main(int argc, char* argv[]) {
+  const char *data_dir = argc > 1 ? argv[1] : DEFAULT_DATA_DIR;
+  long dataset_mb = argc > 2 ? atol(argv[2]) : DEFAULT_DATASET_MB;
+  int message_size = argc > 3 ? atoi(argv[3]) : DEFAULT_MESSAGE_SIZE;
+  int tail_pct = argc > 4 ? atoi(argv[4]) : DEFAULT_TAIL_PCT;
+
+  if (dataset_mb <= 0 || message_size <= 0 ||
+      tail_pct < 0 || tail_pct > 100) {
+    printf("usage: ./recovery_bench [data_dir] [dataset_mb] [message_size] [tail_pct]\n");
+    return EXIT_FAILURE;
+  }
+
+  // Starting from an existing directory would skew everything.
+  if (access(data_dir, F_OK) == 0) {
+    printf("%s already exists, remove it or pick another.\n", data_dir);
+    return EXIT_FAILURE;
+  }
+
+  long messages = dataset_mb * 1048576 / message_size;
+
+  // Build in a child so the recovering process starts with a clean heap.
+  fflush(stdout);
+  pid_t pid = fork();
+  if (pid == -1) {
+    perror("Fork error");
+    return EXIT_FAILURE;
+  } else if (pid == 0) {
+    build_dataset(data_dir, messages, message_size, tail_pct);
+    exit(EXIT_SUCCESS);
+  }
+
+  int status;
+  if (waitpid(pid, &status, 0) == -1 ||
+      !WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) {
+    printf("Building dataset failed.\n");
+    return EXIT_FAILURE;
+  }
+
+  // Drop what we can of the page cache effect by syncing first. A truly
+  // cold run needs the cache dropped as root between build and recovery.
+  sync();
+
+  double start = now();
+  if (!server_init(data_dir, 0, 0)) {
+    return EXIT_FAILURE;
+  }
+  double elapsed = now() - start;
+
+  printf("Recovered %ld MB of messages in %.2f s (%.0f MB/s).\n",
+         dataset_mb, elapsed, dataset_mb / elapsed);
+  printf("Projected for 10 GB: %.1f s.\n", elapsed * 10240 / dataset_mb);
+
+  server_shutdown();
+  return EXIT_SUCCESS;
+}
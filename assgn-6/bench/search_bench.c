@@ -0,0 +1,249 @@
+/**
+ * EECS 338 Operating Systems
+ * Case Western Reserve University
+ * (C) 2015 Christian Gunderman
+ */
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "mailbox.h"
+#include "search.h"
+
+/*
+ * Search index benchmark. Fills mailboxes of growing size with messages of
+ * words drawn from a Zipf distribution, like real text, then reports the
+ * index's memory against the messages', how long the first search takes
+ * to build it, what keeping it up to date adds to replacing a message, and
+ * query latency for a single term, two terms and a prefix.
+ *
+ * usage: ./search_bench [words_per_message] [vocabulary] [sizes...]
+ */
+
+// Preprocessor Defines.
+#define DEFAULT_WORDS 50
+#define DEFAULT_VOCABULARY 50000
+#define QUERIES 2000
+#define UPDATES 2000
+#define QUERY_KINDS 3
+
+static const int kDefaultSizes[] = { 1000, 10000, 100000 };
+
+// Cumulative Zipf weights of the vocabulary, by rank.
+static double *g_cumulative = NULL;
+static int g_vocabulary = DEFAULT_VOCABULARY;
+static unsigned int g_seed = 1;
+
+/**
+ * Gets a monotonic timestamp in seconds.
+ */
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * Writes the word of the given rank: its number in base 26 letters, at
+ * least three of them.
+ */
+static void word(int rank, char *out) {
+  char tmp[16];
+  int len = 0;
+
+  do {
+    tmp[len++] = 'a' + rank % 26;
+    rank /= 26;
+  } while (rank > 0 || len < 3);
+
+  for (int i = 0; i < len; i++) {
+    out[i] = tmp[len - 1 - i];
+  }
+  out[len] = '\0';
+}
+
+/**
+ * Picks a rank from the Zipf distribution.
+ */
+static int pick_rank() {
+  double r = (double)rand_r(&g_seed) / RAND_MAX * g_cumulative[g_vocabulary - 1];
+  int low = 0;
+  int high = g_vocabulary - 1;
+
+  while (low < high) {
+    int mid = low + (high - low) / 2;
+    if (g_cumulative[mid] < r) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+  return low;
+}
+
+/**
+ * Writes a message of words random words into out.
+ */
+static void make_message(int words, char *out) {
+  char *p = out;
+
+  for (int i = 0; i < words; i++) {
+    word(pick_rank(), p);
+    p += strlen(p);
+    *p++ = ' ';
+  }
+  *p = '\0';
+}
+
+/**
+ * Writes a query of the given kind: 0 a word, 1 two words, 2 the first two
+ * letters of a word as a prefix.
+ */
+static void make_query(int kind, char *out) {
+  char a[16];
+  char b[16];
+
+  word(pick_rank(), a);
+  word(pick_rank(), b);
+  if (kind == 0) {
+    strcpy(out, a);
+  } else if (kind == 1) {
+    sprintf(out, "%s %s", a, b);
+  } else {
+    sprintf(out, "%.2s*", a);
+  }
+}
+
+/**
+ * qsort() comparator for latencies.
+ */
+static int compare_doubles(const void *a, const void *b) {
+  double da = *(const double*)a;
+  double db = *(const double*)b;
+
+  return (da > db) - (da < db);
+}
+
+/**
+ * Times QUERIES queries of one kind, setting the p50 and p99 in us.
+ */
+static void time_queries(Mailbox *mailbox, int kind, double *p50,
+                         double *p99) {
+  static double us[QUERIES];
+  SearchHit hits[100];
+  char query[64];
+  int total;
+
+  for (int i = 0; i < QUERIES; i++) {
+    make_query(kind, query);
+    double start = now();
+    if (!mailbox_search(mailbox, query, hits, 100, &total)) {
+      printf("Search failed, out of memory.\n");
+      exit(EXIT_FAILURE);
+    }
+    us[i] = (now() - start) * 1e6;
+  }
+
+  qsort(us, QUERIES, sizeof(double), compare_doubles);
+  *p50 = us[QUERIES / 2];
+  *p99 = us[QUERIES * 99 / 100];
+}
+
+/**
+ * Times replacing UPDATES random messages, returning us per replace.
+ */
+static double time_updates(Mailbox *mailbox, int messages, int words,
+                           char *message) {
+  double total = 0;
+
+  for (int i = 0; i < UPDATES; i++) {
+    make_message(words, message);
+    double start = now();
+    if (!mailbox_put(mailbox, rand_r(&g_seed) % messages, message)) {
+      printf("Insert failed, out of memory.\n");
+      exit(EXIT_FAILURE);
+    }
+    total += now() - start;
+  }
+  return total / UPDATES * 1e6;
+}
+
+/**
+ * Runs one mailbox size and prints its results row.
+ */
+static void run_size(int messages, int words) {
+  char *message = malloc(words * 16 + 1);
+  Mailbox *mailbox = mailbox_new("bench");
+  SearchHit hit;
+  int total;
+
+  for (int i = 0; i < messages; i++) {
+    make_message(words, message);
+    if (!mailbox_put(mailbox, i, message)) {
+      printf("Insert failed, out of memory.\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  // Replacing before there's an index, then building it with a search.
+  double plain_us = time_updates(mailbox, messages, words, message);
+  double start = now();
+  mailbox_search(mailbox, "", &hit, 1, &total);
+  double build_ms = (now() - start) * 1e3;
+  double indexed_us = time_updates(mailbox, messages, words, message);
+
+  double p50[QUERY_KINDS];
+  double p99[QUERY_KINDS];
+  for (int kind = 0; kind < QUERY_KINDS; kind++) {
+    time_queries(mailbox, kind, &p50[kind], &p99[kind]);
+  }
+
+  printf("%8d %9.1f %8.1f %9.1f %10.1f %6.1f/%-6.1f %7.1f/%-7.1f "
+         "%7.1f/%-7.1f %7.1f/%-7.1f\n",
+         messages, mailbox->bytes / 1048576.0,
+         search_memory(mailbox->index) / 1048576.0,
+         (double)search_memory(mailbox->index) / messages, build_ms,
+         plain_us, indexed_us, p50[0], p99[0], p50[1], p99[1], p50[2], p99[2]);
+
+  mailbox_free(mailbox);
+  free(message);
+}
+
+/**
+ * Application Entry point.
+ */
+int main(int argc, char* argv[]) {
+  int words = argc > 1 ? atoi(argv[1]) : DEFAULT_WORDS;
+  g_vocabulary = argc > 2 ? atoi(argv[2]) : DEFAULT_VOCABULARY;
+
+  if (words <= 0 || g_vocabulary <= 0) {
+    printf("usage: ./search_bench [words_per_message] [vocabulary] [sizes...]\n");
+    return EXIT_FAILURE;
+  }
+
+  g_cumulative = malloc(g_vocabulary * sizeof(double));
+  for (int i = 0; i < g_vocabulary; i++) {
+    g_cumulative[i] = (i > 0 ? g_cumulative[i - 1] : 0) + 1.0 / (i + 1);
+  }
+
+  printf("%i words per message from %i, Zipf distributed\n", words,
+         g_vocabulary);
+  printf("%8s %9s %8s %9s %10s %13s %15s %15s %15s\n", "messages", "text (MB)",
+         "idx (MB)", "idx B/msg", "build (ms)", "replace (us)",
+         "term p50/p99", "2 terms", "prefix");
+
+  if (argc > 3) {
+    for (int i = 3; i < argc; i++) {
+      run_size(atoi(argv[i]), words);
+    }
+  } else {
+    for (size_t i = 0; i < sizeof(kDefaultSizes) / sizeof(int); i++) {
+      run_size(kDefaultSizes[i], words);
+    }
+  }
+
+  free(g_cumulative);
+  return EXIT_SUCCESS;
+}
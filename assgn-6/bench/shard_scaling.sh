@@ -0,0 +1,50 @@
+#!/bin/bash
+#
+# EECS 338 Operating Systems
+# Case Western Reserve University
+# (C) 2015 Christian Gunderman
+#
+# Measures how throughput scales with the number of shards. For each shard
+# count, starts that many servers with ../shards.sh, drives them with
+# loadgen routing by user, and prints the total ops/s. Run from bench/
+# after building the server and benchmarks.
+#
+# usage: ./shard_scaling.sh [shard counts...] (default 1 2 4)
+#   SESSIONS, SECONDS_EACH, USERS and BASE_PORT override the defaults.
+
+COUNTS=${*:-1 2 4}
+SESSIONS=${SESSIONS:-8}
+SECONDS_EACH=${SECONDS_EACH:-10}
+USERS=${USERS:-4000}
+BASE_PORT=${BASE_PORT:-7101}
+DATA_DIR=$(mktemp -d)
+
+cd "$(dirname "$0")/.." || exit 1
+
+echo "cores: $(nproc), sessions: $SESSIONS, users: $USERS, ${SECONDS_EACH}s each"
+printf "%8s %12s %12s\n" shards ops_per_s speedup
+BASELINE=""
+
+for N in $COUNTS; do
+    ./shards.sh "$N" "$BASE_PORT" "$DATA_DIR/$N" -s 0 > /dev/null &
+    LAUNCHER=$!
+    sleep 1
+
+    LIST=$(seq -s, "$BASE_PORT" $((BASE_PORT + N - 1)))
+    OPS=$(bench/loadgen -h 127.0.0.1 -S "$LIST" -c "$SESSIONS" \
+              -d "$SECONDS_EACH" -u "$USERS" |
+          sed -n 's/.*"total".*"ops_per_s": \([0-9.]*\).*/\1/p')
+
+    kill "$LAUNCHER"
+    wait "$LAUNCHER" 2> /dev/null
+
+    if [ "$OPS" == "" ]; then
+        echo "loadgen failed with $N shards."
+        break
+    fi
+    BASELINE=${BASELINE:-$OPS}
+    awk -v n="$N" -v ops="$OPS" -v base="$BASELINE" \
+        'BEGIN { printf "%8d %12.1f %11.2fx\n", n, ops, ops / base }'
+done
+
+rm -rf "$DATA_DIR"
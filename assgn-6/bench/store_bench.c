@@ -0,0 +1,198 @@
+/**
+ * EECS 338 Operating Systems
+ * Case Western Reserve University
+ * (C) 2015 Christian Gunderman
+ */
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "mailbox.h"
+#include "msgidx.h"
+
+/*
+ * Message storage benchmark. Fills a number of mailboxes with messages
+ * using each storage strategy and reports resident memory and insert
+ * throughput. Each strategy runs in its own forked child so that one
+ * strategy's heap doesn't skew the next one's numbers.
+ *
+ * usage: ./store_bench [mailboxes] [messages_per_mailbox] [message_size]
+ */
+
+// Preprocessor Defines.
+#define DEFAULT_MAILBOXES 100000
+#define DEFAULT_MESSAGES 5
+#define DEFAULT_MESSAGE_SIZE 32
+
+typedef enum strategy_t {
+  CALLOC_X8 = 0,  // Original: calloc(len + 1, sizeof(char*)) per message.
+  MALLOC = 1,     // malloc(len + 1) per message.
+  SLAB = 2        // Shared slab, private arenas for big mailboxes.
+} strategy_t;
+
+static const char *kStrategyNames[] = { "calloc x8", "malloc", "slab" };
+
+/**
+ * Gets the resident set size of this process in bytes.
+ */
+static size_t resident_bytes() {
+  long pages = 0;
+  FILE *statm = fopen("/proc/self/statm", "r");
+
+  if (statm == NULL || fscanf(statm, "%*s %ld", &pages) != 1) {
+    perror("Unable to read /proc/self/statm");
+    exit(EXIT_FAILURE);
+  }
+  fclose(statm);
+
+  return pages * sysconf(_SC_PAGESIZE);
+}
+
+/**
+ * Gets a monotonic timestamp in seconds.
+ */
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * Inserts a message into a plain index, allocating it as strategy says,
+ * and frees whatever it replaced.
+ */
+static bool index_put(strategy_t strategy, MsgIdx *idx, int mnum,
+                      const char *message) {
+  size_t size = strlen(message) + 1;
+  char *msg = strategy == CALLOC_X8 ?
+    calloc(size, sizeof(char*)) : malloc(size);
+  void *old_msg;
+
+  if (msg == NULL) {
+    return false;
+  }
+  memcpy(msg, message, size);
+
+  if (!msgidx_put(idx, mnum, msg, &old_msg)) {
+    free(msg);
+    return false;
+  }
+  free(old_msg);
+  return true;
+}
+
+/**
+ * Frees a plain index along with each of its messages.
+ */
+static void index_free(MsgIdx *idx) {
+  for (int i = 0; i < msgidx_count(idx); i++) {
+    void *msg;
+    if (msgidx_at(idx, i, NULL, &msg)) {
+      free(msg);
+    }
+  }
+  msgidx_free(idx);
+}
+
+/**
+ * Runs one strategy and prints its results row.
+ */
+static void run_strategy(strategy_t strategy, int mailboxes, int messages,
+                         const char *message) {
+  void **boxes = calloc(mailboxes, sizeof(void*));
+  size_t base_rss = resident_bytes();
+
+  // Create all of the mailboxes first.
+  for (int i = 0; i < mailboxes; i++) {
+    boxes[i] = strategy == SLAB ? (void*)mailbox_new("bench") : (void*)msgidx_new();
+  }
+
+  // Round robin inserts across mailboxes, like many users receiving mail.
+  double start = now();
+  for (int m = 0; m < messages; m++) {
+    for (int i = 0; i < mailboxes; i++) {
+      bool ok = strategy == SLAB ?
+        mailbox_put(boxes[i], m, message) :
+        index_put(strategy, boxes[i], m, message);
+
+      if (!ok) {
+        printf("Insert failed, out of memory.\n");
+        exit(EXIT_FAILURE);
+      }
+    }
+  }
+  double insert_time = now() - start;
+  size_t rss = resident_bytes() - base_rss;
+
+  // Tear it all down, as if every user quit.
+  start = now();
+  for (int i = 0; i < mailboxes; i++) {
+    if (strategy == SLAB) {
+      mailbox_free(boxes[i]);
+    } else {
+      index_free(boxes[i]);
+    }
+  }
+  double quit_time = now() - start;
+
+  long inserts = (long)mailboxes * messages;
+  printf("%-10s %12.1f %14.1f %14.0f %12.1f\n",
+         kStrategyNames[strategy],
+         rss / 1048576.0,
+         (double)rss / mailboxes,
+         inserts / insert_time,
+         quit_time * 1e3);
+  free(boxes);
+}
+
+/**
+ * Application Entry point.
+ */
+int main(int argc, char* argv[]) {
+  int mailboxes = argc > 1 ? atoi(argv[1]) : DEFAULT_MAILBOXES;
+  int messages = argc > 2 ? atoi(argv[2]) : DEFAULT_MESSAGES;
+  int message_size = argc > 3 ? atoi(argv[3]) : DEFAULT_MESSAGE_SIZE;
+
+  if (mailboxes <= 0 || messages < 0 || message_size < 0) {
+    printf("usage: ./store_bench [mailboxes] [messages_per_mailbox] [message_size]\n");
+    return EXIT_FAILURE;
+  }
+
+  // Build a message of the requested length.
+  char *message = malloc(message_size + 1);
+  memset(message, 'm', message_size);
+  message[message_size] = '\0';
+
+  printf("%i mailboxes x %i messages x %i bytes\n",
+         mailboxes, messages, message_size);
+  printf("%-10s %12s %14s %14s %12s\n",
+         "strategy", "rss (MB)", "bytes/mailbox", "inserts/s", "quit (ms)");
+
+  // Run each strategy in a fresh child process.
+  for (strategy_t s = CALLOC_X8; s <= SLAB; s++) {
+    fflush(stdout);
+    pid_t pid = fork();
+
+    if (pid == -1) {
+      perror("Fork error");
+      return EXIT_FAILURE;
+    } else if (pid == 0) {
+      run_strategy(s, mailboxes, messages, message);
+      exit(EXIT_SUCCESS);
+    }
+
+    int status;
+    if (waitpid(pid, &status, 0) == -1 ||
+        !WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) {
+      printf("Strategy %s failed.\n", kStrategyNames[s]);
+      return EXIT_FAILURE;
+    }
+  }
+
+  free(message);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,58 @@
+#!/bin/bash
+#
+# EECS 338 Operating Systems
+# Case Western Reserve University
+# (C) 2015 Christian Gunderman
+#
+# Compares the shared memory transport against UDP and TCP RPC. Starts one
+# server serving all three, then for each session count drives it with
+# loadgen over each transport in turn, and prints the total ops/s and the
+# retrieve latency. Run from bench/ after building the server and
+# benchmarks.
+#
+# usage: ./transport_compare.sh [session counts...] (default 1 8)
+#   SECONDS_EACH, USERS, SIZE and PORT override the defaults.
+
+COUNTS=${*:-1 8}
+SECONDS_EACH=${SECONDS_EACH:-10}
+USERS=${USERS:-1000}
+SIZE=${SIZE:-64}
+PORT=${PORT:-7201}
+DATA_DIR=$(mktemp -d)
+SOCKET=$DATA_DIR/mailbox.sock
+
+cd "$(dirname "$0")/.." || exit 1
+
+server/server -d "$DATA_DIR/data" -s 0 -p "$PORT" -L "$SOCKET" > /dev/null &
+SERVER=$!
+sleep 1
+
+echo "cores: $(nproc), users: $USERS, message size: $SIZE, ${SECONDS_EACH}s each"
+printf "%9s %5s %12s %14s %14s\n" transport c ops_per_s retrieve_p50 retrieve_p99
+
+for C in $COUNTS; do
+    for T in shm udp tcp; do
+        case $T in
+        shm) ARGS=(-L "$SOCKET") ;;
+        udp) ARGS=(-h 127.0.0.1 -p "$PORT") ;;
+        tcp) ARGS=(-h 127.0.0.1 -p "$PORT" -T) ;;
+        esac
+
+        OUT=$(bench/loadgen "${ARGS[@]}" -c "$C" -d "$SECONDS_EACH" \
+                  -u "$USERS" -s "$SIZE")
+        OPS=$(echo "$OUT" |
+              sed -n 's/.*"total".*"ops_per_s": \([0-9.]*\).*/\1/p')
+        P50=$(echo "$OUT" | sed -n '/"retrieve"/{n;s/.*"p50": \([0-9.]*\).*/\1/p}')
+        P99=$(echo "$OUT" | sed -n '/"retrieve"/{n;s/.*"p99": \([0-9.]*\).*/\1/p}')
+
+        if [ "$OPS" == "" ]; then
+            echo "loadgen failed over $T with $C sessions."
+            continue
+        fi
+        printf "%9s %5d %12s %12sus %12sus\n" "$T" "$C" "$OPS" "$P50" "$P99"
+    done
+done
+
+kill "$SERVER"
+wait "$SERVER" 2> /dev/null
+rm -rf "$DATA_DIR"
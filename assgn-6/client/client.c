@@ -3,17 +3,43 @@
  * Case Western Reserve University
  * (C) 2015 Christian Gunderman
  */
+#define _XOPEN_SOURCE 700
+
+#include <stdbool.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <memory.h>
 #include <strings.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
 
 #include "proto.h"
+#include "shard.h"
+#include "shm.h"
 
 // RPC doesn't allow NULL strings, so, we pass unused params as an empty string.
 #define NULL_STR "\0"
-// Max length of a message sent to the server.
-#define MSG_MAX  80
+
+// Directory to cache retrieved messages in, if set in the environment.
+#define CACHE_ENV "MAILBOX_CACHE"
+#define CACHE_PATH_MAX 4096
+
+// Shards to route calls across, if set in the environment. See
+// protocol/shard.h for the format.
+#define SHARDS_ENV "MAILBOX_SHARDS"
+
+// Unix socket of a server on this machine to call through shared memory
+// instead, if set in the environment. See protocol/shm.h.
+#define LOCAL_ENV "MAILBOX_LOCAL"
+
+// The shards, and a client to each once it's been used. No shards means
+// every call goes to the one server given on the command line.
+static ShardAddr g_shards[SHARD_MAX];
+static CLIENT *g_shard_clients[SHARD_MAX];
+static int g_shard_count = 0;
 
 /*
  * Error codes array.
@@ -27,6 +53,34 @@ const char *kErrors[] = {
   "Mailbox is full or message number too big",
   "Invalid message number",
   "Message not exists",
+  "Message chunk out of order or too big",
+  "Session handle is stale",
+  "User belongs to another shard",
+};
+
+/*
+ * Procedure names, by procedure number - 1.
+ */
+const char *kProcs[] = {
+  "START",
+  "QUIT",
+  "INSERT_MESSAGE",
+  "RETRIEVE_MESSAGE",
+  "LIST_ALL_MESSAGES",
+  "DELETE_MESSAGE",
+  "SNAPSHOT",
+  "STATS",
+  "INSERT_CHUNK",
+  "RETRIEVE_CHUNK",
+  "OPEN",
+  "INSERT_MESSAGE_BY_HANDLE",
+  "RETRIEVE_MESSAGE_BY_HANDLE",
+  "LIST_ALL_MESSAGES_BY_HANDLE",
+  "DELETE_MESSAGE_BY_HANDLE",
+  "INSERT_MULTI",
+  "WAIT",
+  "RETRIEVE_IF_MODIFIED",
+  "SEARCH",
 };
 
 /*
@@ -75,36 +129,179 @@ MailboxResult mailbox_quit(CLIENT *clnt, char *user) {
 }
 
 /*
- * Get message from server RPC Call.
+ * Get message from server RPC Call. Fetched a chunk at a time and written
+ * to out as it arrives, so messages of any size use bounded memory. If tag
+ * isn't NULL it is set to the message's version.
  */
 MailboxResult mailbox_retrieve_message(CLIENT *clnt, char *user, int mnum,
-                                       char *message, int message_len) {
-  MailboxParams params;
+                                       FILE *out, u_quad_t *tag) {
+  MailboxChunkParams params;
+  u_int total = 0;
+  u_quad_t version = 0;
 
   // Zero (null) and structs and values.
   memset(&params, 0, sizeof(params));
 
   params.user = user;
-  params.message = NULL_STR;
   params.mnum = mnum;
 
-  // Create get message from the server.
-  MailboxMessageResponse *result = mailbox_retrieve_message_1(&params, clnt);
+  do {
+    // Get the next chunk from the server.
+    MailboxChunkResponse *result = mailbox_retrieve_chunk_1(&params, clnt);
+    if (result == NULL) {
+      clnt_perror (clnt, "Retrieve message call failed.");
+      exit(1);
+    }
+
+    if (result->result != MailboxResultSuccess) {
+      return result->result;
+    }
+
+    // The message was replaced part way through.
+    if (params.offset != 0 &&
+        (result->total != total || result->tag != version)) {
+      clnt_freeres(clnt, (xdrproc_t)xdr_MailboxChunkResponse, (caddr_t)result);
+      return MailboxResultBadChunk;
+    }
+    total = result->total;
+    version = result->tag;
+
+    fwrite(result->data.data_val, 1, result->data.data_len, out);
+    params.offset += result->data.data_len;
+    clnt_freeres(clnt, (xdrproc_t)xdr_MailboxChunkResponse, (caddr_t)result);
+  } while (params.offset < total);
+
+  if (tag != NULL) {
+    *tag = version;
+  }
+  return MailboxResultSuccess;
+}
+
+/*
+ * Builds the path user's message mnum is cached at in dir. Anything in the
+ * user name that isn't safe in a file name is hex escaped.
+ */
+static void cache_path(char *path, const char *dir, const char *user,
+                       int mnum) {
+  int len = snprintf(path, CACHE_PATH_MAX, "%s/", dir);
+
+  for (const char *c = user; *c != '\0' && len < CACHE_PATH_MAX - 16; c++) {
+    if ((*c >= 'a' && *c <= 'z') || (*c >= 'A' && *c <= 'Z') ||
+        (*c >= '0' && *c <= '9') || *c == '-' || *c == '_' || *c == '@') {
+      path[len++] = *c;
+    } else {
+      len += sprintf(path + len, "%%%02X", (unsigned char)*c);
+    }
+  }
+  snprintf(path + len, CACHE_PATH_MAX - len, ".%i", mnum);
+}
+
+/*
+ * Copies the rest of in to out.
+ */
+static void copy_file(FILE *in, FILE *out) {
+  char buf[MAX_CHUNK];
+  size_t len;
+
+  while ((len = fread(buf, 1, sizeof(buf), in)) > 0) {
+    fwrite(buf, 1, len, out);
+  }
+}
+
+/*
+ * Get message from server RPC Call, through the on disk cache in dir. Each
+ * cached message is a file holding its version on the first line and then
+ * the message. The server is asked for the message only if it has a
+ * different version, so rereading one that hasn't changed costs a tiny
+ * request and reply instead of the whole message.
+ */
+MailboxResult mailbox_retrieve_cached(CLIENT *clnt, const char *dir,
+                                      char *user, int mnum, FILE *out) {
+  MailboxCachedParams params;
+  char path[CACHE_PATH_MAX];
+  char tmp_path[CACHE_PATH_MAX + 1];
+  unsigned long long tag = 0;
+
+  cache_path(path, dir, user, mnum);
+  FILE *cached = fopen(path, "r");
+  if (cached != NULL && fscanf(cached, "%llu\n", &tag) != 1) {
+    tag = 0;
+  }
+
+  // Store data.
+  params.user = user;
+  params.mnum = mnum;
+  params.tag = tag;
+
+  // Ask for it unless it's what we have.
+  MailboxCachedResponse *result = mailbox_retrieve_if_modified_1(&params, clnt);
   if (result == NULL) {
-    clnt_perror (clnt, "Retrieve message call failed.");
+    clnt_perror (clnt, "Retrieve if modified call failed.");
     exit(1);
   }
 
-  strncpy(message, result->message, message_len-1);
+  if (result->result != MailboxResultSuccess || !result->modified) {
+    MailboxResult status = result->result;
+    if (status == MailboxResultSuccess) {
+      copy_file(cached, out);
+    }
+    if (cached != NULL) {
+      fclose(cached);
+    }
+    clnt_freeres(clnt, (xdrproc_t)xdr_MailboxCachedResponse, (caddr_t)result);
+    return status;
+  }
+
+  if (cached != NULL) {
+    fclose(cached);
+  }
 
-  return (*result).result;
+  // Fetch it into a new cache file, which replaces the old one if it all
+  // arrives as the version we were told about.
+  mkdir(dir, 0755);
+  snprintf(tmp_path, sizeof(tmp_path), "%s~", path);
+  FILE *fresh = fopen(tmp_path, "w+");
+  if (fresh == NULL) {
+    perror("Unable to write message cache");
+    exit(1);
+  }
+  fprintf(fresh, "%llu\n", (unsigned long long)result->tag);
+  long start = ftell(fresh);
+
+  MailboxResult status = MailboxResultSuccess;
+  u_quad_t fetched = result->tag;
+  if (result->total <= MAX_CHUNK) {
+    fwrite(result->message, 1, result->total, fresh);
+  } else {
+    status = mailbox_retrieve_message(clnt, user, mnum, fresh, &fetched);
+  }
+
+  bool keep = status == MailboxResultSuccess && fetched == result->tag &&
+              fflush(fresh) == 0;
+  clnt_freeres(clnt, (xdrproc_t)xdr_MailboxCachedResponse, (caddr_t)result);
+
+  if (status == MailboxResultSuccess) {
+    fseek(fresh, start, SEEK_SET);
+    copy_file(fresh, out);
+  }
+  fclose(fresh);
+
+  if (!keep || rename(tmp_path, path) == -1) {
+    unlink(tmp_path);
+  }
+  return status;
 }
 
 /*
- * List all messages from server call.
+ * List all messages from server call. Each message's number and length
+ * are put in mnums and totals. A message shorter than its total didn't fit
+ * in the reply and has to be retrieved on its own. The messages are copies,
+ * since a shared memory reply is overwritten by the next call, and must be
+ * freed.
  */
 MailboxResult mailbox_list_all_messages(CLIENT *clnt, char *user,
-                                        char **messages, int max_email) {
+                                        char **messages, int *mnums,
+                                        u_int *totals, int max_email) {
   MailboxParams params;
 
   // Zero (null) and structs and values.
@@ -123,20 +320,73 @@ MailboxResult mailbox_list_all_messages(CLIENT *clnt, char *user,
   }
 
   // Store all of the messages in an array.
-  for (int i = 0; i < MAX_EMAIL &&
-         strcmp(result->messages[i], NULL_STR) != 0; i++) {
-      messages[i] = result->messages[i];
+  for (int i = 0; i < MAX_EMAIL && i < max_email &&
+         result->mnums[i] != -1; i++) {
+      messages[i] = strdup(result->messages[i]);
+      if (messages[i] == NULL) {
+        perror("Unable to copy message");
+        exit(1);
+      }
+      mnums[i] = result->mnums[i];
+      totals[i] = result->totals[i];
   }
 
   return (*result).result;
 }
 
 /*
- * Create new message and insert into specified index RPC Call.
+ * Insert a message read from in, total bytes long, in MAX_CHUNK pieces
+ * RPC Call. Only one chunk is held in memory at a time.
+ */
+MailboxResult mailbox_insert_chunks(CLIENT *clnt, char *user, int mnum,
+                                    FILE *in, u_int total) {
+  MailboxChunkParams params;
+  char chunk[MAX_CHUNK];
+
+  params.user = user;
+  params.mnum = mnum;
+  params.total = total;
+  params.offset = 0;
+  params.data.data_val = chunk;
+
+  do {
+    params.data.data_len = fread(chunk, 1, MAX_CHUNK, in);
+    if (params.data.data_len == 0 && params.offset < total) {
+      printf("Message ended early.\n");
+      exit(1);
+    }
+
+    // Send the chunk to the server.
+    MailboxResult *result = mailbox_insert_chunk_1(&params, clnt);
+    if (result == (MailboxResult *) NULL) {
+      clnt_perror (clnt, "Insert chunk call failed.");
+      exit(1);
+    }
+
+    if (*result != MailboxResultSuccess) {
+      return *result;
+    }
+    params.offset += params.data.data_len;
+  } while (params.offset < total);
+
+  return MailboxResultSuccess;
+}
+
+/*
+ * Create new message and insert into specified index RPC Call. Messages
+ * too big for one request are sent in chunks.
  */
 MailboxResult mailbox_insert_message(CLIENT *clnt, char *user, int mnum, char *message) {
   MailboxParams params;
 
+  if (strlen(message) > MAX_CHUNK) {
+    FILE *in = fmemopen(message, strlen(message), "r");
+    MailboxResult result = mailbox_insert_chunks(clnt, user, mnum, in,
+                                                 strlen(message));
+    fclose(in);
+    return result;
+  }
+
   // Store data.
   params.user = user;
   params.message = message;
@@ -152,6 +402,112 @@ MailboxResult mailbox_insert_message(CLIENT *clnt, char *user, int mnum, char *m
   return *result;
 }
 
+/*
+ * Insert one message into several users' mailboxes RPC Call. The server
+ * stores the body once for all of them. delivered is set to how many got
+ * it.
+ */
+MailboxResult mailbox_insert_multi(CLIENT *clnt, char **users, int count,
+                                   int mnum, char *message, int *delivered) {
+  MailboxMultiParams params;
+
+  // Store data.
+  params.users.users_val = users;
+  params.users.users_len = count;
+  params.message = message;
+  params.mnum = mnum;
+
+  // Create message on the server.
+  MailboxMultiResponse *result = mailbox_insert_multi_1(&params, clnt);
+  if (result == NULL) {
+    clnt_perror (clnt, "Insert multi call failed.");
+    exit(1);
+  }
+
+  *delivered = result->delivered;
+  return result->result;
+}
+
+/*
+ * Wait for a mailbox to change RPC Call. Blocks for up to timeout seconds
+ * until the mailbox is past version, and fills in result with its new
+ * version and what changed.
+ */
+MailboxResult mailbox_wait(CLIENT *clnt, char *user, u_quad_t version,
+                           int timeout, MailboxWaitResponse *result) {
+  MailboxWaitParams params;
+  struct timeval total;
+
+  // Store data.
+  params.user = user;
+  params.since = version;
+  params.timeout_ms = timeout * 1000;
+
+  // Give the server the whole wait and a bit to answer in.
+  total.tv_sec = timeout + 5;
+  total.tv_usec = 0;
+  clnt_control(clnt, CLSET_TIMEOUT, (char*)&total);
+
+  // Wait on the server.
+  MailboxWaitResponse *response = mailbox_wait_1(&params, clnt);
+  if (response == NULL) {
+    clnt_perror (clnt, "Wait call failed.");
+    exit(1);
+  }
+
+  *result = *response;
+  return result->result;
+}
+
+/*
+ * Search messages RPC Call. Sets mnums to the numbers of up to max of the
+ * best matches, best first, count to how many that is and total to how
+ * many matched in all.
+ */
+MailboxResult mailbox_search(CLIENT *clnt, char *user, char *query,
+                             int *mnums, int max, int *count, int *total) {
+  MailboxSearchParams params;
+
+  params.user = user;
+  params.query = query;
+
+  MailboxSearchResponse *result = mailbox_search_1(&params, clnt);
+  if (result == NULL) {
+    clnt_perror (clnt, "Search call failed.");
+    exit(1);
+  }
+
+  MailboxResult status = result->result;
+  *count = 0;
+  *total = result->total;
+  for (u_int i = 0; i < result->mnums.mnums_len && *count < max; i++) {
+    mnums[(*count)++] = result->mnums.mnums_val[i];
+  }
+
+  clnt_freeres(clnt, (xdrproc_t)xdr_MailboxSearchResponse, (caddr_t)result);
+  return status;
+}
+
+/*
+ * Insert the contents of a file as a message.
+ */
+MailboxResult mailbox_insert_file(CLIENT *clnt, char *user, int mnum,
+                                  char *path) {
+  FILE *in = fopen(path, "r");
+  if (in == NULL) {
+    perror("Unable to open message file");
+    exit(1);
+  }
+
+  fseek(in, 0, SEEK_END);
+  long total = ftell(in);
+  fseek(in, 0, SEEK_SET);
+
+  MailboxResult result = mailbox_insert_chunks(clnt, user, mnum, in, total);
+  fclose(in);
+  return result;
+}
+
 /*
  * Delete message at specified index RPC Call.
  */
@@ -173,6 +529,253 @@ MailboxResult mailbox_delete_message(CLIENT *clnt, char *user, int mnum) {
   return *result;
 }
 
+/*
+ * Start a background snapshot of the server RPC Call.
+ */
+MailboxResult mailbox_snapshot(CLIENT *clnt) {
+  MailboxParams params;
+
+  // Zero (null) and structs and values.
+  memset(&params, 0, sizeof(params));
+
+  params.user = NULL_STR;
+  params.message = NULL_STR;
+
+  // Ask the server to snapshot itself.
+  MailboxResult *result = mailbox_snapshot_1(&params, clnt);
+  if (result == (MailboxResult *) NULL) {
+    clnt_perror (clnt, "Snapshot call failed.");
+    exit(1);
+  }
+
+  return *result;
+}
+
+/*
+ * Get server statistics RPC Call.
+ */
+MailboxResult mailbox_stats(CLIENT *clnt, MailboxStatsResponse *stats) {
+  MailboxParams params;
+
+  // Zero (null) and structs and values.
+  memset(&params, 0, sizeof(params));
+
+  params.user = NULL_STR;
+  params.message = NULL_STR;
+
+  // Get the statistics from the server.
+  MailboxStatsResponse *result = mailbox_stats_1(&params, clnt);
+  if (result == NULL) {
+    clnt_perror (clnt, "Stats call failed.");
+    exit(1);
+  }
+
+  *stats = *result;
+  return (*result).result;
+}
+
+/*
+ * Gets the latency, in microseconds, under which the given fraction of a
+ * procedure's calls completed. Bucket i of the histogram holds calls under
+ * 2^i microseconds. Returns -1 if that's in the open ended last bucket.
+ */
+static long latency_percentile(MailboxProcStats *proc, double fraction) {
+  u_quad_t seen = 0;
+
+  for (int i = 0; i < LATENCY_BUCKETS; i++) {
+    seen += proc->latency[i];
+    if (seen >= fraction * proc->calls) {
+      return i < LATENCY_BUCKETS - 1 ? 1L << i : -1;
+    }
+  }
+  return -1;
+}
+
+/*
+ * Prints a latency percentile column.
+ */
+static void print_percentile(MailboxProcStats *proc, double fraction) {
+  long us = latency_percentile(proc, fraction);
+
+  if (us == -1) {
+    printf(" %9s", "slower");
+  } else {
+    printf(" %7ldus", us);
+  }
+}
+
+/*
+ * Prints server statistics.
+ */
+static void print_stats(MailboxStatsResponse *stats) {
+  printf("%-28s %10s %8s %9s %9s %9s\n",
+         "Procedure", "Calls", "Errors", "p50 <", "p99 <", "max <");
+  for (int i = 0; i < MAILBOX_PROCS; i++) {
+    MailboxProcStats *proc = &stats->procs[i];
+
+    if (proc->calls == 0) {
+      continue;
+    }
+
+    printf("%-28s %10llu %8llu", kProcs[i],
+           (unsigned long long)proc->calls, (unsigned long long)proc->errors);
+    print_percentile(proc, 0.50);
+    print_percentile(proc, 0.99);
+    print_percentile(proc, 1.0);
+    printf("\n");
+  }
+
+  printf("\nResults:\n");
+  for (int i = 0; i < MAILBOX_RESULTS; i++) {
+    if (stats->results[i] != 0) {
+      printf("  %-42s %10llu\n", kErrors[i],
+             (unsigned long long)stats->results[i]);
+    }
+  }
+
+  printf("\nUsers:          %llu\n", (unsigned long long)stats->users);
+  printf("Messages:       %llu\n", (unsigned long long)stats->messages);
+  printf("Message bytes:  %llu\n", (unsigned long long)stats->message_bytes);
+  printf("Storage bytes:  %llu\n", (unsigned long long)stats->storage_bytes);
+
+  if (stats->shared_references != 0) {
+    printf("\nShared bodies:  %llu, %llu references\n",
+           (unsigned long long)stats->shared_bodies,
+           (unsigned long long)stats->shared_references);
+    printf("Shared bytes:   %llu\n", (unsigned long long)stats->shared_bytes);
+    printf("Dedup saved:    %llu bytes (%.1fx)\n",
+           (unsigned long long)stats->dedup_saved_bytes,
+           (double)(stats->shared_bytes + stats->dedup_saved_bytes) /
+           stats->shared_bytes);
+  }
+
+  if (stats->memory_budget != 0) {
+    MailboxProcStats *loads = &stats->mailbox_loads;
+    unsigned long long lookups = stats->mailbox_hits + loads->calls;
+
+    printf("\nMemory budget:  %llu bytes, %llu in use\n",
+           (unsigned long long)stats->memory_budget,
+           (unsigned long long)stats->resident_bytes);
+    printf("Spilled users:  %llu, %llu evictions\n",
+           (unsigned long long)stats->spilled_users,
+           (unsigned long long)stats->mailbox_evictions);
+    printf("Lookups:        %llu hits, %llu loads (%.1f%% hit rate)\n",
+           (unsigned long long)stats->mailbox_hits,
+           (unsigned long long)loads->calls,
+           lookups != 0 ? 100.0 * stats->mailbox_hits / lookups : 100.0);
+    if (loads->calls != 0) {
+      printf("Load latency:  ");
+      print_percentile(loads, 0.5);
+      print_percentile(loads, 0.99);
+      printf(" (%llu failed)\n", (unsigned long long)loads->errors);
+    }
+  }
+}
+
+/*
+ * Creates a client straight to a shard's port. Shards share a host, so
+ * they can't all register with the portmapper.
+ */
+static CLIENT *connect_shard(ShardAddr *shard) {
+  struct addrinfo hints, *res;
+  struct sockaddr_in addr;
+  struct timeval retry = { 1, 0 };
+  int sock = RPC_ANYSOCK;
+
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_INET;
+  if (getaddrinfo(shard->host, NULL, &hints, &res) != 0) {
+    return NULL;
+  }
+  memcpy(&addr, res->ai_addr, sizeof(addr));
+  addr.sin_port = htons(shard->port);
+  freeaddrinfo(res);
+
+  return clntudp_create(&addr, MAILBOX_PROG, MAILBOX_VERSION, retry, &sock);
+}
+
+/*
+ * Gets the client for shard i, connecting on first use.
+ */
+static CLIENT *shard_client(int i) {
+  if (g_shard_clients[i] == NULL) {
+    g_shard_clients[i] = connect_shard(&g_shards[i]);
+    if (g_shard_clients[i] == NULL) {
+      clnt_pcreateerror(g_shards[i].host);
+      exit(1);
+    }
+  }
+  return g_shard_clients[i];
+}
+
+/*
+ * Gets the client to send a call about user to: the owning shard's if
+ * calls are sharded, otherwise clnt.
+ */
+static CLIENT *route(CLIENT *clnt, const char *user) {
+  if (g_shard_count == 0) {
+    return clnt;
+  }
+  return shard_client(shard_of(user, g_shard_count));
+}
+
+/*
+ * Sends a message to several users, split up into one call per shard they
+ * belong to when sharded. delivered is the total, and the result the first
+ * failure.
+ */
+static MailboxResult insert_multi(CLIENT *clnt, char **users, int count,
+                                  int mnum, char *message, int *delivered) {
+  if (g_shard_count == 0) {
+    return mailbox_insert_multi(clnt, users, count, mnum, message, delivered);
+  }
+
+  MailboxResult result = MailboxResultSuccess;
+  char **mine = malloc(count * sizeof(char*));
+  if (mine == NULL) {
+    perror("Unable to split recipients");
+    exit(1);
+  }
+
+  *delivered = 0;
+  for (int i = 0; i < g_shard_count; i++) {
+    int mine_count = 0;
+    int shard_delivered;
+
+    for (int j = 0; j < count; j++) {
+      if (shard_of(users[j], g_shard_count) == i) {
+        mine[mine_count++] = users[j];
+      }
+    }
+    if (mine_count == 0) {
+      continue;
+    }
+
+    MailboxResult status = mailbox_insert_multi(shard_client(i), mine,
+                                                mine_count, mnum, message,
+                                                &shard_delivered);
+    *delivered += shard_delivered;
+    if (status != MailboxResultSuccess && result == MailboxResultSuccess) {
+      result = status;
+    }
+  }
+
+  free(mine);
+  return result;
+}
+
+/*
+ * Retrieves a message, through the cache if one is set up.
+ */
+static MailboxResult retrieve(CLIENT *clnt, char *user, int mnum, FILE *out) {
+  const char *dir = getenv(CACHE_ENV);
+
+  if (dir != NULL && dir[0] != '\0') {
+    return mailbox_retrieve_cached(clnt, dir, user, mnum, out);
+  }
+  return mailbox_retrieve_message(clnt, user, mnum, out, NULL);
+}
+
 /*
  * Print application usage info.
  */
@@ -184,8 +787,22 @@ static void print_help() {
   printf("  ./client [hostname] quit [user] ...\n");
   printf("  ./client [hostname] insert_message [user] [msg_num] [msg]\n");
   printf("  ./client [hostname] retrieve_message [user] [msg_num]\n");
+  printf("  ./client [hostname] insert_multi [msg_num] [msg] [user] ...\n");
+  printf("  ./client [hostname] insert_file [user] [msg_num] [path]\n");
+  printf("  ./client [hostname] retrieve_file [user] [msg_num] [path]\n");
   printf("  ./client [hostname] list_all_messages [user]\n");
   printf("  ./client [hostname] delete_message [user] [msg_num] [msg]\n");
+  printf("  ./client [hostname] wait [user] [version] [timeout_s]\n");
+  printf("  ./client [hostname] search [user] [term] ...\n");
+  printf("  ./client [hostname] snapshot\n");
+  printf("  ./client [hostname] stats\n");
+  printf("Set %s to a directory to cache retrieved messages there.\n",
+         CACHE_ENV);
+  printf("Set %s to a list of shard ports or host:ports, e.g. 7001,7002,\n"
+         "to route each user's calls to the shard that owns them.\n",
+         SHARDS_ENV);
+  printf("Set %s to the socket path of a server on this machine, see\n"
+         "server -L, to call it through shared memory.\n", LOCAL_ENV);
 
   // Ascii art courtesy of cowsay unix util.
   printf(" _______________________________________\n");
@@ -210,11 +827,27 @@ int main (int argc, char *argv[]) {
     print_help();
   }
 
-  // Generate client.
-  clnt = clnt_create (argv[1], MAILBOX_PROG, MAILBOX_VERSION, "udp");
-  if (clnt == NULL) {
-    clnt_pcreateerror (argv[1]);
-    exit (1);
+  // Generate client, or clients per shard as they're needed.
+  const char *shards = getenv(SHARDS_ENV);
+  const char *local = getenv(LOCAL_ENV);
+  if (local != NULL && local[0] != '\0') {
+    clnt = clntshm_create(local);
+    if (clnt == NULL) {
+      clnt_pcreateerror (local);
+      exit (1);
+    }
+  } else if (shards != NULL && shards[0] != '\0') {
+    g_shard_count = shard_parse(shards, argv[1], g_shards, SHARD_MAX);
+    if (g_shard_count <= 0) {
+      printf("Bad %s, expected a list like 7001,7002.\n", SHARDS_ENV);
+      exit(1);
+    }
+  } else {
+    clnt = clnt_create (argv[1], MAILBOX_PROG, MAILBOX_VERSION, "udp");
+    if (clnt == NULL) {
+      clnt_pcreateerror (argv[1]);
+      exit (1);
+    }
   }
 
   // Perform desired action.
@@ -223,37 +856,152 @@ int main (int argc, char *argv[]) {
     if (argc < 4) {
       print_help();
     }
-    result = mailbox_start(clnt, argv[3]);
+    result = mailbox_start(route(clnt, argv[3]), argv[3]);
   } else if (strcasecmp(argv[2], "QUIT") == 0) {
     if (argc < 4) {
       print_help();
     }
-    result = mailbox_quit(clnt, argv[3]);
+    result = mailbox_quit(route(clnt, argv[3]), argv[3]);
   } else if (strcasecmp(argv[2], "INSERT_MESSAGE") == 0) {
     if (argc < 6) {
       print_help();
     }
-    result = mailbox_insert_message(clnt, argv[3], atoi(argv[4]), argv[5]);
+    result = mailbox_insert_message(route(clnt, argv[3]), argv[3],
+                                    atoi(argv[4]), argv[5]);
   } else if (strcasecmp(argv[2], "RETRIEVE_MESSAGE") == 0) {
-    char message[MSG_MAX] = "";
     if (argc < 5) {
       print_help();
     }
-    result = mailbox_retrieve_message(clnt, argv[3], atoi(argv[4]), message, MSG_MAX);
-    printf(message);
+    result = retrieve(route(clnt, argv[3]), argv[3], atoi(argv[4]), stdout);
+  } else if (strcasecmp(argv[2], "INSERT_MULTI") == 0) {
+    if (argc < 6) {
+      print_help();
+    }
+    int delivered;
+    result = insert_multi(clnt, argv + 5, argc - 5, atoi(argv[3]), argv[4],
+                          &delivered);
+    printf("Delivered to %i of %i.\n", delivered, argc - 5);
+  } else if (strcasecmp(argv[2], "INSERT_FILE") == 0) {
+    if (argc < 6) {
+      print_help();
+    }
+    result = mailbox_insert_file(route(clnt, argv[3]), argv[3], atoi(argv[4]),
+                                 argv[5]);
+  } else if (strcasecmp(argv[2], "RETRIEVE_FILE") == 0) {
+    if (argc < 6) {
+      print_help();
+    }
+    FILE *out = fopen(argv[5], "w");
+    if (out == NULL) {
+      perror("Unable to create message file");
+      exit(1);
+    }
+    result = retrieve(route(clnt, argv[3]), argv[3], atoi(argv[4]), out);
+    fclose(out);
   } else if (strcasecmp(argv[2], "DELETE_MESSAGE") == 0) {
     if (argc < 5) {
       print_help();
     }
-    result = mailbox_delete_message(clnt, argv[3], atoi(argv[4]));
+    result = mailbox_delete_message(route(clnt, argv[3]), argv[3],
+                                    atoi(argv[4]));
   } else if (strcasecmp(argv[2], "LIST_ALL_MESSAGES") == 0) {
     if (argc < 4) {
       print_help();
     }
     char *messages[MAX_EMAIL];
-    result = mailbox_list_all_messages(clnt, argv[3], messages, MAX_EMAIL);
+    int mnums[MAX_EMAIL];
+    u_int totals[MAX_EMAIL];
+    CLIENT *shard = route(clnt, argv[3]);
+    result = mailbox_list_all_messages(shard, argv[3], messages, mnums,
+                                       totals, MAX_EMAIL);
     for (int i = 0; i < MAX_EMAIL && messages[i] != NULL; i++) {
-      printf("* %s\n", messages[i]);
+      // Too big to come with the list, so fetch it in chunks.
+      if (strlen(messages[i]) < totals[i]) {
+        printf("* ");
+        fflush(stdout);
+        retrieve(shard, argv[3], mnums[i], stdout);
+        printf("\n");
+      } else {
+        printf("* %s\n", messages[i]);
+      }
+      free(messages[i]);
+    }
+  } else if (strcasecmp(argv[2], "WAIT") == 0) {
+    if (argc < 6) {
+      print_help();
+    }
+    MailboxWaitResponse wait;
+    result = mailbox_wait(route(clnt, argv[3]), argv[3],
+                          strtoull(argv[4], NULL, 10), atoi(argv[5]), &wait);
+    if (result == MailboxResultSuccess) {
+      printf("Version %llu%s:", (unsigned long long)wait.current,
+             wait.resync ? ", list everything again" : "");
+      for (u_int i = 0; i < wait.changed.changed_len; i++) {
+        printf(" %i", wait.changed.changed_val[i]);
+      }
+      printf("\n");
+    }
+  } else if (strcasecmp(argv[2], "SEARCH") == 0) {
+    if (argc < 5) {
+      print_help();
+    }
+
+    // Terms may be given as separate arguments or one quoted one.
+    size_t len = 1;
+    for (int i = 4; i < argc; i++) {
+      len += strlen(argv[i]) + 1;
+    }
+    char *query = calloc(len, 1);
+    if (query == NULL) {
+      perror("Unable to build query");
+      exit(1);
+    }
+    for (int i = 4; i < argc; i++) {
+      strcat(strcat(query, argv[i]), " ");
+    }
+
+    int mnums[MAX_HITS];
+    int count, total;
+    result = mailbox_search(route(clnt, argv[3]), argv[3], query, mnums,
+                            MAX_HITS, &count, &total);
+    if (result == MailboxResultSuccess) {
+      for (int i = 0; i < count; i++) {
+        printf("* %i\n", mnums[i]);
+      }
+      printf("%i of %i matches.\n", count, total);
+    }
+    free(query);
+  } else if (strcasecmp(argv[2], "SNAPSHOT") == 0) {
+    // Every shard takes its own.
+    if (g_shard_count == 0) {
+      result = mailbox_snapshot(clnt);
+    }
+    for (int i = 0; i < g_shard_count; i++) {
+      MailboxResult status = mailbox_snapshot(shard_client(i));
+      if (i == 0 || (status != MailboxResultSuccess &&
+                     result == MailboxResultSuccess)) {
+        result = status;
+      }
+    }
+  } else if (strcasecmp(argv[2], "STATS") == 0) {
+    MailboxStatsResponse stats;
+    if (g_shard_count == 0) {
+      result = mailbox_stats(clnt, &stats);
+      if (result == MailboxResultSuccess) {
+        print_stats(&stats);
+      }
+    }
+    for (int i = 0; i < g_shard_count; i++) {
+      printf("%sShard %i of %i, %s:%i\n", i == 0 ? "" : "\n", i,
+             g_shard_count, g_shards[i].host, g_shards[i].port);
+      MailboxResult status = mailbox_stats(shard_client(i), &stats);
+      if (status == MailboxResultSuccess) {
+        print_stats(&stats);
+      }
+      if (i == 0 || (status != MailboxResultSuccess &&
+                     result == MailboxResultSuccess)) {
+        result = status;
+      }
     }
   } else {
     print_help();
@@ -266,7 +1014,14 @@ int main (int argc, char *argv[]) {
     printf("Error: %s\n", kErrors[result]);
   }
 
-  // Free client.
-  clnt_destroy(clnt);
+  // Free clients.
+  if (clnt != NULL) {
+    clnt_destroy(clnt);
+  }
+  for (int i = 0; i < g_shard_count; i++) {
+    if (g_shard_clients[i] != NULL) {
+      clnt_destroy(g_shard_clients[i]);
+    }
+  }
   exit(0);
 }
@@ -21,12 +21,16 @@ enum MailboxResult {
   MailboxResultUserNotExists = 4,
   MailboxResultMailboxFull = 5,
   MailboxResultInvalidMnum = 6,
-  MailboxResultMessageNotExists = 7
+  MailboxResultMessageNotExists = 7,
+  MailboxResultBadChunk = 8,
+  MailboxResultBadHandle = 9,
+  MailboxResultWrongShard = 10
 };
 
 struct MailboxMessageResponse {
   MailboxResult result;
-  str message;
+  str message;         /* Empty if over MAX_CHUNK, use RETRIEVE_CHUNK. */
+  unsigned int total;  /* Length of the whole message. */
 };
 typedef struct MailboxMessageResponse MailboxMessageResponse;
 
@@ -34,10 +38,140 @@ const MAX_EMAIL = 20;
 
 struct MailboxMessageListResponse {
   MailboxResult result;
-  str messages[MAX_EMAIL];
+  str messages[MAX_EMAIL];         /* Empty past MAX_CHUNK between them. */
+  int mnums[MAX_EMAIL];            /* -1 past the last message. */
+  unsigned int totals[MAX_EMAIL];  /* Length of each whole message. */
 };
 typedef struct MailboxMessageListResponse MailboxMessageListResponse;
 
+const MAILBOX_PROCS = 19;
+const MAILBOX_RESULTS = 11;
+const LATENCY_BUCKETS = 20;
+
+struct MailboxProcStats {
+  unsigned hyper calls;
+  unsigned hyper errors;
+  unsigned hyper latency[LATENCY_BUCKETS];
+};
+typedef struct MailboxProcStats MailboxProcStats;
+
+struct MailboxStatsResponse {
+  MailboxResult result;
+  MailboxProcStats procs[MAILBOX_PROCS];
+  unsigned hyper results[MAILBOX_RESULTS];
+  unsigned hyper users;
+  unsigned hyper messages;
+  unsigned hyper message_bytes;
+  unsigned hyper storage_bytes;
+  unsigned hyper shared_bodies;
+  unsigned hyper shared_references;
+  unsigned hyper shared_bytes;
+  unsigned hyper dedup_saved_bytes;
+  unsigned hyper memory_budget;     /* 0 if unlimited. */
+  unsigned hyper resident_bytes;    /* What counts against the budget. */
+  unsigned hyper spilled_users;     /* Mailboxes only on disk right now. */
+  unsigned hyper mailbox_hits;      /* Lookups that found it in memory. */
+  unsigned hyper mailbox_evictions;
+  MailboxProcStats mailbox_loads;   /* Lookups that read it from disk. */
+};
+typedef struct MailboxStatsResponse MailboxStatsResponse;
+
+const MAX_CHUNK = 8000;
+
+struct MailboxChunkParams {
+  str user;
+  int mnum;
+  unsigned int total;
+  unsigned int offset;
+  opaque data<MAX_CHUNK>;
+};
+typedef struct MailboxChunkParams MailboxChunkParams;
+
+struct MailboxChunkResponse {
+  MailboxResult result;
+  unsigned int total;
+  unsigned int offset;
+  unsigned hyper tag;  /* Version of the message the chunk is from. */
+  opaque data<MAX_CHUNK>;
+};
+typedef struct MailboxChunkResponse MailboxChunkResponse;
+
+struct MailboxHandleParams {
+  unsigned hyper handle;
+  int mnum;
+  str message;
+};
+typedef struct MailboxHandleParams MailboxHandleParams;
+
+struct MailboxOpenResponse {
+  MailboxResult result;
+  unsigned hyper handle;
+};
+typedef struct MailboxOpenResponse MailboxOpenResponse;
+
+const MAX_RECIPIENTS = 1024;
+
+struct MailboxMultiParams {
+  str users<MAX_RECIPIENTS>;
+  int mnum;
+  str message;
+};
+typedef struct MailboxMultiParams MailboxMultiParams;
+
+struct MailboxMultiResponse {
+  MailboxResult result;
+  int delivered;
+};
+typedef struct MailboxMultiResponse MailboxMultiResponse;
+
+const MAX_CHANGES = 64;
+
+struct MailboxWaitParams {
+  str user;
+  unsigned hyper since;    /* Version the client has seen. */
+  unsigned int timeout_ms;
+};
+typedef struct MailboxWaitParams MailboxWaitParams;
+
+struct MailboxWaitResponse {
+  MailboxResult result;
+  unsigned hyper current;  /* Version the mailbox is at now. */
+  bool resync;
+  int changed<MAX_CHANGES>;
+};
+typedef struct MailboxWaitResponse MailboxWaitResponse;
+
+struct MailboxCachedParams {
+  str user;
+  int mnum;
+  unsigned hyper tag;  /* Version the client holds, 0 for none. */
+};
+typedef struct MailboxCachedParams MailboxCachedParams;
+
+struct MailboxCachedResponse {
+  MailboxResult result;
+  bool modified;
+  unsigned hyper tag;
+  unsigned int total;
+  str message;  /* Empty unless modified and total <= MAX_CHUNK. */
+};
+typedef struct MailboxCachedResponse MailboxCachedResponse;
+
+const MAX_HITS = 100;
+
+struct MailboxSearchParams {
+  str user;
+  str query;  /* Terms that must all appear, "term*" for a prefix. */
+};
+typedef struct MailboxSearchParams MailboxSearchParams;
+
+struct MailboxSearchResponse {
+  MailboxResult result;
+  int total;               /* Matches in all, only the best are sent. */
+  int mnums<MAX_HITS>;     /* Best first. */
+};
+typedef struct MailboxSearchResponse MailboxSearchResponse;
+
 program MAILBOX_PROG {
   version MAILBOX_VERSION {
     MailboxResult MAILBOX_START(MailboxParams) = 1;
@@ -46,5 +180,18 @@ program MAILBOX_PROG {
     MailboxMessageResponse MAILBOX_RETRIEVE_MESSAGE(MailboxParams) = 4;
     MailboxMessageListResponse MAILBOX_LIST_ALL_MESSAGES(MailboxParams) = 5;
     MailboxResult MAILBOX_DELETE_MESSAGE(MailboxParams) = 6;
+    MailboxResult MAILBOX_SNAPSHOT(MailboxParams) = 7;
+    MailboxStatsResponse MAILBOX_STATS(MailboxParams) = 8;
+    MailboxResult MAILBOX_INSERT_CHUNK(MailboxChunkParams) = 9;
+    MailboxChunkResponse MAILBOX_RETRIEVE_CHUNK(MailboxChunkParams) = 10;
+    MailboxOpenResponse MAILBOX_OPEN(MailboxParams) = 11;
+    MailboxResult MAILBOX_INSERT_MESSAGE_BY_HANDLE(MailboxHandleParams) = 12;
+    MailboxMessageResponse MAILBOX_RETRIEVE_MESSAGE_BY_HANDLE(MailboxHandleParams) = 13;
+    MailboxMessageListResponse MAILBOX_LIST_ALL_MESSAGES_BY_HANDLE(MailboxHandleParams) = 14;
+    MailboxResult MAILBOX_DELETE_MESSAGE_BY_HANDLE(MailboxHandleParams) = 15;
+    MailboxMultiResponse MAILBOX_INSERT_MULTI(MailboxMultiParams) = 16;
+    MailboxWaitResponse MAILBOX_WAIT(MailboxWaitParams) = 17;
+    MailboxCachedResponse MAILBOX_RETRIEVE_IF_MODIFIED(MailboxCachedParams) = 18;
+    MailboxSearchResponse MAILBOX_SEARCH(MailboxSearchParams) = 19;
   } = 1;
 } = 2473650;
@@ -0,0 +1,78 @@
+/**
+ * EECS 338 Operating Systems
+ * Case Western Reserve University
+ * (C) 2015 Christian Gunderman
+ */
+#include "shard.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Gets the 32 bit FNV-1a hash of a user name.
+ */
+uint32_t shard_hash(const char *user) {
+  uint32_t hash = 2166136261u;
+
+  for (const unsigned char *c = (const unsigned char*)user; *c != '\0'; c++) {
+    hash ^= *c;
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+/*
+ * Gets the shard, 0 to count - 1, that owns user.
+ */
+int shard_of(const char *user, int count) {
+  return (int)(((uint64_t)shard_hash(user) * (uint32_t)count) >> 32);
+}
+
+/*
+ * Parses a list of shards into shards, which has room for max. Entries
+ * without a host get default_host. Returns how many there were, or -1 if
+ * the list is malformed or too long.
+ */
+int shard_parse(const char *list, const char *default_host,
+                ShardAddr *shards, int max) {
+  int count = 0;
+  const char *entry = list;
+
+  while (*entry != '\0') {
+    const char *end = strchr(entry, ',');
+    const char *stop = end != NULL ? end : entry + strlen(entry);
+    const char *colon = memchr(entry, ':', stop - entry);
+    char *rest;
+
+    if (count == max) {
+      return -1;
+    }
+
+    // host:port, or just the port.
+    if (colon != NULL) {
+      size_t host_len = colon - entry;
+      if (host_len == 0 || host_len >= SHARD_HOST_MAX) {
+        return -1;
+      }
+      memcpy(shards[count].host, entry, host_len);
+      shards[count].host[host_len] = '\0';
+      entry = colon + 1;
+    } else {
+      snprintf(shards[count].host, SHARD_HOST_MAX, "%s", default_host);
+    }
+
+    shards[count].port = (int)strtol(entry, &rest, 10);
+    if (rest == entry || rest != stop ||
+        shards[count].port <= 0 || shards[count].port > 65535) {
+      return -1;
+    }
+    count++;
+
+    if (end == NULL) {
+      break;
+    }
+    entry = end + 1;
+  }
+  return count;
+}
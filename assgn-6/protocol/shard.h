@@ -0,0 +1,39 @@
+/**
+ * EECS 338 Operating Systems
+ * Case Western Reserve University
+ * (C) 2015 Christian Gunderman
+ */
+#ifndef SHARD__H__
+#define SHARD__H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Sharding of users across several servers. Each shard owns one range of
+ * a 32 bit hash of user names, so with N shards shard i owns the hashes
+ * from i * 2^32 / N up to (i + 1) * 2^32 / N. The client, load generator
+ * and servers all use this to agree on who owns which user.
+ *
+ * Shards are listed as a comma separated list of host:port or just port,
+ * in shard order, e.g. "7001,7002" or "alpha:7001,beta:7001".
+ */
+
+// Most shards a list can name.
+#define SHARD_MAX 64
+#define SHARD_HOST_MAX 256
+
+// Where one shard's server is.
+typedef struct ShardAddr {
+  char host[SHARD_HOST_MAX];  // Default host if the list didn't give one.
+  int port;
+} ShardAddr;
+
+uint32_t shard_hash(const char *user);
+
+int shard_of(const char *user, int count);
+
+int shard_parse(const char *list, const char *default_host,
+                ShardAddr *shards, int max);
+
+#endif // SHARD__H__
@@ -0,0 +1,456 @@
+/**
+ * EECS 338 Operating Systems
+ * Case Western Reserve University
+ * (C) 2015 Christian Gunderman
+ */
+#define _GNU_SOURCE
+
+#include "shm.h"
+#include "proto.h"
+
+#include <errno.h>
+#include <linux/futex.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+// Preprocessor Defines.
+#define SHM_ALIGN(n) (((n) + 7) & ~(size_t)7)
+#define SHM_STRING(type, field) { offsetof(type, field), -1, 1 }
+#define SHM_ARRAY(type, field, elem) \
+  { offsetof(type, field.field##_val), offsetof(type, field.field##_len), \
+    sizeof(elem) }
+#define SHM_OPAQUE(type, field) SHM_ARRAY(type, field, char)
+#define SHM_MESSAGE(i) SHM_STRING(MailboxMessageListResponse, messages[i])
+
+// A pointer in a struct, carried as an offset from the start of the data.
+// len is where its u_int count of elem byte elements is, or -1 for a NUL
+// terminated string.
+typedef struct ShmField {
+  size_t ptr;
+  long len;
+  size_t elem;
+} ShmField;
+
+// Layout of an argument or result struct.
+typedef struct ShmType {
+  size_t size;
+  int count;
+  ShmField fields[MAX_EMAIL];
+} ShmType;
+
+// A client's state, in its CLIENT's cl_private.
+typedef struct ShmClient {
+  int sock;             // Only held open so the server sees us hang up.
+  int event;            // Bumped to tell the server there's a call.
+  ShmHeader *header;    // The region.
+  char *data;
+  bool timeout_set;     // Set by CLSET_TIMEOUT, overriding the call's.
+  struct timeval timeout;
+  bool broken;          // A call timed out, its reply may still come.
+  struct rpc_err error;
+} ShmClient;
+
+// Argument layouts.
+static const ShmType kParams = { sizeof(MailboxParams), 2, {
+  SHM_STRING(MailboxParams, user), SHM_STRING(MailboxParams, message) } };
+static const ShmType kChunkParams = { sizeof(MailboxChunkParams), 2, {
+  SHM_STRING(MailboxChunkParams, user),
+  SHM_OPAQUE(MailboxChunkParams, data) } };
+static const ShmType kHandleParams = { sizeof(MailboxHandleParams), 1, {
+  SHM_STRING(MailboxHandleParams, message) } };
+static const ShmType kCachedParams = { sizeof(MailboxCachedParams), 1, {
+  SHM_STRING(MailboxCachedParams, user) } };
+static const ShmType kSearchParams = { sizeof(MailboxSearchParams), 2, {
+  SHM_STRING(MailboxSearchParams, user),
+  SHM_STRING(MailboxSearchParams, query) } };
+
+// Result layouts.
+static const ShmType kResult = { sizeof(MailboxResult), 0, { { 0, 0, 0 } } };
+static const ShmType kMessageResponse = { sizeof(MailboxMessageResponse), 1, {
+  SHM_STRING(MailboxMessageResponse, message) } };
+static const ShmType kListResponse = {
+  sizeof(MailboxMessageListResponse), MAX_EMAIL, {
+  SHM_MESSAGE(0), SHM_MESSAGE(1), SHM_MESSAGE(2), SHM_MESSAGE(3),
+  SHM_MESSAGE(4), SHM_MESSAGE(5), SHM_MESSAGE(6), SHM_MESSAGE(7),
+  SHM_MESSAGE(8), SHM_MESSAGE(9), SHM_MESSAGE(10), SHM_MESSAGE(11),
+  SHM_MESSAGE(12), SHM_MESSAGE(13), SHM_MESSAGE(14), SHM_MESSAGE(15),
+  SHM_MESSAGE(16), SHM_MESSAGE(17), SHM_MESSAGE(18), SHM_MESSAGE(19) } };
+static const ShmType kStatsResponse = { sizeof(MailboxStatsResponse), 0,
+  { { 0, 0, 0 } } };
+static const ShmType kChunkResponse = { sizeof(MailboxChunkResponse), 1, {
+  SHM_OPAQUE(MailboxChunkResponse, data) } };
+static const ShmType kOpenResponse = { sizeof(MailboxOpenResponse), 0,
+  { { 0, 0, 0 } } };
+static const ShmType kCachedResponse = { sizeof(MailboxCachedResponse), 1, {
+  SHM_STRING(MailboxCachedResponse, message) } };
+static const ShmType kSearchResponse = { sizeof(MailboxSearchResponse), 1, {
+  SHM_ARRAY(MailboxSearchResponse, mnums, int) } };
+
+// Layouts by procedure number, NULL for those not carried.
+static const ShmType *kArgs[MAILBOX_PROCS + 1] = {
+  NULL,
+  &kParams, &kParams, &kParams, &kParams,   // START .. RETRIEVE_MESSAGE
+  &kParams, &kParams, &kParams, &kParams,   // LIST_ALL .. STATS
+  &kChunkParams, &kChunkParams, &kParams,   // INSERT_CHUNK .. OPEN
+  &kHandleParams, &kHandleParams, &kHandleParams, &kHandleParams,
+  NULL, NULL,                               // INSERT_MULTI, WAIT
+  &kCachedParams, &kSearchParams,
+};
+static const ShmType *kResults[MAILBOX_PROCS + 1] = {
+  NULL,
+  &kResult, &kResult, &kResult, &kMessageResponse,
+  &kListResponse, &kResult, &kResult, &kStatsResponse,
+  &kResult, &kChunkResponse, &kOpenResponse,
+  &kResult, &kMessageResponse, &kListResponse, &kResult,
+  NULL, NULL,
+  &kCachedResponse, &kSearchResponse,
+};
+
+/*
+ * Checks whether proc can be called through shared memory.
+ */
+bool shm_supported(unsigned long proc) {
+  return proc <= MAILBOX_PROCS && kArgs[proc] != NULL;
+}
+
+/*
+ * Lays out proc's arguments, or its result if result is set, from src into
+ * data: the struct, then what its pointers point to, each pointer replaced
+ * by the offset it was copied to. Returns the bytes used, or 0 if it
+ * doesn't fit in capacity.
+ */
+size_t shm_encode(unsigned long proc, bool result, const void *src,
+                  char *data, size_t capacity) {
+  const ShmType *type = result ? kResults[proc] : kArgs[proc];
+  size_t used = type->size;
+
+  if (used > capacity) {
+    return 0;
+  }
+  memcpy(data, src, type->size);
+
+  for (int i = 0; i < type->count; i++) {
+    const ShmField *field = &type->fields[i];
+    const char *ptr = *(char * const*)((const char*)src + field->ptr);
+    size_t len;
+
+    // XDR won't send a NULL string either.
+    if (field->len < 0) {
+      if (ptr == NULL) {
+        return 0;
+      }
+      len = strlen(ptr) + 1;
+    } else {
+      len = *(const u_int*)((const char*)src + field->len) * field->elem;
+    }
+
+    used = SHM_ALIGN(used);
+    if (used > capacity || len > capacity - used) {
+      return 0;
+    }
+    if (len > 0) {
+      memcpy(data + used, ptr, len);
+    }
+    *(char**)(data + field->ptr) = (char*)(uintptr_t)used;
+    used += len;
+  }
+  return used;
+}
+
+/*
+ * Reads proc's arguments, or its result, laid out by shm_encode() in the
+ * length bytes of data, into dst. Pointers in dst point into data, which
+ * must stay mapped while they are used. Returns false if any point outside
+ * of it, or a string isn't terminated.
+ */
+bool shm_decode(unsigned long proc, bool result, char *data, size_t length,
+                void *dst) {
+  const ShmType *type = result ? kResults[proc] : kArgs[proc];
+
+  if (length < type->size) {
+    return false;
+  }
+  memcpy(dst, data, type->size);
+
+  for (int i = 0; i < type->count; i++) {
+    const ShmField *field = &type->fields[i];
+    char **ptr = (char**)((char*)dst + field->ptr);
+    uintptr_t offset = (uintptr_t)*ptr;
+
+    if (offset < type->size || offset > length) {
+      return false;
+    }
+    if (field->len < 0) {
+      if (memchr(data + offset, '\0', length - offset) == NULL) {
+        return false;
+      }
+    } else if (offset % field->elem != 0 ||
+               *(u_int*)((char*)dst + field->len) >
+               (length - offset) / field->elem) {
+      return false;
+    }
+    *ptr = data + offset;
+  }
+  return true;
+}
+
+/*
+ * Records a failed call, for clnt_geterr().
+ */
+static enum clnt_stat shm_fail(ShmClient *shm, enum clnt_stat stat) {
+  shm->error.re_status = stat;
+  shm->error.re_errno = stat == RPC_CANTSEND ? errno : 0;
+  return stat;
+}
+
+/*
+ * Gets the time left until deadline, or false if it has passed.
+ */
+static bool shm_time_left(const struct timespec *deadline,
+                          struct timespec *left) {
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  left->tv_sec = deadline->tv_sec - now.tv_sec;
+  left->tv_nsec = deadline->tv_nsec - now.tv_nsec;
+  if (left->tv_nsec < 0) {
+    left->tv_sec--;
+    left->tv_nsec += 1000000000L;
+  }
+  return left->tv_sec >= 0;
+}
+
+/*
+ * Makes a call: writes the arguments into the region, rings the server and
+ * sleeps until it has replied in the same place. The xdr procedures are
+ * unused, the layout comes from the procedure number.
+ */
+static enum clnt_stat shm_call(CLIENT *clnt, rpcproc_t proc, xdrproc_t xargs,
+                               void *args, xdrproc_t xres, void *res,
+                               struct timeval timeout) {
+  ShmClient *shm = clnt->cl_private;
+  ShmHeader *header = shm->header;
+  size_t capacity = SHM_REGION_BYTES - SHM_DATA_OFFSET;
+  uint64_t ring = 1;
+
+  if (shm->broken) {
+    return shm_fail(shm, RPC_CANTRECV);
+  }
+  if (!shm_supported(proc)) {
+    return shm_fail(shm, RPC_PROCUNAVAIL);
+  }
+
+  size_t length = shm_encode(proc, false, args, shm->data, capacity);
+  if (length == 0) {
+    return shm_fail(shm, RPC_CANTENCODEARGS);
+  }
+
+  header->proc = proc;
+  header->length = length;
+  __atomic_store_n(&header->state, SHM_REQUEST, __ATOMIC_RELEASE);
+  if (write(shm->event, &ring, sizeof(ring)) != sizeof(ring)) {
+    return shm_fail(shm, RPC_CANTSEND);
+  }
+
+  // Sleep while the state is still SHM_REQUEST.
+  struct timespec deadline;
+  if (shm->timeout_set) {
+    timeout = shm->timeout;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &deadline);
+  deadline.tv_sec += timeout.tv_sec;
+  deadline.tv_nsec += timeout.tv_usec * 1000L;
+  if (deadline.tv_nsec >= 1000000000L) {
+    deadline.tv_sec++;
+    deadline.tv_nsec -= 1000000000L;
+  }
+  while (__atomic_load_n(&header->state, __ATOMIC_ACQUIRE) != SHM_REPLY) {
+    struct timespec left;
+
+    if (!shm_time_left(&deadline, &left)) {
+      shm->broken = true;
+      return shm_fail(shm, RPC_TIMEDOUT);
+    }
+    syscall(SYS_futex, &header->state, FUTEX_WAIT, SHM_REQUEST, &left,
+            NULL, 0);
+  }
+
+  switch (header->status) {
+  case SHM_OK:
+    break;
+  case SHM_UNSUPPORTED:
+    return shm_fail(shm, RPC_PROCUNAVAIL);
+  case SHM_BAD_ARGS:
+    return shm_fail(shm, RPC_CANTDECODEARGS);
+  default:
+    return shm_fail(shm, RPC_CANTDECODERES);
+  }
+
+  if (header->length > capacity ||
+      !shm_decode(proc, true, shm->data, header->length, res)) {
+    return shm_fail(shm, RPC_CANTDECODERES);
+  }
+  return shm_fail(shm, RPC_SUCCESS);
+}
+
+/*
+ * Nothing to abort, calls are synchronous.
+ */
+static void shm_abort(CLIENT *clnt) {
+}
+
+/*
+ * Gets the error of the last call.
+ */
+static void shm_geterr(CLIENT *clnt, struct rpc_err *error) {
+  *error = ((ShmClient*)clnt->cl_private)->error;
+}
+
+/*
+ * Results point into the region, so there's nothing to free.
+ */
+static bool_t shm_freeres(CLIENT *clnt, xdrproc_t xres, void *res) {
+  return TRUE;
+}
+
+/*
+ * Unmaps the region and hangs up.
+ */
+static void shm_destroy(CLIENT *clnt) {
+  ShmClient *shm = clnt->cl_private;
+
+  munmap(shm->header, SHM_REGION_BYTES);
+  close(shm->event);
+  close(shm->sock);
+  if (clnt->cl_auth != NULL) {
+    auth_destroy(clnt->cl_auth);
+  }
+  free(shm);
+  free(clnt);
+}
+
+/*
+ * Gets or sets the timeout, the only setting there is.
+ */
+static bool_t shm_control(CLIENT *clnt, u_int request, void *info) {
+  ShmClient *shm = clnt->cl_private;
+
+  switch (request) {
+  case CLSET_TIMEOUT:
+    shm->timeout = *(struct timeval*)info;
+    shm->timeout_set = true;
+    return TRUE;
+  case CLGET_TIMEOUT:
+    *(struct timeval*)info = shm->timeout;
+    return TRUE;
+  default:
+    return FALSE;
+  }
+}
+
+static struct clnt_ops kShmOps = {
+  shm_call,
+  shm_abort,
+  shm_geterr,
+  shm_freeres,
+  shm_destroy,
+  shm_control,
+};
+
+/*
+ * Gets the region and eventfd the server sends once it accepts us.
+ */
+static bool shm_receive(int sock, int *fds) {
+  char byte;
+  char control[CMSG_SPACE(2 * sizeof(int))];
+  struct iovec iov = { &byte, 1 };
+  struct msghdr msg;
+
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+
+  if (recvmsg(sock, &msg, MSG_CMSG_CLOEXEC) != 1) {
+    return false;
+  }
+
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  if (cmsg == NULL || cmsg->cmsg_level != SOL_SOCKET ||
+      cmsg->cmsg_type != SCM_RIGHTS ||
+      cmsg->cmsg_len != CMSG_LEN(2 * sizeof(int))) {
+    errno = EPROTO;
+    return false;
+  }
+  memcpy(fds, CMSG_DATA(cmsg), 2 * sizeof(int));
+  return true;
+}
+
+/*
+ * Cleans up after clntshm_create() fails part way, setting rpc_createerr.
+ */
+static CLIENT *shm_create_failed(int sock, int *fds, CLIENT *clnt,
+                                 ShmClient *shm) {
+  rpc_createerr.cf_stat = RPC_SYSTEMERROR;
+  rpc_createerr.cf_error.re_errno = errno;
+
+  for (int i = 0; i < 2; i++) {
+    if (fds[i] != -1) {
+      close(fds[i]);
+    }
+  }
+  if (sock != -1) {
+    close(sock);
+  }
+  free(shm);
+  free(clnt);
+  return NULL;
+}
+
+/*
+ * Creates a client to the server listening on the unix socket at path,
+ * see server -L. Returns NULL with rpc_createerr set on failure, like the
+ * other clnt*_create()s.
+ */
+CLIENT *clntshm_create(const char *path) {
+  struct sockaddr_un addr;
+  int fds[2] = { -1, -1 };
+  void *region;
+  CLIENT *clnt = calloc(1, sizeof(CLIENT));
+  ShmClient *shm = calloc(1, sizeof(ShmClient));
+  int sock = -1;
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    errno = ENAMETOOLONG;
+    return shm_create_failed(sock, fds, clnt, shm);
+  }
+  strcpy(addr.sun_path, path);
+
+  if (clnt == NULL || shm == NULL ||
+      (sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) == -1 ||
+      connect(sock, (struct sockaddr*)&addr, sizeof(addr)) == -1 ||
+      !shm_receive(sock, fds) ||
+      (region = mmap(NULL, SHM_REGION_BYTES, PROT_READ | PROT_WRITE,
+                     MAP_SHARED, fds[0], 0)) == MAP_FAILED) {
+    return shm_create_failed(sock, fds, clnt, shm);
+  }
+  close(fds[0]);
+
+  shm->sock = sock;
+  shm->event = fds[1];
+  shm->header = region;
+  shm->data = (char*)region + SHM_DATA_OFFSET;
+  clnt->cl_ops = &kShmOps;
+  clnt->cl_private = shm;
+  clnt->cl_auth = authnone_create();
+  return clnt;
+}
@@ -0,0 +1,70 @@
+/**
+ * EECS 338 Operating Systems
+ * Case Western Reserve University
+ * (C) 2015 Christian Gunderman
+ */
+#ifndef SHM__H__
+#define SHM__H__
+
+#include <rpc/rpc.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Shared memory transport for clients on the same machine as the server.
+ * A client connects to the server's unix socket and is handed a region of
+ * shared memory and an eventfd over it. Each call copies the argument
+ * struct into the region, with its strings after it and their pointers
+ * made into offsets, bumps the eventfd, and sleeps on a futex in the
+ * region's header. The server runs the same handler RPC would, lays the
+ * result out in the region the same way and wakes the client, which reads
+ * it in place. No XDR, no sockets and no copies beyond those two.
+ *
+ * The socket is only used to hand over the region and to notice the
+ * client hanging up. clntshm_create() returns an ordinary CLIENT, so the
+ * rpcgen stubs work on it unchanged. Results point into the region and
+ * are valid until the next call on that client.
+ *
+ * MAILBOX_INSERT_MULTI, whose arguments are a list of strings, and
+ * MAILBOX_WAIT, which may be parked, aren't carried and fail with
+ * RPC_PROCUNAVAIL.
+ */
+
+// Bytes of the region, header included. Calls whose arguments or result
+// don't fit fail.
+#define SHM_REGION_BYTES (4 * 1024 * 1024)
+
+// Where the call starts in the region, a cache line after the header.
+#define SHM_DATA_OFFSET 64
+
+// States of the futex word.
+#define SHM_IDLE 0
+#define SHM_REQUEST 1     // Arguments written, for the server.
+#define SHM_REPLY 2       // Result written, for the client.
+
+// Outcome of a call, set alongside SHM_REPLY.
+#define SHM_OK 0
+#define SHM_UNSUPPORTED 1  // Not a procedure this transport carries.
+#define SHM_BAD_ARGS 2
+#define SHM_TOO_BIG 3      // Result doesn't fit in the region.
+
+// Start of the region.
+typedef struct ShmHeader {
+  uint32_t state;    // Futex word, SHM_IDLE, SHM_REQUEST or SHM_REPLY.
+  uint32_t proc;
+  uint32_t status;   // SHM_OK etc, once replied.
+  uint32_t length;   // Bytes of arguments or result at SHM_DATA_OFFSET.
+} ShmHeader;
+
+CLIENT *clntshm_create(const char *path);
+
+bool shm_supported(unsigned long proc);
+
+size_t shm_encode(unsigned long proc, bool result, const void *src,
+                  char *data, size_t capacity);
+
+bool shm_decode(unsigned long proc, bool result, char *data, size_t length,
+                void *dst);
+
+#endif // SHM__H__
@@ -0,0 +1,196 @@
+/**
+ * EECS 338 Operating Systems
+ * Case Western Reserve University
+ * (C) 2015 Christian Gunderman
+ */
+#include "bodystore.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Bucket array starts at this many and doubles whenever there are more
+// bodies than buckets.
+#define BODYSTORE_MIN_BUCKETS 64
+
+// A stored body. Callers only ever see data.
+typedef struct Body {
+  struct Body *next;  // Hash chain.
+  uint64_t hash;
+  uint32_t refs;
+  uint32_t size;      // Bytes of data, including the terminator.
+  char data[];
+} Body;
+
+// Global state:
+// One store for the whole server, like g_users_ht.
+static Body **g_buckets = NULL;
+static size_t g_bucket_count = 0;
+static BodyStoreStats g_stats;
+
+/*
+ * FNV-1a hash of size bytes.
+ */
+static uint64_t bodystore_hash(const char *message, size_t size) {
+  uint64_t hash = 14695981039346656037ULL;
+
+  for (size_t i = 0; i < size; i++) {
+    hash ^= (unsigned char)message[i];
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+/*
+ * Gets the body a string handed out by the store belongs to.
+ */
+static Body *bodystore_body(char *data) {
+  return (Body*)(data - offsetof(Body, data));
+}
+
+/*
+ * Finds the body with these contents, or NULL.
+ */
+static Body *bodystore_lookup(const char *message, size_t size,
+                              uint64_t hash) {
+  if (g_bucket_count == 0) {
+    return NULL;
+  }
+
+  for (Body *body = g_buckets[hash & (g_bucket_count - 1)]; body != NULL;
+       body = body->next) {
+    if (body->hash == hash && body->size == size &&
+        memcmp(body->data, message, size) == 0) {
+      return body;
+    }
+  }
+  return NULL;
+}
+
+/*
+ * Doubles the bucket array. Failure just leaves the chains longer.
+ */
+static void bodystore_grow() {
+  size_t count = g_bucket_count == 0 ?
+                 BODYSTORE_MIN_BUCKETS : g_bucket_count * 2;
+  Body **buckets = calloc(count, sizeof(Body*));
+
+  if (buckets == NULL) {
+    return;
+  }
+
+  for (size_t i = 0; i < g_bucket_count; i++) {
+    Body *body = g_buckets[i];
+    while (body != NULL) {
+      Body *next = body->next;
+      body->next = buckets[body->hash & (count - 1)];
+      buckets[body->hash & (count - 1)] = body;
+      body = next;
+    }
+  }
+
+  free(g_buckets);
+  g_buckets = buckets;
+  g_bucket_count = count;
+}
+
+/*
+ * Gets a reference to the body with message's contents, size bytes
+ * including the terminator, storing it if it isn't already. Returns NULL
+ * if out of memory.
+ */
+char *bodystore_add(const char *message, size_t size) {
+  uint64_t hash = bodystore_hash(message, size);
+  Body *body = bodystore_lookup(message, size, hash);
+
+  if (body != NULL) {
+    bodystore_ref(body->data);
+    return body->data;
+  }
+
+  if (g_stats.bodies >= g_bucket_count) {
+    bodystore_grow();
+  }
+  if (g_bucket_count == 0 || !(body = malloc(sizeof(Body) + size))) {
+    return NULL;
+  }
+
+  body->hash = hash;
+  body->refs = 1;
+  body->size = size;
+  memcpy(body->data, message, size);
+
+  body->next = g_buckets[hash & (g_bucket_count - 1)];
+  g_buckets[hash & (g_bucket_count - 1)] = body;
+
+  g_stats.bodies++;
+  g_stats.refs++;
+  g_stats.bytes += size;
+  g_stats.ref_bytes += size;
+  return body->data;
+}
+
+/*
+ * Gets a reference to the body with message's contents if one is stored,
+ * otherwise NULL.
+ */
+char *bodystore_find(const char *message, size_t size) {
+  if (g_stats.bodies == 0) {
+    return NULL;
+  }
+
+  Body *body = bodystore_lookup(message, size, bodystore_hash(message, size));
+  if (body == NULL) {
+    return NULL;
+  }
+
+  bodystore_ref(body->data);
+  return body->data;
+}
+
+/*
+ * Takes another reference to a body.
+ */
+void bodystore_ref(char *data) {
+  Body *body = bodystore_body(data);
+
+  body->refs++;
+  g_stats.refs++;
+  g_stats.ref_bytes += body->size;
+}
+
+/*
+ * Gets a body's size, including the terminator.
+ */
+size_t bodystore_size(char *data) {
+  return bodystore_body(data)->size;
+}
+
+/*
+ * Releases a reference to a body, freeing it with the last one.
+ */
+void bodystore_release(char *data) {
+  Body *body = bodystore_body(data);
+
+  g_stats.refs--;
+  g_stats.ref_bytes -= body->size;
+  if (--body->refs > 0) {
+    return;
+  }
+
+  Body **link = &g_buckets[body->hash & (g_bucket_count - 1)];
+  while (*link != body) {
+    link = &(*link)->next;
+  }
+  *link = body->next;
+
+  g_stats.bodies--;
+  g_stats.bytes -= body->size;
+  free(body);
+}
+
+/*
+ * Gets the store's totals.
+ */
+void bodystore_stats(BodyStoreStats *stats) {
+  *stats = g_stats;
+}
@@ -0,0 +1,42 @@
+/**
+ * EECS 338 Operating Systems
+ * Case Western Reserve University
+ * (C) 2015 Christian Gunderman
+ */
+#ifndef BODYSTORE__H__
+#define BODYSTORE__H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Content addressed, reference counted store of message bodies shared
+ * between mailboxes. A body sent to many users is stored once, and each
+ * mailbox holding it owns one reference. Bodies are looked up by a hash of
+ * their contents, so the same text inserted again is shared too. Bodies
+ * are handed out as plain strings, which are only freed once the last
+ * reference is released.
+ */
+
+// Totals for stats. ref_bytes is what the bodies would take unshared.
+typedef struct BodyStoreStats {
+  uint64_t bodies;
+  uint64_t refs;
+  uint64_t bytes;
+  uint64_t ref_bytes;
+} BodyStoreStats;
+
+char *bodystore_add(const char *message, size_t size);
+
+char *bodystore_find(const char *message, size_t size);
+
+void bodystore_ref(char *body);
+
+size_t bodystore_size(char *body);
+
+void bodystore_release(char *body);
+
+void bodystore_stats(BodyStoreStats *stats);
+
+#endif // BODYSTORE__H__
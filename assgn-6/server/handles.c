@@ -0,0 +1,109 @@
+/**
+ * EECS 338 Operating Systems
+ * Case Western Reserve University
+ * (C) 2015 Christian Gunderman
+ */
+#define _XOPEN_SOURCE 700
+
+#include "handles.h"
+
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+// Table storage starts at this many slots and doubles when full.
+#define HANDLES_MIN_CAPACITY 64
+
+typedef struct HandleSlot {
+  void *target;        // NULL while the slot is free.
+  uint32_t gen;        // Bumped every time the slot is freed.
+  uint32_t next_free;  // Next free slot, while this one is free.
+} HandleSlot;
+
+// Global state:
+// One table for the whole server, like g_users_ht.
+static HandleSlot *g_slots = NULL;
+static uint32_t g_count = 0;      // Slots ever used.
+static uint32_t g_capacity = 0;
+static uint32_t g_free = UINT32_MAX;  // Head of the free slot list.
+
+// Generation every slot starts at, picked at random per run like the
+// message versions' epoch, so a handle kept from before a restart doesn't
+// open whichever mailbox got its slot this time round.
+static uint32_t g_epoch = 0;
+
+/*
+ * Gets the generation new slots start at.
+ */
+static uint32_t handle_epoch() {
+  while (g_epoch == 0) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    g_epoch = (uint32_t)(ts.tv_sec * 1000000007u + ts.tv_nsec) ^
+              ((uint32_t)getpid() << 16) ^ 0x9e3779b9u;
+  }
+  return g_epoch;
+}
+
+/*
+ * Creates a handle for target.
+ */
+bool handle_new(void *target, uint64_t *handle) {
+  uint32_t slot;
+
+  if (g_free != UINT32_MAX) {
+    slot = g_free;
+    g_free = g_slots[slot].next_free;
+  } else {
+    if (g_count == g_capacity) {
+      uint32_t capacity = g_capacity == 0 ?
+                          HANDLES_MIN_CAPACITY : g_capacity * 2;
+      HandleSlot *slots = realloc(g_slots, capacity * sizeof(HandleSlot));
+      if (slots == NULL) {
+        return false;
+      }
+      g_slots = slots;
+      g_capacity = capacity;
+    }
+
+    slot = g_count++;
+    g_slots[slot].gen = handle_epoch();
+  }
+
+  g_slots[slot].target = target;
+  *handle = (uint64_t)g_slots[slot].gen << 32 | slot;
+  return true;
+}
+
+/*
+ * Gets the object a handle refers to, or NULL if it is stale or was never
+ * valid.
+ */
+void *handle_get(uint64_t handle) {
+  uint32_t slot = (uint32_t)handle;
+
+  if (slot >= g_count || g_slots[slot].gen != (uint32_t)(handle >> 32)) {
+    return NULL;
+  }
+  return g_slots[slot].target;
+}
+
+/*
+ * Invalidates a handle, and every copy of it, freeing its slot.
+ */
+void handle_close(uint64_t handle) {
+  uint32_t slot = (uint32_t)handle;
+
+  if (handle_get(handle) == NULL) {
+    return;
+  }
+
+  g_slots[slot].target = NULL;
+  g_slots[slot].next_free = g_free;
+
+  // Skip generation 0 on wrap, so no handle is ever 0.
+  if (++g_slots[slot].gen == 0) {
+    g_slots[slot].gen = 1;
+  }
+  g_free = slot;
+}
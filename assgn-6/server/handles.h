@@ -0,0 +1,28 @@
+/**
+ * EECS 338 Operating Systems
+ * Case Western Reserve University
+ * (C) 2015 Christian Gunderman
+ */
+#ifndef HANDLES__H__
+#define HANDLES__H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Session handles: compact, opaque 64 bit numbers that map straight to an
+ * object, here a mailbox, without hashing a name. A handle is a slot in a
+ * table plus the slot's generation, so once an object is closed its old
+ * handles are recognized as stale even after the slot is reused. Slots'
+ * generations start from a random number each run, so handles from
+ * before a restart are stale too, but for a 1 in 2^32 chance. 0 is never
+ * a valid handle.
+ */
+
+bool handle_new(void *target, uint64_t *handle);
+
+void *handle_get(uint64_t handle);
+
+void handle_close(uint64_t handle);
+
+#endif // HANDLES__H__
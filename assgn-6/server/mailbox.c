@@ -0,0 +1,809 @@
+/**
+ * EECS 338 Operating Systems
+ * Case Western Reserve University
+ * (C) 2015 Christian Gunderman
+ */
+#define _XOPEN_SOURCE 700
+
+#include "mailbox.h"
+#include "bodystore.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// Arena shared by all mailboxes that don't have their own yet.
+static Slab *g_shared_slab = NULL;
+
+// Message versions. Every message stored gets the next count, and the
+// epoch is picked at random per run and moved on if the count wraps, so a
+// version can't come round again for another message in the same slot
+// until 2^32 more messages have been stored.
+static uint32_t g_version_epoch = 0;
+static uint32_t g_version_count = 0;
+
+/*
+ * Gets the version for a message being stored.
+ */
+static unsigned int mailbox_next_version() {
+  if (g_version_epoch == 0) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    g_version_epoch = (uint32_t)(ts.tv_sec * 1000000007u + ts.tv_nsec) ^
+                      ((uint32_t)getpid() << 16);
+  }
+
+  if (++g_version_count == 0) {
+    g_version_epoch++;
+    g_version_count = 1;
+  }
+  return g_version_count;
+}
+
+/*
+ * Gets the arena this mailbox's messages live in, creating the shared one
+ * on first use.
+ */
+static Slab *mailbox_slab(Mailbox *mailbox) {
+  if (mailbox->slab != NULL) {
+    return mailbox->slab;
+  }
+
+  if (g_shared_slab == NULL) {
+    g_shared_slab = slab_new();
+  }
+  return g_shared_slab;
+}
+
+/*
+ * Moves the mailbox to its next version because mnum changed.
+ */
+static void mailbox_changed(Mailbox *mailbox, int mnum) {
+  mailbox->version++;
+  if (mailbox->changes != NULL) {
+    mailbox->changes[mailbox->version % MAILBOX_CHANGES] = mnum;
+  }
+}
+
+/*
+ * Moves mnum in the search index, if there is one, from old_msg to msg,
+ * either of which may be NULL. If the index can't be updated it's thrown
+ * away, to be built again by the next search.
+ */
+static void mailbox_reindex(Mailbox *mailbox, int mnum, const char *old_msg,
+                            const char *msg) {
+  if (mailbox->index == NULL) {
+    return;
+  }
+
+  if (old_msg != NULL) {
+    search_remove(mailbox->index, mnum, old_msg);
+  }
+  if (msg != NULL && !search_add(mailbox->index, mnum, msg)) {
+    search_free(mailbox->index);
+    mailbox->index = NULL;
+  }
+}
+
+/*
+ * Gives back a message that was stored in an entry of the given size,
+ * shared flag included, either to the body store or to the arena.
+ */
+static void mailbox_release(Mailbox *mailbox, char *msg, unsigned int size) {
+  if (size & MAILBOX_SHARED) {
+    bodystore_release(msg);
+  } else {
+    slab_release(mailbox_slab(mailbox), msg, size);
+    mailbox->bytes -= size;
+  }
+}
+
+/*
+ * Moves every private message out of the shared arena into a new private
+ * one. Shared bodies stay where they are. Failure leaves the mailbox in the
+ * shared arena, which is still valid.
+ */
+static void mailbox_promote(Mailbox *mailbox) {
+  Slab *slab = slab_new();
+  if (slab == NULL) {
+    return;
+  }
+
+  // Copy everything first so failure part way is easy to back out of.
+  int count = msgidx_count(mailbox->messages);
+  char **copies = malloc(count * sizeof(char*));
+  if (copies == NULL) {
+    slab_free(slab);
+    return;
+  }
+
+  for (int i = 0; i < count; i++) {
+    MsgIdxEntry *entry = &mailbox->messages->entries[i];
+
+    if (entry->size & MAILBOX_SHARED) {
+      continue;
+    }
+    if (!(copies[i] = slab_alloc(slab, entry->size))) {
+      slab_free(slab);
+      free(copies);
+      return;
+    }
+    memcpy(copies[i], entry->value, entry->size);
+  }
+
+  // Swap the copies in and give the originals back to the shared arena.
+  for (int i = 0; i < count; i++) {
+    MsgIdxEntry *entry = &mailbox->messages->entries[i];
+
+    if (entry->size & MAILBOX_SHARED) {
+      continue;
+    }
+    slab_release(g_shared_slab, entry->value, entry->size);
+    entry->value = copies[i];
+  }
+
+  free(copies);
+  mailbox->slab = slab;
+}
+
+/*
+ * Drops an upload, giving its buffer back.
+ */
+static void mailbox_drop_upload(MailboxUpload **link) {
+  MailboxUpload *upload = *link;
+
+  *link = upload->next;
+  slab_release(upload->slab, upload->buf, upload->total + 1);
+  free(upload);
+}
+
+/*
+ * Gives back every message in the mailbox and its arena, leaving it with
+ * no index at all.
+ */
+static void mailbox_drop_messages(Mailbox *mailbox) {
+  if (mailbox->messages != NULL) {
+    for (int i = 0; i < msgidx_count(mailbox->messages); i++) {
+      MsgIdxEntry *entry = &mailbox->messages->entries[i];
+
+      if (entry->size & MAILBOX_SHARED) {
+        bodystore_release(entry->value);
+      } else if (mailbox->slab == NULL) {
+        slab_release(g_shared_slab, entry->value, entry->size);
+      }
+    }
+  }
+
+  if (mailbox->slab != NULL) {
+    slab_free(mailbox->slab);
+  }
+
+  msgidx_free(mailbox->messages);
+  search_free(mailbox->index);
+  mailbox->messages = NULL;
+  mailbox->index = NULL;
+  mailbox->slab = NULL;
+  mailbox->bytes = 0;
+}
+
+/*
+ * Creates a new mailbox with no messages for the given user.
+ */
+Mailbox *mailbox_new(const char *user) {
+  Mailbox *mailbox = calloc(1, sizeof(Mailbox));
+  if (mailbox == NULL) {
+    return NULL;
+  }
+
+  mailbox->user = malloc(strlen(user) + 1);
+  mailbox->messages = msgidx_new();
+  if (mailbox->user == NULL || mailbox->messages == NULL) {
+    mailbox_free(mailbox);
+    return NULL;
+  }
+  strcpy(mailbox->user, user);
+
+  return mailbox;
+}
+
+/*
+ * Frees the mailbox. A mailbox with its own arena frees all of its messages
+ * in one step, otherwise they are handed back to the shared arena. Shared
+ * bodies lose a reference either way.
+ */
+void mailbox_free(Mailbox *mailbox) {
+  if (mailbox == NULL) {
+    return;
+  }
+
+  // Uploads may be in the shared arena even if the mailbox has its own.
+  while (mailbox->uploads != NULL) {
+    if (mailbox->uploads->slab == mailbox->slab) {
+      MailboxUpload *next = mailbox->uploads->next;
+      free(mailbox->uploads);
+      mailbox->uploads = next;
+    } else {
+      mailbox_drop_upload(&mailbox->uploads);
+    }
+  }
+
+  mailbox_drop_messages(mailbox);
+  free(mailbox->changes);
+  free(mailbox->user);
+  free(mailbox);
+}
+
+/*
+ * Stores msg under mnum in place of the message there, if any, releasing
+ * it. size includes the terminator and the shared flag.
+ */
+static bool mailbox_store(Mailbox *mailbox, int mnum, char *msg,
+                          unsigned int size) {
+  MsgIdxEntry *entry = msgidx_entry(mailbox->messages, mnum);
+  unsigned int old_size = entry != NULL ? entry->size : 0;
+  void *old_msg;
+
+  if (!msgidx_put(mailbox->messages, mnum, msg, &old_msg)) {
+    return false;
+  }
+  entry = msgidx_entry(mailbox->messages, mnum);
+  entry->size = size;
+  entry->version = mailbox_next_version();
+  if (!(size & MAILBOX_SHARED)) {
+    mailbox->bytes += size;
+  }
+
+  mailbox_reindex(mailbox, mnum, old_msg, msg);
+  if (old_msg != NULL) {
+    mailbox_release(mailbox, old_msg, old_size);
+  }
+  mailbox_changed(mailbox, mnum);
+  return true;
+}
+
+/*
+ * Stores msg, which is size bytes including its terminator and already in
+ * slab, under mnum, replacing and releasing any message already there.
+ */
+static bool mailbox_install(Mailbox *mailbox, Slab *slab, int mnum,
+                            char *msg, size_t size) {
+  // The mailbox moved arenas while msg was being filled in.
+  if (slab != mailbox_slab(mailbox)) {
+    char *copy = slab_alloc(mailbox_slab(mailbox), size);
+    if (copy == NULL) {
+      slab_release(slab, msg, size);
+      return false;
+    }
+    memcpy(copy, msg, size);
+    slab_release(slab, msg, size);
+    slab = mailbox_slab(mailbox);
+    msg = copy;
+  }
+
+  if (!mailbox_store(mailbox, mnum, msg, size)) {
+    slab_release(slab, msg, size);
+    return false;
+  }
+
+  // Big enough to be worth an arena of its own.
+  if (mailbox->slab == NULL && mailbox->bytes > MAILBOX_PRIVATE_ARENA_BYTES) {
+    mailbox_promote(mailbox);
+  }
+  return true;
+}
+
+/*
+ * Copies message into the mailbox's arena and stores it under mnum,
+ * replacing and releasing any message that was already there. If the body
+ * store already holds the same text, that is shared instead.
+ */
+bool mailbox_put(Mailbox *mailbox, int mnum, const char *message) {
+  Slab *slab = mailbox_slab(mailbox);
+  size_t size = strlen(message) + 1;
+
+  char *body = bodystore_find(message, size);
+  if (body != NULL) {
+    bool ok = mailbox_put_body(mailbox, mnum, body);
+    bodystore_release(body);
+    return ok;
+  }
+
+  if (slab == NULL) {
+    return false;
+  }
+
+  char *msg = slab_alloc(slab, size);
+  if (msg == NULL) {
+    return false;
+  }
+  memcpy(msg, message, size);
+
+  return mailbox_install(mailbox, slab, mnum, msg, size);
+}
+
+/*
+ * Stores a body from the body store under mnum, taking a reference to it,
+ * replacing and releasing any message that was already there.
+ */
+bool mailbox_put_body(Mailbox *mailbox, int mnum, char *body) {
+  bodystore_ref(body);
+  if (!mailbox_store(mailbox, mnum, body,
+                     bodystore_size(body) | MAILBOX_SHARED)) {
+    bodystore_release(body);
+    return false;
+  }
+  return true;
+}
+
+/*
+ * Stores message under mnum as a shared body, so other mailboxes holding
+ * the same text share it.
+ */
+bool mailbox_put_shared(Mailbox *mailbox, int mnum, const char *message) {
+  char *body = bodystore_add(message, strlen(message) + 1);
+  if (body == NULL) {
+    return false;
+  }
+
+  bool ok = mailbox_put_body(mailbox, mnum, body);
+  bodystore_release(body);
+  return ok;
+}
+
+/*
+ * Writes len bytes of data at offset into the message being sent in chunks
+ * under mnum, which will be total bytes long. A chunk at offset 0 starts
+ * the message over, allocating all of it up front so the rest are copied
+ * straight into place. Chunks may be resent, but must not leave a gap.
+ * Once the last byte is in, the message replaces whatever was under mnum.
+ * data must not contain NULs, and offset + len must be within total.
+ */
+MailboxChunkStatus mailbox_put_chunk(Mailbox *mailbox, int mnum, size_t total,
+                                     size_t offset, const char *data,
+                                     size_t len) {
+  MailboxUpload **link = &mailbox->uploads;
+  int uploads = 0;
+
+  while (*link != NULL && (*link)->mnum != mnum) {
+    link = &(*link)->next;
+    uploads++;
+  }
+
+  // A first chunk always starts over.
+  if (offset == 0 && *link != NULL) {
+    mailbox_drop_upload(link);
+  }
+
+  MailboxUpload *upload = *link;
+  if (upload == NULL) {
+    if (offset != 0) {
+      return MailboxChunkOutOfOrder;
+    }
+    if (uploads >= MAILBOX_MAX_UPLOADS) {
+      return MailboxChunkTooMany;
+    }
+
+    Slab *slab = mailbox_slab(mailbox);
+    if (slab == NULL || !(upload = calloc(1, sizeof(MailboxUpload)))) {
+      return MailboxChunkNoMemory;
+    }
+    if (!(upload->buf = slab_alloc(slab, total + 1))) {
+      free(upload);
+      return MailboxChunkNoMemory;
+    }
+
+    upload->slab = slab;
+    upload->total = total;
+    upload->mnum = mnum;
+    upload->next = mailbox->uploads;
+    mailbox->uploads = upload;
+    link = &mailbox->uploads;
+  } else if (upload->total != total || offset > upload->received) {
+    return MailboxChunkOutOfOrder;
+  }
+
+  memcpy(upload->buf + offset, data, len);
+  if (offset + len > upload->received) {
+    upload->received = offset + len;
+  }
+
+  if (upload->received < upload->total) {
+    return MailboxChunkPending;
+  }
+
+  // All here. Hand the buffer over to the index.
+  upload->buf[upload->total] = '\0';
+  *link = upload->next;
+
+  bool ok = mailbox_install(mailbox, upload->slab, mnum, upload->buf,
+                            upload->total + 1);
+  free(upload);
+  return ok ? MailboxChunkComplete : MailboxChunkNoMemory;
+}
+
+/*
+ * Gets the message stored under mnum, and its length and version if those
+ * aren't NULL. The string is owned by the mailbox. The version changes
+ * every time a message is stored under mnum, and after every restart.
+ */
+bool mailbox_get(Mailbox *mailbox, int mnum, char **message, size_t *length,
+                 uint64_t *version) {
+  MsgIdxEntry *entry = msgidx_entry(mailbox->messages, mnum);
+
+  if (entry == NULL) {
+    return false;
+  }
+
+  *message = entry->value;
+  if (length != NULL) {
+    *length = (entry->size & ~MAILBOX_SHARED) - 1;
+  }
+  if (version != NULL) {
+    *version = (uint64_t)g_version_epoch << 32 | entry->version;
+  }
+  return true;
+}
+
+/*
+ * Deletes the message stored under mnum. Returns false if there wasn't one.
+ */
+bool mailbox_remove(Mailbox *mailbox, int mnum) {
+  MsgIdxEntry *entry = msgidx_entry(mailbox->messages, mnum);
+  void *old_msg;
+
+  if (entry == NULL) {
+    return false;
+  }
+
+  unsigned int old_size = entry->size;
+  msgidx_remove(mailbox->messages, mnum, &old_msg);
+  mailbox_reindex(mailbox, mnum, old_msg, NULL);
+  mailbox_release(mailbox, old_msg, old_size);
+  mailbox_changed(mailbox, mnum);
+  return true;
+}
+
+/*
+ * Gets the number of messages in the mailbox, loaded or not.
+ */
+int mailbox_count(Mailbox *mailbox) {
+  if (mailbox->messages == NULL) {
+    return mailbox->cold_count;
+  }
+  return msgidx_count(mailbox->messages);
+}
+
+/*
+ * Gets the i'th message in ascending mnum order.
+ */
+bool mailbox_at(Mailbox *mailbox, int i, int *mnum, char **message) {
+  void *msg;
+
+  if (!msgidx_at(mailbox->messages, i, mnum, &msg)) {
+    return false;
+  }
+
+  if (message != NULL) {
+    *message = msg;
+  }
+  return true;
+}
+
+/*
+ * Gets whether the i'th message in ascending mnum order is a shared body.
+ */
+bool mailbox_shared_at(Mailbox *mailbox, int i) {
+  return i < msgidx_count(mailbox->messages) &&
+         (mailbox->messages->entries[i].size & MAILBOX_SHARED) != 0;
+}
+
+/*
+ * Starts remembering which messages change, from the current version on.
+ * Mailboxes nobody waits on don't pay for it.
+ */
+bool mailbox_watch(Mailbox *mailbox) {
+  if (mailbox->changes == NULL) {
+    if (!(mailbox->changes = malloc(MAILBOX_CHANGES * sizeof(int)))) {
+      return false;
+    }
+    mailbox->changes_since = mailbox->version;
+  }
+  return true;
+}
+
+/*
+ * Gets the numbers of the messages changed after version since, ascending
+ * and each once, into mnums, which has room for MAILBOX_CHANGES. Returns
+ * false if that's no longer known, because the mailbox wasn't watched
+ * then or has changed too much since, and the client has to list it all.
+ */
+bool mailbox_changes(Mailbox *mailbox, uint64_t since, int *mnums,
+                     int *count) {
+  *count = 0;
+
+  if (!mailbox_watch(mailbox) || since < mailbox->changes_since ||
+      since > mailbox->version || mailbox->version - since > MAILBOX_CHANGES) {
+    return false;
+  }
+
+  for (uint64_t v = since + 1; v <= mailbox->version; v++) {
+    int mnum = mailbox->changes[v % MAILBOX_CHANGES];
+    int pos = *count;
+
+    // Insertion sort, skipping repeats. There are only a few.
+    while (pos > 0 && mnums[pos - 1] > mnum) {
+      pos--;
+    }
+    if (pos > 0 && mnums[pos - 1] == mnum) {
+      continue;
+    }
+    memmove(&mnums[pos + 1], &mnums[pos], (*count - pos) * sizeof(int));
+    mnums[pos] = mnum;
+    (*count)++;
+  }
+  return true;
+}
+
+/*
+ * Finds the messages matching query, see search.h, putting the best max in
+ * hits and setting total to how many matched. The index is built on the
+ * first search and kept up to date from then on, so mailboxes nobody
+ * searches don't pay for one. Returns false if it ran out of memory.
+ */
+bool mailbox_search(Mailbox *mailbox, const char *query, SearchHit *hits,
+                    int max, int *total) {
+  if (mailbox->index == NULL) {
+    if (!(mailbox->index = search_new())) {
+      return false;
+    }
+
+    for (int i = 0; i < msgidx_count(mailbox->messages); i++) {
+      MsgIdxEntry *entry = &mailbox->messages->entries[i];
+
+      if (!search_add(mailbox->index, entry->mnum, entry->value)) {
+        search_free(mailbox->index);
+        mailbox->index = NULL;
+        return false;
+      }
+    }
+  }
+
+  *total = search_query(mailbox->index, query, hits, max);
+  return *total != -1;
+}
+
+/*
+ * Gets the bytes of heap the mailbox holds. Messages in the shared arena
+ * are counted by what they use, a private arena by what it has reserved.
+ * Shared bodies belong to the body store and aren't counted. The search
+ * index is.
+ */
+size_t mailbox_memory(Mailbox *mailbox) {
+  size_t bytes = sizeof(Mailbox) + strlen(mailbox->user) + 1;
+
+  if (mailbox->changes != NULL) {
+    bytes += MAILBOX_CHANGES * sizeof(int);
+  }
+
+  // Only the header is left while spilled.
+  if (mailbox->messages == NULL) {
+    return bytes;
+  }
+  bytes += msgidx_memory(mailbox->messages);
+  bytes += search_memory(mailbox->index);
+
+  if (mailbox->slab != NULL) {
+    bytes += mailbox->slab->bytes_reserved;
+  } else {
+    bytes += mailbox->bytes;
+  }
+
+  for (MailboxUpload *upload = mailbox->uploads; upload != NULL;
+       upload = upload->next) {
+    bytes += sizeof(MailboxUpload);
+    if (upload->slab != mailbox->slab) {
+      bytes += upload->total + 1;
+    }
+  }
+  return bytes;
+}
+
+// Layout of a file written by mailbox_save(): a header, then each message
+// as its index entry minus the pointer, followed by its text and
+// terminator. Only ever read back by the process that wrote it, so it is
+// in native byte order.
+typedef struct MailboxSavedHeader {
+  int count;
+  unsigned int reserved;
+  uint64_t bytes;  // Private message bytes, to size the arena up front.
+} MailboxSavedHeader;
+
+typedef struct MailboxSavedEntry {
+  int mnum;
+  unsigned int size;
+  unsigned int version;
+} MailboxSavedEntry;
+
+/*
+ * Writes every message in the mailbox to out, versions and sharing
+ * included, so mailbox_load() can put it back exactly as it was. The
+ * mailbox itself is left as it is.
+ */
+bool mailbox_save(Mailbox *mailbox, FILE *out) {
+  MailboxSavedHeader header;
+
+  memset(&header, 0, sizeof(header));
+  header.count = msgidx_count(mailbox->messages);
+  header.bytes = mailbox->bytes;
+  if (fwrite(&header, sizeof(header), 1, out) != 1) {
+    return false;
+  }
+
+  for (int i = 0; i < header.count; i++) {
+    MsgIdxEntry *entry = &mailbox->messages->entries[i];
+    MailboxSavedEntry saved;
+
+    saved.mnum = entry->mnum;
+    saved.size = entry->size;
+    saved.version = entry->version;
+    if (fwrite(&saved, sizeof(saved), 1, out) != 1 ||
+        fwrite(entry->value, 1, entry->size & ~MAILBOX_SHARED, out) !=
+        (entry->size & ~MAILBOX_SHARED)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/*
+ * Frees the mailbox's messages, which should have been saved, keeping
+ * only what's needed to answer for it without them: its name, handle,
+ * versions, change history, count and size.
+ */
+void mailbox_unload(Mailbox *mailbox) {
+  size_t bytes = mailbox->bytes;
+
+  mailbox->cold_count = msgidx_count(mailbox->messages);
+  mailbox_drop_messages(mailbox);
+  mailbox->bytes = bytes;
+}
+
+/*
+ * Gets whether the mailbox's messages are in memory.
+ */
+bool mailbox_loaded(Mailbox *mailbox) {
+  return mailbox->messages != NULL;
+}
+
+/*
+ * Reads back the messages written to in by mailbox_save(), in ascending
+ * mnum order, passing each one to fn.
+ */
+bool mailbox_read_saved(FILE *in, MailboxSavedFn fn, void *ctx) {
+  MailboxSavedHeader header;
+  char *buf = NULL;
+  size_t buf_size = 0;
+  bool ok = true;
+
+  if (fread(&header, sizeof(header), 1, in) != 1) {
+    return false;
+  }
+
+  for (int i = 0; i < header.count && ok; i++) {
+    MailboxSavedEntry saved;
+    MsgIdxEntry entry;
+    size_t size;
+
+    if (fread(&saved, sizeof(saved), 1, in) != 1) {
+      ok = false;
+      break;
+    }
+
+    size = saved.size & ~MAILBOX_SHARED;
+    if (size == 0 || size > MAILBOX_MAX_MESSAGE + 1) {
+      ok = false;
+      break;
+    }
+    if (size > buf_size) {
+      char *bigger = realloc(buf, size);
+      if (bigger == NULL) {
+        ok = false;
+        break;
+      }
+      buf = bigger;
+      buf_size = size;
+    }
+    if (fread(buf, 1, size, in) != size || buf[size - 1] != '\0') {
+      ok = false;
+      break;
+    }
+
+    entry.mnum = saved.mnum;
+    entry.size = saved.size;
+    entry.version = saved.version;
+    entry.value = buf;
+    fn(ctx, &entry);
+  }
+
+  free(buf);
+  return ok;
+}
+
+// State of a mailbox_load() in progress.
+typedef struct MailboxLoad {
+  Mailbox *mailbox;
+  bool ok;
+} MailboxLoad;
+
+/*
+ * Puts one saved message back in the mailbox being loaded, see
+ * MailboxSavedFn. Unlike storing a message, this keeps its version and
+ * isn't a change.
+ */
+static void mailbox_load_entry(void *ctx, const MsgIdxEntry *saved) {
+  MailboxLoad *load = ctx;
+  Mailbox *mailbox = load->mailbox;
+  unsigned int size = saved->size & ~MAILBOX_SHARED;
+  char *msg;
+
+  if (!load->ok) {
+    return;
+  }
+
+  if (saved->size & MAILBOX_SHARED) {
+    msg = bodystore_add(saved->value, size);
+  } else if ((msg = slab_alloc(mailbox_slab(mailbox), size)) != NULL) {
+    memcpy(msg, saved->value, size);
+  }
+
+  if (msg == NULL || !msgidx_put(mailbox->messages, saved->mnum, msg, NULL)) {
+    if (msg != NULL && (saved->size & MAILBOX_SHARED)) {
+      bodystore_release(msg);
+    } else if (msg != NULL) {
+      slab_release(mailbox_slab(mailbox), msg, size);
+    }
+    load->ok = false;
+    return;
+  }
+
+  MsgIdxEntry *entry = msgidx_entry(mailbox->messages, saved->mnum);
+  entry->size = saved->size;
+  entry->version = saved->version;
+  if (!(saved->size & MAILBOX_SHARED)) {
+    mailbox->bytes += size;
+  }
+}
+
+/*
+ * Reads the mailbox's messages back from a file written by mailbox_save()
+ * after it was unloaded. Failure leaves it unloaded.
+ */
+bool mailbox_load(Mailbox *mailbox, FILE *in) {
+  MailboxSavedHeader header;
+  MailboxLoad load;
+
+  if (fread(&header, sizeof(header), 1, in) != 1 ||
+      fseek(in, 0, SEEK_SET) == -1) {
+    return false;
+  }
+
+  if (!(mailbox->messages = msgidx_new())) {
+    return false;
+  }
+  mailbox->bytes = 0;
+
+  // Straight into an arena of its own if it had one.
+  if (header.bytes > MAILBOX_PRIVATE_ARENA_BYTES) {
+    mailbox->slab = slab_new();
+  }
+
+  load.mailbox = mailbox;
+  load.ok = true;
+  if (!mailbox_read_saved(in, mailbox_load_entry, &load) || !load.ok) {
+    mailbox_drop_messages(mailbox);
+    mailbox->bytes = header.bytes;
+    return false;
+  }
+  return true;
+}
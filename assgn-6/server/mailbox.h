@@ -0,0 +1,132 @@
+/**
+ * EECS 338 Operating Systems
+ * Case Western Reserve University
+ * (C) 2015 Christian Gunderman
+ */
+#ifndef MAILBOX__H__
+#define MAILBOX__H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "msgidx.h"
+#include "search.h"
+#include "slab.h"
+
+/*
+ * A single user's mailbox: the sparse message index plus the slab arena
+ * the message bodies live in. Small mailboxes share one global arena, since
+ * a private one would cost more in slack than it saves. Once a mailbox's
+ * messages outgrow MAILBOX_PRIVATE_ARENA_BYTES they move to an arena of
+ * their own, which is freed in one step when the mailbox is. A mailbox
+ * still in the shared arena is freed a message at a time.
+ */
+#define MAILBOX_PRIVATE_ARENA_BYTES 4096
+
+// Limits on messages sent in chunks. A message's whole buffer is allocated
+// by its first chunk, so these bound what a client can make us reserve.
+#define MAILBOX_MAX_MESSAGE (64 * 1024 * 1024)
+#define MAILBOX_MAX_UPLOADS 4
+
+// Set in a message's MsgIdxEntry size when its body lives in the body store
+// rather than the mailbox's arena.
+#define MAILBOX_SHARED 0x80000000u
+
+// Changes remembered per watched mailbox, for MAILBOX_WAIT to report.
+// Matches MAX_CHANGES in proto.x.
+#define MAILBOX_CHANGES 64
+
+// A message being received in chunks. Its buffer is the final message,
+// filled in place, and joins the index once the last byte arrives.
+typedef struct MailboxUpload {
+  struct MailboxUpload *next;
+  Slab *slab;       // Arena buf came from, the mailbox may move meanwhile.
+  char *buf;        // total + 1 bytes.
+  size_t total;
+  size_t received;  // Bytes 0..received are filled in.
+  int mnum;
+} MailboxUpload;
+
+// Outcome of writing a chunk.
+typedef enum MailboxChunkStatus {
+  MailboxChunkPending,     // Stored, more to come.
+  MailboxChunkComplete,    // That was the last of it, the message is in.
+  MailboxChunkOutOfOrder,  // Leaves a gap, or no upload to add to.
+  MailboxChunkTooMany,     // Already MAILBOX_MAX_UPLOADS in progress.
+  MailboxChunkNoMemory
+} MailboxChunkStatus;
+
+typedef struct Mailbox {
+  char *user;
+  struct Mailbox *prev;  // Links in the server's list of all mailboxes.
+  struct Mailbox *next;
+  MsgIdx *messages;      // NULL while spilled to disk.
+  Slab *slab;    // Private arena, or NULL if using the shared one.
+  size_t bytes;  // Private message bytes, including terminators.
+  MailboxUpload *uploads;  // Messages still arriving in chunks.
+  uint64_t handle;         // Session handle, 0 until first opened.
+  uint64_t version;        // Bumped by every change to a message.
+  int *changes;            // Ring of mnums changed, by version, once watched.
+  uint64_t changes_since;  // Versions after this are in changes.
+  struct MailboxWaiter *waiters;  // Clients blocked in MAILBOX_WAIT.
+  SearchIndex *index;      // Of the messages, once searched and loaded.
+  struct Mailbox *lru_prev;  // Links in the spill LRU, most recent first.
+  struct Mailbox *lru_next;
+  size_t resident;        // Bytes last counted against the memory budget.
+  uint64_t cold_id;       // Spill file it was last saved to, 0 if never.
+  uint64_t cold_version;  // Its version when that was written.
+  int cold_count;         // Messages in the spill file while unloaded.
+} Mailbox;
+
+// Gets one message read back from a file written by mailbox_save(). The
+// entry and its value are only valid for the duration of the call.
+typedef void (*MailboxSavedFn)(void *ctx, const MsgIdxEntry *entry);
+
+Mailbox *mailbox_new(const char *user);
+
+void mailbox_free(Mailbox *mailbox);
+
+bool mailbox_put(Mailbox *mailbox, int mnum, const char *message);
+
+bool mailbox_put_body(Mailbox *mailbox, int mnum, char *body);
+
+bool mailbox_put_shared(Mailbox *mailbox, int mnum, const char *message);
+
+MailboxChunkStatus mailbox_put_chunk(Mailbox *mailbox, int mnum, size_t total,
+                                     size_t offset, const char *data,
+                                     size_t len);
+
+bool mailbox_get(Mailbox *mailbox, int mnum, char **message, size_t *length,
+                 uint64_t *version);
+
+bool mailbox_remove(Mailbox *mailbox, int mnum);
+
+int mailbox_count(Mailbox *mailbox);
+
+bool mailbox_at(Mailbox *mailbox, int i, int *mnum, char **message);
+
+bool mailbox_shared_at(Mailbox *mailbox, int i);
+
+bool mailbox_watch(Mailbox *mailbox);
+
+bool mailbox_changes(Mailbox *mailbox, uint64_t since, int *mnums,
+                     int *count);
+
+bool mailbox_search(Mailbox *mailbox, const char *query, SearchHit *hits,
+                    int max, int *total);
+
+size_t mailbox_memory(Mailbox *mailbox);
+
+bool mailbox_save(Mailbox *mailbox, FILE *out);
+
+void mailbox_unload(Mailbox *mailbox);
+
+bool mailbox_load(Mailbox *mailbox, FILE *in);
+
+bool mailbox_loaded(Mailbox *mailbox);
+
+bool mailbox_read_saved(FILE *in, MailboxSavedFn fn, void *ctx);
+
+#endif // MAILBOX__H__
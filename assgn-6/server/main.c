@@ -0,0 +1,264 @@
+/**
+ * EECS 338 Operating Systems
+ * Case Western Reserve University
+ * (C) 2015 Christian Gunderman
+ */
+#define _XOPEN_SOURCE 700
+
+#include "proto.h"
+#include "server.h"
+#include "shmsvc.h"
+#include "waiters.h"
+
+#include <errno.h>
+#include <netinet/in.h>
+#include <rpc/pmap_clnt.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * Server entry point. Replaces the main() rpcgen would generate so that
+ * state can be recovered before serving, persistence work can run between
+ * requests, and Ctrl-C shuts down cleanly instead of losing the last
+ * commit group.
+ */
+
+// Preprocessor Defines.
+#define DEFAULT_DATA_DIR "mailbox-data"
+#define DEFAULT_SNAPSHOT_MB 64
+
+// rpcgen -m generated dispatcher, in proto_svc.c.
+void mailbox_prog_1(struct svc_req *rqstp, SVCXPRT *transp);
+
+// Set by the signal handler to stop the request loop.
+static volatile sig_atomic_t g_stop = 0;
+
+/**
+ * SIGINT/SIGTERM handler. Just flags the loop to stop, the actual shutdown
+ * happens outside of signal context.
+ */
+static void stop_handler(int signum) {
+  g_stop = 1;
+}
+
+/**
+ * Gets a monotonic timestamp in milliseconds.
+ */
+static double now_ms() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+/**
+ * Dispatches a request to the rpcgen generated dispatcher, timing it from
+ * decoding the arguments to sending the reply. A MAILBOX_WAIT that is
+ * parked, or a change whose reply is held for the log, is timed to when it
+ * was parked.
+ */
+static void dispatch(struct svc_req *rqstp, SVCXPRT *transp) {
+  unsigned long proc = rqstp->rq_proc;
+  double start = now_ms();
+
+  // Stream transports are made per connection, so are hooked on first use.
+  waiter_hook(transp);
+
+  mailbox_prog_1(rqstp, transp);
+  server_request_time(proc, now_ms() - start);
+
+  // A request answered without a reply, like a parked wait, holds nothing.
+  waiter_take_hold();
+}
+
+/**
+ * Print application usage info.
+ */
+static void print_help() {
+  printf("RPC Mailbox Server\n");
+  printf("(C) 2015 Christian Gunderman\n\n");
+  printf("usage: ./server [-d data_dir] [-s snapshot_mb] [-m memory_mb] "
+         "[-p port]\n"
+         "                [-S shard/shards] [-L socket_path] [-a]\n");
+  printf("  -d  directory for the log and snapshots (default %s)\n",
+         DEFAULT_DATA_DIR);
+  printf("  -s  snapshot after this many MB of log, 0 for never (default %i)\n",
+         DEFAULT_SNAPSHOT_MB);
+  printf("  -m  spill least recently used mailboxes to disk past this many MB\n"
+         "      of memory, 0 for never (default 0)\n");
+  printf("  -p  serve on this fixed port without the portmapper\n");
+  printf("  -S  only take users of this shard, e.g. 0/4, see "
+         "protocol/shard.h\n");
+  printf("  -L  also serve local clients through shared memory, connecting\n"
+         "      on a unix socket at this path, see protocol/shm.h\n");
+  printf("  -a  answer changes before they're fsync'd, faster but a crash can\n"
+         "      lose changes clients were told succeeded\n");
+  exit(1);
+}
+
+/**
+ * Creates and registers a transport of the given socket type. With a port
+ * the socket is bound to it and not registered with the portmapper,
+ * otherwise it gets any port and is registered like rpcgen's main does.
+ */
+static void register_transport(int type, int port) {
+  int sock = RPC_ANYSOCK;
+  int protocol = type == SOCK_DGRAM ? IPPROTO_UDP : IPPROTO_TCP;
+  SVCXPRT *transp;
+
+  if (port != 0) {
+    struct sockaddr_in addr;
+    int one = 1;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+
+    if ((sock = socket(AF_INET, type, 0)) == -1 ||
+        setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) == -1 ||
+        bind(sock, (struct sockaddr*)&addr, sizeof(addr)) == -1 ||
+        (type == SOCK_STREAM && listen(sock, SOMAXCONN) == -1)) {
+      perror("Unable to bind server port");
+      exit(1);
+    }
+    protocol = 0;
+  }
+
+  if (type == SOCK_DGRAM) {
+    transp = svcudp_create(sock);
+  } else {
+    transp = svctcp_create(sock, 0, 0);
+  }
+
+  if (transp == NULL) {
+    fprintf(stderr, "cannot create %s service.\n",
+            type == SOCK_DGRAM ? "udp" : "tcp");
+    exit(1);
+  }
+
+  // Before the first request, so datagram requests can wait too.
+  waiter_hook(transp);
+
+  if (!svc_register(transp, MAILBOX_PROG, MAILBOX_VERSION,
+                    dispatch, protocol)) {
+    fprintf(stderr, "unable to register (MAILBOX_PROG, MAILBOX_VERSION, %s).\n",
+            type == SOCK_DGRAM ? "udp" : "tcp");
+    exit(1);
+  }
+}
+
+/**
+ * Application entry point.
+ */
+int main(int argc, char *argv[]) {
+  const char *data_dir = DEFAULT_DATA_DIR;
+  long snapshot_mb = DEFAULT_SNAPSHOT_MB;
+  long memory_mb = 0;
+  int port = 0;
+  int shard_index = 0;
+  int shard_count = 1;
+  const char *local_path = NULL;
+  int opt;
+
+  // Line buffered, so recovery and snapshot reports survive a kill.
+  setvbuf(stdout, NULL, _IOLBF, 0);
+
+  while ((opt = getopt(argc, argv, "d:s:m:p:S:L:a")) != -1) {
+    switch (opt) {
+    case 'd':
+      data_dir = optarg;
+      break;
+    case 's':
+      snapshot_mb = atol(optarg);
+      break;
+    case 'm':
+      memory_mb = atol(optarg);
+      break;
+    case 'p':
+      port = atoi(optarg);
+      break;
+    case 'S':
+      if (sscanf(optarg, "%d/%d", &shard_index, &shard_count) != 2 ||
+          shard_count < 1 || shard_index < 0 || shard_index >= shard_count) {
+        print_help();
+      }
+      break;
+    case 'L':
+      local_path = optarg;
+      break;
+    case 'a':
+      server_early_replies(true);
+      break;
+    default:
+      print_help();
+    }
+  }
+
+  server_shard(shard_index, shard_count);
+
+  // Recover before accepting any requests.
+  if (!server_init(data_dir, snapshot_mb * 1024 * 1024,
+                   memory_mb * 1024 * 1024)) {
+    exit(1);
+  }
+
+  if (port == 0) {
+    pmap_unset(MAILBOX_PROG, MAILBOX_VERSION);
+  }
+  register_transport(SOCK_DGRAM, port);
+  register_transport(SOCK_STREAM, port);
+  if (local_path != NULL && !shmsvc_open(local_path)) {
+    exit(1);
+  }
+
+  // Stop on Ctrl-C without SA_RESTART, so select() returns and the loop
+  // notices.
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = stop_handler;
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+
+  // A waiting client may hang up before its late reply goes out, which
+  // should be a failed write, not the end of the server.
+  signal(SIGPIPE, SIG_IGN);
+
+  // Same as svc_run(), but wakes up for the server's own deadlines.
+  while (!g_stop) {
+    fd_set readfds = svc_fdset;
+    shmsvc_fdset(&readfds);
+    int wait_ms = server_tick();
+    waiter_fdset(&readfds);
+    struct timeval timeout;
+
+    timeout.tv_sec = wait_ms / 1000;
+    timeout.tv_usec = (wait_ms % 1000) * 1000;
+
+    int ready = select(FD_SETSIZE, &readfds, NULL, NULL,
+                       wait_ms < 0 ? NULL : &timeout);
+    if (ready == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      perror("select failed");
+      break;
+    }
+
+    if (ready > 0) {
+      shmsvc_serve(&readfds);
+      svc_getreqset(&readfds);
+    }
+  }
+
+  printf("Shutting down.\n");
+  shmsvc_close();
+  server_shutdown();
+  return 0;
+}
@@ -0,0 +1,210 @@
+/**
+ * EECS 338 Operating Systems
+ * Case Western Reserve University
+ * (C) 2015 Christian Gunderman
+ */
+#include "msgidx.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Entry storage is allocated lazily, starting at this many slots and
+// doubling from there. Shrinks by half once it drops below a quarter full.
+#define MSGIDX_MIN_CAPACITY 2
+
+/*
+ * Binary searches for mnum. Returns true if found, and sets pos to either
+ * its position or the position it should be inserted at to keep order.
+ */
+static bool msgidx_find(MsgIdx *idx, int mnum, int *pos) {
+  int low = 0;
+  int high = idx->count;
+
+  while (low < high) {
+    int mid = low + (high - low) / 2;
+
+    if (idx->entries[mid].mnum < mnum) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+
+  *pos = low;
+  return low < idx->count && idx->entries[low].mnum == mnum;
+}
+
+/*
+ * Resizes entry storage to hold exactly capacity entries. A capacity of zero
+ * releases the storage entirely.
+ */
+static bool msgidx_resize(MsgIdx *idx, int capacity) {
+  if (capacity == 0) {
+    free(idx->entries);
+    idx->entries = NULL;
+    idx->capacity = 0;
+    return true;
+  }
+
+  MsgIdxEntry *entries = realloc(idx->entries, capacity * sizeof(MsgIdxEntry));
+  if (entries == NULL) {
+    return false;
+  }
+
+  idx->entries = entries;
+  idx->capacity = capacity;
+  return true;
+}
+
+/*
+ * Creates a new, empty index. No entry storage is allocated until the
+ * first message is inserted.
+ */
+MsgIdx *msgidx_new() {
+  return calloc(1, sizeof(MsgIdx));
+}
+
+/*
+ * Frees the index. Values are owned by the caller and are not freed.
+ */
+void msgidx_free(MsgIdx *idx) {
+  if (idx != NULL) {
+    free(idx->entries);
+    free(idx);
+  }
+}
+
+/*
+ * Looks up the value stored under mnum. value may be NULL if the caller
+ * only wants to test for existence.
+ */
+bool msgidx_get(MsgIdx *idx, int mnum, void **value) {
+  int pos;
+
+  if (!msgidx_find(idx, mnum, &pos)) {
+    return false;
+  }
+
+  if (value != NULL) {
+    *value = idx->entries[pos].value;
+  }
+  return true;
+}
+
+/*
+ * Gets the entry for mnum, or NULL if there isn't one. Only valid until
+ * the index is next changed.
+ */
+MsgIdxEntry *msgidx_entry(MsgIdx *idx, int mnum) {
+  int pos;
+
+  if (!msgidx_find(idx, mnum, &pos)) {
+    return NULL;
+  }
+  return &idx->entries[pos];
+}
+
+/*
+ * Stores value under mnum, replacing any existing value. The replaced value,
+ * or NULL if there wasn't one, is returned in old_value so the caller can
+ * free it. Returns false only if storage could not be grown.
+ */
+bool msgidx_put(MsgIdx *idx, int mnum, void *value, void **old_value) {
+  int pos;
+
+  if (old_value != NULL) {
+    *old_value = NULL;
+  }
+
+  // Replace in place.
+  if (msgidx_find(idx, mnum, &pos)) {
+    if (old_value != NULL) {
+      *old_value = idx->entries[pos].value;
+    }
+    idx->entries[pos].value = value;
+    idx->entries[pos].size = 0;
+    idx->entries[pos].version = 0;
+    return true;
+  }
+
+  // Grow if full.
+  if (idx->count == idx->capacity &&
+      !msgidx_resize(idx, idx->capacity == 0 ?
+                     MSGIDX_MIN_CAPACITY : idx->capacity * 2)) {
+    return false;
+  }
+
+  // Shift the tail up one to keep the entries in order.
+  memmove(&idx->entries[pos + 1], &idx->entries[pos],
+          (idx->count - pos) * sizeof(MsgIdxEntry));
+  idx->entries[pos].mnum = mnum;
+  idx->entries[pos].size = 0;
+  idx->entries[pos].version = 0;
+  idx->entries[pos].value = value;
+  idx->count++;
+
+  return true;
+}
+
+/*
+ * Removes mnum from the index, returning its value in old_value. Returns
+ * false if there was no such message.
+ */
+bool msgidx_remove(MsgIdx *idx, int mnum, void **old_value) {
+  int pos;
+
+  if (!msgidx_find(idx, mnum, &pos)) {
+    return false;
+  }
+
+  if (old_value != NULL) {
+    *old_value = idx->entries[pos].value;
+  }
+
+  memmove(&idx->entries[pos], &idx->entries[pos + 1],
+          (idx->count - pos - 1) * sizeof(MsgIdxEntry));
+  idx->count--;
+
+  // Give memory back once the mailbox has mostly emptied. Failure to shrink
+  // is harmless, we just keep the bigger block.
+  if (idx->count == 0) {
+    msgidx_resize(idx, 0);
+  } else if (idx->capacity > MSGIDX_MIN_CAPACITY &&
+             idx->count < idx->capacity / 4) {
+    msgidx_resize(idx, idx->capacity / 2);
+  }
+
+  return true;
+}
+
+/*
+ * Gets the number of messages in the index.
+ */
+int msgidx_count(MsgIdx *idx) {
+  return idx->count;
+}
+
+/*
+ * Gets the i'th message in ascending mnum order, for iteration from
+ * 0 to msgidx_count() - 1.
+ */
+bool msgidx_at(MsgIdx *idx, int i, int *mnum, void **value) {
+  if (i < 0 || i >= idx->count) {
+    return false;
+  }
+
+  if (mnum != NULL) {
+    *mnum = idx->entries[i].mnum;
+  }
+  if (value != NULL) {
+    *value = idx->entries[i].value;
+  }
+  return true;
+}
+
+/*
+ * Gets the bytes of heap the index itself is using, not counting values.
+ */
+size_t msgidx_memory(MsgIdx *idx) {
+  return sizeof(MsgIdx) + idx->capacity * sizeof(MsgIdxEntry);
+}
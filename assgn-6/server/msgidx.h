@@ -0,0 +1,52 @@
+/**
+ * EECS 338 Operating Systems
+ * Case Western Reserve University
+ * (C) 2015 Christian Gunderman
+ */
+#ifndef MSGIDX__H__
+#define MSGIDX__H__
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Sparse, ordered index of a mailbox's messages keyed by message number.
+ * Starts out empty (no entry storage at all) and only grows to hold the
+ * messages that actually exist, so an empty mailbox costs just the header.
+ */
+
+// A single message slot: the client chosen message number and its body.
+// size and version are the caller's to use, the index only zeroes them
+// when a value is stored.
+typedef struct MsgIdxEntry {
+  int mnum;
+  unsigned int size;
+  unsigned int version;
+  void *value;
+} MsgIdxEntry;
+
+typedef struct MsgIdx {
+  MsgIdxEntry *entries;  // Sorted by mnum, NULL until first insert.
+  int count;
+  int capacity;
+} MsgIdx;
+
+MsgIdx *msgidx_new();
+
+void msgidx_free(MsgIdx *idx);
+
+bool msgidx_get(MsgIdx *idx, int mnum, void **value);
+
+MsgIdxEntry *msgidx_entry(MsgIdx *idx, int mnum);
+
+bool msgidx_put(MsgIdx *idx, int mnum, void *value, void **old_value);
+
+bool msgidx_remove(MsgIdx *idx, int mnum, void **old_value);
+
+int msgidx_count(MsgIdx *idx);
+
+bool msgidx_at(MsgIdx *idx, int i, int *mnum, void **value);
+
+size_t msgidx_memory(MsgIdx *idx);
+
+#endif // MSGIDX__H__
@@ -0,0 +1,1075 @@
+/**
+ * EECS 338 Operating Systems
+ * Case Western Reserve University
+ * (C) 2015 Christian Gunderman
+ */
+#define _XOPEN_SOURCE 700
+
+#include "persist.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+// Preprocessor Defines.
+#define PERSIST_COMMIT_MS 5              // Max time a record waits for fsync.
+#define PERSIST_BUFFER_SIZE (64 * 1024)  // Write out the log buffer past this.
+#define PERSIST_PATH_MAX 4096
+#define PERSIST_SNAPSHOT_POLL_MS 10      // How often to check on a snapshot.
+
+// Snapshot file magic. Written last, so a torn snapshot never looks valid.
+static const char kSnapMagic[8] = { 'M', 'B', 'X', 'S', 'N', 'A', 'P', '1' };
+
+// Log record framing. length is the bytes of body plus strings that follow,
+// crc covers the same bytes, so a torn tail is detected on replay.
+typedef struct LogRecordHeader {
+  uint32_t length;
+  uint32_t crc;
+} LogRecordHeader;
+
+typedef struct LogRecordBody {
+  uint8_t op;
+  uint8_t pad[3];
+  int32_t mnum;
+  uint32_t user_len;
+  uint32_t message_len;
+  // Followed by user and message bytes, no terminators.
+} LogRecordBody;
+
+// Snapshot layout. Everything is 8 byte aligned and every string is NUL
+// terminated in place, so a mapped snapshot can be read without copying.
+typedef struct SnapHeader {
+  char magic[8];
+  uint64_t gen;
+  uint64_t users;
+  uint64_t messages;
+  uint64_t bytes;       // Total file size, including this header.
+} SnapHeader;
+
+typedef struct SnapUser {
+  uint32_t user_len;
+  uint32_t message_count;
+  // Followed by user, NUL, padding to 8 and then its messages.
+} SnapUser;
+
+typedef struct SnapMessage {
+  int32_t mnum;
+  uint32_t message_len;  // SNAP_SHARED is set for shared bodies.
+  // Followed by message, NUL and padding to 8.
+} SnapMessage;
+
+#define SNAP_SHARED 0x80000000u
+
+struct PersistSnapshot {
+  FILE *file;
+  uint64_t users;
+  uint64_t messages;
+  uint64_t bytes;
+  bool failed;
+  SnapUser user;         // Last user added, and where its record is.
+  uint64_t user_offset;
+  uint32_t user_messages;  // Messages actually added for it so far.
+};
+
+// Global state:
+// The server is single threaded and has exactly one data directory, so
+// like g_users_ht this lives for the life of the process.
+static char *g_dir = NULL;
+static int g_log_fd = -1;
+static unsigned long g_gen = 0;
+static unsigned long g_base_gen = 0;  // Newest snapshot on disk, 0 if none.
+static size_t g_log_bytes = 0;
+static size_t g_snapshot_log_bytes = 0;
+static PersistDumpFn g_dump = NULL;
+static bool g_recovering = false;
+
+// Group commit buffer. Records wait here, then are written out and fsync'd
+// together once the oldest has waited PERSIST_COMMIT_MS. Records are
+// counted as they're logged, and as they become durable, so replies can
+// be held until theirs are.
+static char *g_buf = NULL;
+static size_t g_buf_len = 0;
+static size_t g_buf_cap = 0;
+static bool g_unsynced = false;
+static double g_unsynced_since = 0;
+static bool g_log_failed = false;  // Records are stuck until the disk works.
+static uint64_t g_logged = 0;
+static uint64_t g_durable = 0;
+
+// Background snapshot in progress, if g_snap_pid isn't -1, and the
+// counters it is measured against.
+static pid_t g_snap_pid = -1;
+static unsigned long g_snap_gen = 0;
+static double g_snap_start = 0;
+static double g_snap_fork_ms = 0;
+static long g_snap_minflt = 0;
+static long g_snap_child_minflt = 0;
+
+// Request service times since the last snapshot, and during the current.
+typedef struct PersistLatency {
+  unsigned long count;
+  double total_ms;
+  double max_ms;
+} PersistLatency;
+
+static PersistLatency g_latency_idle;
+static PersistLatency g_latency_snapshot;
+
+/*
+ * Gets a monotonic timestamp in milliseconds.
+ */
+static double persist_now_ms() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+/*
+ * CRC-32 (IEEE) of len bytes, continuing from crc.
+ */
+static uint32_t persist_crc32(uint32_t crc, const void *data, size_t len) {
+  static uint32_t table[256];
+  static bool table_ready = false;
+  const uint8_t *bytes = data;
+
+  if (!table_ready) {
+    for (uint32_t i = 0; i < 256; i++) {
+      uint32_t c = i;
+      for (int k = 0; k < 8; k++) {
+        c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+      }
+      table[i] = c;
+    }
+    table_ready = true;
+  }
+
+  crc = ~crc;
+  for (size_t i = 0; i < len; i++) {
+    crc = table[(crc ^ bytes[i]) & 0xFF] ^ (crc >> 8);
+  }
+  return ~crc;
+}
+
+/*
+ * Builds the path of a data file, e.g. "dir/log.3".
+ */
+static void persist_path(char *path, const char *kind, unsigned long gen,
+                         const char *suffix) {
+  snprintf(path, PERSIST_PATH_MAX, "%s/%s.%lu%s", g_dir, kind, gen, suffix);
+}
+
+/*
+ * fsyncs the data directory so renames and creates are durable.
+ */
+static void persist_sync_dir() {
+  int fd = open(g_dir, O_RDONLY);
+
+  if (fd != -1) {
+    fsync(fd);
+    close(fd);
+  }
+}
+
+/*
+ * Writes all of buf to fd, retrying short writes. Returns the bytes
+ * written, which are fewer than len if a write failed.
+ */
+static size_t persist_write_all(int fd, const char *buf, size_t len) {
+  size_t done = 0;
+
+  while (done < len) {
+    ssize_t written = write(fd, buf + done, len - done);
+
+    if (written == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      break;
+    }
+    done += written;
+  }
+  return done;
+}
+
+/*
+ * Says a log write or sync failed, once, not on every retry while the disk
+ * stays full.
+ */
+static void persist_log_failed(const char *what) {
+  if (!g_log_failed) {
+    perror(what);
+    g_log_failed = true;
+  }
+}
+
+/*
+ * Writes the buffered records to the log, and fsyncs it if sync is set.
+ * Anything a failed write leaves behind stays buffered and goes out with
+ * the next flush, and a failed sync is tried again with it. Returns false
+ * if records are still waiting to be written or synced.
+ */
+static bool persist_flush(bool sync) {
+  if (g_buf_len > 0) {
+    size_t written = persist_write_all(g_log_fd, g_buf, g_buf_len);
+
+    g_log_bytes += written;
+    g_buf_len -= written;
+    memmove(g_buf, g_buf + written, g_buf_len);
+
+    if (g_buf_len > 0) {
+      persist_log_failed("Log write error");
+      return false;
+    }
+  }
+
+  if (sync && g_unsynced) {
+    if (fdatasync(g_log_fd) == -1) {
+      persist_log_failed("Log sync error");
+      return false;
+    }
+    g_unsynced = false;
+    g_durable = g_logged;
+  }
+
+  if (g_log_failed && !g_unsynced) {
+    printf("Log writes resumed.\n");
+    g_log_failed = false;
+  }
+  return true;
+}
+
+/*
+ * Appends a record to the log buffer, with user_len bytes of user.
+ */
+static void persist_append(PersistOp op, const char *user, size_t user_len,
+                           int mnum, const char *message) {
+  LogRecordBody body;
+  memset(&body, 0, sizeof(body));
+  body.op = op;
+  body.mnum = mnum;
+  body.user_len = user_len;
+  body.message_len = message != NULL ? strlen(message) : 0;
+
+  LogRecordHeader header;
+  header.length = sizeof(body) + body.user_len + body.message_len;
+  header.crc = persist_crc32(0, &body, sizeof(body));
+  header.crc = persist_crc32(header.crc, user, body.user_len);
+  header.crc = persist_crc32(header.crc, message, body.message_len);
+
+  // Make room in the buffer.
+  size_t needed = g_buf_len + sizeof(header) + header.length;
+  if (needed > g_buf_cap) {
+    size_t cap = g_buf_cap == 0 ? PERSIST_BUFFER_SIZE : g_buf_cap;
+    while (cap < needed) {
+      cap *= 2;
+    }
+
+    char *buf = realloc(g_buf, cap);
+    if (buf == NULL) {
+      perror("Log buffer error");
+      return;
+    }
+    g_buf = buf;
+    g_buf_cap = cap;
+  }
+
+  char *pos = g_buf + g_buf_len;
+  memcpy(pos, &header, sizeof(header));
+  pos += sizeof(header);
+  memcpy(pos, &body, sizeof(body));
+  pos += sizeof(body);
+  memcpy(pos, user, body.user_len);
+  pos += body.user_len;
+  if (message != NULL) {
+    memcpy(pos, message, body.message_len);
+  }
+  g_buf_len = needed;
+  g_logged++;
+
+  // Start the commit timer on the first record of a group.
+  if (!g_unsynced) {
+    g_unsynced = true;
+    g_unsynced_since = persist_now_ms();
+  }
+
+  // Don't let the buffer grow without bound between commits.
+  if (g_buf_len >= PERSIST_BUFFER_SIZE) {
+    persist_flush(false);
+  }
+}
+
+/*
+ * Appends an operation to the log. It is durable once the current commit
+ * group is fsync'd by persist_tick(), at most PERSIST_COMMIT_MS later,
+ * which persist_durable() shows. Does nothing while recovering, or if
+ * persistence isn't open.
+ */
+void persist_log(PersistOp op, const char *user, int mnum,
+                 const char *message) {
+  if (g_log_fd == -1 || g_recovering) {
+    return;
+  }
+
+  persist_append(op, user, strlen(user), mnum, message);
+}
+
+/*
+ * Logs one message delivered to several users as a single record, so the
+ * body is written once however many recipients it has.
+ */
+void persist_log_multi(char **users, int user_count, int mnum,
+                       const char *message) {
+  if (g_log_fd == -1 || g_recovering || user_count == 0) {
+    return;
+  }
+
+  // Names one after another, each with its terminator.
+  size_t len = 0;
+  for (int i = 0; i < user_count; i++) {
+    len += strlen(users[i]) + 1;
+  }
+
+  char *list = malloc(len);
+  if (list == NULL) {
+    perror("Log buffer error");
+    return;
+  }
+
+  char *pos = list;
+  for (int i = 0; i < user_count; i++) {
+    size_t size = strlen(users[i]) + 1;
+    memcpy(pos, users[i], size);
+    pos += size;
+  }
+
+  persist_append(PersistOpInsertMulti, list, len, mnum, message);
+  free(list);
+}
+
+/*
+ * Writes raw bytes to a snapshot, padded out to 8 byte alignment.
+ */
+static void persist_snapshot_write(PersistSnapshot *snap, const void *data,
+                                   size_t len, bool pad) {
+  static const char zeros[8] = { 0 };
+
+  if (len > 0 && fwrite(data, 1, len, snap->file) != len) {
+    snap->failed = true;
+  }
+  snap->bytes += len;
+
+  if (pad && snap->bytes % 8 != 0) {
+    size_t pad_len = 8 - snap->bytes % 8;
+    if (fwrite(zeros, 1, pad_len, snap->file) != pad_len) {
+      snap->failed = true;
+    }
+    snap->bytes += pad_len;
+  }
+}
+
+/*
+ * Finishes the last user added. If a different number of messages followed
+ * it than it said, its record is rewritten with the number that did.
+ */
+static void persist_snapshot_end_user(PersistSnapshot *snap) {
+  if (snap->users == 0 || snap->user.message_count == snap->user_messages) {
+    return;
+  }
+
+  snap->user.message_count = snap->user_messages;
+  if (fseek(snap->file, snap->user_offset, SEEK_SET) != 0 ||
+      fwrite(&snap->user, sizeof(snap->user), 1, snap->file) != 1 ||
+      fseek(snap->file, 0, SEEK_END) != 0) {
+    snap->failed = true;
+  }
+}
+
+/*
+ * Adds a user to the snapshot, followed by calls to
+ * persist_snapshot_message() for their message_count messages.
+ */
+void persist_snapshot_user(PersistSnapshot *snap, const char *user,
+                           int message_count) {
+  persist_snapshot_end_user(snap);
+
+  snap->user.user_len = strlen(user);
+  snap->user.message_count = message_count;
+  snap->user_offset = snap->bytes;
+  snap->user_messages = 0;
+
+  persist_snapshot_write(snap, &snap->user, sizeof(snap->user), false);
+  persist_snapshot_write(snap, user, snap->user.user_len + 1, true);
+  snap->users++;
+}
+
+/*
+ * Adds a message belonging to the last user added to the snapshot. Shared
+ * messages are still written out whole for every user holding them, and
+ * go back into the body store when loaded.
+ */
+void persist_snapshot_message(PersistSnapshot *snap, int mnum,
+                              const char *message, bool shared) {
+  SnapMessage rec;
+  size_t len = strlen(message);
+  rec.mnum = mnum;
+  rec.message_len = len | (shared ? SNAP_SHARED : 0);
+
+  persist_snapshot_write(snap, &rec, sizeof(rec), false);
+  persist_snapshot_write(snap, message, len + 1, true);
+  snap->messages++;
+  snap->user_messages++;
+}
+
+/*
+ * Removes every data file older than gen, and any unfinished snapshot.
+ */
+static void persist_remove_before(unsigned long gen) {
+  DIR *dir = opendir(g_dir);
+  struct dirent *ent;
+
+  if (dir == NULL) {
+    return;
+  }
+
+  while ((ent = readdir(dir)) != NULL) {
+    unsigned long file_gen;
+    char kind[8];
+    char path[PERSIST_PATH_MAX];
+
+    if (sscanf(ent->d_name, "%4[a-z].%lu", kind, &file_gen) == 2 &&
+        (strcmp(kind, "snap") == 0 || strcmp(kind, "log") == 0) &&
+        (file_gen < gen || strchr(ent->d_name, '~') != NULL)) {
+      snprintf(path, sizeof(path), "%s/%s", g_dir, ent->d_name);
+      unlink(path);
+    }
+  }
+  closedir(dir);
+}
+
+/*
+ * Finds the newest snapshot with a generation below below. Returns false if
+ * there isn't one.
+ */
+static bool persist_find_snapshot(unsigned long below, unsigned long *gen) {
+  DIR *dir = opendir(g_dir);
+  struct dirent *ent;
+  bool found = false;
+
+  if (dir == NULL) {
+    return false;
+  }
+
+  while ((ent = readdir(dir)) != NULL) {
+    unsigned long file_gen;
+    char kind[8];
+
+    if (strchr(ent->d_name, '~') == NULL &&
+        sscanf(ent->d_name, "%4[a-z].%lu", kind, &file_gen) == 2 &&
+        strcmp(kind, "snap") == 0 && file_gen < below &&
+        (!found || file_gen > *gen)) {
+      *gen = file_gen;
+      found = true;
+    }
+  }
+  closedir(dir);
+  return found;
+}
+
+/*
+ * Writes the snapshot for gen. Runs in the forked child, so it sees the
+ * state exactly as it was at the fork and must not touch the log.
+ */
+static bool persist_write_snapshot(unsigned long gen) {
+  double start = persist_now_ms();
+  char tmp_path[PERSIST_PATH_MAX];
+  char snap_path[PERSIST_PATH_MAX];
+
+  persist_path(tmp_path, "snap", gen, "~");
+  persist_path(snap_path, "snap", gen, "");
+
+  PersistSnapshot snap;
+  memset(&snap, 0, sizeof(snap));
+  if (!(snap.file = fopen(tmp_path, "w"))) {
+    perror("Snapshot create error");
+    return false;
+  }
+
+  // Leave room for the header, which is filled in last.
+  SnapHeader header;
+  memset(&header, 0, sizeof(header));
+  persist_snapshot_write(&snap, &header, sizeof(header), false);
+
+  bool dumped = g_dump(&snap);
+  persist_snapshot_end_user(&snap);
+  if (!dumped) {
+    // The caller said what it couldn't read.
+    fclose(snap.file);
+    unlink(tmp_path);
+    return false;
+  }
+
+  memcpy(header.magic, kSnapMagic, sizeof(header.magic));
+  header.gen = gen;
+  header.users = snap.users;
+  header.messages = snap.messages;
+  header.bytes = snap.bytes;
+
+  if (snap.failed ||
+      fflush(snap.file) != 0 ||
+      fseek(snap.file, 0, SEEK_SET) != 0 ||
+      fwrite(&header, sizeof(header), 1, snap.file) != 1 ||
+      fflush(snap.file) != 0 ||
+      fsync(fileno(snap.file)) != 0) {
+    perror("Snapshot write error");
+    fclose(snap.file);
+    unlink(tmp_path);
+    return false;
+  }
+  fclose(snap.file);
+
+  if (rename(tmp_path, snap_path) == -1) {
+    perror("Snapshot publish error");
+    unlink(tmp_path);
+    return false;
+  }
+  persist_sync_dir();
+
+  printf("Snapshot %lu: %llu users, %llu messages, "
+         "%.1f MB written in %.1f ms.\n",
+         gen, (unsigned long long)header.users,
+         (unsigned long long)header.messages,
+         header.bytes / 1048576.0, persist_now_ms() - start);
+  return true;
+}
+
+/*
+ * Gets the minor page faults so far of this process (children false) or
+ * of its reaped children (children true). Faults while a snapshot runs
+ * include the pages copied on write, but also every other page either
+ * process touches for the first time, such as new allocations and the
+ * child's stdio buffers, so they are only an upper bound on the copies.
+ */
+static long persist_minflt(bool children) {
+  struct rusage usage;
+
+  if (getrusage(children ? RUSAGE_CHILDREN : RUSAGE_SELF, &usage) == -1) {
+    return 0;
+  }
+  return usage.ru_minflt;
+}
+
+/*
+ * Reaps the snapshot child, waiting for it if wait is set. On success the
+ * files it supersedes are removed, and either way how it went is reported.
+ * Returns false if it is still running.
+ */
+static bool persist_reap_snapshot(bool wait) {
+  int status;
+  pid_t pid;
+
+  do {
+    pid = waitpid(g_snap_pid, &status, wait ? 0 : WNOHANG);
+  } while (pid == -1 && errno == EINTR);
+
+  if (pid == 0) {
+    return false;
+  }
+
+  bool ok = pid == g_snap_pid && WIFEXITED(status) &&
+            WEXITSTATUS(status) == EXIT_SUCCESS;
+  g_snap_pid = -1;
+
+  if (!ok) {
+    // The log carries on from the last good snapshot, so nothing is lost.
+    printf("Snapshot %lu failed.\n", g_snap_gen);
+  } else {
+    // The snapshot this one replaces stays, with its logs, in case the new
+    // one turns out unreadable.
+    persist_remove_before(g_base_gen);
+    g_base_gen = g_snap_gen;
+  }
+
+  PersistLatency *idle = &g_latency_idle;
+  PersistLatency *busy = &g_latency_snapshot;
+  printf("Snapshot %lu: %.1f ms total, fork paused requests %.2f ms, "
+         "%ld minor page faults (server %ld, snapshot %ld).\n",
+         g_snap_gen, persist_now_ms() - g_snap_start, g_snap_fork_ms,
+         (persist_minflt(false) - g_snap_minflt) +
+         (persist_minflt(true) - g_snap_child_minflt),
+         persist_minflt(false) - g_snap_minflt,
+         persist_minflt(true) - g_snap_child_minflt);
+  if (busy->count > 0) {
+    printf("Snapshot %lu: %lu requests at %.3f ms avg, %.3f ms max, "
+           "vs %lu at %.3f ms avg, %.3f ms max before.\n",
+           g_snap_gen, busy->count, busy->total_ms / busy->count, busy->max_ms,
+           idle->count,
+           idle->count > 0 ? idle->total_ms / idle->count : 0, idle->max_ms);
+  }
+
+  memset(idle, 0, sizeof(*idle));
+  memset(busy, 0, sizeof(*busy));
+  return true;
+}
+
+/*
+ * Starts a snapshot of the whole server state in the background. The server
+ * is forked and the child writes out its copy on write view of the state
+ * while this process carries on serving into a new log. The old snapshot
+ * and logs are removed once the child has the new snapshot on disk. Returns
+ * false if one couldn't be started, or one is already running.
+ */
+bool persist_snapshot() {
+  if (g_log_fd == -1 || g_dump == NULL || g_snap_pid != -1) {
+    return false;
+  }
+
+  unsigned long gen = g_gen + 1;
+  char log_path[PERSIST_PATH_MAX];
+
+  persist_path(log_path, "log", gen, "");
+
+  // Everything up to here is covered by the snapshot, the rest goes in the
+  // new log, which has to exist before the snapshot that refers to it.
+  // Records that can't be written yet belong in the old log, so wait.
+  if (!persist_flush(true)) {
+    return false;
+  }
+  int log_fd = open(log_path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+  if (log_fd == -1) {
+    perror("Snapshot log error");
+    return false;
+  }
+  persist_sync_dir();
+
+  // Don't let the child inherit anything still waiting to be printed.
+  fflush(stdout);
+
+  long minflt = persist_minflt(false);
+  long child_minflt = persist_minflt(true);
+  double start = persist_now_ms();
+
+  pid_t pid = fork();
+  if (pid == -1) {
+    perror("Snapshot fork error");
+    close(log_fd);
+    unlink(log_path);
+    return false;
+  } else if (pid == 0) {
+    // Exit without atexit handlers or stdio flushes that belong to the
+    // server.
+    bool ok = persist_write_snapshot(gen);
+    fflush(stdout);
+    _exit(ok ? EXIT_SUCCESS : EXIT_FAILURE);
+  }
+
+  g_snap_pid = pid;
+  g_snap_gen = gen;
+  g_snap_start = start;
+  g_snap_fork_ms = persist_now_ms() - start;
+  g_snap_minflt = minflt;
+  g_snap_child_minflt = child_minflt;
+
+  close(g_log_fd);
+  g_log_fd = log_fd;
+  g_log_bytes = 0;
+  g_gen = gen;
+  return true;
+}
+
+/*
+ * Gets how many records have been logged so far.
+ */
+uint64_t persist_logged() {
+  return g_logged;
+}
+
+/*
+ * Gets how many of the records logged so far are fsync'd. A reply to a
+ * change is safe to send once this reaches persist_logged() as it was
+ * after the change.
+ */
+uint64_t persist_durable() {
+  return g_durable;
+}
+
+/*
+ * Gets whether a snapshot process is still running.
+ */
+bool persist_snapshot_running() {
+  return g_snap_pid != -1;
+}
+
+/*
+ * Records how long a request took to serve, so that snapshot reports can
+ * show how much the snapshot slowed requests down.
+ */
+void persist_request_time(double ms) {
+  PersistLatency *latency = g_snap_pid != -1 ?
+                            &g_latency_snapshot : &g_latency_idle;
+
+  latency->count++;
+  latency->total_ms += ms;
+  if (ms > latency->max_ms) {
+    latency->max_ms = ms;
+  }
+}
+
+/*
+ * Performs any persistence work that has come due: commits the current
+ * group, starts a snapshot once the log is big enough, and reaps one that
+ * has finished. Returns the milliseconds until it next needs to be called,
+ * or -1 if nothing is pending.
+ */
+int persist_tick() {
+  int wait_ms = -1;
+
+  if (g_log_fd == -1) {
+    return -1;
+  }
+
+  if (g_snap_pid != -1 && !persist_reap_snapshot(false)) {
+    wait_ms = PERSIST_SNAPSHOT_POLL_MS;
+  }
+
+  if (g_unsynced) {
+    double waited = persist_now_ms() - g_unsynced_since;
+    if (waited < PERSIST_COMMIT_MS) {
+      int commit_ms = (int)(PERSIST_COMMIT_MS - waited) + 1;
+      return wait_ms == -1 || commit_ms < wait_ms ? commit_ms : wait_ms;
+    }
+
+    // Try again next commit if the log couldn't be written.
+    if (!persist_flush(true)) {
+      return wait_ms == -1 || PERSIST_COMMIT_MS < wait_ms ?
+             PERSIST_COMMIT_MS : wait_ms;
+    }
+  }
+
+  if (g_snap_pid == -1 && g_snapshot_log_bytes > 0 &&
+      g_log_bytes >= g_snapshot_log_bytes && persist_snapshot()) {
+    wait_ms = PERSIST_SNAPSHOT_POLL_MS;
+  }
+  return wait_ms;
+}
+
+/*
+ * Maps a whole file read only. Returns NULL for empty or missing files.
+ */
+static char *persist_map(const char *path, size_t *size) {
+  int fd = open(path, O_RDONLY);
+  struct stat st;
+  char *data = NULL;
+
+  if (fd == -1) {
+    return NULL;
+  }
+
+  if (fstat(fd, &st) == 0 && st.st_size > 0) {
+    data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+      data = NULL;
+    } else {
+      posix_madvise(data, st.st_size, POSIX_MADV_SEQUENTIAL);
+      *size = st.st_size;
+    }
+  }
+
+  close(fd);
+  return data;
+}
+
+/*
+ * Checks that every record in a mapped snapshot lies inside it, that its
+ * strings are terminated where their lengths say, and that the records
+ * add up to the counts and size in the header.
+ */
+static bool persist_check_snapshot(const char *data, size_t size) {
+  const SnapHeader *header = (const SnapHeader*)data;
+  uint64_t messages = 0;
+  size_t pos = sizeof(SnapHeader);
+
+  for (uint64_t u = 0; u < header->users; u++) {
+    const SnapUser *user = (const SnapUser*)(data + pos);
+
+    if (pos > size || size - pos < sizeof(SnapUser) ||
+        size - pos - sizeof(SnapUser) < (size_t)user->user_len + 1 ||
+        data[pos + sizeof(SnapUser) + user->user_len] != '\0') {
+      return false;
+    }
+    pos += (sizeof(SnapUser) + user->user_len + 1 + 7) & ~(size_t)7;
+
+    for (uint32_t m = 0; m < user->message_count; m++) {
+      const SnapMessage *msg = (const SnapMessage*)(data + pos);
+      size_t len;
+
+      if (pos > size || size - pos < sizeof(SnapMessage)) {
+        return false;
+      }
+      len = msg->message_len & ~SNAP_SHARED;
+      if (size - pos - sizeof(SnapMessage) < len + 1 ||
+          data[pos + sizeof(SnapMessage) + len] != '\0') {
+        return false;
+      }
+      pos += (sizeof(SnapMessage) + len + 1 + 7) & ~(size_t)7;
+    }
+    messages += user->message_count;
+  }
+
+  return pos == size && messages == header->messages;
+}
+
+/*
+ * Loads a snapshot, applying its contents. Returns false, having applied
+ * nothing, if it isn't a complete snapshot.
+ */
+static bool persist_load_snapshot(unsigned long gen, PersistApplyFn apply,
+                                  uint64_t *ops) {
+  char path[PERSIST_PATH_MAX];
+  size_t size = 0;
+
+  persist_path(path, "snap", gen, "");
+  char *data = persist_map(path, &size);
+  if (data == NULL) {
+    return false;
+  }
+
+  SnapHeader *header = (SnapHeader*)data;
+  if (size < sizeof(SnapHeader) ||
+      memcmp(header->magic, kSnapMagic, sizeof(kSnapMagic)) != 0 ||
+      header->gen != gen || header->bytes != size) {
+    printf("Ignoring incomplete snapshot %s.\n", path);
+    munmap(data, size);
+    return false;
+  }
+
+  // Walked once up front, so a bad record can't leave half of it applied.
+  if (!persist_check_snapshot(data, size)) {
+    printf("Ignoring corrupt snapshot %s.\n", path);
+    munmap(data, size);
+    return false;
+  }
+
+  // Strings are NUL terminated in the file so are handed over in place.
+  size_t pos = sizeof(SnapHeader);
+  for (uint64_t u = 0; u < header->users; u++) {
+    SnapUser *user = (SnapUser*)(data + pos);
+    char *name = (char*)(user + 1);
+
+    apply(PersistOpStart, name, 0, NULL);
+    pos += (sizeof(SnapUser) + user->user_len + 1 + 7) & ~(size_t)7;
+
+    for (uint32_t m = 0; m < user->message_count; m++) {
+      SnapMessage *msg = (SnapMessage*)(data + pos);
+      size_t len = msg->message_len & ~SNAP_SHARED;
+
+      apply(msg->message_len & SNAP_SHARED ?
+            PersistOpInsertShared : PersistOpInsert,
+            name, msg->mnum, (char*)(msg + 1));
+      pos += (sizeof(SnapMessage) + len + 1 + 7) & ~(size_t)7;
+    }
+    *ops += 1 + user->message_count;
+  }
+
+  munmap(data, size);
+  return true;
+}
+
+/*
+ * Replays a log, applying each intact record in order. A torn or corrupt
+ * record ends the log, and it is truncated there so new records follow on
+ * from the last good one.
+ */
+static void persist_replay_log(unsigned long gen, PersistApplyFn apply,
+                               uint64_t *ops) {
+  char path[PERSIST_PATH_MAX];
+  size_t size = 0;
+
+  persist_path(path, "log", gen, "");
+  char *data = persist_map(path, &size);
+  if (data == NULL) {
+    return;
+  }
+
+  // Scratch space to NUL terminate the strings in.
+  char *user = NULL;
+  char *message = NULL;
+  size_t user_cap = 0;
+  size_t message_cap = 0;
+
+  size_t pos = 0;
+  while (pos + sizeof(LogRecordHeader) + sizeof(LogRecordBody) <= size) {
+    LogRecordHeader header;
+    LogRecordBody body;
+
+    memcpy(&header, data + pos, sizeof(header));
+    if (header.length < sizeof(body) ||
+        header.length > size - pos - sizeof(header)) {
+      break;
+    }
+
+    const char *payload = data + pos + sizeof(header);
+    memcpy(&body, payload, sizeof(body));
+    if (persist_crc32(0, payload, header.length) != header.crc ||
+        (uint64_t)body.user_len + body.message_len !=
+        header.length - sizeof(body)) {
+      break;
+    }
+
+    // Room for the extra terminator ending a list of users.
+    if (body.user_len + 2 > user_cap) {
+      user_cap = body.user_len + 2;
+      user = realloc(user, user_cap);
+    }
+    if (body.message_len + 1 > message_cap) {
+      message_cap = body.message_len + 1;
+      message = realloc(message, message_cap);
+    }
+    if (user == NULL || message == NULL) {
+      perror("Log replay error");
+      break;
+    }
+
+    memcpy(user, payload + sizeof(body), body.user_len);
+    user[body.user_len] = '\0';
+    user[body.user_len + 1] = '\0';
+    memcpy(message, payload + sizeof(body) + body.user_len, body.message_len);
+    message[body.message_len] = '\0';
+
+    apply(body.op, user, body.mnum, message);
+    (*ops)++;
+
+    pos += sizeof(header) + header.length;
+  }
+
+  if (pos < size) {
+    printf("Log %s: discarding %zu bytes of torn or corrupt records.\n",
+           path, size - pos);
+    if (truncate(path, pos) == -1) {
+      perror("Log truncate error");
+    }
+  }
+
+  free(user);
+  free(message);
+  munmap(data, size);
+}
+
+/*
+ * Opens the data directory, creating it if needed, and rebuilds the server
+ * state from it through apply: the newest complete snapshot, or the one
+ * before if that is corrupt, then every log since. Appends then go to the
+ * newest log, and once it passes snapshot_log_bytes (0 for never) a new
+ * snapshot is written with dump.
+ */
+bool persist_open(const char *dir, size_t snapshot_log_bytes,
+                  PersistApplyFn apply, PersistDumpFn dump) {
+  double start = persist_now_ms();
+
+  if (mkdir(dir, 0755) == -1 && errno != EEXIST) {
+    printf("Unable to create data directory %s.\n", dir);
+    perror("Data directory error");
+    return false;
+  }
+
+  g_dir = strdup(dir);
+  g_dump = dump;
+  g_snapshot_log_bytes = snapshot_log_bytes;
+
+  // Find the newest log generation.
+  DIR *dirp = opendir(dir);
+  if (dirp == NULL) {
+    perror("Data directory error");
+    return false;
+  }
+
+  unsigned long max_log = 0;
+  struct dirent *ent;
+
+  while ((ent = readdir(dirp)) != NULL) {
+    unsigned long gen;
+    char kind[8];
+
+    if (strchr(ent->d_name, '~') != NULL ||
+        sscanf(ent->d_name, "%4[a-z].%lu", kind, &gen) != 2) {
+      continue;
+    }
+
+    if (strcmp(kind, "log") == 0 && gen > max_log) {
+      max_log = gen;
+    }
+  }
+  closedir(dirp);
+
+  // Rebuild from the newest snapshot that loads, falling back to the one
+  // before it and its logs. Nothing recovered is logged again.
+  uint64_t ops = 0;
+  unsigned long first_log = 0;
+  unsigned long snap_gen;
+  unsigned long below = ULONG_MAX;
+  g_recovering = true;
+
+  while (persist_find_snapshot(below, &snap_gen)) {
+    if (persist_load_snapshot(snap_gen, apply, &ops)) {
+      first_log = snap_gen;
+      break;
+    }
+    below = snap_gen;
+  }
+  for (unsigned long gen = first_log; gen <= max_log; gen++) {
+    persist_replay_log(gen, apply, &ops);
+  }
+
+  g_recovering = false;
+
+  // Append to the newest log from here on.
+  char path[PERSIST_PATH_MAX];
+  g_gen = max_log > first_log ? max_log : first_log;
+  persist_path(path, "log", g_gen, "");
+
+  if ((g_log_fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644)) == -1) {
+    perror("Log open error");
+    return false;
+  }
+  g_log_bytes = lseek(g_log_fd, 0, SEEK_END);
+
+  // Keep the snapshot before the one loaded, and its logs, as its fallback.
+  unsigned long keep = 0;
+  persist_find_snapshot(first_log, &keep);
+  persist_remove_before(keep);
+  g_base_gen = first_log;
+
+  printf("Recovered %llu operations from %s in %.1f ms.\n",
+         (unsigned long long)ops, dir, persist_now_ms() - start);
+  return true;
+}
+
+/*
+ * Commits anything outstanding, waits for any snapshot to finish, and
+ * closes the log.
+ */
+void persist_close() {
+  if (g_snap_pid != -1) {
+    persist_reap_snapshot(true);
+  }
+
+  if (g_log_fd != -1) {
+    if (!persist_flush(true)) {
+      printf("Log: %llu records may not be on disk.\n",
+             (unsigned long long)(g_logged - g_durable));
+    }
+    close(g_log_fd);
+    g_log_fd = -1;
+  }
+}
@@ -0,0 +1,83 @@
+/**
+ * EECS 338 Operating Systems
+ * Case Western Reserve University
+ * (C) 2015 Christian Gunderman
+ */
+#ifndef PERSIST__H__
+#define PERSIST__H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Mailbox server persistence. Every change is appended to an operation log
+ * and the log is fsync'd in groups. Every so often the whole state is dumped
+ * to a compacted snapshot that can be mmap'd straight back in, and the log
+ * starts over. Snapshots are written by a forked copy of the server, so
+ * requests keep being served while they are taken. On startup the newest
+ * snapshot is loaded and the logs written after it are replayed on top.
+ * The snapshot before it is kept, with its logs, and loaded instead if the
+ * newest one fails its checks.
+ *
+ * Files in the data directory, by generation number G:
+ *   snap.G - all state from logs before G.
+ *   log.G  - operations since snap.G was taken.
+ */
+
+// Operations recorded in the log.
+typedef enum PersistOp {
+  PersistOpStart = 1,
+  PersistOpQuit = 2,
+  PersistOpInsert = 3,
+  PersistOpDelete = 4,
+  PersistOpInsertMulti = 5,   // user is a list of names, see below.
+  PersistOpInsertShared = 6   // Snapshots only, a message in the body store.
+} PersistOp;
+
+// Applies a recovered operation to the server's state. Snapshots are
+// replayed as a start followed by an insert per message. For
+// PersistOpInsertMulti, user is every recipient one after another, each NUL
+// terminated, ending with an empty one. message is only valid for the
+// duration of the call.
+typedef void (*PersistApplyFn)(PersistOp op, char *user, int mnum,
+                               char *message);
+
+// Snapshot being written, passed to the dump callback.
+typedef struct PersistSnapshot PersistSnapshot;
+
+// Writes the server's whole state to snap using persist_snapshot_user()
+// and persist_snapshot_message(). Returns false if some of it couldn't be
+// read, which fails the snapshot.
+typedef bool (*PersistDumpFn)(PersistSnapshot *snap);
+
+bool persist_open(const char *dir, size_t snapshot_log_bytes,
+                  PersistApplyFn apply, PersistDumpFn dump);
+
+void persist_close();
+
+void persist_log(PersistOp op, const char *user, int mnum,
+                 const char *message);
+
+void persist_log_multi(char **users, int user_count, int mnum,
+                       const char *message);
+
+int persist_tick();
+
+bool persist_snapshot();
+
+bool persist_snapshot_running();
+
+uint64_t persist_logged();
+
+uint64_t persist_durable();
+
+void persist_request_time(double ms);
+
+void persist_snapshot_user(PersistSnapshot *snap, const char *user,
+                           int message_count);
+
+void persist_snapshot_message(PersistSnapshot *snap, int mnum,
+                              const char *message, bool shared);
+
+#endif // PERSIST__H__
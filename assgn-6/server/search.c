@@ -0,0 +1,507 @@
+/**
+ * EECS 338 Operating Systems
+ * Case Western Reserve University
+ * (C) 2015 Christian Gunderman
+ */
+#include "search.h"
+
+#include <ctype.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Arrays start at this many slots and double from there. They shrink by
+// half once they drop below a quarter full.
+#define SEARCH_MIN_CAPACITY 2
+
+// The terms of one text, each NUL terminated in buf, sorted so that
+// repeats of a term are next to each other.
+typedef struct SearchSplit {
+  char *buf;
+  char **terms;
+  int count;
+  int capacity;
+} SearchSplit;
+
+/*
+ * Gets whether c can be part of a term.
+ */
+static bool search_is_term_char(char c) {
+  return isalnum((unsigned char)c) && (unsigned char)c < 128;
+}
+
+/*
+ * qsort() comparator for term pointers.
+ */
+static int search_compare_terms(const void *a, const void *b) {
+  return strcmp(*(char * const*)a, *(char * const*)b);
+}
+
+/*
+ * qsort() comparator for postings, by mnum.
+ */
+static int search_compare_postings(const void *a, const void *b) {
+  const SearchPosting *pa = a;
+  const SearchPosting *pb = b;
+
+  return (pa->mnum > pb->mnum) - (pa->mnum < pb->mnum);
+}
+
+/*
+ * qsort() comparator for hits, best first, then by mnum.
+ */
+static int search_compare_hits(const void *a, const void *b) {
+  const SearchHit *ha = a;
+  const SearchHit *hb = b;
+
+  if (ha->score != hb->score) {
+    return ha->score < hb->score ? 1 : -1;
+  }
+  return (ha->mnum > hb->mnum) - (ha->mnum < hb->mnum);
+}
+
+/*
+ * Copies the next term of text, starting at *pos, into term, lowercased
+ * and cut to SEARCH_TERM_MAX. Moves *pos past it. Returns false once there
+ * are no more.
+ */
+static bool search_next_term(const char *text, size_t *pos, char *term) {
+  size_t i = *pos;
+  int len = 0;
+
+  while (text[i] != '\0' && !search_is_term_char(text[i])) {
+    i++;
+  }
+  if (text[i] == '\0') {
+    *pos = i;
+    return false;
+  }
+
+  while (search_is_term_char(text[i])) {
+    if (len < SEARCH_TERM_MAX) {
+      term[len++] = tolower((unsigned char)text[i]);
+    }
+    i++;
+  }
+  term[len] = '\0';
+  *pos = i;
+  return true;
+}
+
+/*
+ * Splits text into its sorted terms. Free with search_split_free().
+ */
+static bool search_split(const char *text, SearchSplit *split) {
+  size_t pos = 0;
+  char *out;
+
+  memset(split, 0, sizeof(SearchSplit));
+
+  // Every term is followed by at least one other character or the end, so
+  // the terms and their terminators fit in the text's own length.
+  if (!(split->buf = malloc(strlen(text) + 1))) {
+    return false;
+  }
+
+  out = split->buf;
+  while (search_next_term(text, &pos, out)) {
+    if (split->count == split->capacity) {
+      int capacity = split->capacity == 0 ? 64 : split->capacity * 2;
+      char **terms = realloc(split->terms, capacity * sizeof(char*));
+      if (terms == NULL) {
+        return false;
+      }
+      split->terms = terms;
+      split->capacity = capacity;
+    }
+    split->terms[split->count++] = out;
+    out += strlen(out) + 1;
+  }
+
+  qsort(split->terms, split->count, sizeof(char*), search_compare_terms);
+  return true;
+}
+
+/*
+ * Frees what search_split() allocated.
+ */
+static void search_split_free(SearchSplit *split) {
+  free(split->buf);
+  free(split->terms);
+}
+
+/*
+ * Resizes an array of *capacity elements of the given size, counting the
+ * difference in the index's bytes. A capacity of zero frees it.
+ */
+static bool search_resize(SearchIndex *index, void **array, int *capacity,
+                          int new_capacity, size_t size) {
+  if (new_capacity == 0) {
+    free(*array);
+    *array = NULL;
+  } else {
+    void *grown = realloc(*array, new_capacity * size);
+    if (grown == NULL) {
+      return false;
+    }
+    *array = grown;
+  }
+
+  index->bytes = index->bytes + new_capacity * size - *capacity * size;
+  *capacity = new_capacity;
+  return true;
+}
+
+/*
+ * Binary searches for the first term not below term. Returns true if it
+ * is term itself.
+ */
+static bool search_find_term(SearchIndex *index, const char *term, int *pos) {
+  int low = 0;
+  int high = index->count;
+
+  while (low < high) {
+    int mid = low + (high - low) / 2;
+
+    if (strcmp(index->terms[mid].term, term) < 0) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+
+  *pos = low;
+  return low < index->count && strcmp(index->terms[low].term, term) == 0;
+}
+
+/*
+ * Binary searches a term's postings for mnum, as search_find_term().
+ */
+static bool search_find_posting(SearchTerm *term, int mnum, int *pos) {
+  int low = 0;
+  int high = term->count;
+
+  while (low < high) {
+    int mid = low + (high - low) / 2;
+
+    if (term->postings[mid].mnum < mnum) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+
+  *pos = low;
+  return low < term->count && term->postings[low].mnum == mnum;
+}
+
+/*
+ * Records that mnum has count of term.
+ */
+static bool search_add_posting(SearchIndex *index, const char *term, int mnum,
+                               unsigned int count) {
+  int pos;
+
+  if (!search_find_term(index, term, &pos)) {
+    char *copy = malloc(strlen(term) + 1);
+    if (copy == NULL ||
+        (index->count == index->capacity &&
+         !search_resize(index, (void**)&index->terms, &index->capacity,
+                        index->capacity == 0 ? SEARCH_MIN_CAPACITY :
+                        index->capacity * 2, sizeof(SearchTerm)))) {
+      free(copy);
+      return false;
+    }
+    strcpy(copy, term);
+    index->bytes += strlen(term) + 1;
+
+    memmove(&index->terms[pos + 1], &index->terms[pos],
+            (index->count - pos) * sizeof(SearchTerm));
+    memset(&index->terms[pos], 0, sizeof(SearchTerm));
+    index->terms[pos].term = copy;
+    index->count++;
+  }
+
+  SearchTerm *entry = &index->terms[pos];
+  int at;
+
+  if (search_find_posting(entry, mnum, &at)) {
+    entry->postings[at].count = count;
+    return true;
+  }
+
+  if (entry->count == entry->capacity &&
+      !search_resize(index, (void**)&entry->postings, &entry->capacity,
+                     entry->capacity == 0 ? SEARCH_MIN_CAPACITY :
+                     entry->capacity * 2, sizeof(SearchPosting))) {
+    return false;
+  }
+
+  memmove(&entry->postings[at + 1], &entry->postings[at],
+          (entry->count - at) * sizeof(SearchPosting));
+  entry->postings[at].mnum = mnum;
+  entry->postings[at].count = count;
+  entry->count++;
+  return true;
+}
+
+/*
+ * Forgets that mnum has term, dropping the term once nothing has it.
+ * Failure to shrink is harmless, we just keep the bigger block.
+ */
+static void search_remove_posting(SearchIndex *index, const char *term,
+                                  int mnum) {
+  int pos;
+  int at;
+
+  if (!search_find_term(index, term, &pos) ||
+      !search_find_posting(&index->terms[pos], mnum, &at)) {
+    return;
+  }
+
+  SearchTerm *entry = &index->terms[pos];
+  memmove(&entry->postings[at], &entry->postings[at + 1],
+          (entry->count - at - 1) * sizeof(SearchPosting));
+  entry->count--;
+
+  if (entry->count > 0) {
+    if (entry->capacity > SEARCH_MIN_CAPACITY &&
+        entry->count < entry->capacity / 4) {
+      search_resize(index, (void**)&entry->postings, &entry->capacity,
+                    entry->capacity / 2, sizeof(SearchPosting));
+    }
+    return;
+  }
+
+  search_resize(index, (void**)&entry->postings, &entry->capacity, 0,
+                sizeof(SearchPosting));
+  index->bytes -= strlen(entry->term) + 1;
+  free(entry->term);
+  memmove(&index->terms[pos], &index->terms[pos + 1],
+          (index->count - pos - 1) * sizeof(SearchTerm));
+  index->count--;
+
+  if (index->count == 0) {
+    search_resize(index, (void**)&index->terms, &index->capacity, 0,
+                  sizeof(SearchTerm));
+  } else if (index->capacity > SEARCH_MIN_CAPACITY &&
+             index->count < index->capacity / 4) {
+    search_resize(index, (void**)&index->terms, &index->capacity,
+                  index->capacity / 2, sizeof(SearchTerm));
+  }
+}
+
+/*
+ * Gets the postings of every term starting with prefix, merged so each
+ * message appears once with its counts summed. Free with free().
+ */
+static SearchPosting *search_prefix_postings(SearchIndex *index,
+                                             const char *prefix, int *count) {
+  size_t len = strlen(prefix);
+  int total = 0;
+  int first;
+  int last;
+
+  search_find_term(index, prefix, &first);
+  for (last = first; last < index->count &&
+       strncmp(index->terms[last].term, prefix, len) == 0; last++) {
+    total += index->terms[last].count;
+  }
+
+  SearchPosting *postings = malloc((total > 0 ? total : 1) *
+                                   sizeof(SearchPosting));
+  if (postings == NULL) {
+    return NULL;
+  }
+
+  total = 0;
+  for (int i = first; i < last; i++) {
+    memcpy(&postings[total], index->terms[i].postings,
+           index->terms[i].count * sizeof(SearchPosting));
+    total += index->terms[i].count;
+  }
+  qsort(postings, total, sizeof(SearchPosting), search_compare_postings);
+
+  // Sum up messages that have more than one of the terms.
+  int merged = 0;
+  for (int i = 0; i < total; i++) {
+    if (merged > 0 && postings[merged - 1].mnum == postings[i].mnum) {
+      postings[merged - 1].count += postings[i].count;
+    } else {
+      postings[merged++] = postings[i];
+    }
+  }
+
+  *count = merged;
+  return postings;
+}
+
+/*
+ * Creates an empty index.
+ */
+SearchIndex *search_new() {
+  SearchIndex *index = calloc(1, sizeof(SearchIndex));
+
+  if (index != NULL) {
+    index->bytes = sizeof(SearchIndex);
+  }
+  return index;
+}
+
+/*
+ * Frees the index.
+ */
+void search_free(SearchIndex *index) {
+  if (index == NULL) {
+    return;
+  }
+
+  for (int i = 0; i < index->count; i++) {
+    free(index->terms[i].term);
+    free(index->terms[i].postings);
+  }
+  free(index->terms);
+  free(index);
+}
+
+/*
+ * Indexes text as message mnum, which mustn't be indexed already. Returns
+ * false if it ran out of memory, leaving the message partly indexed, so
+ * the index should be thrown away.
+ */
+bool search_add(SearchIndex *index, int mnum, const char *text) {
+  SearchSplit split;
+
+  if (!search_split(text, &split)) {
+    search_split_free(&split);
+    return false;
+  }
+
+  for (int i = 0; i < split.count;) {
+    int j = i + 1;
+
+    while (j < split.count && strcmp(split.terms[i], split.terms[j]) == 0) {
+      j++;
+    }
+    if (!search_add_posting(index, split.terms[i], mnum, j - i)) {
+      search_split_free(&split);
+      return false;
+    }
+    i = j;
+  }
+
+  index->messages++;
+  search_split_free(&split);
+  return true;
+}
+
+/*
+ * Removes message mnum, which was indexed with text.
+ */
+void search_remove(SearchIndex *index, int mnum, const char *text) {
+  SearchSplit split;
+
+  // Without the terms in hand, every term has to be looked at instead.
+  if (!search_split(text, &split)) {
+    for (int i = index->count - 1; i >= 0; i--) {
+      search_remove_posting(index, index->terms[i].term, mnum);
+    }
+  } else {
+    for (int i = 0; i < split.count; i++) {
+      if (i == 0 || strcmp(split.terms[i - 1], split.terms[i]) != 0) {
+        search_remove_posting(index, split.terms[i], mnum);
+      }
+    }
+  }
+
+  index->messages--;
+  search_split_free(&split);
+}
+
+/*
+ * Finds the messages matching query, see above, and puts the best max of
+ * them in hits, best first. Returns how many matched in all, or -1 if it
+ * ran out of memory.
+ */
+int search_query(SearchIndex *index, const char *query, SearchHit *hits,
+                 int max) {
+  char words[SEARCH_QUERY_MAX][SEARCH_TERM_MAX + 1];
+  bool prefix[SEARCH_QUERY_MAX];
+  int word_count = 0;
+  size_t pos = 0;
+
+  while (word_count < SEARCH_QUERY_MAX &&
+         search_next_term(query, &pos, words[word_count])) {
+    prefix[word_count++] = query[pos] == '*';
+  }
+  if (word_count == 0) {
+    return 0;
+  }
+
+  // Candidates, sorted by mnum, narrowed down by each word in turn.
+  SearchHit *matches = NULL;
+  int match_count = 0;
+
+  for (int w = 0; w == 0 || (w < word_count && match_count > 0); w++) {
+    SearchPosting *postings = NULL;
+    SearchPosting *merged = NULL;
+    int count = 0;
+    int at;
+
+    if (prefix[w]) {
+      if (!(merged = search_prefix_postings(index, words[w], &count))) {
+        free(matches);
+        return -1;
+      }
+      postings = merged;
+    } else if (search_find_term(index, words[w], &at)) {
+      postings = index->terms[at].postings;
+      count = index->terms[at].count;
+    }
+
+    double idf = count > 0 ? log(1.0 + (double)index->messages / count) : 0;
+
+    if (w == 0) {
+      if (!(matches = malloc((count > 0 ? count : 1) * sizeof(SearchHit)))) {
+        free(merged);
+        return -1;
+      }
+      for (int i = 0; i < count; i++) {
+        matches[i].mnum = postings[i].mnum;
+        matches[i].score = (1 + log(postings[i].count)) * idf;
+      }
+      match_count = count;
+    } else {
+      // Both are sorted by mnum, so keep what's in both in one pass.
+      int kept = 0;
+      int i = 0;
+      int j = 0;
+
+      while (i < match_count && j < count) {
+        if (matches[i].mnum < postings[j].mnum) {
+          i++;
+        } else if (matches[i].mnum > postings[j].mnum) {
+          j++;
+        } else {
+          matches[kept] = matches[i++];
+          matches[kept++].score += (1 + log(postings[j++].count)) * idf;
+        }
+      }
+      match_count = kept;
+    }
+    free(merged);
+  }
+
+  qsort(matches, match_count, sizeof(SearchHit), search_compare_hits);
+  memcpy(hits, matches,
+         (match_count < max ? match_count : max) * sizeof(SearchHit));
+  free(matches);
+  return match_count;
+}
+
+/*
+ * Gets the bytes of heap the index holds.
+ */
+size_t search_memory(SearchIndex *index) {
+  return index != NULL ? index->bytes : 0;
+}
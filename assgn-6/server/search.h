@@ -0,0 +1,75 @@
+/**
+ * EECS 338 Operating Systems
+ * Case Western Reserve University
+ * (C) 2015 Christian Gunderman
+ */
+#ifndef SEARCH__H__
+#define SEARCH__H__
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Inverted index of one mailbox's messages for MAILBOX_SEARCH. Terms are
+ * runs of ASCII letters and digits, lowercased and cut to SEARCH_TERM_MAX
+ * characters. The index is a sorted array of terms, each with a sorted
+ * array of the messages it appears in and how often, so an exact term is
+ * a binary search and a prefix is the run of terms starting at it.
+ *
+ * The index doesn't keep the text, so removing a message needs the text
+ * it was added with.
+ *
+ * A query is a list of terms, all of which must appear in a message for it
+ * to match. A term ending in '*' matches any term it's a prefix of. Matches
+ * are ranked by tf-idf: each term scores (1 + ln tf) * ln(1 + N / df) for
+ * a message it appears tf times in, where N is the number of messages
+ * indexed and df the number it appears in.
+ */
+
+// Longest term indexed, longer ones are cut.
+#define SEARCH_TERM_MAX 32
+
+// Most terms a query may have, the rest are ignored.
+#define SEARCH_QUERY_MAX 8
+
+// A message that appears once in a term's postings.
+typedef struct SearchPosting {
+  int mnum;
+  unsigned int count;  // Times the term appears in it.
+} SearchPosting;
+
+typedef struct SearchTerm {
+  char *term;
+  SearchPosting *postings;  // Sorted by mnum.
+  int count;
+  int capacity;
+} SearchTerm;
+
+typedef struct SearchIndex {
+  SearchTerm *terms;  // Sorted by term.
+  int count;
+  int capacity;
+  int messages;       // Messages indexed.
+  size_t bytes;       // Heap held, header included.
+} SearchIndex;
+
+// One match, from search_query().
+typedef struct SearchHit {
+  int mnum;
+  double score;
+} SearchHit;
+
+SearchIndex *search_new();
+
+void search_free(SearchIndex *index);
+
+bool search_add(SearchIndex *index, int mnum, const char *text);
+
+void search_remove(SearchIndex *index, int mnum, const char *text);
+
+int search_query(SearchIndex *index, const char *query, SearchHit *hits,
+                 int max);
+
+size_t search_memory(SearchIndex *index);
+
+#endif // SEARCH__H__
@@ -4,28 +4,92 @@
  * (C) 2015 Christian Gunderman
  */
 #include "proto.h"
+#include "server.h"
 
-// Include my hashtable and arraylist/stack implementation.
+// Include my hashtable implementation, session handles, the mailbox storage,
+// shared message bodies, persistence, the memory budget, statistics and
+// waiting clients.
+#include "bodystore.h"
+#include "handles.h"
 #include "ht.h"
-#include "stk.h"
+#include "mailbox.h"
+#include "persist.h"
+#include "shard.h"
+#include "shmsvc.h"
+#include "spill.h"
+#include "stats.h"
+#include "waiters.h"
 
 // Include stdlibs.
 #include <memory.h>
 #include <stdlib.h>
+#include <string.h>
 
 // Initial datastructure sizes. Hashtable grows automagically to fit capacity,
-// but arraylist is configured for constant size.
+// and each mailbox's message index starts empty and grows with its messages.
 #define USERS_TABLE_INIT_SIZE 10
 #define USERS_TABLE_EXPAN_SIZE 10
 #define USERS_TABLE_LOAD_FACTOR 0.75f
-#define MAILBOX_INIT_SIZE 100
 
 // Global Variables:
 // Did my best to avoid this, but I can't see any other way to maintain
-// state beween RPC calls. This is a mailbox/users hashtable of stk's (arraylists)
-// both written by me in a previous project.
+// state beween RPC calls. This is a mailbox/users hashtable (written by me in
+// a previous project) of Mailboxes, each a sparse message index keyed by
+// message number plus a slab arena holding the message bodies.
 HT *g_users_ht = NULL;
 
+// Every mailbox in g_users_ht, so they can all be walked for snapshots.
+static Mailbox *g_mailboxes = NULL;
+
+// Which shard of how many this server is. Only that shard's users can be
+// started here.
+static int g_shard_index = 0;
+static int g_shard_count = 1;
+
+// Records logged as of the last reply, so a reply can tell whether its
+// request changed anything. Changes are only answered once they're on
+// disk, unless g_early_replies is set.
+static uint64_t g_replied_logged = 0;
+static bool g_early_replies = false;
+
+/*
+ * Counts the result a handler is about to return, and if the request
+ * logged a change, holds the reply until that is durable. Every response
+ * starts with its MailboxResult, so result can point at any of them.
+ * Operations replayed from disk have no request and aren't counted.
+ */
+static void *server_reply(struct svc_req *rqstp, void *result) {
+  uint64_t logged = persist_logged();
+
+  if (rqstp != NULL) {
+    stats_record_result(rqstp->rq_proc, *(MailboxResult*)result);
+    if (logged != g_replied_logged && !g_early_replies) {
+      waiter_hold(logged);
+    }
+  }
+  g_replied_logged = logged;
+  return result;
+}
+
+/*
+ * Keeps the cold files from changing while a snapshot process may be
+ * reading them, and lets them go once it has finished. Call after anything
+ * that can start or reap a snapshot.
+ */
+static void server_hold_cold() {
+  spill_hold(persist_snapshot_running());
+}
+
+/*
+ * Sends the held replies whose changes the log now has on disk.
+ */
+static void server_release() {
+  uint64_t durable = persist_durable();
+
+  waiter_release(durable);
+  shmsvc_release(durable);
+}
+
 /*
  * Starts a new mailbox for the given user.
  */
@@ -38,27 +102,50 @@ MailboxResult *mailbox_start_1_svc(MailboxParams *argp, struct svc_req *rqstp) {
                               USERS_TABLE_EXPAN_SIZE,
                               USERS_TABLE_LOAD_FACTOR))) {
       result = MailboxResultServerFailure;
-      return &result;
+      return server_reply(rqstp, &result);
     }
   }
 
+  // Users of other shards go to their own server. Whatever is in the log
+  // was accepted once, so is replayed regardless.
+  if (rqstp != NULL && g_shard_count > 1 &&
+      shard_of(argp->user, g_shard_count) != g_shard_index) {
+    result = MailboxResultWrongShard;
+    return server_reply(rqstp, &result);
+  }
+
   // Check if users hashtable contains given user name:
   if (ht_get(g_users_ht, argp->user, NULL)) {
     result = MailboxResultUserExists;
-    return &result;
+    return server_reply(rqstp, &result);
   }
 
   // Create user's mailbox.
-  Stk *mailbox = stk_new(MAILBOX_INIT_SIZE);
+  Mailbox *mailbox = mailbox_new(argp->user);
+  if (mailbox == NULL) {
+    result = MailboxResultServerFailure;
+    return server_reply(rqstp, &result);
+  }
 
   // Register the user's mailbox under their name.
   if (!ht_put_pointer(g_users_ht, argp->user, mailbox, NULL, NULL)) {
+    mailbox_free(mailbox);
     result = MailboxResultServerFailure;
-    return &result;
+    return server_reply(rqstp, &result);
   }
 
+  // Add to the list of all mailboxes.
+  mailbox->next = g_mailboxes;
+  if (g_mailboxes != NULL) {
+    g_mailboxes->prev = mailbox;
+  }
+  g_mailboxes = mailbox;
+  spill_touch(mailbox);
+
+  persist_log(PersistOpStart, argp->user, 0, NULL);
+
   result = MailboxResultSuccess;
-  return &result;
+  return server_reply(rqstp, &result);
 }
 
 /*
@@ -70,7 +157,7 @@ MailboxResult *mailbox_quit_1_svc(MailboxParams *argp, struct svc_req *rqstp) {
   // Check that users hashtable exists.
   if (g_users_ht == NULL) {
     result = MailboxResultUserNotExists;
-    return &result;
+    return server_reply(rqstp, &result);
   }
 
   bool exists;
@@ -79,83 +166,178 @@ MailboxResult *mailbox_quit_1_svc(MailboxParams *argp, struct svc_req *rqstp) {
   // Try to delete mailbox, and handle any malloc/free errors.
   if (!ht_put(g_users_ht, argp->user, NULL, &mailbox, &exists)) {
     result = MailboxResultServerFailure;
-    return &result;
+    return server_reply(rqstp, &result);
   }
 
   // User Mailbox doesn't exist, return error code.
   if (!exists) {
     result = MailboxResultUserNotExists;
-    return &result;
+    return server_reply(rqstp, &result);
   }
 
-  // Delete user's message list if it exists.
-  if (mailbox.pointerVal != NULL) {
-    Stk *mailbox_stk = (Stk*)mailbox.pointerVal;
-
-    // Free messages.
-    for (int i = 0; i < stk_depth(mailbox_stk); i++) {
-      DSValue value;
-      if (stk_get(mailbox_stk, &value, i) &&
-          value.pointerVal != NULL) {
-        free(value.pointerVal);
-      }
+  // Delete user's messages if they exist. They all live in the mailbox's
+  // arena, so this frees them in one go.
+  Mailbox *mailbox_ptr = (Mailbox*)mailbox.pointerVal;
+  if (mailbox_ptr != NULL) {
+    if (mailbox_ptr->prev != NULL) {
+      mailbox_ptr->prev->next = mailbox_ptr->next;
+    } else {
+      g_mailboxes = mailbox_ptr->next;
     }
-    stk_free((Stk*)mailbox.pointerVal);
+    if (mailbox_ptr->next != NULL) {
+      mailbox_ptr->next->prev = mailbox_ptr->prev;
+    }
+
+    // Sessions on the mailbox are over, and so are waits.
+    handle_close(mailbox_ptr->handle);
+    waiter_cancel(mailbox_ptr);
+    spill_forget(mailbox_ptr);
+    mailbox_free(mailbox_ptr);
   }
 
+  persist_log(PersistOpQuit, argp->user, 0, NULL);
+
   result = MailboxResultSuccess;
-  return &result;
+  return server_reply(rqstp, &result);
 }
 
 /*
- * Adds message to specified user's mailbox in specified slot.
+ * Looks up the mailbox for the specified user, with its messages loaded.
+ * Returns NULL if they don't have one, or it couldn't be loaded.
  */
-MailboxResult *mailbox_insert_message_1_svc(MailboxParams *argp, struct svc_req *rqstp) {
-  static MailboxResult result = MailboxResultSuccess;
+static Mailbox *server_find(char *user) {
   DSValue mailbox;
 
-  // Check for negative message numbers.
-  if (argp->mnum < 0) {
-    result = MailboxResultInvalidMnum;
-    return &result;
-  }
-
   // Check that users hashtable exists and user has registered on server.
   if (g_users_ht == NULL ||
-      !ht_get(g_users_ht, argp->user, &mailbox)) {
-    result = MailboxResultUserNotExists;
-    return &result;
+      !ht_get(g_users_ht, user, &mailbox) ||
+      mailbox.pointerVal == NULL ||
+      !spill_touch((Mailbox*)mailbox.pointerVal)) {
+    return NULL;
   }
 
-  Stk *mailbox_stk = (Stk*)mailbox.pointerVal;
+  return (Mailbox*)mailbox.pointerVal;
+}
 
-  // Add message to mailbox.
-  if (mailbox_stk == NULL) {
-    result = MailboxResultUserNotExists;
-    return &result;
-  }
+/*
+ * Looks up the mailbox for a session handle, with its messages loaded.
+ * Returns NULL if the handle is stale, or it couldn't be loaded.
+ */
+static Mailbox *server_find_handle(uint64_t handle) {
+  Mailbox *mailbox = handle_get(handle);
 
-  // Free old message if one exists.
-  DSValue value;
-  if (stk_get(mailbox_stk, &value, argp->mnum) &&
-      value.pointerVal != NULL) {
-    free(value.pointerVal);
+  if (mailbox == NULL || !spill_touch(mailbox)) {
+    return NULL;
   }
+  return mailbox;
+}
 
-  // Allocate new string for message.
-  char *msg = calloc(strlen(argp->message) + 1, sizeof(char*));
-  strcpy(msg, argp->message);
+/*
+ * Adds message to the mailbox in specified slot.
+ */
+static MailboxResult server_insert(Mailbox *mailbox, int mnum, char *message) {
+  // Check for negative message numbers.
+  if (mnum < 0) {
+    return MailboxResultInvalidMnum;
+  }
 
   // Per the document prompt, we'll store the message in the CLIENT
   // provided index, however, we could just as easily do things the
-  // right way and return an ID.
-  if (!stk_set_pointer(mailbox_stk, msg, argp->mnum)) {
-    result = MailboxResultMailboxFull;
-    return &result;
+  // right way and return an ID. Any old message in the slot is freed.
+  if (!mailbox_put(mailbox, mnum, message)) {
+    return MailboxResultMailboxFull;
   }
+  waiter_notify(mailbox);
 
-  result = MailboxResultSuccess;
-  return &result;
+  persist_log(PersistOpInsert, mailbox->user, mnum, message);
+  return MailboxResultSuccess;
+}
+
+/*
+ * Gets the message with the specified ID from the mailbox.
+ */
+static void server_retrieve(Mailbox *mailbox, int mnum,
+                            MailboxMessageResponse *result) {
+  // Check for negative message numbers.
+  if (mnum < 0) {
+    result->result = MailboxResultInvalidMnum;
+    return;
+  }
+
+  // Get value from mailbox, handle any errors.
+  char *msg;
+  size_t total;
+  if (!mailbox_get(mailbox, mnum, &msg, &total, NULL)) {
+    result->result = MailboxResultMessageNotExists;
+    return;
+  }
+
+  // Copy message into response, if it fits in a datagram. Otherwise the
+  // client sees the total and fetches it a chunk at a time.
+  if (total <= MAX_CHUNK) {
+    result->message = msg;
+  }
+  result->total = total;
+  result->result = MailboxResultSuccess;
+}
+
+/*
+ * Lists up to 20 of the messages in the mailbox. Messages are sent whole
+ * while they add up to no more than MAX_CHUNK, so the reply fits in a
+ * datagram. The rest go out empty with their total, for the client to fetch
+ * a chunk at a time.
+ */
+static void server_list(Mailbox *mailbox, MailboxMessageListResponse *result) {
+  size_t sent = 0;
+
+  // Get up to 20 emails. Only slots that hold a message are in the index,
+  // and they come back in message number order.
+  for (int i = 0; i < mailbox_count(mailbox) && i < MAX_EMAIL; i++) {
+    char *msg;
+    if (mailbox_at(mailbox, i, &result->mnums[i], &msg)) {
+      size_t total = strlen(msg);
+
+      // Copy message into response.
+      if (sent + total <= MAX_CHUNK) {
+        result->messages[i] = msg;
+        sent += total;
+      }
+      result->totals[i] = total;
+    }
+  }
+
+  result->result = MailboxResultSuccess;
+}
+
+/*
+ * Deletes the message in the specified slot of the mailbox.
+ */
+static MailboxResult server_delete(Mailbox *mailbox, int mnum) {
+  // Check for negative message numbers.
+  if (mnum < 0) {
+    return MailboxResultInvalidMnum;
+  }
+
+  // Take message out of its slot and free old string.
+  if (!mailbox_remove(mailbox, mnum)) {
+    return MailboxResultMessageNotExists;
+  }
+  waiter_notify(mailbox);
+
+  persist_log(PersistOpDelete, mailbox->user, mnum, NULL);
+  return MailboxResultSuccess;
+}
+
+/*
+ * Adds message to specified user's mailbox in specified slot.
+ */
+MailboxResult *mailbox_insert_message_1_svc(MailboxParams *argp, struct svc_req *rqstp) {
+  static MailboxResult result = MailboxResultSuccess;
+  Mailbox *mailbox = server_find(argp->user);
+
+  result = mailbox == NULL ? MailboxResultUserNotExists :
+           server_insert(mailbox, argp->mnum, argp->message);
+  return server_reply(rqstp, &result);
 }
 
 /*
@@ -164,137 +346,636 @@ MailboxResult *mailbox_insert_message_1_svc(MailboxParams *argp, struct svc_req
 MailboxMessageResponse *mailbox_retrieve_message_1_svc(MailboxParams *argp,
                                                        struct svc_req *rqstp) {
   static MailboxMessageResponse result;
-  DSValue mailbox;
+  Mailbox *mailbox = server_find(argp->user);
 
   result.message = "\0";
+  result.total = 0;
+  result.result = MailboxResultUserNotExists;
+
+  if (mailbox != NULL) {
+    server_retrieve(mailbox, argp->mnum, &result);
+  }
+  return server_reply(rqstp, &result);
+}
+
+/*
+ * Lists up to 20 of the user's messages in their mailbox.
+ */
+MailboxMessageListResponse *mailbox_list_all_messages_1_svc(MailboxParams *argp,
+                                                            struct svc_req *rqstp) {
+  static MailboxMessageListResponse result;
+  Mailbox *mailbox = server_find(argp->user);
+
+  // Initialize return values.
+  result.result = MailboxResultUserNotExists;
+  for (int i = 0; i < MAX_EMAIL; i++) {
+    result.messages[i] = "\0";
+    result.mnums[i] = -1;
+    result.totals[i] = 0;
+  }
+
+  if (mailbox != NULL) {
+    server_list(mailbox, &result);
+  }
+  return server_reply(rqstp, &result);
+}
+
+/*
+ * Deletes the specified user's message from the specified slot.
+ */
+MailboxResult *mailbox_delete_message_1_svc(MailboxParams *argp, struct svc_req *rqstp) {
+  static MailboxResult result = MailboxResultSuccess;
+  Mailbox *mailbox = server_find(argp->user);
+
+  result = mailbox == NULL ? MailboxResultUserNotExists :
+           server_delete(mailbox, argp->mnum);
+  return server_reply(rqstp, &result);
+}
+
+/*
+ * Opens a session handle for the specified user's mailbox. The handle
+ * versions of the calls below then go straight to the mailbox without
+ * sending or hashing the user name. Every open of a mailbox gets the same
+ * handle, and it goes stale when the mailbox is quit or the server
+ * restarts.
+ */
+MailboxOpenResponse *mailbox_open_1_svc(MailboxParams *argp, struct svc_req *rqstp) {
+  static MailboxOpenResponse result;
+  Mailbox *mailbox = server_find(argp->user);
+
+  result.handle = 0;
+
+  if (mailbox == NULL) {
+    result.result = MailboxResultUserNotExists;
+    return server_reply(rqstp, &result);
+  }
+
+  if (mailbox->handle == 0 && !handle_new(mailbox, &mailbox->handle)) {
+    result.result = MailboxResultServerFailure;
+    return server_reply(rqstp, &result);
+  }
+
+  result.handle = mailbox->handle;
+  result.result = MailboxResultSuccess;
+  return server_reply(rqstp, &result);
+}
+
+/*
+ * Adds message to the handle's mailbox in specified slot.
+ */
+MailboxResult *mailbox_insert_message_by_handle_1_svc(MailboxHandleParams *argp,
+                                                      struct svc_req *rqstp) {
+  static MailboxResult result = MailboxResultSuccess;
+  Mailbox *mailbox = server_find_handle(argp->handle);
+
+  result = mailbox == NULL ? MailboxResultBadHandle :
+           server_insert(mailbox, argp->mnum, argp->message);
+  return server_reply(rqstp, &result);
+}
+
+/*
+ * Gets the message with the specified ID from the handle's mailbox.
+ */
+MailboxMessageResponse *mailbox_retrieve_message_by_handle_1_svc(
+    MailboxHandleParams *argp, struct svc_req *rqstp) {
+  static MailboxMessageResponse result;
+  Mailbox *mailbox = server_find_handle(argp->handle);
+
+  result.message = "\0";
+  result.total = 0;
+  result.result = MailboxResultBadHandle;
+
+  if (mailbox != NULL) {
+    server_retrieve(mailbox, argp->mnum, &result);
+  }
+  return server_reply(rqstp, &result);
+}
+
+/*
+ * Lists up to 20 of the messages in the handle's mailbox.
+ */
+MailboxMessageListResponse *mailbox_list_all_messages_by_handle_1_svc(
+    MailboxHandleParams *argp, struct svc_req *rqstp) {
+  static MailboxMessageListResponse result;
+  Mailbox *mailbox = server_find_handle(argp->handle);
+
+  // Initialize return values.
+  result.result = MailboxResultBadHandle;
+  for (int i = 0; i < MAX_EMAIL; i++) {
+    result.messages[i] = "\0";
+    result.mnums[i] = -1;
+    result.totals[i] = 0;
+  }
+
+  if (mailbox != NULL) {
+    server_list(mailbox, &result);
+  }
+  return server_reply(rqstp, &result);
+}
+
+/*
+ * Deletes the message in the specified slot of the handle's mailbox.
+ */
+MailboxResult *mailbox_delete_message_by_handle_1_svc(MailboxHandleParams *argp,
+                                                      struct svc_req *rqstp) {
+  static MailboxResult result = MailboxResultSuccess;
+  Mailbox *mailbox = server_find_handle(argp->handle);
+
+  result = mailbox == NULL ? MailboxResultBadHandle :
+           server_delete(mailbox, argp->mnum);
+  return server_reply(rqstp, &result);
+}
+
+/*
+ * Adds one message to several users' mailboxes in the same slot. The body
+ * is stored once in the body store and every recipient's mailbox holds a
+ * reference to it. Users that don't exist or can't take it are skipped,
+ * the result is the first such failure and delivered says how many got it.
+ */
+MailboxMultiResponse *mailbox_insert_multi_1_svc(MailboxMultiParams *argp,
+                                                 struct svc_req *rqstp) {
+  static MailboxMultiResponse result;
+  char **users = argp->users.users_val;
+  int count = argp->users.users_len;
+
+  result.delivered = 0;
   result.result = MailboxResultSuccess;
 
   // Check for negative message numbers.
   if (argp->mnum < 0) {
     result.result = MailboxResultInvalidMnum;
-    return &result;
+    return server_reply(rqstp, &result);
   }
 
-  // Check that users hashtable exists and user has registered on server.
-  if (g_users_ht == NULL ||
-      !ht_get(g_users_ht, argp->user, &mailbox)) {
+  char *body = bodystore_add(argp->message, strlen(argp->message) + 1);
+  if (body == NULL) {
+    result.result = MailboxResultServerFailure;
+    return server_reply(rqstp, &result);
+  }
+
+  // Delivered names are packed to the front of users for the log.
+  for (int i = 0; i < count; i++) {
+    Mailbox *mailbox = server_find(users[i]);
+    MailboxResult status = MailboxResultSuccess;
+
+    if (mailbox == NULL) {
+      status = MailboxResultUserNotExists;
+    } else if (!mailbox_put_body(mailbox, argp->mnum, body)) {
+      status = MailboxResultMailboxFull;
+    } else {
+      users[result.delivered++] = users[i];
+      waiter_notify(mailbox);
+    }
+
+    if (status != MailboxResultSuccess &&
+        result.result == MailboxResultSuccess) {
+      result.result = status;
+    }
+  }
+
+  persist_log_multi(users, result.delivered, argp->mnum, argp->message);
+
+  // The mailboxes hold their own references now.
+  bodystore_release(body);
+  return server_reply(rqstp, &result);
+}
+
+/*
+ * Waits for the user's mailbox to change from version since, for up to
+ * timeout_ms, then gets its new version and the numbers of the messages
+ * that changed, inserted, replaced or deleted. If the server can't tell
+ * which, resync is set and the client should list the mailbox again. A
+ * since other than the current version answers straight away, so a client
+ * starts from 0 and then passes back each current version it is given.
+ * Waiting takes no thread, the request is parked and answered later.
+ */
+MailboxWaitResponse *mailbox_wait_1_svc(MailboxWaitParams *argp,
+                                        struct svc_req *rqstp) {
+  static MailboxWaitResponse result;
+  Mailbox *mailbox = server_find(argp->user);
+
+  memset(&result, 0, sizeof(result));
+
+  if (mailbox == NULL) {
     result.result = MailboxResultUserNotExists;
-    return &result;
+    return server_reply(rqstp, &result);
+  }
+
+  // Nothing new yet. The reply is sent once there is.
+  if (argp->since == mailbox->version && argp->timeout_ms > 0 &&
+      rqstp != NULL &&
+      waiter_add(rqstp, mailbox, argp->since, argp->timeout_ms)) {
+    return NULL;
+  }
+
+  waiter_result(mailbox, argp->since, &result);
+  return server_reply(rqstp, &result);
+}
+
+/*
+ * Starts a background snapshot of every mailbox. The server keeps serving
+ * while it is written and reports how it went when it finishes.
+ */
+MailboxResult *mailbox_snapshot_1_svc(MailboxParams *argp, struct svc_req *rqstp) {
+  static MailboxResult result = MailboxResultSuccess;
+
+  result = persist_snapshot() ? MailboxResultSuccess :
+                                MailboxResultServerFailure;
+  server_hold_cold();
+  return server_reply(rqstp, &result);
+}
+
+/*
+ * Writes one chunk of a message sent in pieces. A chunk at offset 0 sets
+ * the message's total length and starts it over, and the message replaces
+ * the one under mnum once every byte up to total is in. Chunks can be
+ * resent but not skip ahead.
+ */
+MailboxResult *mailbox_insert_chunk_1_svc(MailboxChunkParams *argp,
+                                          struct svc_req *rqstp) {
+  static MailboxResult result = MailboxResultSuccess;
+  size_t len = argp->data.data_len;
+
+  // Check for negative message numbers.
+  if (argp->mnum < 0) {
+    result = MailboxResultInvalidMnum;
+    return server_reply(rqstp, &result);
   }
 
-  Stk *mailbox_stk = (Stk*)mailbox.pointerVal;
+  // Messages are strings, so no NULs, and the chunk has to fit.
+  if (argp->total > MAILBOX_MAX_MESSAGE ||
+      argp->offset > argp->total || len > argp->total - argp->offset ||
+      memchr(argp->data.data_val, '\0', len) != NULL) {
+    result = MailboxResultBadChunk;
+    return server_reply(rqstp, &result);
+  }
+
+  Mailbox *mailbox_ptr = server_find(argp->user);
+  if (mailbox_ptr == NULL) {
+    result = MailboxResultUserNotExists;
+    return server_reply(rqstp, &result);
+  }
+
+  switch (mailbox_put_chunk(mailbox_ptr, argp->mnum, argp->total,
+                            argp->offset, argp->data.data_val, len)) {
+  case MailboxChunkPending:
+    result = MailboxResultSuccess;
+    break;
+  case MailboxChunkComplete: {
+    // Only whole messages are logged.
+    char *msg;
+    mailbox_get(mailbox_ptr, argp->mnum, &msg, NULL, NULL);
+    persist_log(PersistOpInsert, argp->user, argp->mnum, msg);
+    waiter_notify(mailbox_ptr);
+    result = MailboxResultSuccess;
+    break;
+  }
+  case MailboxChunkOutOfOrder:
+    result = MailboxResultBadChunk;
+    break;
+  case MailboxChunkTooMany:
+    result = MailboxResultMailboxFull;
+    break;
+  case MailboxChunkNoMemory:
+    result = MailboxResultServerFailure;
+    break;
+  }
+
+  return server_reply(rqstp, &result);
+}
 
-  // Add message to mailbox.
-  if (mailbox.pointerVal == NULL) {
+/*
+ * Reads up to MAX_CHUNK bytes of a message from offset. The response
+ * points straight into the stored message, which XDR encodes from, and
+ * carries its version so a client can tell if it changed between chunks.
+ */
+MailboxChunkResponse *mailbox_retrieve_chunk_1_svc(MailboxChunkParams *argp,
+                                                   struct svc_req *rqstp) {
+  static MailboxChunkResponse result;
+  char *msg;
+
+  memset(&result, 0, sizeof(result));
+
+  // Check for negative message numbers.
+  if (argp->mnum < 0) {
+    result.result = MailboxResultInvalidMnum;
+    return server_reply(rqstp, &result);
+  }
+
+  Mailbox *mailbox = server_find(argp->user);
+  if (mailbox == NULL) {
     result.result = MailboxResultUserNotExists;
-    return &result;
+    return server_reply(rqstp, &result);
   }
 
-  // Get value from mailbox, handle any errors.
-  DSValue wrapper;
-  if (!stk_get(mailbox_stk, &wrapper, argp->mnum)) {
+  size_t total;
+  if (!mailbox_get(mailbox, argp->mnum, &msg, &total, &result.tag)) {
     result.result = MailboxResultMessageNotExists;
-    return &result;
+    return server_reply(rqstp, &result);
   }
 
-  // Check message exists.
-  if (wrapper.pointerVal == NULL) {
-    result.result = MailboxResultMessageNotExists;
-    return &result;
+  if (argp->offset > total) {
+    result.result = MailboxResultBadChunk;
+    return server_reply(rqstp, &result);
   }
 
-  // Copy message into response.
-  result.message = wrapper.pointerVal;
+  result.total = total;
+  result.offset = argp->offset;
+  result.data.data_val = msg + argp->offset;
+  result.data.data_len = total - argp->offset < MAX_CHUNK ?
+                         total - argp->offset : MAX_CHUNK;
 
   result.result = MailboxResultSuccess;
-  return &result;
+  return server_reply(rqstp, &result);
 }
 
 /*
- * Lists up to 20 of the user's messages in their mailbox.
+ * Gets a message unless the client already has it. If tag is the message's
+ * version the reply is just "not modified". Otherwise it has the current
+ * version and length, and the message itself if it fits in one reply,
+ * else the client fetches it with RETRIEVE_CHUNK.
  */
-MailboxMessageListResponse *mailbox_list_all_messages_1_svc(MailboxParams *argp,
-                                                            struct svc_req *rqstp) {
-  static MailboxMessageListResponse result;
-  DSValue mailbox;
+MailboxCachedResponse *mailbox_retrieve_if_modified_1_svc(
+    MailboxCachedParams *argp, struct svc_req *rqstp) {
+  static MailboxCachedResponse result;
+  Mailbox *mailbox = server_find(argp->user);
+  char *msg;
+  size_t total;
+
+  memset(&result, 0, sizeof(result));
+  result.message = "\0";
 
-  // Initialize return values.
-  result.result = MailboxResultSuccess;
-  for (int i = 0; i < MAX_EMAIL; i++) {
-    result.messages[i] = "\0";
+  if (mailbox == NULL) {
+    result.result = MailboxResultUserNotExists;
+    return server_reply(rqstp, &result);
   }
 
-  // Check that users hashtable exists and user has registered on server.
-  if (g_users_ht == NULL ||
-      !ht_get(g_users_ht, argp->user, &mailbox)) {
+  // Check for negative message numbers.
+  if (argp->mnum < 0) {
+    result.result = MailboxResultInvalidMnum;
+    return server_reply(rqstp, &result);
+  }
+
+  if (!mailbox_get(mailbox, argp->mnum, &msg, &total, &result.tag)) {
+    result.result = MailboxResultMessageNotExists;
+    return server_reply(rqstp, &result);
+  }
+
+  result.total = total;
+  result.modified = result.tag != argp->tag;
+  if (result.modified && total <= MAX_CHUNK) {
+    result.message = msg;
+  }
+
+  result.result = MailboxResultSuccess;
+  return server_reply(rqstp, &result);
+}
+
+/*
+ * Searches the user's messages, returning the numbers of the best matches,
+ * best first, and how many matched in all.
+ */
+MailboxSearchResponse *mailbox_search_1_svc(MailboxSearchParams *argp,
+                                            struct svc_req *rqstp) {
+  static MailboxSearchResponse result;
+  static int mnums[MAX_HITS];
+  SearchHit hits[MAX_HITS];
+  Mailbox *mailbox = server_find(argp->user);
+  int total;
+
+  memset(&result, 0, sizeof(result));
+  result.mnums.mnums_val = mnums;
+
+  if (mailbox == NULL) {
     result.result = MailboxResultUserNotExists;
-    return &result;
+    return server_reply(rqstp, &result);
   }
 
-  Stk *mailbox_stk = (Stk*)mailbox.pointerVal;
+  if (!mailbox_search(mailbox, argp->query, hits, MAX_HITS, &total)) {
+    result.result = MailboxResultServerFailure;
+    return server_reply(rqstp, &result);
+  }
 
-  // Get up to 20 emails.
-  for (int i = 0, j = 0; i < stk_depth(mailbox_stk) && j < MAX_EMAIL; i++) {
+  result.total = total;
+  result.mnums.mnums_len = total < MAX_HITS ? total : MAX_HITS;
+  for (u_int i = 0; i < result.mnums.mnums_len; i++) {
+    mnums[i] = hits[i].mnum;
+  }
 
-    DSValue wrapper;
-    if (stk_get(mailbox_stk, &wrapper, i) &&
-        wrapper.pointerVal != NULL) {
+  result.result = MailboxResultSuccess;
+  return server_reply(rqstp, &result);
+}
 
-      // Copy message into response.
-      result.messages[j++] = wrapper.pointerVal;
-    }
+/*
+ * Gets the server's statistics: the per procedure counters, plus how many
+ * users and messages there are, the memory holding them and how much
+ * sharing bodies saves.
+ */
+MailboxStatsResponse *mailbox_stats_1_svc(MailboxParams *argp, struct svc_req *rqstp) {
+  static MailboxStatsResponse result;
+
+  memset(&result, 0, sizeof(result));
+
+  // Walked here rather than counted in the handlers, STATS is rare.
+  for (Mailbox *mailbox = g_mailboxes; mailbox != NULL; mailbox = mailbox->next) {
+    result.users++;
+    result.messages += mailbox_count(mailbox);
+    result.message_bytes += mailbox->bytes;
+    result.storage_bytes += mailbox_memory(mailbox);
   }
 
+  // Shared bodies count once in storage, and once per reference in the
+  // message bytes they'd take up unshared.
+  BodyStoreStats shared;
+  bodystore_stats(&shared);
+  result.shared_bodies = shared.bodies;
+  result.shared_references = shared.refs;
+  result.shared_bytes = shared.bytes;
+  result.dedup_saved_bytes = shared.ref_bytes - shared.bytes;
+  result.message_bytes += shared.ref_bytes;
+  result.storage_bytes += shared.bytes;
+
+  SpillStats spill;
+  spill_stats(&spill);
+  result.memory_budget = spill.budget_bytes;
+  result.resident_bytes = spill.resident_bytes;
+  result.spilled_users = spill.spilled;
+
   result.result = MailboxResultSuccess;
+  server_reply(rqstp, &result);
+
+  // Copied last, so it includes this call's own result.
+  stats_get(&result);
   return &result;
 }
 
 /*
- * Deletes the specified user's message from the specified slot.
+ * Replays a message delivered to a list of users, see PersistApplyFn.
  */
-MailboxResult *mailbox_delete_message_1_svc(MailboxParams *argp, struct svc_req *rqstp) {
- static MailboxResult result = MailboxResultSuccess;
-  DSValue mailbox;
+static void server_apply_multi(char *users, int mnum, char *message) {
+  MailboxMultiParams params;
+  int count = 0;
 
-  // Check for negative message numbers.
-  if (argp->mnum < 0) {
-    result = MailboxResultInvalidMnum;
-    return &result;
+  for (char *user = users; *user != '\0'; user += strlen(user) + 1) {
+    count++;
   }
 
-  // Check that users hashtable exists and user has registered on server.
-  if (g_users_ht == NULL ||
-      !ht_get(g_users_ht, argp->user, &mailbox)) {
-    result = MailboxResultUserNotExists;
-    return &result;
+  params.users.users_len = count;
+  params.users.users_val = malloc(count * sizeof(char*));
+  params.mnum = mnum;
+  params.message = message;
+  if (params.users.users_val == NULL) {
+    return;
   }
 
-  Stk *mailbox_stk = (Stk*)mailbox.pointerVal;
+  count = 0;
+  for (char *user = users; *user != '\0'; user += strlen(user) + 1) {
+    params.users.users_val[count++] = user;
+  }
 
-  // Remove message from mailbox.
-  if (mailbox.pointerVal == NULL) {
-    result = MailboxResultUserNotExists;
-    return &result;
+  mailbox_insert_multi_1_svc(&params, NULL);
+  free(params.users.users_val);
+}
+
+/*
+ * Reapplies an operation recovered from disk by running it through the
+ * same handler a client request would.
+ */
+static void server_apply(PersistOp op, char *user, int mnum, char *message) {
+  MailboxParams params;
+
+  params.user = user;
+  params.mnum = mnum;
+  params.message = message != NULL ? message : "\0";
+
+  switch (op) {
+  case PersistOpStart:
+    mailbox_start_1_svc(&params, NULL);
+    break;
+  case PersistOpQuit:
+    mailbox_quit_1_svc(&params, NULL);
+    break;
+  case PersistOpInsert:
+    mailbox_insert_message_1_svc(&params, NULL);
+    break;
+  case PersistOpDelete:
+    mailbox_delete_message_1_svc(&params, NULL);
+    break;
+  case PersistOpInsertMulti:
+    server_apply_multi(user, mnum, params.message);
+    break;
+  case PersistOpInsertShared: {
+    // Straight in, there's no request for a lone shared message.
+    Mailbox *mailbox = server_find(user);
+    if (mailbox != NULL) {
+      mailbox_put_shared(mailbox, mnum, params.message);
+    }
+    break;
+  }
   }
+}
 
-  // Free old string.
-  DSValue old_value;
-  if (stk_get(mailbox_stk, &old_value, argp->mnum) &&
-      old_value.pointerVal != NULL) {
-    free(old_value.pointerVal);
-  } else {
-    result = MailboxResultMessageNotExists;
-    return &result;
+/*
+ * Writes a spilled message into a snapshot, see MailboxSavedFn.
+ */
+static void server_dump_saved(void *snap, const MsgIdxEntry *entry) {
+  persist_snapshot_message(snap, entry->mnum, entry->value,
+                           (entry->size & MAILBOX_SHARED) != 0);
+}
+
+/*
+ * Writes every mailbox and message into a snapshot. Spilled mailboxes are
+ * copied from their cold files rather than loaded. That runs in the
+ * snapshot process, while the server holds the cold files as they were at
+ * the fork, see server_hold_cold(). Returns false if one can't be read.
+ */
+static bool server_dump(PersistSnapshot *snap) {
+  for (Mailbox *mailbox = g_mailboxes; mailbox != NULL; mailbox = mailbox->next) {
+    persist_snapshot_user(snap, mailbox->user, mailbox_count(mailbox));
+
+    if (!mailbox_loaded(mailbox)) {
+      if (!spill_read(mailbox, server_dump_saved, snap)) {
+        printf("Unable to read mailbox %s for the snapshot.\n",
+               mailbox->user);
+        return false;
+      }
+      continue;
+    }
+
+    for (int i = 0; i < mailbox_count(mailbox); i++) {
+      int mnum;
+      char *msg;
+      if (mailbox_at(mailbox, i, &mnum, &msg)) {
+        persist_snapshot_message(snap, mnum, msg,
+                                 mailbox_shared_at(mailbox, i));
+      }
+    }
   }
+  return true;
+}
 
-  // Per the document prompt, we'll store the message in the CLIENT
-  // provided index, however, we could just as easily do things the
-  // right way and return an ID.
-  if (!stk_set_pointer(mailbox_stk, NULL, argp->mnum)) {
-    result = MailboxResultServerFailure;
-    return &result;
+
+/*
+ * Loads the server's state from data_dir and logs changes there from now
+ * on. A snapshot is taken each time the log grows past snapshot_log_bytes.
+ * Mailboxes are spilled to disk to keep their memory under memory_budget,
+ * unless it is 0.
+ */
+bool server_init(const char *data_dir, size_t snapshot_log_bytes,
+                 size_t memory_budget) {
+  return spill_init(data_dir, memory_budget) &&
+         persist_open(data_dir, snapshot_log_bytes, server_apply, server_dump);
+}
+
+/*
+ * Answers changes before they're on disk if early is set, so a crash can
+ * lose up to the last commit group of changes clients were told about.
+ */
+void server_early_replies(bool early) {
+  g_early_replies = early;
+}
+
+/*
+ * Makes this server shard index of count, so it only takes users whose
+ * names hash into that shard's range.
+ */
+void server_shard(int index, int count) {
+  g_shard_index = index;
+  g_shard_count = count;
+}
+
+/*
+ * Periodic work between requests. Returns milliseconds until it next needs
+ * to run, or -1 if there's nothing pending.
+ */
+int server_tick() {
+  spill_tick();
+
+  int persist_ms = persist_tick();
+  server_hold_cold();
+  server_release();
+  int wait_ms = waiter_tick();
+
+  if (persist_ms == -1 || (wait_ms != -1 && wait_ms < persist_ms)) {
+    return wait_ms;
   }
+  return persist_ms;
+}
 
-  result = MailboxResultSuccess;
-  return &result;
+/*
+ * Records how long a request to procedure proc took to serve, for the
+ * statistics and snapshot reports.
+ */
+void server_request_time(unsigned long proc, double ms) {
+  stats_record_call(proc, ms);
+  persist_request_time(ms);
+}
+
+/*
+ * Makes everything durable ahead of exiting, and answers the changes still
+ * waiting on it.
+ */
+void server_shutdown() {
+  persist_close();
+  server_release();
 }
@@ -0,0 +1,30 @@
+/**
+ * EECS 338 Operating Systems
+ * Case Western Reserve University
+ * (C) 2015 Christian Gunderman
+ */
+#ifndef SERVER__H__
+#define SERVER__H__
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Server lifecycle, called from main.c around the RPC loop. The RPC
+ * handlers themselves are declared in the rpcgen generated proto.h.
+ */
+
+bool server_init(const char *data_dir, size_t snapshot_log_bytes,
+                 size_t memory_budget);
+
+void server_shard(int index, int count);
+
+void server_early_replies(bool early);
+
+int server_tick();
+
+void server_request_time(unsigned long proc, double ms);
+
+void server_shutdown();
+
+#endif // SERVER__H__
@@ -0,0 +1,374 @@
+/**
+ * EECS 338 Operating Systems
+ * Case Western Reserve University
+ * (C) 2015 Christian Gunderman
+ */
+#define _GNU_SOURCE
+
+#include "shmsvc.h"
+#include "proto.h"
+#include "server.h"
+#include "shm.h"
+#include "waiters.h"
+
+#include <errno.h>
+#include <linux/futex.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+// A connected client.
+typedef struct ShmConn {
+  struct ShmConn *next;
+  int sock;
+  int event;
+  char *region;  // SHM_REGION_BYTES shared, then a page of zeros.
+  uint64_t held;  // Reply is written but waits for the log to reach this.
+} ShmConn;
+
+// Global state:
+static int g_listen = -1;
+static char *g_path = NULL;
+static ShmConn *g_conns = NULL;
+static size_t g_page = 0;
+
+/*
+ * Gets a monotonic timestamp in milliseconds.
+ */
+static double shmsvc_now_ms() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+/*
+ * Maps a client's region. The page after it is private and all zeros, so
+ * a string the client unterminates after it has been checked still ends
+ * there instead of running off the mapping.
+ */
+static char *shmsvc_map(int fd) {
+  char *region = mmap(NULL, SHM_REGION_BYTES + g_page, PROT_READ,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (region == MAP_FAILED) {
+    return NULL;
+  }
+
+  if (mmap(region, SHM_REGION_BYTES, PROT_READ | PROT_WRITE,
+           MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) {
+    munmap(region, SHM_REGION_BYTES + g_page);
+    return NULL;
+  }
+  return region;
+}
+
+/*
+ * Sends the client its region and eventfd.
+ */
+static bool shmsvc_send(int sock, int *fds) {
+  char byte = 0;
+  char control[CMSG_SPACE(2 * sizeof(int))];
+  struct iovec iov = { &byte, 1 };
+  struct msghdr msg;
+
+  memset(&msg, 0, sizeof(msg));
+  memset(control, 0, sizeof(control));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(2 * sizeof(int));
+  memcpy(CMSG_DATA(cmsg), fds, 2 * sizeof(int));
+
+  return sendmsg(sock, &msg, MSG_NOSIGNAL) == 1;
+}
+
+/*
+ * Accepts a client and sets up its region.
+ */
+static void shmsvc_accept() {
+  int fds[2] = { -1, -1 };
+  ShmConn *conn = calloc(1, sizeof(ShmConn));
+  int sock = accept4(g_listen, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+  if (conn != NULL && sock != -1 && sock < FD_SETSIZE &&
+      (fds[0] = memfd_create("mailbox-shm", MFD_CLOEXEC)) != -1 &&
+      (fds[1] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) != -1 &&
+      fds[1] < FD_SETSIZE &&
+      ftruncate(fds[0], SHM_REGION_BYTES) != -1 &&
+      (conn->region = shmsvc_map(fds[0])) != NULL) {
+    if (shmsvc_send(sock, fds)) {
+      close(fds[0]);
+      conn->sock = sock;
+      conn->event = fds[1];
+      conn->next = g_conns;
+      g_conns = conn;
+      return;
+    }
+    munmap(conn->region, SHM_REGION_BYTES + g_page);
+  }
+
+  if (sock != -1) {
+    perror("Unable to set up local client");
+    close(sock);
+  }
+  for (int i = 0; i < 2; i++) {
+    if (fds[i] != -1) {
+      close(fds[i]);
+    }
+  }
+  free(conn);
+}
+
+/*
+ * Runs the handler for proc, with a request that has no transport. The
+ * handlers only look at the procedure number.
+ */
+static void *shmsvc_run(unsigned long proc, void *args) {
+  struct svc_req req;
+
+  memset(&req, 0, sizeof(req));
+  req.rq_prog = MAILBOX_PROG;
+  req.rq_vers = MAILBOX_VERSION;
+  req.rq_proc = proc;
+
+  switch (proc) {
+  case MAILBOX_START:
+    return mailbox_start_1_svc(args, &req);
+  case MAILBOX_QUIT:
+    return mailbox_quit_1_svc(args, &req);
+  case MAILBOX_INSERT_MESSAGE:
+    return mailbox_insert_message_1_svc(args, &req);
+  case MAILBOX_RETRIEVE_MESSAGE:
+    return mailbox_retrieve_message_1_svc(args, &req);
+  case MAILBOX_LIST_ALL_MESSAGES:
+    return mailbox_list_all_messages_1_svc(args, &req);
+  case MAILBOX_DELETE_MESSAGE:
+    return mailbox_delete_message_1_svc(args, &req);
+  case MAILBOX_SNAPSHOT:
+    return mailbox_snapshot_1_svc(args, &req);
+  case MAILBOX_STATS:
+    return mailbox_stats_1_svc(args, &req);
+  case MAILBOX_INSERT_CHUNK:
+    return mailbox_insert_chunk_1_svc(args, &req);
+  case MAILBOX_RETRIEVE_CHUNK:
+    return mailbox_retrieve_chunk_1_svc(args, &req);
+  case MAILBOX_OPEN:
+    return mailbox_open_1_svc(args, &req);
+  case MAILBOX_INSERT_MESSAGE_BY_HANDLE:
+    return mailbox_insert_message_by_handle_1_svc(args, &req);
+  case MAILBOX_RETRIEVE_MESSAGE_BY_HANDLE:
+    return mailbox_retrieve_message_by_handle_1_svc(args, &req);
+  case MAILBOX_LIST_ALL_MESSAGES_BY_HANDLE:
+    return mailbox_list_all_messages_by_handle_1_svc(args, &req);
+  case MAILBOX_DELETE_MESSAGE_BY_HANDLE:
+    return mailbox_delete_message_by_handle_1_svc(args, &req);
+  case MAILBOX_RETRIEVE_IF_MODIFIED:
+    return mailbox_retrieve_if_modified_1_svc(args, &req);
+  case MAILBOX_SEARCH:
+    return mailbox_search_1_svc(args, &req);
+  default:
+    return NULL;
+  }
+}
+
+/*
+ * Hands the client the reply written in its region and wakes it.
+ */
+static void shmsvc_wake(ShmConn *conn) {
+  ShmHeader *header = (ShmHeader*)conn->region;
+
+  __atomic_store_n(&header->state, SHM_REPLY, __ATOMIC_RELEASE);
+  syscall(SYS_futex, &header->state, FUTEX_WAKE, 1, NULL, NULL, 0);
+}
+
+/*
+ * Serves the call waiting in a client's region, if there is one, writing
+ * the result over its arguments and waking the client. A change isn't
+ * answered until it is durable, see shmsvc_release().
+ */
+static void shmsvc_call(ShmConn *conn) {
+  ShmHeader *header = (ShmHeader*)conn->region;
+  char *data = conn->region + SHM_DATA_OFFSET;
+  size_t capacity = SHM_REGION_BYTES - SHM_DATA_OFFSET;
+  double start = shmsvc_now_ms();
+  uint32_t status = SHM_OK;
+  size_t length = 0;
+
+  if (conn->held != 0 ||
+      __atomic_load_n(&header->state, __ATOMIC_ACQUIRE) != SHM_REQUEST) {
+    return;
+  }
+
+  // Arguments are read in place, their strings pointing into the region.
+  union {
+    MailboxParams params;
+    MailboxChunkParams chunk;
+    MailboxHandleParams handle;
+    MailboxCachedParams cached;
+    MailboxSearchParams search;
+  } args;
+  unsigned long proc = header->proc;
+
+  if (!shm_supported(proc)) {
+    status = SHM_UNSUPPORTED;
+  } else if (header->length > capacity ||
+             !shm_decode(proc, false, data, header->length, &args)) {
+    status = SHM_BAD_ARGS;
+  } else {
+    // Handlers copy what they keep, so the arguments can be overwritten.
+    length = shm_encode(proc, true, shmsvc_run(proc, &args), data, capacity);
+    if (length == 0) {
+      status = SHM_TOO_BIG;
+    }
+  }
+
+  header->status = status;
+  header->length = length;
+  conn->held = waiter_take_hold();
+  if (conn->held == 0) {
+    shmsvc_wake(conn);
+  }
+
+  if (status == SHM_OK) {
+    server_request_time(proc, shmsvc_now_ms() - start);
+  }
+}
+
+/*
+ * Hangs up on a client and unmaps its region.
+ */
+static void shmsvc_drop(ShmConn **link) {
+  ShmConn *conn = *link;
+
+  *link = conn->next;
+  munmap(conn->region, SHM_REGION_BYTES + g_page);
+  close(conn->event);
+  close(conn->sock);
+  free(conn);
+}
+
+/*
+ * Listens for local clients on a unix socket at path, replacing any left
+ * by a previous run.
+ */
+bool shmsvc_open(const char *path) {
+  struct sockaddr_un addr;
+
+  g_page = sysconf(_SC_PAGESIZE);
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    printf("Local socket path %s is too long.\n", path);
+    return false;
+  }
+  strcpy(addr.sun_path, path);
+  unlink(path);
+
+  if ((g_listen = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                         0)) == -1 ||
+      bind(g_listen, (struct sockaddr*)&addr, sizeof(addr)) == -1 ||
+      listen(g_listen, SOMAXCONN) == -1) {
+    perror("Unable to listen on local socket");
+    return false;
+  }
+
+  g_path = strdup(path);
+  return g_path != NULL;
+}
+
+/*
+ * Adds the sockets and eventfds to wait on to fds.
+ */
+void shmsvc_fdset(fd_set *fds) {
+  if (g_listen == -1) {
+    return;
+  }
+
+  FD_SET(g_listen, fds);
+  for (ShmConn *conn = g_conns; conn != NULL; conn = conn->next) {
+    FD_SET(conn->sock, fds);
+    FD_SET(conn->event, fds);
+  }
+}
+
+/*
+ * Serves whatever in ready is ours, and takes it out of ready.
+ */
+void shmsvc_serve(fd_set *ready) {
+  if (g_listen == -1) {
+    return;
+  }
+
+  ShmConn **link = &g_conns;
+  while (*link != NULL) {
+    ShmConn *conn = *link;
+    uint64_t rings;
+    char byte;
+
+    if (FD_ISSET(conn->event, ready)) {
+      FD_CLR(conn->event, ready);
+      if (read(conn->event, &rings, sizeof(rings)) == sizeof(rings)) {
+        shmsvc_call(conn);
+      }
+    }
+
+    // Clients never send on the socket, so it's readable once they're gone.
+    if (FD_ISSET(conn->sock, ready)) {
+      FD_CLR(conn->sock, ready);
+      ssize_t got = recv(conn->sock, &byte, 1, 0);
+      if (got == 0 || (got == -1 && errno != EAGAIN && errno != EINTR)) {
+        shmsvc_drop(link);
+        continue;
+      }
+    }
+    link = &conn->next;
+  }
+
+  // Accepted last, so the new client's fds aren't looked at in this ready.
+  if (FD_ISSET(g_listen, ready)) {
+    FD_CLR(g_listen, ready);
+    shmsvc_accept();
+  }
+}
+
+/*
+ * Wakes the clients whose held replies are now durable, up to seq.
+ */
+void shmsvc_release(uint64_t seq) {
+  for (ShmConn *conn = g_conns; conn != NULL; conn = conn->next) {
+    if (conn->held != 0 && conn->held <= seq) {
+      conn->held = 0;
+      shmsvc_wake(conn);
+    }
+  }
+}
+
+/*
+ * Hangs up on every client and removes the socket.
+ */
+void shmsvc_close() {
+  if (g_listen == -1) {
+    return;
+  }
+
+  while (g_conns != NULL) {
+    shmsvc_drop(&g_conns);
+  }
+  close(g_listen);
+  g_listen = -1;
+  unlink(g_path);
+  free(g_path);
+  g_path = NULL;
+}
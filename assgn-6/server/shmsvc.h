@@ -0,0 +1,32 @@
+/**
+ * EECS 338 Operating Systems
+ * Case Western Reserve University
+ * (C) 2015 Christian Gunderman
+ */
+#ifndef SHMSVC__H__
+#define SHMSVC__H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/select.h>
+
+/*
+ * Server end of the shared memory transport, see protocol/shm.h. Serves
+ * from the same request loop as RPC: the listening socket, each client's
+ * eventfd and each client's socket are added to the select() set, and
+ * whichever are ready are handled before RPC gets the rest. Calls run the
+ * same handlers RPC would, so they are counted in the statistics and
+ * logged alike, and replies to changes wait for the log the same way.
+ */
+
+bool shmsvc_open(const char *path);
+
+void shmsvc_fdset(fd_set *fds);
+
+void shmsvc_serve(fd_set *ready);
+
+void shmsvc_release(uint64_t seq);
+
+void shmsvc_close();
+
+#endif // SHMSVC__H__
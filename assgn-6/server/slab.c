@@ -0,0 +1,250 @@
+/**
+ * EECS 338 Operating Systems
+ * Case Western Reserve University
+ * (C) 2015 Christian Gunderman
+ */
+#include "slab.h"
+
+#include <stdlib.h>
+
+// Chunks are a page each. Growing them geometrically would leave up to a
+// third of a big arena as uncarved slack, a page at a time bounds it.
+#define SLAB_CHUNK_SIZE 4096
+
+// Block sizes. 8 byte steps for the short messages that dominate, then four
+// classes per doubling so at most a fifth of a block is wasted. Every class
+// is a multiple of 8 so blocks stay pointer aligned and can hold a free
+// list link.
+static const size_t kSlabClasses[SLAB_CLASS_COUNT] = {
+  8, 16, 24, 32, 40, 48, 56, 64,
+  80, 96, 112, 128, 160, 192, 224, 256,
+  320, 384, 448, 512, 640, 768, 896, 1024,
+  1280, 1536, 1792, 2048
+};
+
+// Number of classes that are 8 bytes apart.
+#define SLAB_LINEAR_CLASSES 8
+
+// Header of a chunk that blocks are carved out of.
+struct SlabChunk {
+  SlabChunk *next;
+  size_t size;
+};
+
+// Header of a block too big for any size class.
+struct SlabLarge {
+  SlabLarge *prev;
+  SlabLarge *next;
+};
+
+/*
+ * Gets the index of the smallest class that fits size.
+ */
+static int slab_class(size_t size) {
+  if (size <= kSlabClasses[SLAB_LINEAR_CLASSES - 1]) {
+    return size == 0 ? 0 : (int)((size + 7) / 8) - 1;
+  }
+
+  int i = SLAB_LINEAR_CLASSES;
+  while (kSlabClasses[i] < size) {
+    i++;
+  }
+  return i;
+}
+
+/*
+ * Links a new chunk into the arena and makes it the one blocks are carved
+ * from. header_size bytes at the front of the chunk are skipped.
+ */
+static void slab_add_chunk(Slab *slab, SlabChunk *chunk, size_t chunk_size,
+                           size_t header_size) {
+  chunk->size = chunk_size;
+  chunk->next = slab->chunks;
+  slab->chunks = chunk;
+
+  slab->bump = (char*)chunk + header_size;
+  slab->bump_left = chunk_size - header_size;
+  slab->bytes_reserved += chunk_size;
+}
+
+/*
+ * Creates an empty arena. Its bookkeeping is placed in the first chunk,
+ * ahead of the blocks carved from it.
+ */
+Slab *slab_new() {
+  SlabChunk *chunk = malloc(SLAB_CHUNK_SIZE);
+  if (chunk == NULL) {
+    return NULL;
+  }
+
+  Slab *slab = (Slab*)(chunk + 1);
+  slab->chunks = NULL;
+  slab->large = NULL;
+  slab->free_lists = NULL;
+  slab->bytes_used = 0;
+  slab->bytes_reserved = 0;
+
+  slab_add_chunk(slab, chunk, SLAB_CHUNK_SIZE,
+                 sizeof(SlabChunk) + sizeof(Slab));
+  return slab;
+}
+
+/*
+ * Frees the arena and every block in it at once. Blocks don't need to be
+ * released individually first.
+ */
+void slab_free(Slab *slab) {
+  if (slab == NULL) {
+    return;
+  }
+
+  while (slab->large != NULL) {
+    SlabLarge *next = slab->large->next;
+    free(slab->large);
+    slab->large = next;
+  }
+
+  // The first chunk, which holds slab itself, is at the end of the list.
+  SlabChunk *chunk = slab->chunks;
+  while (chunk != NULL) {
+    SlabChunk *next = chunk->next;
+    free(chunk);
+    chunk = next;
+  }
+}
+
+/*
+ * Allocates a block directly from malloc and links it into the large list
+ * so slab_free() can find it.
+ */
+static void *slab_alloc_large(Slab *slab, size_t size) {
+  SlabLarge *large = malloc(sizeof(SlabLarge) + size);
+  if (large == NULL) {
+    return NULL;
+  }
+
+  large->prev = NULL;
+  large->next = slab->large;
+  if (slab->large != NULL) {
+    slab->large->prev = large;
+  }
+  slab->large = large;
+
+  slab->bytes_used += size;
+  slab->bytes_reserved += sizeof(SlabLarge) + size;
+  return large + 1;
+}
+
+/*
+ * Adds a new chunk to carve blocks from. The tail
+ * of the previous chunk is handed to the free lists so it isn't lost, if
+ * there are free lists yet.
+ */
+static bool slab_grow(Slab *slab) {
+  SlabChunk *chunk = malloc(SLAB_CHUNK_SIZE);
+  if (chunk == NULL) {
+    return false;
+  }
+
+  // Salvage what's left of the old chunk, biggest classes first.
+  for (int i = SLAB_CLASS_COUNT - 1;
+       i >= 0 && slab->free_lists != NULL && slab->bump_left > 0; i--) {
+    while (slab->bump_left >= kSlabClasses[i]) {
+      *(void**)slab->bump = slab->free_lists[i];
+      slab->free_lists[i] = slab->bump;
+      slab->bump += kSlabClasses[i];
+      slab->bump_left -= kSlabClasses[i];
+    }
+  }
+
+  slab_add_chunk(slab, chunk, SLAB_CHUNK_SIZE, sizeof(SlabChunk));
+  return true;
+}
+
+/*
+ * Carves a fresh block of the given class from the newest chunk.
+ */
+static void *slab_carve(Slab *slab, int size_class) {
+  size_t block_size = kSlabClasses[size_class];
+
+  if (slab->bump_left < block_size && !slab_grow(slab)) {
+    return NULL;
+  }
+
+  void *block = slab->bump;
+  slab->bump += block_size;
+  slab->bump_left -= block_size;
+  return block;
+}
+
+/*
+ * Allocates a block of at least size bytes from the arena. Returns NULL
+ * if memory is exhausted.
+ */
+void *slab_alloc(Slab *slab, size_t size) {
+  if (size > SLAB_MAX_CLASS_SIZE) {
+    return slab_alloc_large(slab, size);
+  }
+
+  int size_class = slab_class(size);
+  void *block;
+
+  // Reuse a released block if there is one, otherwise carve a new one.
+  if (slab->free_lists != NULL && slab->free_lists[size_class] != NULL) {
+    block = slab->free_lists[size_class];
+    slab->free_lists[size_class] = *(void**)block;
+  } else if (!(block = slab_carve(slab, size_class))) {
+    return NULL;
+  }
+
+  slab->bytes_used += kSlabClasses[size_class];
+  return block;
+}
+
+/*
+ * Returns a block to the arena. size must be the size it was allocated with.
+ */
+void slab_release(Slab *slab, void *block, size_t size) {
+  if (block == NULL) {
+    return;
+  }
+
+  if (size > SLAB_MAX_CLASS_SIZE) {
+    SlabLarge *large = (SlabLarge*)block - 1;
+
+    if (large->prev != NULL) {
+      large->prev->next = large->next;
+    } else {
+      slab->large = large->next;
+    }
+    if (large->next != NULL) {
+      large->next->prev = large->prev;
+    }
+
+    slab->bytes_used -= size;
+    slab->bytes_reserved -= sizeof(SlabLarge) + size;
+    free(large);
+    return;
+  }
+
+  int size_class = slab_class(size);
+  slab->bytes_used -= kSlabClasses[size_class];
+
+  // First release, carve out the free list table. If that fails the block
+  // is simply lost until the whole arena is freed.
+  if (slab->free_lists == NULL) {
+    int table_class = slab_class(SLAB_CLASS_COUNT * sizeof(void*));
+    void **free_lists = slab_carve(slab, table_class);
+
+    if (free_lists == NULL) {
+      return;
+    }
+    for (int i = 0; i < SLAB_CLASS_COUNT; i++) {
+      free_lists[i] = NULL;
+    }
+    slab->free_lists = free_lists;
+  }
+
+  *(void**)block = slab->free_lists[size_class];
+  slab->free_lists[size_class] = block;
+}
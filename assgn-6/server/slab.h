@@ -0,0 +1,50 @@
+/**
+ * EECS 338 Operating Systems
+ * Case Western Reserve University
+ * (C) 2015 Christian Gunderman
+ */
+#ifndef SLAB__H__
+#define SLAB__H__
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Size-class slab arena for message bodies. Small blocks are carved out of
+ * a few larger chunks and recycled through per-class free lists, so there
+ * is no per-message malloc header. Blocks bigger than the largest class get
+ * their own allocation. Everything is released together by slab_free().
+ *
+ * The arena's own bookkeeping lives at the head of its first chunk rather
+ * than in a separate allocation, and the free list table is only carved out
+ * of the arena once the first block is released.
+ */
+
+// Number of size classes, see kSlabClasses in slab.c.
+#define SLAB_CLASS_COUNT 28
+
+// Largest block served from a size class.
+#define SLAB_MAX_CLASS_SIZE 2048
+
+typedef struct SlabChunk SlabChunk;
+typedef struct SlabLarge SlabLarge;
+
+typedef struct Slab {
+  SlabChunk *chunks;     // Every chunk carved from, first one holds this.
+  SlabLarge *large;      // Oversized blocks.
+  void **free_lists;     // Recycled blocks per class, NULL until a release.
+  char *bump;            // Uncarved part of newest chunk.
+  size_t bump_left;
+  size_t bytes_used;     // Handed out to callers.
+  size_t bytes_reserved; // Obtained from malloc.
+} Slab;
+
+Slab *slab_new();
+
+void slab_free(Slab *slab);
+
+void *slab_alloc(Slab *slab, size_t size);
+
+void slab_release(Slab *slab, void *block, size_t size);
+
+#endif // SLAB__H__
@@ -0,0 +1,377 @@
+/**
+ * EECS 338 Operating Systems
+ * Case Western Reserve University
+ * (C) 2015 Christian Gunderman
+ */
+#define _XOPEN_SOURCE 700
+
+#include "spill.h"
+#include "bodystore.h"
+#include "stats.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+// Preprocessor Defines.
+#define SPILL_PATH_MAX 4096
+
+// Global state:
+static char *g_cold_dir = NULL;
+static size_t g_budget = 0;       // 0 for no limit.
+static size_t g_resident = 0;     // Sum of every mailbox's resident bytes.
+static uint64_t g_spilled = 0;    // Mailboxes unloaded right now.
+static uint64_t g_next_id = 1;    // Next cold file name.
+static bool g_warned = false;     // Already said spilling is failing.
+
+// While a snapshot process is reading cold files, none are replaced or
+// removed. Files the server is done with wait here until it finishes.
+static bool g_held = false;
+static uint64_t *g_doomed = NULL;
+static size_t g_doomed_count = 0;
+static size_t g_doomed_cap = 0;
+
+// Loaded mailboxes, most recently touched first.
+static Mailbox *g_lru_head = NULL;
+static Mailbox *g_lru_tail = NULL;
+
+// Mailbox the current request is using. It may change size until the next
+// touch, so it is counted again then, and is never the one evicted.
+static Mailbox *g_current = NULL;
+
+/*
+ * Gets a monotonic timestamp in milliseconds.
+ */
+static double spill_now_ms() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+/*
+ * Builds the path of a mailbox's cold file, e.g. "dir/cold/12".
+ */
+static void spill_path(char *path, Mailbox *mailbox, const char *suffix) {
+  snprintf(path, SPILL_PATH_MAX, "%s/%llu%s", g_cold_dir,
+           (unsigned long long)mailbox->cold_id, suffix);
+}
+
+/*
+ * Deletes the mailbox's cold file, or if they're held, queues it to be
+ * deleted once they aren't. Returns false if it couldn't be queued.
+ */
+static bool spill_remove(Mailbox *mailbox) {
+  char path[SPILL_PATH_MAX];
+
+  if (g_held) {
+    if (g_doomed_count == g_doomed_cap) {
+      size_t cap = g_doomed_cap == 0 ? 64 : g_doomed_cap * 2;
+      uint64_t *doomed = realloc(g_doomed, cap * sizeof(*doomed));
+      if (doomed == NULL) {
+        return false;
+      }
+      g_doomed = doomed;
+      g_doomed_cap = cap;
+    }
+    g_doomed[g_doomed_count++] = mailbox->cold_id;
+    return true;
+  }
+
+  spill_path(path, mailbox, "");
+  unlink(path);
+  return true;
+}
+
+/*
+ * Counts the mailbox's memory against the budget again.
+ */
+static void spill_account(Mailbox *mailbox) {
+  size_t bytes = mailbox_memory(mailbox);
+
+  g_resident = g_resident - mailbox->resident + bytes;
+  mailbox->resident = bytes;
+}
+
+/*
+ * Takes the mailbox out of the LRU list, if it's in it.
+ */
+static void spill_unlink(Mailbox *mailbox) {
+  if (mailbox->lru_prev != NULL) {
+    mailbox->lru_prev->lru_next = mailbox->lru_next;
+  } else if (g_lru_head == mailbox) {
+    g_lru_head = mailbox->lru_next;
+  } else {
+    return;
+  }
+
+  if (mailbox->lru_next != NULL) {
+    mailbox->lru_next->lru_prev = mailbox->lru_prev;
+  } else {
+    g_lru_tail = mailbox->lru_prev;
+  }
+  mailbox->lru_prev = NULL;
+  mailbox->lru_next = NULL;
+}
+
+/*
+ * Puts the mailbox at the front of the LRU list.
+ */
+static void spill_push(Mailbox *mailbox) {
+  mailbox->lru_next = g_lru_head;
+  if (g_lru_head != NULL) {
+    g_lru_head->lru_prev = mailbox;
+  } else {
+    g_lru_tail = mailbox;
+  }
+  g_lru_head = mailbox;
+}
+
+/*
+ * Writes the mailbox's messages to its cold file and frees them. The file
+ * from last time is kept if nothing has changed since it was written.
+ * Cold files don't outlive the process, so they're never fsync'd.
+ */
+static bool spill_evict(Mailbox *mailbox) {
+  char path[SPILL_PATH_MAX];
+  char tmp_path[SPILL_PATH_MAX];
+
+  if (mailbox->cold_id == 0 || mailbox->cold_version != mailbox->version) {
+    // A snapshot may be reading the old file, so while they're held the
+    // new one gets a name of its own.
+    if (mailbox->cold_id != 0 && g_held) {
+      if (!spill_remove(mailbox)) {
+        return false;
+      }
+      mailbox->cold_id = 0;
+    }
+    if (mailbox->cold_id == 0) {
+      mailbox->cold_id = g_next_id++;
+    }
+    spill_path(path, mailbox, "");
+    spill_path(tmp_path, mailbox, "~");
+
+    // Renamed into place, so a crash never leaves half a file behind.
+    FILE *out = fopen(tmp_path, "w");
+    bool ok = out != NULL && mailbox_save(mailbox, out);
+    if ((out != NULL && fclose(out) != 0) || !ok ||
+        rename(tmp_path, path) == -1) {
+      if (!g_warned) {
+        perror("Unable to spill mailbox");
+        g_warned = true;
+      }
+      unlink(tmp_path);
+      return false;
+    }
+    mailbox->cold_version = mailbox->version;
+  }
+
+  mailbox_unload(mailbox);
+  spill_unlink(mailbox);
+  spill_account(mailbox);
+  g_spilled++;
+  stats_record_eviction();
+  return true;
+}
+
+/*
+ * Evicts least recently used mailboxes until everything fits the budget.
+ * The current mailbox and any still receiving chunks stay.
+ */
+static void spill_trim() {
+  BodyStoreStats shared;
+  Mailbox *victim = g_lru_tail;
+
+  if (g_budget == 0) {
+    return;
+  }
+
+  bodystore_stats(&shared);
+  while (victim != NULL && g_resident + shared.bytes > g_budget) {
+    Mailbox *prev = victim->lru_prev;
+
+    if (victim != g_current && victim->uploads == NULL) {
+      if (!spill_evict(victim)) {
+        return;
+      }
+      bodystore_stats(&shared);
+    }
+    victim = prev;
+  }
+}
+
+/*
+ * Reads an unloaded mailbox's messages back from its cold file.
+ */
+static bool spill_load(Mailbox *mailbox) {
+  char path[SPILL_PATH_MAX];
+  double start = spill_now_ms();
+
+  spill_path(path, mailbox, "");
+  FILE *in = fopen(path, "r");
+  bool ok = in != NULL && mailbox_load(mailbox, in);
+  if (in != NULL) {
+    fclose(in);
+  }
+
+  stats_record_load(spill_now_ms() - start, ok);
+  if (!ok) {
+    printf("Unable to load mailbox %s from %s.\n", mailbox->user, path);
+    return false;
+  }
+  g_spilled--;
+  return true;
+}
+
+/*
+ * Sets up spilling to the cold directory under data_dir, once the total
+ * memory of the mailboxes passes budget_bytes, or never if it is 0. Cold
+ * files left by a previous run are stale and deleted.
+ */
+bool spill_init(const char *data_dir, size_t budget_bytes) {
+  g_cold_dir = malloc(strlen(data_dir) + sizeof("/cold"));
+  if (g_cold_dir == NULL) {
+    return false;
+  }
+  sprintf(g_cold_dir, "%s/cold", data_dir);
+  g_budget = budget_bytes;
+
+  DIR *dirp = opendir(g_cold_dir);
+  if (dirp != NULL) {
+    struct dirent *ent;
+    char path[SPILL_PATH_MAX];
+
+    while ((ent = readdir(dirp)) != NULL) {
+      if (ent->d_name[0] != '.') {
+        snprintf(path, sizeof(path), "%s/%s", g_cold_dir, ent->d_name);
+        unlink(path);
+      }
+    }
+    closedir(dirp);
+  }
+
+  if (g_budget == 0) {
+    return true;
+  }
+
+  if ((mkdir(data_dir, 0755) == -1 && errno != EEXIST) ||
+      (mkdir(g_cold_dir, 0755) == -1 && errno != EEXIST)) {
+    printf("Unable to create spill directory %s.\n", g_cold_dir);
+    perror("Spill directory error");
+    return false;
+  }
+  return true;
+}
+
+/*
+ * Marks the mailbox as the one being used now, loading its messages first
+ * if they were spilled, and makes room for it. Call before every use.
+ * Returns false if its messages couldn't be loaded.
+ */
+bool spill_touch(Mailbox *mailbox) {
+  if (g_current != NULL && g_current != mailbox) {
+    spill_account(g_current);
+  }
+  g_current = mailbox;
+
+  if (mailbox_loaded(mailbox)) {
+    stats_record_hit();
+    spill_unlink(mailbox);
+  } else if (!spill_load(mailbox)) {
+    return false;
+  }
+
+  spill_push(mailbox);
+  spill_account(mailbox);
+  spill_trim();
+  return true;
+}
+
+/*
+ * Stops tracking a mailbox that is about to be freed, deleting its cold
+ * file.
+ */
+void spill_forget(Mailbox *mailbox) {
+  if (mailbox_loaded(mailbox)) {
+    spill_unlink(mailbox);
+  } else {
+    g_spilled--;
+  }
+
+  g_resident -= mailbox->resident;
+  mailbox->resident = 0;
+  if (g_current == mailbox) {
+    g_current = NULL;
+  }
+
+  // Left behind if it can't be queued, spill_init() clears it next run.
+  if (mailbox->cold_id != 0) {
+    spill_remove(mailbox);
+  }
+}
+
+/*
+ * Holds every cold file as it is while a snapshot process reads them, or
+ * once hold is cleared, deletes those the server let go of meanwhile.
+ */
+void spill_hold(bool hold) {
+  char path[SPILL_PATH_MAX];
+
+  g_held = hold;
+  if (hold) {
+    return;
+  }
+
+  for (size_t i = 0; i < g_doomed_count; i++) {
+    snprintf(path, sizeof(path), "%s/%llu", g_cold_dir,
+             (unsigned long long)g_doomed[i]);
+    unlink(path);
+  }
+  g_doomed_count = 0;
+}
+
+/*
+ * Reads an unloaded mailbox's messages from its cold file without loading
+ * them, passing each to fn.
+ */
+bool spill_read(Mailbox *mailbox, MailboxSavedFn fn, void *ctx) {
+  char path[SPILL_PATH_MAX];
+
+  spill_path(path, mailbox, "");
+  FILE *in = fopen(path, "r");
+  if (in == NULL) {
+    return false;
+  }
+
+  bool ok = mailbox_read_saved(in, fn, ctx);
+  fclose(in);
+  return ok;
+}
+
+/*
+ * Counts the last mailbox used, now that its request is done, and evicts
+ * whatever no longer fits.
+ */
+void spill_tick() {
+  if (g_current != NULL) {
+    spill_account(g_current);
+    g_current = NULL;
+  }
+  spill_trim();
+}
+
+/*
+ * Gets the budget and what's counted against it.
+ */
+void spill_stats(SpillStats *stats) {
+  BodyStoreStats shared;
+
+  bodystore_stats(&shared);
+  stats->budget_bytes = g_budget;
+  stats->resident_bytes = g_resident + shared.bytes;
+  stats->spilled = g_spilled;
+}
@@ -0,0 +1,51 @@
+/**
+ * EECS 338 Operating Systems
+ * Case Western Reserve University
+ * (C) 2015 Christian Gunderman
+ */
+#ifndef SPILL__H__
+#define SPILL__H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mailbox.h"
+
+/*
+ * Memory budget for mailboxes. Every mailbox the server looks up is
+ * touched, which moves it to the front of an LRU list and counts its
+ * memory. While the total is over budget, the messages of the least
+ * recently used mailboxes are written to a file each in the cold/
+ * directory under the data directory and freed. The Mailbox itself stays,
+ * with its name, handle and versions, so only its messages go. The next
+ * touch reads them back before the caller sees it, so nothing else in the
+ * server knows a mailbox was ever out.
+ *
+ * Cold files only hold what is already in the log and snapshots, and are
+ * thrown away on restart. Snapshots copy unloaded mailboxes straight from
+ * them, so they're held unchanged while one is being written.
+ */
+
+// Totals for stats. resident_bytes includes the shared bodies.
+typedef struct SpillStats {
+  uint64_t budget_bytes;
+  uint64_t resident_bytes;
+  uint64_t spilled;
+} SpillStats;
+
+bool spill_init(const char *data_dir, size_t budget_bytes);
+
+bool spill_touch(Mailbox *mailbox);
+
+void spill_forget(Mailbox *mailbox);
+
+void spill_hold(bool hold);
+
+bool spill_read(Mailbox *mailbox, MailboxSavedFn fn, void *ctx);
+
+void spill_tick();
+
+void spill_stats(SpillStats *stats);
+
+#endif // SPILL__H__
@@ -0,0 +1,90 @@
+/**
+ * EECS 338 Operating Systems
+ * Case Western Reserve University
+ * (C) 2015 Christian Gunderman
+ */
+#include "stats.h"
+
+#include <string.h>
+
+// Counters, in the same layout they are sent in. Only the procedure and
+// result parts are kept here, the rest is filled in by the server.
+static MailboxStatsResponse g_stats;
+
+/*
+ * Gets the latency histogram bucket for ms. Bucket i holds latencies under
+ * 2^i microseconds, and the last one everything slower.
+ */
+static int stats_bucket(double ms) {
+  double us = ms * 1000;
+  int bucket = 0;
+
+  while (bucket < LATENCY_BUCKETS - 1 && us >= (1 << bucket)) {
+    bucket++;
+  }
+  return bucket;
+}
+
+/*
+ * Records a call to procedure proc that took ms to serve, from receiving
+ * it to sending the reply.
+ */
+void stats_record_call(unsigned long proc, double ms) {
+  if (proc < 1 || proc > MAILBOX_PROCS) {
+    return;
+  }
+
+  MailboxProcStats *stats = &g_stats.procs[proc - 1];
+  stats->calls++;
+  stats->latency[stats_bucket(ms)]++;
+}
+
+/*
+ * Records the result procedure proc returned.
+ */
+void stats_record_result(unsigned long proc, MailboxResult result) {
+  if (result < MAILBOX_RESULTS) {
+    g_stats.results[result]++;
+  }
+
+  if (result != MailboxResultSuccess && proc >= 1 && proc <= MAILBOX_PROCS) {
+    g_stats.procs[proc - 1].errors++;
+  }
+}
+
+/*
+ * Records a mailbox lookup that found its messages in memory.
+ */
+void stats_record_hit() {
+  g_stats.mailbox_hits++;
+}
+
+/*
+ * Records a mailbox lookup that had to read its messages back from disk,
+ * taking ms.
+ */
+void stats_record_load(double ms, bool ok) {
+  g_stats.mailbox_loads.calls++;
+  g_stats.mailbox_loads.latency[stats_bucket(ms)]++;
+  if (!ok) {
+    g_stats.mailbox_loads.errors++;
+  }
+}
+
+/*
+ * Records a mailbox's messages being spilled to disk.
+ */
+void stats_record_eviction() {
+  g_stats.mailbox_evictions++;
+}
+
+/*
+ * Copies the counters out into stats.
+ */
+void stats_get(MailboxStatsResponse *stats) {
+  memcpy(stats->procs, g_stats.procs, sizeof(stats->procs));
+  memcpy(stats->results, g_stats.results, sizeof(stats->results));
+  stats->mailbox_hits = g_stats.mailbox_hits;
+  stats->mailbox_evictions = g_stats.mailbox_evictions;
+  stats->mailbox_loads = g_stats.mailbox_loads;
+}
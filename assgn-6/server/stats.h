@@ -0,0 +1,32 @@
+/**
+ * EECS 338 Operating Systems
+ * Case Western Reserve University
+ * (C) 2015 Christian Gunderman
+ */
+#ifndef STATS__H__
+#define STATS__H__
+
+#include <stdbool.h>
+
+#include "proto.h"
+
+/*
+ * Server statistics reported by MAILBOX_STATS: calls, errors and a latency
+ * histogram per procedure, and a count of every result returned. The server
+ * serves requests on a single thread, so the counters are that thread's
+ * own plain variables, with no locks or atomics on the handler path.
+ */
+
+void stats_record_call(unsigned long proc, double ms);
+
+void stats_record_result(unsigned long proc, MailboxResult result);
+
+void stats_record_hit();
+
+void stats_record_load(double ms, bool ok);
+
+void stats_record_eviction();
+
+void stats_get(MailboxStatsResponse *stats);
+
+#endif // STATS__H__
@@ -0,0 +1,622 @@
+/**
+ * EECS 338 Operating Systems
+ * Case Western Reserve University
+ * (C) 2015 Christian Gunderman
+ */
+#define _XOPEN_SOURCE 700
+
+#include "waiters.h"
+#include "stats.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <time.h>
+
+// Preprocessor Defines.
+#define WAITER_REPLY_SIZE 1024  // Fits a MailboxWaitResponse with room over.
+#define WAITER_MAX_OPS 4        // Kinds of transport, really just UDP and TCP.
+#define WAITER_HEAP_INIT 16
+
+// A parked MAILBOX_WAIT request.
+typedef struct MailboxWaiter {
+  struct MailboxWaiter *prev;  // Links in the mailbox's waiters.
+  struct MailboxWaiter *next;
+  struct MailboxWaiter *stream_next;  // Others on the same stream.
+  Mailbox *mailbox;
+  SVCXPRT *transp;
+  uint64_t version;  // Reply once the mailbox is past this.
+  double deadline;   // Or at this time, in ms.
+  int heap_pos;
+  bool datagram;
+  uint32_t xid;      // Datagram only, who to reply to.
+  struct sockaddr_storage addr;
+  socklen_t addr_len;
+} MailboxWaiter;
+
+// A reply held back until the change it reports is durable.
+typedef struct WaiterHeld {
+  struct WaiterHeld *next;
+  uint64_t seq;      // Sent once waiter_release() reaches this.
+  SVCXPRT *transp;
+  bool datagram;
+  uint32_t xid;      // Datagram only, who to reply to.
+  struct sockaddr_storage addr;
+  socklen_t addr_len;
+  char *body;        // The results, already XDR encoded.
+  u_int body_len;
+} WaiterHeld;
+
+// A transport's operations, wrapped. Transports point at ops, so it must
+// come first.
+typedef struct WaiterOps {
+  struct xp_ops ops;
+  const struct xp_ops *orig;
+  bool datagram;
+} WaiterOps;
+
+// Global state:
+// One set of waiters for the process, served from the request loop.
+static WaiterOps g_ops[WAITER_MAX_OPS];
+static int g_ops_count = 0;
+
+// Id of the last datagram request received.
+static uint32_t g_xid = 0;
+
+// Waiters by deadline, a binary min heap.
+static MailboxWaiter **g_heap = NULL;
+static int g_heap_len = 0;
+static int g_heap_cap = 0;
+
+// Waiters on stream transports, by socket.
+static MailboxWaiter *g_streams[FD_SETSIZE];
+
+// Held replies, oldest first, and what to hold the next one until.
+static WaiterHeld *g_held_head = NULL;
+static WaiterHeld *g_held_tail = NULL;
+static uint64_t g_hold = 0;
+
+/*
+ * Gets a monotonic timestamp in milliseconds.
+ */
+static double waiter_now_ms() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+/*
+ * Swaps two heap slots.
+ */
+static void waiter_heap_swap(int a, int b) {
+  MailboxWaiter *waiter = g_heap[a];
+
+  g_heap[a] = g_heap[b];
+  g_heap[b] = waiter;
+  g_heap[a]->heap_pos = a;
+  g_heap[b]->heap_pos = b;
+}
+
+/*
+ * Restores heap order around pos after its deadline moved.
+ */
+static void waiter_heap_fix(int pos) {
+  while (pos > 0 && g_heap[pos]->deadline < g_heap[(pos - 1) / 2]->deadline) {
+    waiter_heap_swap(pos, (pos - 1) / 2);
+    pos = (pos - 1) / 2;
+  }
+
+  for (;;) {
+    int least = pos;
+    int left = pos * 2 + 1;
+    int right = left + 1;
+
+    if (left < g_heap_len && g_heap[left]->deadline < g_heap[least]->deadline) {
+      least = left;
+    }
+    if (right < g_heap_len &&
+        g_heap[right]->deadline < g_heap[least]->deadline) {
+      least = right;
+    }
+    if (least == pos) {
+      return;
+    }
+    waiter_heap_swap(pos, least);
+    pos = least;
+  }
+}
+
+/*
+ * Unlinks a waiter from everything and frees it.
+ */
+static void waiter_remove(MailboxWaiter *waiter) {
+  if (waiter->prev != NULL) {
+    waiter->prev->next = waiter->next;
+  } else {
+    waiter->mailbox->waiters = waiter->next;
+  }
+  if (waiter->next != NULL) {
+    waiter->next->prev = waiter->prev;
+  }
+
+  if (!waiter->datagram) {
+    MailboxWaiter **link = &g_streams[waiter->transp->xp_fd];
+    while (*link != waiter) {
+      link = &(*link)->stream_next;
+    }
+    *link = waiter->stream_next;
+  }
+
+  int pos = waiter->heap_pos;
+  g_heap_len--;
+  if (pos != g_heap_len) {
+    waiter_heap_swap(pos, g_heap_len);
+    waiter_heap_fix(pos);
+  }
+
+  free(waiter);
+}
+
+/*
+ * Drops the waiters on a stream without replying. Its client has moved on
+ * or gone away.
+ */
+static void waiter_drop_stream(SVCXPRT *transp) {
+  if (transp->xp_fd < 0 || transp->xp_fd >= FD_SETSIZE) {
+    return;
+  }
+
+  MailboxWaiter *waiter = g_streams[transp->xp_fd];
+  while (waiter != NULL) {
+    MailboxWaiter *next = waiter->stream_next;
+    if (waiter->transp == transp) {
+      waiter_remove(waiter);
+    }
+    waiter = next;
+  }
+}
+
+/*
+ * Gets the address of the client a datagram request came from.
+ */
+static void waiter_caller(SVCXPRT *transp, struct sockaddr_storage *addr,
+                          socklen_t *addr_len) {
+  memset(addr, 0, sizeof(*addr));
+#ifdef svc_getrpccaller
+  struct netbuf *caller = svc_getrpccaller(transp);
+  *addr_len = caller->len < sizeof(*addr) ? caller->len : sizeof(*addr);
+  memcpy(addr, caller->buf, *addr_len);
+#else
+  *addr_len = sizeof(struct sockaddr_in);
+  memcpy(addr, svc_getcaller(transp), *addr_len);
+#endif
+}
+
+/*
+ * Sends a late reply. The transport has moved on to other requests, so a
+ * datagram reply is built here with the request's own id and sent to its
+ * client. A stream has read nothing since the request, so it is still set
+ * up to answer it.
+ */
+static bool waiter_send(SVCXPRT *transp, bool datagram, uint32_t xid,
+                        struct sockaddr_storage *addr, socklen_t addr_len,
+                        xdrproc_t proc, void *where, size_t size) {
+  WaiterOps *ops = (WaiterOps*)transp->xp_ops;
+  struct rpc_msg reply;
+
+  memset(&reply, 0, sizeof(reply));
+  reply.rm_xid = xid;
+  reply.rm_direction = REPLY;
+  reply.rm_reply.rp_stat = MSG_ACCEPTED;
+  reply.acpted_rply.ar_verf = _null_auth;
+  reply.acpted_rply.ar_stat = SUCCESS;
+  reply.acpted_rply.ar_results.where = where;
+  reply.acpted_rply.ar_results.proc = proc;
+
+  if (!datagram) {
+    // Straight to the transport, past waiter_send_reply().
+    return ops->orig->xp_reply(transp, &reply);
+  }
+
+  char *buf = malloc(size);
+  XDR xdrs;
+  bool ok = false;
+
+  if (buf != NULL) {
+    xdrmem_create(&xdrs, buf, size, XDR_ENCODE);
+    ok = xdr_replymsg(&xdrs, &reply) &&
+         sendto(transp->xp_fd, buf, xdr_getpos(&xdrs), 0,
+                (struct sockaddr*)addr, addr_len) != -1;
+    xdr_destroy(&xdrs);
+  }
+  free(buf);
+  return ok;
+}
+
+/*
+ * Encodes a held reply's results, which are already XDR, into a reply.
+ */
+static bool_t waiter_xdr_held(XDR *xdrs, WaiterHeld *held) {
+  return xdr_opaque(xdrs, held->body, held->body_len);
+}
+
+/*
+ * Sends a held reply, and frees it.
+ */
+static void waiter_send_held(WaiterHeld *held) {
+  if (!waiter_send(held->transp, held->datagram, held->xid, &held->addr,
+                   held->addr_len, (xdrproc_t)waiter_xdr_held, held,
+                   held->body_len + WAITER_REPLY_SIZE)) {
+    perror("Held reply error");
+  }
+  free(held->body);
+  free(held);
+}
+
+/*
+ * Drops the replies held for a stream that has gone away.
+ */
+static void waiter_drop_held(SVCXPRT *transp) {
+  WaiterHeld **link = &g_held_head;
+  WaiterHeld *prev = NULL;
+
+  while (*link != NULL) {
+    WaiterHeld *held = *link;
+    if (held->transp == transp) {
+      *link = held->next;
+      free(held->body);
+      free(held);
+    } else {
+      prev = held;
+      link = &held->next;
+    }
+  }
+  g_held_tail = prev;
+}
+
+/*
+ * Holds a reply the handler has asked to hold, see waiter_hold(). Returns
+ * false if it can't be, and should be sent now.
+ */
+static bool waiter_park(SVCXPRT *transp, WaiterOps *ops, uint64_t seq,
+                        xdrproc_t proc, void *where) {
+  WaiterHeld *held = calloc(1, sizeof(WaiterHeld));
+  XDR xdrs;
+
+  if (held == NULL) {
+    return false;
+  }
+
+  held->seq = seq;
+  held->transp = transp;
+  held->datagram = ops->datagram;
+  held->xid = g_xid;
+  if (held->datagram) {
+    waiter_caller(transp, &held->addr, &held->addr_len);
+  }
+
+  held->body_len = xdr_sizeof(proc, where);
+  held->body = malloc(held->body_len);
+  if (held->body_len == 0 || held->body == NULL) {
+    free(held->body);
+    free(held);
+    return false;
+  }
+  xdrmem_create(&xdrs, held->body, held->body_len, XDR_ENCODE);
+  bool ok = proc(&xdrs, where);
+  xdr_destroy(&xdrs);
+  if (!ok) {
+    free(held->body);
+    free(held);
+    return false;
+  }
+
+  if (g_held_tail != NULL) {
+    g_held_tail->next = held;
+  } else {
+    g_held_head = held;
+  }
+  g_held_tail = held;
+  return true;
+}
+
+/*
+ * Sends a reply, or holds it if the request asked to, see waiter_hook().
+ */
+static bool_t waiter_send_reply(SVCXPRT *transp, struct rpc_msg *msg) {
+  WaiterOps *ops = (WaiterOps*)transp->xp_ops;
+  uint64_t seq = g_hold;
+
+  g_hold = 0;
+  if (seq != 0 && msg->rm_reply.rp_stat == MSG_ACCEPTED &&
+      msg->acpted_rply.ar_stat == SUCCESS &&
+      waiter_park(transp, ops, seq, msg->acpted_rply.ar_results.proc,
+                  msg->acpted_rply.ar_results.where)) {
+    return TRUE;
+  }
+  return ops->orig->xp_reply(transp, msg);
+}
+
+/*
+ * Receives a request, see waiter_hook().
+ */
+static bool_t waiter_recv(SVCXPRT *transp, struct rpc_msg *msg) {
+  WaiterOps *ops = (WaiterOps*)transp->xp_ops;
+
+  // A stream client is sent replies in order, so if it asks for anything
+  // else it has given up on its wait.
+  if (!ops->datagram) {
+    waiter_drop_stream(transp);
+  }
+
+  bool_t ok = ops->orig->xp_recv(transp, msg);
+  if (ok) {
+    g_xid = msg->rm_xid;
+  }
+  g_hold = 0;
+  return ok;
+}
+
+/*
+ * Destroys a transport, see waiter_hook().
+ */
+static void waiter_destroy(SVCXPRT *transp) {
+  WaiterOps *ops = (WaiterOps*)transp->xp_ops;
+
+  if (!ops->datagram) {
+    waiter_drop_stream(transp);
+    waiter_drop_held(transp);
+  }
+  ops->orig->xp_destroy(transp);
+}
+
+/*
+ * Gets the wrapped operations of a hooked transport, or NULL.
+ */
+static WaiterOps *waiter_ops(SVCXPRT *transp) {
+  for (int i = 0; i < g_ops_count; i++) {
+    if (transp->xp_ops == &g_ops[i].ops) {
+      return &g_ops[i];
+    }
+  }
+  return NULL;
+}
+
+/*
+ * Wraps a transport's receive, reply and destroy operations, so requests
+ * on it can wait and replies can be held. All transports of a kind share
+ * one table of operations, so this only copies each table once. Must be
+ * called on a datagram transport before it receives its first request.
+ */
+void waiter_hook(SVCXPRT *transp) {
+  if (waiter_ops(transp) != NULL) {
+    return;
+  }
+
+  WaiterOps *ops = NULL;
+  for (int i = 0; i < g_ops_count; i++) {
+    if (g_ops[i].orig == transp->xp_ops) {
+      ops = &g_ops[i];
+    }
+  }
+
+  if (ops == NULL) {
+    int type = 0;
+    socklen_t len = sizeof(type);
+
+    // Waits on transports it can't tell apart are answered right away.
+    if (g_ops_count == WAITER_MAX_OPS ||
+        getsockopt(transp->xp_fd, SOL_SOCKET, SO_TYPE, &type, &len) == -1) {
+      return;
+    }
+
+    ops = &g_ops[g_ops_count++];
+    ops->orig = transp->xp_ops;
+    ops->ops = *transp->xp_ops;
+    ops->ops.xp_recv = waiter_recv;
+    ops->ops.xp_reply = waiter_send_reply;
+    ops->ops.xp_destroy = waiter_destroy;
+    ops->datagram = type == SOCK_DGRAM;
+  }
+
+  transp->xp_ops = &ops->ops;
+}
+
+/*
+ * Parks a MAILBOX_WAIT request until the mailbox moves past version or
+ * timeout_ms passes. The handler must then return NULL so no reply is sent
+ * yet. Returns false if the request can't wait, and should be answered
+ * now.
+ */
+bool waiter_add(struct svc_req *rqstp, Mailbox *mailbox, uint64_t version,
+                unsigned int timeout_ms) {
+  SVCXPRT *transp = rqstp->rq_xprt;
+  WaiterOps *ops = waiter_ops(transp);
+
+  if (ops == NULL || (!ops->datagram && transp->xp_fd >= FD_SETSIZE) ||
+      !mailbox_watch(mailbox)) {
+    return false;
+  }
+
+  struct sockaddr_storage addr;
+  socklen_t addr_len = 0;
+  memset(&addr, 0, sizeof(addr));
+  if (ops->datagram) {
+    waiter_caller(transp, &addr, &addr_len);
+
+    // A datagram client resends until it hears back, it's the same wait.
+    for (MailboxWaiter *waiter = mailbox->waiters; waiter != NULL;
+         waiter = waiter->next) {
+      if (waiter->datagram && waiter->xid == g_xid &&
+          waiter->addr_len == addr_len &&
+          memcmp(&waiter->addr, &addr, addr_len) == 0) {
+        return true;
+      }
+    }
+  }
+
+  if (g_heap_len == g_heap_cap) {
+    int cap = g_heap_cap == 0 ? WAITER_HEAP_INIT : g_heap_cap * 2;
+    MailboxWaiter **heap = realloc(g_heap, cap * sizeof(MailboxWaiter*));
+    if (heap == NULL) {
+      return false;
+    }
+    g_heap = heap;
+    g_heap_cap = cap;
+  }
+
+  MailboxWaiter *waiter = calloc(1, sizeof(MailboxWaiter));
+  if (waiter == NULL) {
+    return false;
+  }
+
+  waiter->mailbox = mailbox;
+  waiter->transp = transp;
+  waiter->version = version;
+  waiter->deadline = waiter_now_ms() +
+                     (timeout_ms < WAITER_MAX_MS ? timeout_ms : WAITER_MAX_MS);
+  waiter->datagram = ops->datagram;
+  waiter->xid = g_xid;
+  waiter->addr = addr;
+  waiter->addr_len = addr_len;
+
+  waiter->next = mailbox->waiters;
+  if (mailbox->waiters != NULL) {
+    mailbox->waiters->prev = waiter;
+  }
+  mailbox->waiters = waiter;
+
+  if (!waiter->datagram) {
+    waiter->stream_next = g_streams[transp->xp_fd];
+    g_streams[transp->xp_fd] = waiter;
+  }
+
+  waiter->heap_pos = g_heap_len;
+  g_heap[g_heap_len++] = waiter;
+  waiter_heap_fix(waiter->heap_pos);
+  return true;
+}
+
+/*
+ * Fills in the answer to a wait from version: the mailbox's current version
+ * and which messages changed since, or resync if it can't say.
+ */
+void waiter_result(Mailbox *mailbox, uint64_t version,
+                   MailboxWaitResponse *result) {
+  static int changed[MAX_CHANGES];
+  int count;
+
+  result->result = MailboxResultSuccess;
+  result->current = mailbox->version;
+  result->resync = !mailbox_changes(mailbox, version, changed, &count);
+  result->changed.changed_val = changed;
+  result->changed.changed_len = count;
+}
+
+/*
+ * Sends the late reply to a waiter and removes it.
+ */
+static void waiter_reply(MailboxWaiter *waiter, MailboxResult status) {
+  MailboxWaitResponse result;
+
+  memset(&result, 0, sizeof(result));
+  if (status == MailboxResultSuccess) {
+    waiter_result(waiter->mailbox, waiter->version, &result);
+  }
+  result.result = status;
+
+  if (!waiter_send(waiter->transp, waiter->datagram, waiter->xid,
+                   &waiter->addr, waiter->addr_len,
+                   (xdrproc_t)xdr_MailboxWaitResponse, &result,
+                   WAITER_REPLY_SIZE)) {
+    perror("Wait reply error");
+  }
+
+  stats_record_result(MAILBOX_WAIT, result.result);
+  waiter_remove(waiter);
+}
+
+/*
+ * Answers everyone waiting on a mailbox that has just changed.
+ */
+void waiter_notify(Mailbox *mailbox) {
+  while (mailbox->waiters != NULL) {
+    waiter_reply(mailbox->waiters, MailboxResultSuccess);
+  }
+}
+
+/*
+ * Answers everyone waiting on a mailbox that is going away.
+ */
+void waiter_cancel(Mailbox *mailbox) {
+  while (mailbox->waiters != NULL) {
+    waiter_reply(mailbox->waiters, MailboxResultUserNotExists);
+  }
+}
+
+/*
+ * Answers waits that have timed out. Returns milliseconds until the next
+ * one does, or -1 if none are waiting.
+ */
+int waiter_tick() {
+  double now = waiter_now_ms();
+
+  while (g_heap_len > 0 && g_heap[0]->deadline <= now) {
+    waiter_reply(g_heap[0], MailboxResultSuccess);
+  }
+
+  if (g_heap_len == 0) {
+    return -1;
+  }
+  return (int)(g_heap[0]->deadline - now) + 1;
+}
+
+/*
+ * Holds the reply to the request being handled until waiter_release() is
+ * given seq or later. Only a reply through a hooked RPC transport is held
+ * this way, anyone else takes the hold with waiter_take_hold().
+ */
+void waiter_hold(uint64_t seq) {
+  g_hold = seq;
+}
+
+/*
+ * Gets and clears the hold on the reply to the request being handled, or 0
+ * if it isn't held.
+ */
+uint64_t waiter_take_hold() {
+  uint64_t seq = g_hold;
+
+  g_hold = 0;
+  return seq;
+}
+
+/*
+ * Sends the held replies whose changes are now durable, up to seq.
+ */
+void waiter_release(uint64_t seq) {
+  while (g_held_head != NULL && g_held_head->seq <= seq) {
+    WaiterHeld *held = g_held_head;
+
+    g_held_head = held->next;
+    if (g_held_head == NULL) {
+      g_held_tail = NULL;
+    }
+    waiter_send_held(held);
+  }
+}
+
+/*
+ * Takes the streams with a held reply out of fds. Their next request isn't
+ * read until the reply is out, as reading it would leave the stream set up
+ * to answer that request instead.
+ */
+void waiter_fdset(fd_set *fds) {
+  for (WaiterHeld *held = g_held_head; held != NULL; held = held->next) {
+    if (!held->datagram) {
+      FD_CLR(held->transp->xp_fd, fds);
+    }
+  }
+}
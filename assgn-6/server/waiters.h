@@ -0,0 +1,60 @@
+/**
+ * EECS 338 Operating Systems
+ * Case Western Reserve University
+ * (C) 2015 Christian Gunderman
+ */
+#ifndef WAITERS__H__
+#define WAITERS__H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/select.h>
+
+#include "proto.h"
+#include "mailbox.h"
+
+/*
+ * Clients blocked in MAILBOX_WAIT. The server has a single thread, so a
+ * waiting call can't just block in its handler. Instead the handler parks
+ * the request here and returns without replying, and the reply is sent
+ * later from the request loop, when the mailbox changes or the wait times
+ * out. Parked requests cost a small struct each and no thread.
+ *
+ * Replying late needs a little help from the RPC transports, which only
+ * know how to answer the request they last received. waiter_hook() wraps
+ * a transport's operations so that the id and sender of each datagram
+ * request are kept for a late reply, and so that waits on a stream are
+ * dropped once its client sends something else or hangs up.
+ *
+ * The same late replies hold back the answers to changes until the log
+ * has them on disk. A handler calls waiter_hold() with the log position
+ * its change must reach, its reply is encoded and kept instead of sent,
+ * and waiter_release() sends it once the fsync is done.
+ */
+
+// Longest a client may wait for.
+#define WAITER_MAX_MS 60000
+
+void waiter_hook(SVCXPRT *transp);
+
+bool waiter_add(struct svc_req *rqstp, Mailbox *mailbox, uint64_t version,
+                unsigned int timeout_ms);
+
+void waiter_result(Mailbox *mailbox, uint64_t version,
+                   MailboxWaitResponse *result);
+
+void waiter_notify(Mailbox *mailbox);
+
+void waiter_cancel(Mailbox *mailbox);
+
+int waiter_tick();
+
+void waiter_hold(uint64_t seq);
+
+uint64_t waiter_take_hold();
+
+void waiter_release(uint64_t seq);
+
+void waiter_fdset(fd_set *fds);
+
+#endif // WAITERS__H__
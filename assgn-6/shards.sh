@@ -0,0 +1,43 @@
+#!/bin/bash
+
+echo "RPC Mailbox Server Shards"
+echo "(C) 2015 Christian Gunderman"
+echo
+
+if ! [[ "$1" =~ ^[1-9][0-9]*$ ]]; then
+    echo "Usage: ./shards.sh [shards] [base_port] [data_dir] [server options...]"
+    echo "Starts shards servers on ports base_port (default 7001) and up, each"
+    echo "with its own data_dir/shard.N (default mailbox-data), until Ctrl-C."
+    echo "Server options, like -m, are passed on to every shard."
+    exit 1
+fi
+
+# Arguments.
+N=$1
+BASE_PORT=${2:-7001}
+DATA_DIR=${3:-mailbox-data}
+shift 3 2>/dev/null || shift $#
+
+# Start each shard on its own port and directory, in the background.
+mkdir -p "$DATA_DIR" || exit 1
+PIDS=()
+PORTS=()
+for ((i = 0; i < N; i++)); do
+    PORT=$((BASE_PORT + i))
+    server/server -d "$DATA_DIR/shard.$i" -p "$PORT" -S "$i/$N" "$@" \
+        > "$DATA_DIR/shard.$i.log" 2>&1 &
+    PIDS+=($!)
+    PORTS+=($PORT)
+done
+
+# Stop them all together, and only return once they've shut down.
+stop() {
+    kill "${PIDS[@]}" 2> /dev/null
+    wait
+}
+trap stop INT TERM EXIT
+
+LIST=$(IFS=,; echo "${PORTS[*]}")
+echo "Started $N shards, logs in $DATA_DIR/shard.*.log. Route clients with:"
+echo "  export MAILBOX_SHARDS=$LIST"
+wait